@@ -0,0 +1,427 @@
+#include "Core/Renderer.h"
+#include "Core/RenderStates.h"
+#include "Core/CompiledPixelShader.h"
+#include "LambertianShader.h"
+#include "Graphics/Camera.h"
+#include "Utils/Mesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace EDX;
+using namespace EDX::RasterRenderer;
+
+// Headless benchmark. Renders every reference scene along a scripted camera path for each
+// combination of MSAA mode, texture filter, hierarchical rasterization and pixel shader, and
+// writes one CSV row per configuration. Frames are timed as the viewer runs them, pipelined and
+// without profiling. Stage times and counters come from a separate profiled pass over the path,
+// since profiling makes EndFrame synchronous and records an event per job. Feeding a previous run back through -baseline flags
+// regressions. The shaders all shade the same Lambertian albedo: builtin is the hand written
+// LambertianAlbedoPixelShader, compiled runs Shaders/Lambertian.hlsl on CompiledPixelShader and
+// generated is the C++ ShaderCodeGen emitted for it at build time.
+//
+// Usage: Benchmark [-media dir] [-out file.csv] [-baseline file.csv] [-threshold pct]
+//                  [-width w] [-height h] [-warmup n] [-frames n] [-profileframes n]
+//                  [-scenes a,b] [-msaa 0,2] [-filters 1,2] [-hras 1,0] [-trace dir]
+//                  [-shaders builtin,compiled,generated]
+
+struct SceneDesc
+{
+	const char* name;
+	const char* path; // Relative to the media directory, nullptr for the procedural sphere
+	Vector3 pos;
+	float scale;
+	Vector3 rot;
+	bool interior; // Walk through the scene instead of orbiting around it
+};
+
+static const SceneDesc gScenes[] = {
+	{ "sphere", nullptr, Vector3::ZERO, 1.0f, Vector3::ZERO, false },
+	{ "bunny", "bunny.obj", Vector3(0, -10, 35), 1.0f, Vector3(0, 180, 0), false },
+	{ "dragon", "dragon.obj", Vector3(0, 0, 0), 5.0f, Vector3(0, -90, 0), false },
+	{ "sponza", "sponza/sponza.obj", Vector3(0, 0, 0), 0.01f, Vector3(0, 0, 0), true },
+	{ "san-miguel", "san-miguel/san-miguel.obj", Vector3(2, -2, -5), 1.0f, Vector3(0, 0, 0), true },
+};
+
+static const char* gMSAANames[] = { "off", "2x", "4x", "8x", "16x" };
+static const char* gFilterNames[] = { "Nearest", "Linear", "Trilinear", "Aniso4x", "Aniso8x", "Aniso16x" };
+static const char* gShaderNames[] = { "builtin", "compiled", "generated" };
+static const char* gShaderKeys[] = { "", "/Compiled", "/Generated" }; // Builtin keeps the keys of older baselines
+
+struct BenchmarkOptions
+{
+	std::string mediaDir = "../../Media";
+	std::string outPath = "benchmark.csv";
+	std::string baselinePath;
+	std::string traceDir;
+	float threshold = 5.0f; // Percent increase in median frame time reported as a regression
+	int width = 1280;
+	int height = 720;
+	int warmupFrames = 10;
+	int frames = 120;
+	int profileFrames = 30; // 0 skips the profiled pass
+	std::vector<std::string> scenes;
+	std::vector<int> msaaModes = { 0, 1, 2, 3, 4 };
+	std::vector<int> filters = { 0, 1, 2, 3, 4, 5 };
+	std::vector<int> hRasModes = { 1, 0 };
+	std::vector<int> shaders = { 0 }; // Index into gShaderNames
+};
+
+struct BenchmarkResult
+{
+	std::string key;
+	double medianTime, p99Time, minTime, meanTime;
+	double stageTimes[int(RenderStage::Count)]; // Medians of the profiled pass
+	uint64 counters[int(RenderCounter::Count)]; // From the last profiled frame
+};
+
+static std::vector<std::string> SplitList(const char* str)
+{
+	std::vector<std::string> ret;
+	std::stringstream stream(str);
+	std::string item;
+	while (std::getline(stream, item, ','))
+	{
+		if (!item.empty())
+			ret.push_back(item);
+	}
+
+	return ret;
+}
+
+static std::vector<int> SplitIntList(const char* str)
+{
+	std::vector<int> ret;
+	for (auto& it : SplitList(str))
+		ret.push_back(atoi(it.c_str()));
+
+	return ret;
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchmarkOptions& options)
+{
+	for (auto i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			printf("Missing value for %s\n", arg.c_str());
+			return false;
+		}
+
+		const char* value = argv[++i];
+		if (arg == "-media")
+			options.mediaDir = value;
+		else if (arg == "-out")
+			options.outPath = value;
+		else if (arg == "-baseline")
+			options.baselinePath = value;
+		else if (arg == "-trace")
+			options.traceDir = value;
+		else if (arg == "-threshold")
+			options.threshold = float(atof(value));
+		else if (arg == "-width")
+			options.width = atoi(value);
+		else if (arg == "-height")
+			options.height = atoi(value);
+		else if (arg == "-warmup")
+			options.warmupFrames = atoi(value);
+		else if (arg == "-frames")
+			options.frames = atoi(value);
+		else if (arg == "-profileframes")
+			options.profileFrames = atoi(value);
+		else if (arg == "-scenes")
+			options.scenes = SplitList(value);
+		else if (arg == "-msaa")
+			options.msaaModes = SplitIntList(value);
+		else if (arg == "-filters")
+			options.filters = SplitIntList(value);
+		else if (arg == "-hras")
+			options.hRasModes = SplitIntList(value);
+		else if (arg == "-shaders")
+		{
+			options.shaders.clear();
+			for (auto& it : SplitList(value))
+			{
+				const auto shader = std::find(std::begin(gShaderNames), std::end(gShaderNames), it);
+				if (shader == std::end(gShaderNames))
+				{
+					printf("Unknown shader %s\n", it.c_str());
+					return false;
+				}
+				options.shaders.push_back(int(shader - std::begin(gShaderNames)));
+			}
+		}
+		else
+		{
+			printf("Unknown option %s\n", arg.c_str());
+			return false;
+		}
+	}
+
+	return options.frames > 0 && options.profileFrames >= 0 && options.width > 0 && options.height > 0;
+}
+
+static bool LoadScene(const SceneDesc& desc, const BenchmarkOptions& options, Mesh& mesh)
+{
+	if (!desc.path)
+	{
+		mesh.LoadSphere(desc.pos, Vector3::UNIT_SCALE, desc.rot, 1.2f);
+		return true;
+	}
+
+	const std::string path = options.mediaDir + "/" + desc.path;
+	if (!std::ifstream(path))
+	{
+		printf("Skipping %s, %s not found\n", desc.name, path.c_str());
+		return false;
+	}
+
+	mesh.LoadMesh(desc.pos, desc.scale * Vector3::UNIT_SCALE, desc.rot, path.c_str());
+	return true;
+}
+
+// Deterministic camera path, t in [0, 1). Objects are orbited once, interiors are walked
+// along the longest axis of the bounds while the view sweeps from side to side.
+static void SetupCamera(Camera& camera, const SceneDesc& desc, const Mesh& mesh, const BenchmarkOptions& options, const float t)
+{
+	const BoundingBox bounds = mesh.GetBounds();
+	Vector3 center;
+	float radius;
+	bounds.BoundingSphere(&center, &radius);
+
+	const float angle = 2.0f * float(Math::EDX_PI) * t;
+	if (!desc.interior)
+	{
+		const Vector3 eye = center + 2.5f * radius * Vector3(sinf(angle), 0.25f, -cosf(angle));
+		camera.Init(eye, center, Vector3::UNIT_Y, options.width, options.height, 65, radius * 0.02f, radius * 5.0f);
+		return;
+	}
+
+	const Vector3 extent = bounds.mMax - bounds.mMin;
+	const Vector3 axis = extent.x >= extent.z ? Vector3::UNIT_X : Vector3::UNIT_Z;
+	const Vector3 side = extent.x >= extent.z ? Vector3::UNIT_Z : Vector3::UNIT_X;
+	const float walk = 0.35f * Math::Max(extent.x, extent.z);
+
+	const Vector3 eye = center + (2.0f * t - 1.0f) * walk * axis - 0.25f * extent.y * Vector3::UNIT_Y;
+	const Vector3 dir = axis + 0.6f * sinf(angle) * side;
+	camera.Init(eye, eye + dir, Vector3::UNIT_Y, options.width, options.height, 65, radius * 0.002f, radius * 2.0f);
+}
+
+static double Percentile(std::vector<double> values, const double p)
+{
+	std::sort(values.begin(), values.end());
+	const size_t idx = Math::Min(size_t(p * values.size()), values.size() - 1);
+
+	return values[idx];
+}
+
+static BenchmarkResult RunConfig(Renderer& renderer, const SceneDesc& desc, const Mesh& mesh, const BenchmarkOptions& options,
+	const int msaa, const int filter, const int hRas, const int shader, const PixelShader* pPixelShader)
+{
+	BenchmarkResult result;
+	result.key = std::string(desc.name) + "/" + gMSAANames[msaa] + "/" + gFilterNames[filter] + "/" + (hRas ? "HRas" : "Flat") + gShaderKeys[shader];
+
+	renderer.SetMSAAMode(msaa);
+	renderer.SetTextureFilter(TextureFilter(filter));
+	renderer.SetHierarchicalRasterize(hRas != 0);
+
+	Camera camera;
+	auto renderFrame = [&](const int frame, const int frameCount)
+	{
+		SetupCamera(camera, desc, mesh, options, float(frame) / float(frameCount));
+		renderer.SetTransform(camera.GetViewMatrix(), camera.GetProjMatrix(), camera.GetRasterMatrix());
+		renderer.BeginFrame();
+		renderer.Draw(mesh, Matrix::IDENTITY, pPixelShader);
+		renderer.EndFrame();
+	};
+
+	// Warm up caches, frame arenas and the thread pool
+	for (auto i = 0; i < options.warmupFrames; i++)
+		renderFrame(i, Math::Max(options.warmupFrames, 1));
+
+	// With pipelining EndFrame returns once the frame's back end is started, so in steady state each
+	// frame time covers one geometry pass and the wait for the previous back end
+	std::vector<double> frameTimes;
+	for (auto i = 0; i < options.frames; i++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		renderFrame(i, options.frames);
+		const auto end = std::chrono::steady_clock::now();
+
+		frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	renderer.Flush();
+
+	std::vector<double> stageTimes[int(RenderStage::Count)];
+	renderer.SetProfiling(true);
+	for (auto i = 0; i < options.profileFrames; i++)
+	{
+		renderFrame(i * options.frames / options.profileFrames, options.frames);
+
+		const RenderStats& stats = renderer.GetRenderStats();
+		for (auto s = 0; s < int(RenderStage::Count); s++)
+			stageTimes[s].push_back(stats.GetStageTime(RenderStage(s)));
+	}
+
+	result.medianTime = Percentile(frameTimes, 0.5);
+	result.p99Time = Percentile(frameTimes, 0.99);
+	result.minTime = Percentile(frameTimes, 0.0);
+	result.meanTime = 0.0;
+	for (auto& it : frameTimes)
+		result.meanTime += it;
+	result.meanTime /= frameTimes.size();
+
+	for (auto s = 0; s < int(RenderStage::Count); s++)
+		result.stageTimes[s] = stageTimes[s].empty() ? 0.0 : Percentile(stageTimes[s], 0.5);
+
+	const RenderStats& stats = renderer.GetRenderStats();
+	for (auto c = 0; c < int(RenderCounter::Count); c++)
+		result.counters[c] = options.profileFrames > 0 ? stats.GetCounter(RenderCounter(c)) : 0;
+
+	if (!options.traceDir.empty() && options.profileFrames > 0)
+	{
+		std::string traceName = result.key;
+		std::replace(traceName.begin(), traceName.end(), '/', '_');
+		renderer.WriteChromeTrace((options.traceDir + "/" + traceName + ".json").c_str());
+	}
+	renderer.SetProfiling(false);
+
+	return result;
+}
+
+static bool WriteResults(const std::vector<BenchmarkResult>& results, const BenchmarkOptions& options)
+{
+	std::ofstream file(options.outPath);
+	if (!file)
+		return false;
+
+	file << "config,width,height,frames,median_ms,p99_ms,min_ms,mean_ms";
+	for (auto s = 0; s < int(RenderStage::Count); s++)
+		file << "," << RenderStats::GetStageName(RenderStage(s)) << "_ms";
+	for (auto c = 0; c < int(RenderCounter::Count); c++)
+		file << "," << RenderStats::GetCounterName(RenderCounter(c));
+	file << "\n";
+
+	for (auto& result : results)
+	{
+		file << result.key << "," << options.width << "," << options.height << "," << options.frames << ","
+			<< result.medianTime << "," << result.p99Time << "," << result.minTime << "," << result.meanTime;
+		for (auto s = 0; s < int(RenderStage::Count); s++)
+			file << "," << result.stageTimes[s];
+		for (auto c = 0; c < int(RenderCounter::Count); c++)
+			file << "," << result.counters[c];
+		file << "\n";
+	}
+
+	return file.good();
+}
+
+// Maps config key to median frame time of a previous run written by WriteResults
+static std::map<std::string, double> ReadBaseline(const std::string& path)
+{
+	std::map<std::string, double> ret;
+	std::ifstream file(path);
+	std::string line;
+	std::getline(file, line); // Header
+
+	while (std::getline(file, line))
+	{
+		std::vector<std::string> fields = SplitList(line.c_str());
+		if (fields.size() > 4)
+			ret[fields[0]] = atof(fields[4].c_str());
+	}
+
+	return ret;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	if (!ParseOptions(argc, argv, options))
+		return 1;
+
+	Renderer renderer;
+	renderer.Initialize(options.width, options.height);
+	renderer.SetAsyncPipelining(true);
+
+	CompiledPixelShader compiledShader;
+	Array<ShaderCompiler::CompileError> errorList;
+	if (!compiledShader.Compile("Lambertian.hlsl", LambertianShader::GetSource(), "main", errorList))
+	{
+		for (auto& it : errorList)
+			printf("%s(%i,%i): error: %s\n", it.SrcInfo.FileName.c_str(), it.SrcInfo.Line, it.SrcInfo.Column, it.ErrorMsg.c_str());
+		return 1;
+	}
+
+	LambertianShader generatedShader;
+	const PixelShader* shaders[] = { nullptr, &compiledShader, &generatedShader };
+
+	std::vector<BenchmarkResult> results;
+	for (auto& desc : gScenes)
+	{
+		if (!options.scenes.empty() && std::find(options.scenes.begin(), options.scenes.end(), desc.name) == options.scenes.end())
+			continue;
+
+		Mesh mesh;
+		if (!LoadScene(desc, options, mesh))
+			continue;
+
+		printf("%s: %i triangles\n", desc.name, mesh.GetIndexBuffer()->GetTriangleCount());
+		for (auto msaa : options.msaaModes)
+		{
+			for (auto filter : options.filters)
+			{
+				for (auto hRas : options.hRasModes)
+				{
+					if (msaa < 0 || msaa > 4 || filter < 0 || filter > 5)
+						continue;
+
+					for (auto shader : options.shaders)
+					{
+						results.push_back(RunConfig(renderer, desc, mesh, options, msaa, filter, hRas, shader, shaders[shader]));
+
+						const BenchmarkResult& result = results.back();
+						printf("  %-40s median %8.3f ms  p99 %8.3f ms\n", result.key.c_str(), result.medianTime, result.p99Time);
+					}
+				}
+			}
+		}
+
+		mesh.Release();
+	}
+
+	if (!WriteResults(results, options))
+	{
+		printf("Failed to write %s\n", options.outPath.c_str());
+		return 1;
+	}
+
+	int regressionCount = 0;
+	if (!options.baselinePath.empty())
+	{
+		const std::map<std::string, double> baseline = ReadBaseline(options.baselinePath);
+		for (auto& result : results)
+		{
+			auto it = baseline.find(result.key);
+			if (it == baseline.end() || it->second <= 0.0)
+				continue;
+
+			const double change = 100.0 * (result.medianTime - it->second) / it->second;
+			if (change > options.threshold)
+			{
+				printf("REGRESSION %-40s %8.3f ms -> %8.3f ms (+%.1f%%)\n", result.key.c_str(), it->second, result.medianTime, change);
+				regressionCount++;
+			}
+		}
+
+		printf("%i regression(s) against %s\n", regressionCount, options.baselinePath.c_str());
+	}
+
+	return regressionCount > 0 ? 2 : 0;
+}
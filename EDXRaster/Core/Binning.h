@@ -0,0 +1,174 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Tile.h"
+#include "Core/Memory.h"
+#include "Core/SmartPointer.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Hands out fixed size chunks of triangle refs linearly, chunks are kept alive across frames
+		class TriangleRefAllocator
+		{
+		public:
+			static const int CHUNK_SIZE = 64;
+
+			struct Chunk
+			{
+				Tile::TriangleRef refs[CHUNK_SIZE];
+				Chunk* pNext;
+				int count;
+			};
+
+		private:
+			Array<Chunk*> mChunks;
+			int mUsedCount;
+
+		public:
+			TriangleRefAllocator()
+				: mUsedCount(0)
+			{
+			}
+			~TriangleRefAllocator()
+			{
+				for (auto& it : mChunks)
+					Memory::SafeDelete(it);
+			}
+
+			Chunk* Alloc()
+			{
+				if (mUsedCount == mChunks.Size())
+					mChunks.Add(new Chunk);
+
+				Chunk* pRet = mChunks[mUsedCount++];
+				pRet->pNext = nullptr;
+				pRet->count = 0;
+
+				return pRet;
+			}
+
+			void Reset()
+			{
+				mUsedCount = 0;
+			}
+		};
+
+		// Singly linked list of chunks holding the refs one thread binned into one tile
+		struct BinQueue
+		{
+			TriangleRefAllocator::Chunk* pHead;
+			TriangleRefAllocator::Chunk* pTail;
+			uint size;
+			uint stamp;
+
+			BinQueue()
+				: pHead(nullptr), pTail(nullptr), size(0), stamp(0)
+			{
+			}
+
+			__forceinline void Add(const Tile::TriangleRef& ref, TriangleRefAllocator& allocator)
+			{
+				if (!pTail || pTail->count == TriangleRefAllocator::CHUNK_SIZE)
+				{
+					TriangleRefAllocator::Chunk* pChunk = allocator.Alloc();
+					if (pTail)
+						pTail->pNext = pChunk;
+					else
+						pHead = pChunk;
+					pTail = pChunk;
+				}
+
+				pTail->refs[pTail->count++] = ref;
+				size++;
+			}
+		};
+
+		// Sort-middle binner. Each thread bins into its own queues so no cache line of a Tile
+		// is written during binning. Queues are invalidated in O(1) per frame with a stamp.
+		class TileBinner
+		{
+		private:
+			struct ThreadBins
+			{
+				TriangleRefAllocator allocator;
+				Array<BinQueue> queues;
+			};
+
+			Array<UniquePtr<ThreadBins>> mThreadBins;
+			uint mStamp;
+
+		public:
+			TileBinner()
+				: mStamp(0)
+			{
+			}
+
+			void Init(const int numThreads, const int numTiles)
+			{
+				mThreadBins.Clear();
+				for (auto i = 0; i < numThreads; i++)
+				{
+					mThreadBins.Add(MakeUnique<ThreadBins>());
+					mThreadBins[i]->queues.Resize(numTiles);
+				}
+				mStamp = 0;
+			}
+
+			// Must be called before binning each frame
+			void Reset()
+			{
+				for (auto& it : mThreadBins)
+					it->allocator.Reset();
+
+				mStamp++;
+			}
+
+			__forceinline void Add(const int threadId, const int tileId, const Tile::TriangleRef& ref)
+			{
+				ThreadBins& bins = *mThreadBins[threadId];
+				BinQueue& queue = bins.queues[tileId];
+				if (queue.stamp != mStamp)
+				{
+					queue.pHead = queue.pTail = nullptr;
+					queue.size = 0;
+					queue.stamp = mStamp;
+				}
+
+				queue.Add(ref, bins.allocator);
+			}
+
+			uint GetRefCount(const int tileId) const
+			{
+				uint count = 0;
+				for (auto& it : mThreadBins)
+				{
+					const BinQueue& queue = it->queues[tileId];
+					if (queue.stamp == mStamp)
+						count += queue.size;
+				}
+
+				return count;
+			}
+
+			// Gathers the refs of all threads into the tile. Each thread bins a contiguous range of
+			// primitives, so concatenating in thread order keeps primitive submission order.
+			void Merge(Tile& tile) const
+			{
+				tile.triangleRefs.Clear();
+				tile.triangleRefs.Reserve(GetRefCount(tile.tileId));
+
+				for (auto& it : mThreadBins)
+				{
+					const BinQueue& queue = it->queues[tile.tileId];
+					if (queue.stamp != mStamp)
+						continue;
+
+					for (auto pChunk = queue.pHead; pChunk; pChunk = pChunk->pNext)
+						tile.triangleRefs.Insert(pChunk->refs, pChunk->count, tile.triangleRefs.Size());
+				}
+			}
+		};
+	}
+}
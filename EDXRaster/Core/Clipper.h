@@ -1,7 +1,12 @@
 #pragma once
 
 #include "EDXPrerequisites.h"
-#include <ppl.h>
+#include "SIMD/SSE.h"
+#include "FrameArena.h"
+#include "TriangleSetup.h"
+#include "TaskSystem.h"
+#include "Profiler.h"
+#include <atomic>
 
 #define CLIP_ALL_PLANES 1
 
@@ -23,10 +28,29 @@ namespace EDX
 				}
 			};
 
-			Array<Vertex> vertices;
+			// A triangle clipped by all six planes has at most nine vertices, so no heap storage is needed
+			static const int MAX_VERTICES = 9;
+
+			Vertex vertices[MAX_VERTICES];
+			int vertexCount;
+
+			__forceinline int Size() const
+			{
+				return vertexCount;
+			}
+			__forceinline void Clear()
+			{
+				vertexCount = 0;
+			}
+			__forceinline void Add(const Vertex& vertex)
+			{
+				Assert(vertexCount < MAX_VERTICES);
+				vertices[vertexCount++] = vertex;
+			}
+
 			void FromTriangle(const Vector4& v0, const Vector4& v1, const Vector4& v2)
 			{
-				vertices.Resize(3);
+				vertexCount = 3;
 				vertices[0].pos = v0; vertices[1].pos = v1; vertices[2].pos = v2;
 				vertices[0].clipWeights = Vector3::UNIT_X;
 				vertices[1].clipWeights = Vector3::UNIT_Y;
@@ -45,165 +69,274 @@ namespace EDX
 			static const uint FAR_BIT = 1 << 5;
 			static const uint NEAR_BIT = 1 << 4;
 
-			static uint ComputeClipCode(const Vector4& v)
+			// Direct mapped post-transform cache from source vertex index to per core slot
+			static const uint VERTEX_CACHE_SIZE_LOG_2 = 9;
+			static const uint VERTEX_CACHE_SIZE = 1 << VERTEX_CACHE_SIZE_LOG_2;
+
+			struct VertexCache
+			{
+				uint srcIds[VERTEX_CACHE_SIZE];
+				uint slots[VERTEX_CACHE_SIZE];
+
+				VertexCache()
+				{
+					memset(srcIds, 0xFF, sizeof(srcIds));
+				}
+
+				__forceinline uint Fetch(const uint srcId, const FrameArray<ProjectedVertex>& vertexBufferIn, FrameArray<ProjectedVertex>& vertexBufferOut)
+				{
+					const uint entry = srcId & (VERTEX_CACHE_SIZE - 1);
+					if (srcIds[entry] != srcId)
+					{
+						srcIds[entry] = srcId;
+						slots[entry] = vertexBufferOut.Size();
+						vertexBufferOut.Add(vertexBufferIn[srcId]);
+					}
+
+					return slots[entry];
+				}
+			};
+
+			static __forceinline __m128i PlaneBit(const BoolSSE& outside, const uint bit)
 			{
-				uint code = INSIDE_BIT;
+				return _mm_and_si128(_mm_castps_si128(outside.m128), _mm_set1_epi32(bit));
+			}
+
+			// Clip codes of one vertex of four triangles at once. Screen codes use the view frustum and
+			// drive trivial rejection, guard band codes use x/y planes widened by guardBand and decide
+			// whether a triangle needs clipping at all.
+			static __forceinline void ComputeClipCodes(const FloatSSE& x,
+				const FloatSSE& y,
+				const FloatSSE& z,
+				const FloatSSE& w,
+				const Vector2& guardBand,
+				uint* pScreenCodes,
+				uint* pGuardBandCodes)
+			{
+				const FloatSSE Zero = FloatSSE(Math::EDX_ZERO);
+				const FloatSSE guardX = w * guardBand.x;
+				const FloatSSE guardY = w * guardBand.y;
 
+				__m128i depthCode = _mm_or_si128(PlaneBit(z < Zero, NEAR_BIT), PlaneBit(z > w, FAR_BIT));
+				__m128i screenCode = depthCode;
+				__m128i guardBandCode = depthCode;
 #if CLIP_ALL_PLANES
-				if (v.x < -v.w)
-					code |= LEFT_BIT;
-				if (v.x > v.w)
-					code |= RIGHT_BIT;
-				if (v.y < -v.w)
-					code |= BOTTOM_BIT;
-				if (v.y > v.w)
-					code |= TOP_BIT;
-				if (v.z > v.w)
-					code |= FAR_BIT;
+				screenCode = _mm_or_si128(screenCode, _mm_or_si128(_mm_or_si128(PlaneBit(x + w < Zero, LEFT_BIT), PlaneBit(x > w, RIGHT_BIT)),
+					_mm_or_si128(PlaneBit(y + w < Zero, BOTTOM_BIT), PlaneBit(y > w, TOP_BIT))));
+				guardBandCode = _mm_or_si128(guardBandCode, _mm_or_si128(_mm_or_si128(PlaneBit(x + guardX < Zero, LEFT_BIT), PlaneBit(x > guardX, RIGHT_BIT)),
+					_mm_or_si128(PlaneBit(y + guardY < Zero, BOTTOM_BIT), PlaneBit(y > guardY, TOP_BIT))));
+#else
+				guardBandCode = PlaneBit(z < Zero, NEAR_BIT);
 #endif
-				if (v.z < 0.0f)
-					code |= NEAR_BIT;
-
-				return code;
+				_mm_storeu_si128((__m128i*)pScreenCodes, screenCode);
+				_mm_storeu_si128((__m128i*)pGuardBandCodes, guardBandCode);
 			}
 
 		public:
-			static void Clip(Array<ProjectedVertex>& vertexBufferIn,
+			// Largest raster space extent in pixels for which the 28.4 fixed point edge functions
+			// cannot overflow. Triangles inside the guard band are left to the rasterizer's bounds.
+			static const int GUARD_BAND_EXTENT = 1792;
+			static const int BATCH_SIZE = 4;
+
+			static Vector2 ComputeGuardBand(const int screenWidth, const int screenHeight)
+			{
+				return Vector2(Math::Max(1.0f, GUARD_BAND_EXTENT / float(screenWidth)),
+					Math::Max(1.0f, GUARD_BAND_EXTENT / float(screenHeight)));
+			}
+
+			// Returns the number of triangles that went through polygon clipping
+			static uint Clip(FrameArray<ProjectedVertex>& vertexBufferIn,
 				const IndexBuffer* pIndexBuf,
 				const Array<uint>& texIdBuf,
-				Array<ProjectedVertex>* pProjVertices,
-				Array<RasterTriangle>* pTrianglesBuf,
-				int numCores)
+				const Array<uint>& drawIdBuf,
+				FrameArray<ProjectedVertex>* pProjVertices,
+				FrameArray<RasterTriangle>* pTrianglesBuf,
+				FrameArray<TriangleBlock>* pTriangleBlocks,
+				const Vector2& guardBand,
+				const Matrix& rasterMatrix,
+				const bool cullBackFace,
+				int numCores,
+				Profiler& profiler)
 			{
-				concurrency::parallel_for(0, numCores, [&](int coreId)
+				// Cull mode is resolved once here instead of per triangle
+				if (cullBackFace)
+					return ClipTriangles<true>(vertexBufferIn, pIndexBuf, texIdBuf, drawIdBuf, pProjVertices, pTrianglesBuf, pTriangleBlocks, guardBand, rasterMatrix, numCores, profiler);
+				else
+					return ClipTriangles<false>(vertexBufferIn, pIndexBuf, texIdBuf, drawIdBuf, pProjVertices, pTrianglesBuf, pTriangleBlocks, guardBand, rasterMatrix, numCores, profiler);
+			}
+
+		private:
+			template<bool CullBackFace>
+			static uint ClipTriangles(FrameArray<ProjectedVertex>& vertexBufferIn,
+				const IndexBuffer* pIndexBuf,
+				const Array<uint>& texIdBuf,
+				const Array<uint>& drawIdBuf,
+				FrameArray<ProjectedVertex>* pProjVertices,
+				FrameArray<RasterTriangle>* pTrianglesBuf,
+				FrameArray<TriangleBlock>* pTriangleBlocks,
+				const Vector2& guardBand,
+				const Matrix& rasterMatrix,
+				int numCores,
+				Profiler& profiler)
+			{
+				std::atomic<uint> clippedCount(0);
+				ParallelFor(0, numCores, [&](int coreId)
 				{
-					auto interval = (pIndexBuf->GetTriangleCount() + numCores - 1) / numCores;
-					auto startIdx = coreId * interval;
-					auto endIdx = (coreId + 1) * interval;
+					ScopedProfileEvent event(profiler, "ClipTriangles");
+					const int triangleCount = pIndexBuf->GetTriangleCount();
+					const int interval = (triangleCount + numCores - 1) / numCores;
+					const int startIdx = coreId * interval;
+					const int endIdx = Math::Min((coreId + 1) * interval, triangleCount);
 
 					auto& currentVertexBuf = pProjVertices[coreId];
+					VertexCache vertexCache;
+					TriangleSetup triangleSetup(rasterMatrix, coreId, pTrianglesBuf[coreId], pTriangleBlocks[coreId]);
+					uint coreClippedCount = 0;
 
-					for (auto i = startIdx; i < endIdx; i++)
+					for (auto batchIdx = startIdx; batchIdx < endIdx; batchIdx += BATCH_SIZE)
 					{
-						if (i >= pIndexBuf->GetTriangleCount())
-							return;
-
-						const uint* pIndex = pIndexBuf->GetIndex(i);
-						const Vector4& v0 = vertexBufferIn[pIndex[0]].projectedPos;
-						const Vector4& v1 = vertexBufferIn[pIndex[1]].projectedPos;
-						const Vector4& v2 = vertexBufferIn[pIndex[2]].projectedPos;
-						const uint texId = texIdBuf[i];
-						int idx0 = currentVertexBuf.Size();
-						currentVertexBuf.Add(vertexBufferIn[pIndex[0]]);
-						int idx1 = currentVertexBuf.Size();
-						currentVertexBuf.Add(vertexBufferIn[pIndex[1]]);
-						int idx2 = currentVertexBuf.Size();
-						currentVertexBuf.Add(vertexBufferIn[pIndex[2]]);
-
-						uint clipCode0 = ComputeClipCode(v0);
-						uint clipCode1 = ComputeClipCode(v1);
-						uint clipCode2 = ComputeClipCode(v2);
-
-						if ((clipCode0 | clipCode1 | clipCode2))
+						const int batchCount = Math::Min(BATCH_SIZE, endIdx - batchIdx);
+
+						uint screenCodes[3][BATCH_SIZE];
+						uint guardBandCodes[3][BATCH_SIZE];
+						for (auto k = 0; k < 3; k++)
 						{
-							if (!(clipCode0 & clipCode1 & clipCode2))
+							FloatSSE x = FloatSSE(Math::EDX_ZERO);
+							FloatSSE y = FloatSSE(Math::EDX_ZERO);
+							FloatSSE z = FloatSSE(Math::EDX_ZERO);
+							FloatSSE w = FloatSSE(Math::EDX_ONE);
+							for (auto lane = 0; lane < batchCount; lane++)
 							{
-								int clipVertIds[12];
-
-								Polygon polygon0, polygon1;
-								polygon0.FromTriangle(v0, v1, v2);
-
-								Polygon* pCurrPoly = &polygon0;
-								Polygon* pbuffPoly = &polygon1;
-								ClipPolygon(pCurrPoly, pbuffPoly,
-									(clipCode0 ^ clipCode1) | (clipCode1 ^ clipCode2) | (clipCode2 ^ clipCode0));
-
-								for (int j = 0; j < pCurrPoly->vertices.Size(); j++)
-								{
-									Vector3 weight = pCurrPoly->vertices[j].clipWeights;
-									if (weight.x == 1.0f)
-									{
-										clipVertIds[j] = idx0;
-									}
-									else if (weight.y == 1.0f)
-									{
-										clipVertIds[j] = idx1;
-									}
-									else if (weight.z == 1.0f)
-									{
-										clipVertIds[j] = idx2;
-									}
-									else
-									{
-										clipVertIds[j] = currentVertexBuf.Size();
-										ProjectedVertex tmpVertex;
-										tmpVertex.projectedPos = pCurrPoly->vertices[j].pos;
-										tmpVertex.position = weight.x * currentVertexBuf[idx0].position +
-											weight.y * currentVertexBuf[idx1].position +
-											weight.z * currentVertexBuf[idx2].position;
-										tmpVertex.normal = weight.x * currentVertexBuf[idx0].normal +
-											weight.y * currentVertexBuf[idx1].normal +
-											weight.z * currentVertexBuf[idx2].normal;
-										tmpVertex.texCoord = weight.x * currentVertexBuf[idx0].texCoord +
-											weight.y * currentVertexBuf[idx1].texCoord +
-											weight.z * currentVertexBuf[idx2].texCoord;
-
-										currentVertexBuf.Add(tmpVertex);
-									}
-								}
-
-								// Simple triangulation
-								for (int k = 2; k < pCurrPoly->vertices.Size(); k++)
-								{
-									uint idx[3] = { clipVertIds[0], clipVertIds[k - 1], clipVertIds[k] };
-
-									RasterTriangle tri;
-									if (tri.Setup(currentVertexBuf[clipVertIds[0]].projectedPos.HomogeneousProject(),
-										currentVertexBuf[clipVertIds[k - 1]].projectedPos.HomogeneousProject(),
-										currentVertexBuf[clipVertIds[k]].projectedPos.HomogeneousProject(),
-										idx,
-										coreId,
-										texId))
-									{
-										pTrianglesBuf[coreId].Add(tri);
-									}
-								}
+								const Vector4& pos = vertexBufferIn[pIndexBuf->GetIndex(batchIdx + lane)[k]].projectedPos;
+								x[lane] = pos.x;
+								y[lane] = pos.y;
+								z[lane] = pos.z;
+								w[lane] = pos.w;
 							}
-
-							continue;
+							ComputeClipCodes(x, y, z, w, guardBand, screenCodes[k], guardBandCodes[k]);
 						}
 
-						const uint index[3] = { idx0, idx1, idx2 };
-						RasterTriangle tri;
-						if (tri.Setup(currentVertexBuf[idx0].projectedPos.HomogeneousProject(),
-							currentVertexBuf[idx1].projectedPos.HomogeneousProject(),
-							currentVertexBuf[idx2].projectedPos.HomogeneousProject(),
-							index,
-							coreId,
-							texId))
+						for (auto lane = 0; lane < batchCount; lane++)
 						{
-							pTrianglesBuf[coreId].Add(tri);
+							// Entirely outside one of the frustum planes
+							if (screenCodes[0][lane] & screenCodes[1][lane] & screenCodes[2][lane])
+								continue;
+
+							const int i = batchIdx + lane;
+							const uint planeCode = guardBandCodes[0][lane] | guardBandCodes[1][lane] | guardBandCodes[2][lane];
+							coreClippedCount += planeCode != 0;
+							ClipTriangle<CullBackFace>(vertexBufferIn, pIndexBuf->GetIndex(i), texIdBuf[i], drawIdBuf[i], planeCode, guardBand,
+								vertexCache, currentVertexBuf, triangleSetup);
 						}
 					}
+					triangleSetup.Flush<CullBackFace>();
+
+					clippedCount += coreClippedCount;
 				});
+
+				return clippedCount;
 			}
 
-		private:
+			template<bool CullBackFace>
+			static __forceinline void ClipTriangle(const FrameArray<ProjectedVertex>& vertexBufferIn,
+				const uint* pIndex,
+				const uint texId,
+				const uint drawId,
+				const uint planeCode,
+				const Vector2& guardBand,
+				VertexCache& vertexCache,
+				FrameArray<ProjectedVertex>& currentVertexBuf,
+				TriangleSetup& triangleSetup)
+			{
+				// Shared vertices are copied once per core while they stay in the cache
+				int idx0 = vertexCache.Fetch(pIndex[0], vertexBufferIn, currentVertexBuf);
+				int idx1 = vertexCache.Fetch(pIndex[1], vertexBufferIn, currentVertexBuf);
+				int idx2 = vertexCache.Fetch(pIndex[2], vertexBufferIn, currentVertexBuf);
+
+				// Inside the guard band, x and y are left to the rasterizer's bounding box
+				if (!planeCode)
+				{
+					const uint index[3] = { uint(idx0), uint(idx1), uint(idx2) };
+					triangleSetup.Add<CullBackFace>(currentVertexBuf[idx0].projectedPos.HomogeneousProject(),
+						currentVertexBuf[idx1].projectedPos.HomogeneousProject(),
+						currentVertexBuf[idx2].projectedPos.HomogeneousProject(),
+						index,
+						texId,
+						drawId);
+
+					return;
+				}
+
+				int clipVertIds[Polygon::MAX_VERTICES];
+
+				Polygon polygon0, polygon1;
+				polygon0.FromTriangle(vertexBufferIn[pIndex[0]].projectedPos, vertexBufferIn[pIndex[1]].projectedPos, vertexBufferIn[pIndex[2]].projectedPos);
+
+				Polygon* pCurrPoly = &polygon0;
+				Polygon* pbuffPoly = &polygon1;
+				ClipPolygon(pCurrPoly, pbuffPoly, planeCode, guardBand);
+
+				for (int j = 0; j < pCurrPoly->Size(); j++)
+				{
+					Vector3 weight = pCurrPoly->vertices[j].clipWeights;
+					if (weight.x == 1.0f)
+					{
+						clipVertIds[j] = idx0;
+					}
+					else if (weight.y == 1.0f)
+					{
+						clipVertIds[j] = idx1;
+					}
+					else if (weight.z == 1.0f)
+					{
+						clipVertIds[j] = idx2;
+					}
+					else
+					{
+						clipVertIds[j] = currentVertexBuf.Size();
+						ProjectedVertex tmpVertex;
+						tmpVertex.projectedPos = pCurrPoly->vertices[j].pos;
+						tmpVertex.position = weight.x * currentVertexBuf[idx0].position +
+							weight.y * currentVertexBuf[idx1].position +
+							weight.z * currentVertexBuf[idx2].position;
+						tmpVertex.normal = weight.x * currentVertexBuf[idx0].normal +
+							weight.y * currentVertexBuf[idx1].normal +
+							weight.z * currentVertexBuf[idx2].normal;
+						tmpVertex.texCoord = weight.x * currentVertexBuf[idx0].texCoord +
+							weight.y * currentVertexBuf[idx1].texCoord +
+							weight.z * currentVertexBuf[idx2].texCoord;
+
+						currentVertexBuf.Add(tmpVertex);
+					}
+				}
+
+				// Simple triangulation
+				for (int k = 2; k < pCurrPoly->Size(); k++)
+				{
+					uint idx[3] = { uint(clipVertIds[0]), uint(clipVertIds[k - 1]), uint(clipVertIds[k]) };
+					triangleSetup.Add<CullBackFace>(currentVertexBuf[clipVertIds[0]].projectedPos.HomogeneousProject(),
+						currentVertexBuf[clipVertIds[k - 1]].projectedPos.HomogeneousProject(),
+						currentVertexBuf[clipVertIds[k]].projectedPos.HomogeneousProject(),
+						idx,
+						texId,
+						drawId);
+				}
+			}
 			template<typename PredicateFunc, typename ComputeTFunc, typename ClipFunc>
 			static void ClipByPlane(Polygon*& pInput, Polygon*& pBuffer, PredicateFunc predicate, ComputeTFunc computeT, ClipFunc clip)
 			{
-				pBuffer->vertices.Clear();
-				for (int i = 0; i < pInput->vertices.Size(); i++)
+				pBuffer->Clear();
+				for (int i = 0; i < pInput->Size(); i++)
 				{
 					int i1 = i + 1;
-					if (i1 == pInput->vertices.Size()) i1 = 0;
+					if (i1 == pInput->Size()) i1 = 0;
 					Vector4 v0 = pInput->vertices[i].pos;
 					Vector4 v1 = pInput->vertices[i1].pos;
 					if (predicate(v0))
 					{
 						if (predicate(v1))
 						{
-							pBuffer->vertices.Add(Polygon::Vertex(v1, pInput->vertices[i1].clipWeights));
+							pBuffer->Add(Polygon::Vertex(v1, pInput->vertices[i1].clipWeights));
 						}
 						else
 						{
@@ -211,7 +344,7 @@ namespace EDX
 							Vector4 pos = v0 * (1 - t) + v1 * t;
 							clip(pos);
 							Vector3 weight = pInput->vertices[i].clipWeights * (1 - t) + pInput->vertices[i1].clipWeights * t;
-							pBuffer->vertices.Add(Polygon::Vertex(pos, weight));
+							pBuffer->Add(Polygon::Vertex(pos, weight));
 						}
 					}
 					else
@@ -222,8 +355,8 @@ namespace EDX
 							Vector4 pos = v0 * (1 - t) + v1 * t;
 							clip(pos);
 							Vector3 weight = pInput->vertices[i].clipWeights * (1 - t) + pInput->vertices[i1].clipWeights * t;
-							pBuffer->vertices.Add(Polygon::Vertex(pos, weight));
-							pBuffer->vertices.Add(Polygon::Vertex(v1, pInput->vertices[i1].clipWeights));
+							pBuffer->Add(Polygon::Vertex(pos, weight));
+							pBuffer->Add(Polygon::Vertex(v1, pInput->vertices[i1].clipWeights));
 						}
 					}
 				}
@@ -232,35 +365,38 @@ namespace EDX
 			}
 
 		public:
-			static void ClipPolygon(Polygon*& pInput, Polygon*& pBuffer, const uint planeCode)
+			static void ClipPolygon(Polygon*& pInput, Polygon*& pBuffer, const uint planeCode, const Vector2& guardBand)
 			{
 #if CLIP_ALL_PLANES
+				// X and y planes are the guard band planes, g * w
+				const float gx = guardBand.x;
+				const float gy = guardBand.y;
 				if (planeCode & LEFT_BIT)
 				{
-					ClipByPlane(pInput, pBuffer, [](const Vector4& v) -> bool { return v.x >= -v.w; },
-						[](const Vector4& v0, const Vector4& v1) -> float { return (v0.w + v0.x) / ((v0.x + v0.w) - (v1.x + v1.w)); },
-						[](Vector4& v) { v.x = -v.w; });
+					ClipByPlane(pInput, pBuffer, [=](const Vector4& v) -> bool { return v.x >= -gx * v.w; },
+						[=](const Vector4& v0, const Vector4& v1) -> float { return (gx * v0.w + v0.x) / ((v0.x + gx * v0.w) - (v1.x + gx * v1.w)); },
+						[=](Vector4& v) { v.x = -gx * v.w; });
 				}
 
 				if (planeCode & RIGHT_BIT)
 				{
-					ClipByPlane(pInput, pBuffer, [](const Vector4& v) -> bool { return v.x <= v.w; },
-						[](const Vector4& v0, const Vector4& v1) -> float { return (-v0.w + v0.x) / ((v0.x - v0.w) - (v1.x - v1.w)); },
-						[](Vector4& v) { v.x = v.w; });
+					ClipByPlane(pInput, pBuffer, [=](const Vector4& v) -> bool { return v.x <= gx * v.w; },
+						[=](const Vector4& v0, const Vector4& v1) -> float { return (-gx * v0.w + v0.x) / ((v0.x - gx * v0.w) - (v1.x - gx * v1.w)); },
+						[=](Vector4& v) { v.x = gx * v.w; });
 				}
 
 				if (planeCode & BOTTOM_BIT)
 				{
-					ClipByPlane(pInput, pBuffer, [](const Vector4& v) -> bool { return v.y >= -v.w; },
-						[](const Vector4& v0, const Vector4& v1) -> float { return (v0.w + v0.y) / ((v0.y + v0.w) - (v1.y + v1.w)); },
-						[](Vector4& v) { v.y = -v.w; });
+					ClipByPlane(pInput, pBuffer, [=](const Vector4& v) -> bool { return v.y >= -gy * v.w; },
+						[=](const Vector4& v0, const Vector4& v1) -> float { return (gy * v0.w + v0.y) / ((v0.y + gy * v0.w) - (v1.y + gy * v1.w)); },
+						[=](Vector4& v) { v.y = -gy * v.w; });
 				}
 
 				if (planeCode & TOP_BIT)
 				{
-					ClipByPlane(pInput, pBuffer, [](const Vector4& v) -> bool { return v.y <= v.w; },
-						[](const Vector4& v0, const Vector4& v1) -> float { return (-v0.w + v0.y) / ((v0.y - v0.w) - (v1.y - v1.w)); },
-						[](Vector4& v) { v.y = v.w; });
+					ClipByPlane(pInput, pBuffer, [=](const Vector4& v) -> bool { return v.y <= gy * v.w; },
+						[=](const Vector4& v0, const Vector4& v1) -> float { return (-gy * v0.w + v0.y) / ((v0.y - gy * v0.w) - (v1.y - gy * v1.w)); },
+						[=](Vector4& v) { v.y = gy * v.w; });
 				}
 
 				if (planeCode & FAR_BIT)
@@ -277,11 +413,11 @@ namespace EDX
 						[=](Vector4& v) { v.z = 0.0f; });
 				}
 
-				for (int i = 0; i<pInput->vertices.Size(); i++)
+				for (int i = 0; i<pInput->Size(); i++)
 				{
 					if (pInput->vertices[i].pos.w <= 0.0f)
 					{
-						pInput->vertices.Clear();
+						pInput->Clear();
 						return;
 					}
 				}
@@ -0,0 +1,138 @@
+#include "CompiledPixelShader.h"
+#include "RasterTexture.h"
+#include "../ShaderCompiler/HLSLLexer.h"
+#include "../ShaderCompiler/HLSLParser.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		using namespace ShaderCompiler;
+
+		bool CompiledPixelShader::Compile(const char* fileName,
+			const string& source,
+			const char* entryPoint,
+			Array<CompileError>& errorList)
+		{
+			mProgram = ShaderProgram();
+
+			HLSLLexer lexer;
+			const Array<HLSLToken> tokens = lexer.Tokenize(fileName, source, errorList);
+			if (errorList.Size() > 0)
+				return false;
+
+			HLSLParser parser;
+			if (!parser.Parse(tokens, entryPoint, mProgram, errorList))
+				return false;
+
+			if (mProgram.registerCount > MAX_REGISTERS)
+			{
+				SourceInfo srcInfo = { fileName, 0, 0 };
+				errorList.Add(CompileError("Shader needs more than " + std::to_string(MAX_REGISTERS) + " live values", srcInfo));
+				mProgram = ShaderProgram();
+				return false;
+			}
+
+			return true;
+		}
+
+		bool CompiledPixelShader::CompileFromFile(const char* path,
+			const char* entryPoint,
+			Array<CompileError>& errorList)
+		{
+			std::ifstream file(path);
+			if (!file)
+			{
+				SourceInfo srcInfo = { path, 0, 0 };
+				errorList.Add(CompileError("Cannot open shader file", srcInfo));
+				return false;
+			}
+
+			std::stringstream source;
+			source << file.rdbuf();
+			return Compile(path, source.str(), entryPoint, errorList);
+		}
+
+		Vec3f_SSE CompiledPixelShader::Shade(Fragment& fragIn,
+			const Vector3& eyePos,
+			const Vector3& lightDir,
+			const Vec3f_SSE& position,
+			const Vec3f_SSE& normal,
+			const Vec2f_SSE& texCoord,
+			const Vec2f_SSE texDifferentials[2],
+			const FloatSSE& texLod,
+			const TextureSampler& sampler) const
+		{
+			IRRegister registers[MAX_REGISTERS];
+			const IRRegister* ppArgs[IRInstruction::MAX_ARGS];
+
+			const int instructionCount = mProgram.instructions.Size();
+			for (auto i = 0; i < instructionCount; i++)
+			{
+				const IRInstruction& instr = mProgram.instructions[i];
+				IRRegister& out = registers[mProgram.registers[i]];
+
+				switch (instr.op)
+				{
+				case IROp::Constant:
+					for (auto c = 0; c < instr.width; c++)
+						out.c[c] = FloatSSE(instr.constant[c]);
+					break;
+
+				case IROp::Input:
+					if (instr.slot == int(IRInput::TexCoord))
+					{
+						out.c[0] = texCoord.u;
+						out.c[1] = texCoord.v;
+					}
+					else
+					{
+						const Vec3f_SSE& input = instr.slot == int(IRInput::Position) ? position : normal;
+						out.c[0] = input.x;
+						out.c[1] = input.y;
+						out.c[2] = input.z;
+					}
+					break;
+
+				case IROp::Uniform:
+				{
+					const Vector3& uniform = instr.slot == int(IRUniform::EyePosition) ? eyePos : lightDir;
+					out.c[0] = FloatSSE(uniform.x);
+					out.c[1] = FloatSSE(uniform.y);
+					out.c[2] = FloatSSE(uniform.z);
+					break;
+				}
+
+				case IROp::Sample:
+				{
+					const IRRegister& coord = registers[mProgram.registers[instr.args[0]]];
+					const Vec3f_SSE color = sampler.Sample(fragIn.textureId, Vec2f_SSE(coord.c[0], coord.c[1]), texDifferentials, texLod);
+
+					out.c[0] = color.x;
+					out.c[1] = color.y;
+					out.c[2] = color.z;
+					out.c[3] = FloatSSE(Math::EDX_ONE);
+					break;
+				}
+
+				default:
+					for (auto j = 0; j < instr.argCount; j++)
+						ppArgs[j] = &registers[mProgram.registers[instr.args[j]]];
+
+					ShaderProgram::Evaluate(instr, ppArgs, out);
+					break;
+				}
+			}
+
+			// Before Compile succeeds the program is empty and shades black
+			if (mProgram.result < 0)
+				return Vec3f_SSE(Vector3::ZERO);
+
+			const IRRegister& result = registers[mProgram.registers[mProgram.result]];
+			return Vec3f_SSE(result.c[0], result.c[1], result.c[2]);
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Shader.h"
+#include "../ShaderCompiler/CompilerCommon.h"
+#include "../ShaderCompiler/ShaderIR.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Pixel shader compiled from HLSL source. The optimized IR runs on SoA registers, four lanes per
+		// instruction, so dispatch costs one switch per instruction and batch instead of per pixel.
+		class CompiledPixelShader : public PixelShader
+		{
+		public:
+			static const int MAX_REGISTERS = 32;
+
+		private:
+			ShaderCompiler::ShaderProgram mProgram;
+
+		public:
+			// False with the reasons in errorList if the source does not compile
+			bool Compile(const char* fileName,
+				const string& source,
+				const char* entryPoint,
+				Array<ShaderCompiler::CompileError>& errorList);
+			bool CompileFromFile(const char* path,
+				const char* entryPoint,
+				Array<ShaderCompiler::CompileError>& errorList);
+
+			// Samples use the differentials of the interpolated TEXCOORD, shaders that scale
+			// texture coordinates get the level of detail of the unscaled ones
+			Vec3f_SSE Shade(Fragment& fragIn,
+				const Vector3& eyePos,
+				const Vector3& lightDir,
+				const Vec3f_SSE& position,
+				const Vec3f_SSE& normal,
+				const Vec2f_SSE& texCoord,
+				const Vec2f_SSE texDifferentials[2],
+				const FloatSSE& texLod,
+				const TextureSampler& sampler) const;
+
+			int GetInstructionCount() const
+			{
+				return mProgram.instructions.Size();
+			}
+		};
+	}
+}
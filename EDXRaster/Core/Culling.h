@@ -0,0 +1,105 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Math/Matrix.h"
+#include "Math/BoundingBox.h"
+#include "../Utils/MeshOptimizer.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace Culling
+		{
+			static const uint LEFT_BIT = 1 << 0;
+			static const uint RIGHT_BIT = 1 << 1;
+			static const uint BOTTOM_BIT = 1 << 2;
+			static const uint TOP_BIT = 1 << 3;
+			static const uint NEAR_BIT = 1 << 4;
+			static const uint FAR_BIT = 1 << 5;
+
+			// Same plane convention as the clipper, near plane at z = 0
+			__forceinline uint ComputeOutCode(const Vector4& v)
+			{
+				uint code = 0;
+				if (v.x < -v.w)
+					code |= LEFT_BIT;
+				if (v.x > v.w)
+					code |= RIGHT_BIT;
+				if (v.y < -v.w)
+					code |= BOTTOM_BIT;
+				if (v.y > v.w)
+					code |= TOP_BIT;
+				if (v.z < 0.0f)
+					code |= NEAR_BIT;
+				if (v.z > v.w)
+					code |= FAR_BIT;
+
+				return code;
+			}
+
+			// Conservative test, true only if all eight corners are outside the same frustum plane
+			inline bool BoxOutsideFrustum(const BoundingBox& box, const Matrix& mViewProj)
+			{
+				uint code = ~0u;
+				for (auto i = 0; i < 8; i++)
+				{
+					const Vector4 corner = Vector4(i & 1 ? box.mMax.x : box.mMin.x,
+						i & 2 ? box.mMax.y : box.mMin.y,
+						i & 4 ? box.mMax.z : box.mMin.z,
+						1.0f);
+
+					code &= ComputeOutCode(Matrix::TransformPoint(corner, mViewProj));
+					if (code == 0)
+						return false;
+				}
+
+				return true;
+			}
+
+			// Sign that turns dot(n, eye - p) of an object space winding normal n into the rasterizer's facing,
+			// positive when front faces wind counter clockwise around n. Measured by setting up a small
+			// triangle at constant w, as the combined transform may mirror. Zero without an eye point, e.g. for
+			// orthographic projections.
+			inline float FrontFaceSign(const Matrix& mWorldViewProj, const Matrix& mRaster, const Vector3& eyePos)
+			{
+				// Gradient of clip space w, pointing away from the eye into the view
+				const Vector3 wGradient = Vector3(Matrix::TransformPoint(Vector4(1.0f, 0.0f, 0.0f, 0.0f), mWorldViewProj).w,
+					Matrix::TransformPoint(Vector4(0.0f, 1.0f, 0.0f, 0.0f), mWorldViewProj).w,
+					Matrix::TransformPoint(Vector4(0.0f, 0.0f, 1.0f, 0.0f), mWorldViewProj).w);
+				const float gradientLength = Math::Length(wGradient);
+				if (gradientLength < 1e-8f)
+					return 0.0f;
+
+				// a x b is the view direction, so the triangle's normal points away from the eye
+				const Vector3 forward = wGradient / gradientLength;
+				const Vector3 a = Math::Normalize(Math::Cross(forward, Math::Abs(forward.x) < 0.9f ? Vector3::UNIT_X : Vector3::UNIT_Y));
+				const Vector3 b = Math::Cross(forward, a);
+				const Vector3 center = eyePos + forward;
+
+				Vector2 raster[3];
+				const Vector3 corners[3] = { center, center + a, center + b };
+				for (auto i = 0; i < 3; i++)
+				{
+					const Vector3 projected = Matrix::TransformPoint(Vector4(corners[i].x, corners[i].y, corners[i].z, 1.0f), mWorldViewProj).HomogeneousProject();
+					const Vector3 pos = Matrix::TransformPoint(projected, mRaster);
+					raster[i] = Vector2(pos.x, pos.y);
+				}
+
+				// Same orientation as TriangleSetup::Flush, which keeps positive areas
+				const float det = (raster[0].x - raster[2].x) * (raster[1].y - raster[2].y) - (raster[2].x - raster[1].x) * (raster[2].y - raster[0].y);
+				return det > 0.0f ? -1.0f : (det < 0.0f ? 1.0f : 0.0f);
+			}
+
+			// Conservative, true only if every triangle of the meshlet is back facing seen from eyePos
+			__forceinline bool MeshletBackFacing(const Meshlet& meshlet, const Vector3& eyePos, const float frontFaceSign)
+			{
+				if (frontFaceSign == 0.0f || meshlet.coneCutoff > 1.0f)
+					return false;
+
+				const Vector3 toCenter = meshlet.center - eyePos;
+				return frontFaceSign * Math::Dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * Math::Length(toCenter) + meshlet.radius;
+			}
+		}
+	}
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Shader.h"
+#include "SIMD/SSE.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Structure of arrays fragment store for one tile. Per quad it keeps the barycentrics, a single
+		// packed triangle id, the tile-local quad position and only as many coverage bytes as the current
+		// sample count needs (1 byte up to 2x MSAA).
+		class FragmentBuffer
+		{
+		public:
+			static const int CORE_ID_BITS = 8;
+			static const int TRI_ID_BITS = 32 - CORE_ID_BITS;
+			static const uint TRI_ID_MASK = (1u << TRI_ID_BITS) - 1;
+
+			static __forceinline uint PackTriangleId(const uint coreId, const uint triId)
+			{
+				Assert(triId <= TRI_ID_MASK);
+				return (coreId << TRI_ID_BITS) | triId;
+			}
+			static __forceinline uint UnpackCoreId(const uint packedId)
+			{
+				return packedId >> TRI_ID_BITS;
+			}
+			static __forceinline uint UnpackTriangleId(const uint packedId)
+			{
+				return packedId & TRI_ID_MASK;
+			}
+
+		private:
+			Array<FloatSSE> mLambda0, mLambda1;
+			Array<uint> mTriangleIds;
+			Array<unsigned short> mCoords; // Tile-local quad origin, x in the low byte
+			Array<_byte> mCoverage;
+			uint mSampleCount;
+			uint mCoverageStride;
+			int mLastSize; // Quads of the previous frames, decaying like FrameArray's
+
+		public:
+			FragmentBuffer()
+				: mLastSize(0)
+			{
+				SetSampleCount(1);
+			}
+
+			// Called once per frame before fragments are added. Capacity for the previous frame's
+			// quads is reserved here, so rasterizing steady frames does not regrow the arrays.
+			void SetSampleCount(const uint sampleCount)
+			{
+				mLastSize = Math::Max(Size(), mLastSize >> 1);
+				Clear();
+				mSampleCount = sampleCount;
+				mCoverageStride = Math::Max(1u, (sampleCount << 2) >> 3);
+				Reserve(mLastSize);
+			}
+			uint GetSampleCount() const
+			{
+				return mSampleCount;
+			}
+
+			void Clear()
+			{
+				mLambda0.Clear();
+				mLambda1.Clear();
+				mTriangleIds.Clear();
+				mCoords.Clear();
+				mCoverage.Clear();
+			}
+
+			void Reserve(const int quadCount)
+			{
+				mLambda0.Reserve(quadCount);
+				mLambda1.Reserve(quadCount);
+				mTriangleIds.Reserve(quadCount);
+				mCoords.Reserve(quadCount);
+				mCoverage.Reserve(quadCount * mCoverageStride);
+			}
+
+			__forceinline int Size() const
+			{
+				return mTriangleIds.Size();
+			}
+
+			__forceinline void Add(const FloatSSE& lambda0,
+				const FloatSSE& lambda1,
+				const uint packedTriId,
+				const Vector2i& localCoord,
+				const CoverageMask& mask)
+			{
+				Assert(localCoord.x < 256 && localCoord.y < 256);
+
+				mLambda0.Add(lambda0);
+				mLambda1.Add(lambda1);
+				mTriangleIds.Add(packedTriId);
+				mCoords.Add((unsigned short)(localCoord.x | (localCoord.y << 8)));
+
+				// Coverage bit i is sample (i >> 2), lane (i & 3), stored little endian
+				const int offset = mCoverage.Size();
+				mCoverage.Resize(offset + mCoverageStride);
+				memcpy(&mCoverage[offset], mask.bits, mCoverageStride);
+			}
+
+			void Append(const FragmentBuffer& other)
+			{
+				Assert(other.mCoverageStride == mCoverageStride);
+				if (other.Size() == 0)
+					return;
+
+				mLambda0.Insert(other.mLambda0.Data(), other.mLambda0.Size(), mLambda0.Size());
+				mLambda1.Insert(other.mLambda1.Data(), other.mLambda1.Size(), mLambda1.Size());
+				mTriangleIds.Insert(other.mTriangleIds.Data(), other.mTriangleIds.Size(), mTriangleIds.Size());
+				mCoords.Insert(other.mCoords.Data(), other.mCoords.Size(), mCoords.Size());
+				mCoverage.Insert(other.mCoverage.Data(), other.mCoverage.Size(), mCoverage.Size());
+			}
+
+			__forceinline const FloatSSE& GetLambda0(const int i) const
+			{
+				return mLambda0[i];
+			}
+			__forceinline const FloatSSE& GetLambda1(const int i) const
+			{
+				return mLambda1[i];
+			}
+			__forceinline uint GetTriangleId(const int i) const
+			{
+				return mTriangleIds[i];
+			}
+			__forceinline Vector2i GetTileLocalCoord(const int i) const
+			{
+				return Vector2i(mCoords[i] & 0xFF, mCoords[i] >> 8);
+			}
+			__forceinline int GetCoverageBit(const int i, const int bit) const
+			{
+				return mCoverage[i * mCoverageStride + (bit >> 3)] & (1 << (bit & 7));
+			}
+			// Four bit lane mask of one sample
+			__forceinline int GetSampleLaneMask(const int i, const int sampleId) const
+			{
+				return (mCoverage[i * mCoverageStride + (sampleId >> 1)] >> ((sampleId & 1) << 2)) & 0xF;
+			}
+			__forceinline CoverageMask GetCoverageMask(const int i) const
+			{
+				CoverageMask mask;
+				memcpy(mask.bits, &mCoverage[i * mCoverageStride], mCoverageStride);
+
+				return mask;
+			}
+		};
+	}
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "TaskSystem.h"
+
+#include <xmmintrin.h>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Linear allocator for data that lives for one frame. Reset is O(1); if a frame spilled into
+		// more than one block, the blocks are replaced by a single one sized to the high water mark,
+		// so frames of steady complexity never touch the heap. Arenas bound to a node take their
+		// blocks from that node's memory.
+		class FrameArena
+		{
+		public:
+			static const size_t MIN_BLOCK_SIZE = 1 << 20;
+			static const size_t ALIGNMENT = 64;
+
+		private:
+			struct Block
+			{
+				_byte* pData;
+				size_t size;
+				int node;
+			};
+
+			Array<Block> mBlocks;
+			int mCurrentBlock;
+			size_t mOffset;
+			size_t mBytesUsed;
+			size_t mHighWaterMark;
+			int mNode; // -1 for the regular heap
+
+		public:
+			FrameArena()
+				: mCurrentBlock(-1), mOffset(0), mBytesUsed(0), mHighWaterMark(0), mNode(-1)
+			{
+			}
+			~FrameArena()
+			{
+				FreeBlocks();
+			}
+
+			// Only affects blocks allocated from now on
+			void SetNode(const int node)
+			{
+				mNode = node;
+			}
+
+			void* Alloc(size_t bytes)
+			{
+				bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+				if (mCurrentBlock < 0 || mOffset + bytes > mBlocks[mCurrentBlock].size)
+				{
+					// Reuse a later block if it is big enough, otherwise spill into a new one
+					mCurrentBlock++;
+					if (mCurrentBlock == mBlocks.Size() || mBlocks[mCurrentBlock].size < bytes)
+					{
+						Block block = AllocBlock(Math::Max(bytes, MIN_BLOCK_SIZE));
+						mBlocks.Insert(&block, 1, mCurrentBlock);
+					}
+					mOffset = 0;
+				}
+
+				void* pRet = mBlocks[mCurrentBlock].pData + mOffset;
+				mOffset += bytes;
+				mBytesUsed += bytes;
+
+				return pRet;
+			}
+
+			template<typename T>
+			T* Alloc(const size_t count)
+			{
+				return (T*)Alloc(count * sizeof(T));
+			}
+
+			// Invalidates every allocation made since the last reset
+			void Reset()
+			{
+				mHighWaterMark = Math::Max(mHighWaterMark, mBytesUsed);
+				if (mBlocks.Size() > 1)
+				{
+					FreeBlocks();
+					mBlocks.Add(AllocBlock(mHighWaterMark));
+				}
+
+				mCurrentBlock = mBlocks.Size() > 0 ? 0 : -1;
+				mOffset = 0;
+				mBytesUsed = 0;
+			}
+
+			size_t GetBytesUsed() const
+			{
+				return mBytesUsed;
+			}
+			size_t GetHighWaterMark() const
+			{
+				return Math::Max(mHighWaterMark, mBytesUsed);
+			}
+
+		private:
+			Block AllocBlock(const size_t size) const
+			{
+				Block block = { mNode < 0 ? (_byte*)_mm_malloc(size, ALIGNMENT) : (_byte*)NodeMemory::Alloc(size, mNode), size, mNode };
+				return block;
+			}
+
+			void FreeBlocks()
+			{
+				for (auto& it : mBlocks)
+				{
+					if (it.node < 0)
+						_mm_free(it.pData);
+					else
+						NodeMemory::Release(it.pData, it.size);
+				}
+				mBlocks.Clear();
+			}
+		};
+
+		// Growable array of trivially copyable elements backed by a FrameArena. Storage is dropped by
+		// Clear, which must happen before the arena is reset. The previous frame's size is used as the
+		// initial capacity so steady frames do not regrow.
+		template<typename T>
+		class FrameArray
+		{
+		private:
+			T* mpData;
+			int mSize;
+			int mCapacity;
+			int mLastSize;
+			FrameArena* mpArena;
+
+		public:
+			FrameArray()
+				: mpData(nullptr), mSize(0), mCapacity(0), mLastSize(0), mpArena(nullptr)
+			{
+			}
+
+			void SetArena(FrameArena* pArena)
+			{
+				Clear();
+				mpArena = pArena;
+			}
+
+			void Clear()
+			{
+				mLastSize = Math::Max(mSize, mLastSize >> 1);
+				mpData = nullptr;
+				mSize = 0;
+				mCapacity = 0;
+			}
+
+			void Reserve(const int capacity)
+			{
+				if (capacity <= mCapacity)
+					return;
+
+				Assert(mpArena);
+				T* pNewData = mpArena->Alloc<T>(capacity);
+				if (mSize > 0)
+					memcpy((void*)pNewData, mpData, mSize * sizeof(T));
+
+				mpData = pNewData;
+				mCapacity = capacity;
+			}
+
+			// Elements are left uninitialized
+			void Resize(const int size)
+			{
+				Reserve(size);
+				mSize = size;
+			}
+
+			__forceinline void Add(const T& val)
+			{
+				if (mSize == mCapacity)
+					Reserve(Math::Max(Math::Max(2 * mCapacity, mLastSize), 64));
+
+				mpData[mSize++] = val;
+			}
+
+			__forceinline int Size() const
+			{
+				return mSize;
+			}
+			__forceinline T* Data()
+			{
+				return mpData;
+			}
+			__forceinline const T* Data() const
+			{
+				return mpData;
+			}
+			__forceinline T& operator [] (const int idx)
+			{
+				Assert(idx < mSize);
+				return mpData[idx];
+			}
+			__forceinline const T& operator [] (const int idx) const
+			{
+				Assert(idx < mSize);
+				return mpData[idx];
+			}
+		};
+	}
+}
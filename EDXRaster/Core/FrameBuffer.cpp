@@ -1,10 +1,8 @@
 #include "FrameBuffer.h"
 #include "Tile.h"
+#include "TaskSystem.h"
 #include "Math/EDXMath.h"
 
-#include <ppl.h>
-using namespace concurrency;
-
 namespace EDX
 {
 	namespace RasterRenderer
@@ -16,29 +14,78 @@ namespace EDX
 
 			mResX = iWidth;
 			mResY = iHeight;
-			mColorBufferMS.Init(Vector3i(mSampleCount, iWidth, iHeight));
-			mColorBuffer.Init(Vector2i(iWidth, iHeight));
 
 			mTileDimX = tileDim.x;
 			mTileDimY = tileDim.y;
 
-			mTiledDepthBuffer.Resize(tileDim.x * tileDim.y);
-			for (auto& it : mTiledDepthBuffer)
-				it.Init(Vector3i(mSampleCount, Tile::SIZE >> 1, Tile::SIZE >> 1));
+			const int tileCount = tileDim.x * tileDim.y;
+			mTiledColorBuffer.Init(tileCount, QUADS_PER_TILE * mSampleCount);
+			if (mSampleCount > 1)
+			{
+				mResolvedColor.Init(tileCount, QUADS_PER_TILE);
+				mCompressedLanes.Init(tileCount, QUADS_PER_TILE);
+			}
+			mpBackBuffer = (_byte*)_mm_malloc(iWidth * iHeight * sizeof(uint), 64);
+			mpFrontBuffer = mpBackBuffer;
+			if (mDoubleBuffered)
+			{
+				mpFrontBuffer = (_byte*)_mm_malloc(iWidth * iHeight * sizeof(uint), 64);
+				memset(mpFrontBuffer, 0, iWidth * iHeight * sizeof(uint));
+			}
+
+			mTiledDepthBuffer.Init(tileCount, QUADS_PER_TILE * mSampleCount);
+			mHiZBuffer.Init(tileCount, 1);
+			mZRejectCounts.Resize(tileCount * HiZTile::BLOCK_COUNT);
 		}
 
 		void FrameBuffer::Resize(uint iWidth, uint iHeight, const Vector2i& tileDim, uint sampleCountLog2)
 		{
-			mColorBuffer.Free();
-			mColorBufferMS.Free();
+			FreeBackBuffers();
+			mTiledColorBuffer.Clear();
+			mResolvedColor.Clear();
+			mCompressedLanes.Clear();
 			mTiledDepthBuffer.Clear();
+			mHiZBuffer.Clear();
+			mZRejectCounts.Clear();
 
 			Init(iWidth, iHeight, tileDim, sampleCountLog2);
 		}
 
-		void FrameBuffer::SetPixel(const Color4b& c, const int x, const int y, const uint sId)
+		FrameBuffer::~FrameBuffer()
 		{
-			mColorBufferMS[Vector3i(sId, x, mResY - 1 - y)] = c;
+			FreeBackBuffers();
+		}
+
+		void FrameBuffer::SetDoubleBuffered(const bool doubleBuffered)
+		{
+			if (doubleBuffered == mDoubleBuffered)
+				return;
+
+			mDoubleBuffered = doubleBuffered;
+			if (!mpBackBuffer)
+				return;
+
+			if (mDoubleBuffered)
+			{
+				// The completed frame moves to the front, the back buffer gets the next one
+				mpFrontBuffer = (_byte*)_mm_malloc(mResX * mResY * sizeof(uint), 64);
+				memcpy(mpFrontBuffer, mpBackBuffer, mResX * mResY * sizeof(uint));
+			}
+			else
+			{
+				memcpy(mpBackBuffer, mpFrontBuffer, mResX * mResY * sizeof(uint));
+				_mm_free(mpFrontBuffer);
+				mpFrontBuffer = mpBackBuffer;
+			}
+		}
+
+		void FrameBuffer::FreeBackBuffers()
+		{
+			if (mpFrontBuffer != mpBackBuffer)
+				_mm_free(mpFrontBuffer);
+			_mm_free(mpBackBuffer);
+			mpBackBuffer = nullptr;
+			mpFrontBuffer = nullptr;
 		}
 
 		bool FrameBuffer::ZTest(const float d, const int x, const int y, const uint sId)
@@ -55,53 +102,234 @@ namespace EDX
 		{
 			const int tileX = x >> Tile::SIZE_LOG_2;
 			const int tileY = y >> Tile::SIZE_LOG_2;
-			DimensionalArray<3, FloatSSE>& currTileDepths = mTiledDepthBuffer[tileY * mTileDimX + tileX];
 
 			const int intraTileX = x & (Tile::SIZE - 1);
 			const int intraTileY = y & (Tile::SIZE - 1);
-			FloatSSE& currDepth = currTileDepths[Vector3i(sId, intraTileX >> 1, (Tile::SIZE - 1 - intraTileY) >> 1)];
+			FloatSSE& currDepth = mTiledDepthBuffer[DepthIndex(tileY * mTileDimX + tileX, sId, intraTileX >> 1, (Tile::SIZE - 1 - intraTileY) >> 1)];
 
 			BoolSSE ret = d <= currDepth;
-			currDepth = SSE::Select(ret & mask, d, currDepth);
+			BoolSSE write = ret & mask;
+			currDepth = SSE::Select(write, d, currDepth);
+
+			const int blockIdx = (intraTileY >> HiZTile::BLOCK_SIZE_LOG_2) * HiZTile::BLOCK_DIM + (intraTileX >> HiZTile::BLOCK_SIZE_LOG_2);
+			if (SSE::Any(write))
+				mHiZBuffer[tileY * mTileDimX + tileX].blockDirty[blockIdx] = true;
+
+			if (mCountZRejects)
+			{
+				const int rejected = _mm_movemask_ps(mask.m128) & ~_mm_movemask_ps(ret.m128);
+				mZRejectCounts[(tileY * mTileDimX + tileX) * HiZTile::BLOCK_COUNT + blockIdx] += (rejected & 1) + ((rejected >> 1) & 1) + ((rejected >> 2) & 1) + (rejected >> 3);
+			}
 
 			return ret;
 		}
 
-		void FrameBuffer::Resolve()
+		void FrameBuffer::RefreshHiZBlock(const int tileIdx, const int blockIdx)
+		{
+			HiZTile& hiZ = mHiZBuffer[tileIdx];
+
+			// Depth tiles store quads with y flipped
+			const int QuadsPerBlock = HiZTile::BLOCK_SIZE >> 1;
+			const int quadMinX = (blockIdx % HiZTile::BLOCK_DIM) * QuadsPerBlock;
+			const int quadMinY = (Tile::SIZE >> 1) - (blockIdx / HiZTile::BLOCK_DIM + 1) * QuadsPerBlock;
+
+			FloatSSE maxDepth = FloatSSE(Math::EDX_ZERO);
+			for (uint s = 0; s < mSampleCount; s++)
+			{
+				for (auto y = quadMinY; y < quadMinY + QuadsPerBlock; y++)
+				{
+					for (auto x = quadMinX; x < quadMinX + QuadsPerBlock; x++)
+					{
+						const FloatSSE& depth = mTiledDepthBuffer[DepthIndex(tileIdx, s, x, y)];
+						maxDepth = SSE::Select(depth > maxDepth, depth, maxDepth);
+					}
+				}
+			}
+
+			hiZ.blockMaxZ[blockIdx] = Math::Max(Math::Max(maxDepth[0], maxDepth[1]), Math::Max(maxDepth[2], maxDepth[3]));
+			hiZ.blockDirty[blockIdx] = false;
+		}
+
+		bool FrameBuffer::HiZRejectBlock(const float minZ, const Vector2i& blockMin, const Vector2i& blockMax)
+		{
+			if (blockMin.x >= blockMax.x || blockMin.y >= blockMax.y)
+				return true;
+
+			// Region must lie within a single tile
+			const int tileIdx = (blockMin.y >> Tile::SIZE_LOG_2) * mTileDimX + (blockMin.x >> Tile::SIZE_LOG_2);
+			HiZTile& hiZ = mHiZBuffer[tileIdx];
+			const int minBX = (blockMin.x & (Tile::SIZE - 1)) >> HiZTile::BLOCK_SIZE_LOG_2;
+			const int maxBX = ((blockMax.x - 1) & (Tile::SIZE - 1)) >> HiZTile::BLOCK_SIZE_LOG_2;
+			const int minBY = (blockMin.y & (Tile::SIZE - 1)) >> HiZTile::BLOCK_SIZE_LOG_2;
+			const int maxBY = ((blockMax.y - 1) & (Tile::SIZE - 1)) >> HiZTile::BLOCK_SIZE_LOG_2;
+
+			for (auto by = minBY; by <= maxBY; by++)
+			{
+				for (auto bx = minBX; bx <= maxBX; bx++)
+				{
+					const int blockIdx = by * HiZTile::BLOCK_DIM + bx;
+					if (minZ <= hiZ.blockMaxZ[blockIdx])
+					{
+						if (!hiZ.blockDirty[blockIdx])
+							return false;
+
+						RefreshHiZBlock(tileIdx, blockIdx);
+						if (minZ <= hiZ.blockMaxZ[blockIdx])
+							return false;
+					}
+				}
+			}
+
+			return true;
+		}
+
+		void FrameBuffer::ResolveBlock(const Vector2i& blockMin, const Vector2i& blockMax)
 		{
 			if (mSampleCount == 1)
 				return;
 
-			const float invSampleCount = 1.0f / float(mSampleCount);
-			parallel_for(0, (int)mColorBuffer.LinearSize(), [&](int i)
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i round = _mm_set1_epi16(short(mSampleCount >> 1));
+			const __m128i shift = _mm_cvtsi32_si128(mMultiSampleLevel);
+
+			// Channels are summed as 16 bit integers, at 32x the worst case of 32 * 255 plus the rounding term of 16
+			// is 8176, well inside 16 bits
+			for (auto y = blockMin.y & ~1; y < blockMax.y; y += 2)
 			{
-				const Vector2i idx = mColorBuffer.Index(i);
-				Color c = 0;
-				for (auto s = 0; s < mSampleCount; s++)
+				for (auto x = blockMin.x & ~1; x < blockMax.x; x += 2)
 				{
-					c += Color(mColorBufferMS[Vector3i(s, idx.x, idx.y)]);
+					const int colorIdx = ColorIndex(x, y);
+					const int quadIdx = colorIdx >> mMultiSampleLevel;
+					const IntSSE* pSamples = &mTiledColorBuffer[colorIdx];
+
+					// Interior quads are a copy, edge quads average and keep sample 0 where compressed
+					const int compressed = mCompressedLanes[quadIdx];
+					if (compressed == 0xF)
+					{
+						mResolvedColor[quadIdx] = pSamples[0];
+						continue;
+					}
+
+					__m128i lo = zero, hi = zero;
+					for (uint s = 0; s < mSampleCount; s++)
+					{
+						lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(pSamples[s].m128, zero));
+						hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(pSamples[s].m128, zero));
+					}
+					lo = _mm_srl_epi16(_mm_add_epi16(lo, round), shift);
+					hi = _mm_srl_epi16(_mm_add_epi16(hi, round), shift);
+
+					mResolvedColor[quadIdx] = _mm_packus_epi16(lo, hi);
+					if (compressed)
+						WriteLanes(mResolvedColor[quadIdx], pSamples[0], compressed);
 				}
-				c *= invSampleCount;
-				mColorBuffer[i] = Color4b(c);
+			}
+		}
+
+		void FrameBuffer::Resolve(const bool* pDirtyTiles)
+		{
+			const IntSSE* pQuads = mSampleCount == 1 ? mTiledColorBuffer.Data() : mResolvedColor.Data();
+
+			// Every output row takes the upper or lower half of a row of quads, two quads make four
+			// consecutive pixels. The back buffer is not read again this frame so it is streamed.
+			ParallelFor(0, (int)mTileDimY, [&](int tileY)
+			{
+				const int maxY = Math::Min((tileY + 1) << Tile::SIZE_LOG_2, int(mResY));
+				for (auto y = tileY << Tile::SIZE_LOG_2; y < maxY; y++)
+				{
+					uint* pRow = (uint*)mpBackBuffer + (mResY - 1 - y) * mResX;
+					const bool aligned = (size_t(pRow) & 15) == 0;
+					const bool lowerHalf = (y & 1) != 0;
+
+					for (uint tileX = 0; tileX < mTileDimX; tileX++)
+					{
+						if (pDirtyTiles && !pDirtyTiles[tileY * mTileDimX + tileX])
+							continue;
+
+						const IntSSE* pQuadRow = pQuads + (tileY * mTileDimX + tileX) * QUADS_PER_TILE + ((y & (Tile::SIZE - 1)) >> 1) * QUAD_DIM;
+						for (auto q = 0; q < QUAD_DIM; q += 2)
+						{
+							const uint x = (tileX << Tile::SIZE_LOG_2) + (q << 1);
+							if (x >= mResX)
+								break;
+
+							const __m128i pixels = lowerHalf ?
+								_mm_unpackhi_epi64(pQuadRow[q].m128, pQuadRow[q + 1].m128) :
+								_mm_unpacklo_epi64(pQuadRow[q].m128, pQuadRow[q + 1].m128);
+
+							if (aligned && x + 4 <= mResX)
+								_mm_stream_si128((__m128i*)(pRow + x), pixels);
+							else
+							{
+								uint tail[4];
+								_mm_storeu_si128((__m128i*)tail, pixels);
+								for (uint i = 0; i < 4 && x + i < mResX; i++)
+									pRow[x + i] = tail[i];
+							}
+						}
+					}
+				}
+
+				_mm_sfence();
 			});
 		}
 
+		uint64 FrameBuffer::GetZRejectedLaneCount() const
+		{
+			uint64 count = 0;
+			for (auto& it : mZRejectCounts)
+				count += it;
+
+			return count;
+		}
+
+		void FrameBuffer::ResetZRejectCounts()
+		{
+			for (auto& it : mZRejectCounts)
+				it = 0;
+		}
+
 		void FrameBuffer::Clear(const bool clearColor, const bool clearDepth)
+		{
+			int tileCount = mTileDimX * mTileDimY;
+			ParallelFor(0, tileCount, [&](int i)
+			{
+				ClearTile(i, clearColor, clearDepth);
+			});
+			ResetZRejectCounts();
+		}
+
+		void FrameBuffer::ClearTile(const int tileIdx, const bool clearColor, const bool clearDepth)
 		{
 			if (clearColor)
 			{
-				mColorBuffer.Clear();
-				mColorBufferMS.Clear();
+				if (mSampleCount == 1)
+					memset((void*)&mTiledColorBuffer[tileIdx * QUADS_PER_TILE], 0, QUADS_PER_TILE * sizeof(IntSSE));
+				else
+				{
+					// A cleared tile is fully compressed, only sample 0 needs to be written
+					IntSSE* pQuads = &mTiledColorBuffer[tileIdx * QUADS_PER_TILE * mSampleCount];
+					for (auto q = 0; q < QUADS_PER_TILE; q++)
+						pQuads[q * mSampleCount] = _mm_setzero_si128();
+
+					memset((void*)&mResolvedColor[tileIdx * QUADS_PER_TILE], 0, QUADS_PER_TILE * sizeof(IntSSE));
+					memset(&mCompressedLanes[tileIdx * QUADS_PER_TILE], 0xF, QUADS_PER_TILE);
+				}
 			}
 
-			int tileCount = mTileDimX * mTileDimY;
-			parallel_for(0, tileCount, [&](int i)
+			if (clearDepth)
 			{
-				DimensionalArray<3, FloatSSE>& currTileDepths = mTiledDepthBuffer[i];
+				FloatSSE* pDepths = &mTiledDepthBuffer[DepthIndex(tileIdx, 0, 0, 0)];
+				for (uint j = 0; j < QUADS_PER_TILE * mSampleCount; j++)
+					pDepths[j] = 1.0f;
 
-				for (auto j = 0; j < currTileDepths.LinearSize(); j++)
-					currTileDepths[j] = 1.0f;
-			});
+				HiZTile& hiZ = mHiZBuffer[tileIdx];
+				for (auto j = 0; j < HiZTile::BLOCK_COUNT; j++)
+				{
+					hiZ.blockMaxZ[j] = 1.0f;
+					hiZ.blockDirty[j] = false;
+				}
+			}
 		}
 
 		const int FrameBuffer::MultiSampleOffsets[][64] =
@@ -1,40 +1,135 @@
 #pragma once
 
 #include "Containers/Array.h"
-#include "Containers/DimensionalArray.h"
 #include "Graphics/Color.h"
 #include "SIMD/SSE.h"
+#include "Tile.h"
+#include "TaskSystem.h"
+
+#include <utility>
 
 namespace EDX
 {
 	namespace RasterRenderer
 	{
-		typedef DimensionalArray<2, Color4b> Array2C;
-		typedef DimensionalArray<3, Color4b> Array3C;
+		// Conservative max depth per 8x8 block of a tile. Depth only decreases between clears, so a stale
+		// max is always safe to test against; dirty blocks are just recomputed lazily to tighten it.
+		struct HiZTile
+		{
+			static const int BLOCK_SIZE_LOG_2 = 3;
+			static const int BLOCK_SIZE = 1 << BLOCK_SIZE_LOG_2;
+			static const int BLOCK_DIM = Tile::SIZE >> BLOCK_SIZE_LOG_2;
+			static const int BLOCK_COUNT = BLOCK_DIM * BLOCK_DIM;
+
+			float blockMaxZ[BLOCK_COUNT];
+			bool blockDirty[BLOCK_COUNT]; // Bytes rather than bits so threads owning different blocks never share a word
+		};
 
 		class FrameBuffer
 		{
+		public:
+			static const int QUAD_DIM = Tile::SIZE >> 1;
+			static const int QUADS_PER_TILE = QUAD_DIM * QUAD_DIM;
+
 		private:
-			Array3C mColorBufferMS;
-			Array2C mColorBuffer;
-			Array<DimensionalArray<3, FloatSSE>> mTiledDepthBuffer;
+			// Color is kept per tile as packed RGBA8 quads in the lane order of the shading results,
+			// all samples of a quad adjacent. Multisampled tiles are resolved into mResolvedColor
+			// as soon as they are written, Resolve then only converts the tiles to the linear back buffer.
+			// Per tile storage lives on the node owning the tile, see TaskSystem::GetItemNode.
+			NodeArray<IntSSE> mTiledColorBuffer;
+			NodeArray<IntSSE> mResolvedColor;
+			// MSAA only, per quad the lanes whose samples all hold the color of sample 0. Only sample 0
+			// of those is stored and the resolve copies it, so only edge pixels cost per sample work.
+			NodeArray<_byte> mCompressedLanes;
+			_byte* mpBackBuffer; // Rows bottom up, written by Resolve
+			_byte* mpFrontBuffer; // Last completed frame, the back buffer itself unless double buffered
+			bool mDoubleBuffered;
+			NodeArray<FloatSSE> mTiledDepthBuffer; // Per tile and sample, quads with y flipped
+			NodeArray<HiZTile> mHiZBuffer;
 			uint mTileDimX, mTileDimY;
 			uint mResX, mResY;
 
 			uint mSampleCount;
 			uint mMultiSampleLevel;
 
+			// Profiling only, one counter per Hi-Z block so sub tile jobs never share one
+			Array<uint> mZRejectCounts;
+			bool mCountZRejects;
+
 		public:
 			static const int MultiSampleOffsets[][64];
 
 		public:
+			FrameBuffer()
+				: mpBackBuffer(nullptr), mpFrontBuffer(nullptr), mDoubleBuffered(false), mCountZRejects(false)
+			{
+			}
+			~FrameBuffer();
+
 			void Init(uint iWidth, uint iHeight, const Vector2i& tileDim, uint sampleCountLog2 = 0);
 			void Resize(uint iWidth, uint iHeight, const Vector2i& tileDim, uint sampleCountLog2 = 0);
 
-			void SetPixel(const Color4b& c, const int x, const int y, const uint sId);
+			// Writes the lanes of laneMask of the quad at (x, y) in one store, single sampled buffers only
+			__forceinline void WriteQuad(const IntSSE& colors, const int x, const int y, const int laneMask)
+			{
+				Assert(mSampleCount == 1);
+				WriteLanes(mTiledColorBuffer[ColorIndex(x, y)], colors, laneMask);
+			}
+			// Writes a multisampled quad, pLaneMasks holds the covered lanes of each sample. Lanes covered at
+			// every sample are stored compressed, a partial write expands its lanes to all samples first.
+			__forceinline void WriteQuadSamples(const IntSSE& colors, const int x, const int y, const int* pLaneMasks)
+			{
+				const int colorIdx = ColorIndex(x, y);
+				IntSSE* pSamples = &mTiledColorBuffer[colorIdx];
+				_byte& compressed = mCompressedLanes[colorIdx >> mMultiSampleLevel];
+
+				int fullMask = 0xF, anyMask = 0;
+				for (uint s = 0; s < mSampleCount; s++)
+				{
+					fullMask &= pLaneMasks[s];
+					anyMask |= pLaneMasks[s];
+				}
+
+				const int partialMask = anyMask & ~fullMask;
+				if (partialMask)
+				{
+					const int expandMask = partialMask & compressed;
+					if (expandMask)
+					{
+						for (uint s = 1; s < mSampleCount; s++)
+							WriteLanes(pSamples[s], pSamples[0], expandMask);
+					}
+
+					for (uint s = 0; s < mSampleCount; s++)
+					{
+						const int sampleMask = pLaneMasks[s] & partialMask;
+						if (sampleMask)
+							WriteLanes(pSamples[s], colors, sampleMask);
+					}
+				}
+
+				if (fullMask)
+					WriteLanes(pSamples[0], colors, fullMask);
+
+				compressed = (compressed | fullMask) & ~partialMask;
+			}
 			bool ZTest(const float d, const int x, const int y, const uint sId);
 			BoolSSE ZTestQuad(const FloatSSE& d, const int x, const int y, const uint sId, const BoolSSE& mask);
-			void Resolve();
+
+			// MSAA resolve of a block inside one tile, must run after the last write to the block
+			void ResolveBlock(const Vector2i& blockMin, const Vector2i& blockMax);
+			// Streams the tiles into the linear back buffer, only those flagged in pDirtyTiles if given
+			void Resolve(const bool* pDirtyTiles = nullptr);
+
+			// Hi-Z query, true if a primitive with depth no smaller than minZ is occluded in the region
+			bool HiZRejectBlock(const float minZ, const Vector2i& blockMin, const Vector2i& blockMax);
+
+			void SetCountZRejects(const bool count)
+			{
+				mCountZRejects = count;
+			}
+			uint64 GetZRejectedLaneCount() const;
+			void ResetZRejectCounts();
 
 			uint GetSampleCount() const
 			{
@@ -54,10 +149,50 @@ namespace EDX
 			}
 			const _byte* GetColorBuffer() const
 			{
-				return mSampleCount == 1 ? (_byte*)mColorBufferMS.Data() : (_byte*)mColorBuffer.Data();
+				return mpFrontBuffer;
+			}
+
+			// With two buffers the next frame resolves while the last completed one is still read.
+			// Resolve then writes whole frames only, dirty tiles would miss the frame in between.
+			void SetDoubleBuffered(const bool doubleBuffered);
+			void SwapBuffers()
+			{
+				if (mDoubleBuffered)
+					std::swap(mpBackBuffer, mpFrontBuffer);
 			}
 
 			void Clear(const bool clearColor = true, const bool clearDepth = true);
+			void ClearTile(const int tileIdx, const bool clearColor = true, const bool clearDepth = true);
+
+		private:
+			void FreeBackBuffers();
+			void RefreshHiZBlock(const int tileIdx, const int blockIdx);
+
+			static __forceinline void WriteLanes(IntSSE& dest, const IntSSE& src, const int laneMask)
+			{
+				if (laneMask == 0xF)
+				{
+					dest = src;
+					return;
+				}
+
+				const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+				const __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(laneMask), laneBits), laneBits);
+				dest = _mm_or_si128(_mm_and_si128(mask, src.m128), _mm_andnot_si128(mask, dest.m128));
+			}
+
+			// Index of sample 0 of the quad containing pixel (x, y)
+			__forceinline int ColorIndex(const int x, const int y) const
+			{
+				const int tileIdx = (y >> Tile::SIZE_LOG_2) * mTileDimX + (x >> Tile::SIZE_LOG_2);
+				const int quadIdx = ((y & (Tile::SIZE - 1)) >> 1) * QUAD_DIM + ((x & (Tile::SIZE - 1)) >> 1);
+
+				return (tileIdx * QUADS_PER_TILE + quadIdx) * mSampleCount;
+			}
+			__forceinline int DepthIndex(const int tileIdx, const uint sId, const int quadX, const int quadY) const
+			{
+				return (tileIdx * mSampleCount + sId) * QUADS_PER_TILE + quadY * QUAD_DIM + quadX;
+			}
 		};
 	}
 }
\ No newline at end of file
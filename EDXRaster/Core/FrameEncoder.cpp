@@ -0,0 +1,593 @@
+#include "FrameEncoder.h"
+#include "../Utils/ImageIO.h"
+
+#include <chrono>
+#include <cstdio>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace
+		{
+			// Max payload of one stored deflate block
+			const uint STORED_BLOCK_SIZE = 65535;
+			const uint MAX_FILE_PATH = 260;
+
+			uint Crc32(const _byte* pData, const size_t size, uint crc)
+			{
+				struct Table
+				{
+					uint entries[256];
+				};
+
+				// Built once by the first caller, encoder threads wait on the static's initialization
+				static const Table table = []
+				{
+					Table built;
+					for (uint i = 0; i < 256; i++)
+					{
+						uint c = i;
+						for (auto k = 0; k < 8; k++)
+							c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+						built.entries[i] = c;
+					}
+					return built;
+				}();
+
+				crc = ~crc;
+				for (size_t i = 0; i < size; i++)
+					crc = table.entries[(crc ^ pData[i]) & 0xFF] ^ (crc >> 8);
+
+				return ~crc;
+			}
+
+			uint Adler32(const _byte* pData, const size_t size, uint adler)
+			{
+				// 5552 bytes is the longest run whose sums cannot overflow before the modulo
+				uint a = adler & 0xFFFF;
+				uint b = adler >> 16;
+				for (size_t first = 0; first < size; first += 5552)
+				{
+					const size_t last = Math::Min(first + 5552, size);
+					for (auto i = first; i < last; i++)
+					{
+						a += pData[i];
+						b += a;
+					}
+					a %= 65521;
+					b %= 65521;
+				}
+
+				return (b << 16) | a;
+			}
+
+			void StoreBigEndian(_byte* pDest, const uint value)
+			{
+				pDest[0] = _byte(value >> 24);
+				pDest[1] = _byte(value >> 16);
+				pDest[2] = _byte(value >> 8);
+				pDest[3] = _byte(value);
+			}
+
+			void WriteChunk(std::ofstream& file, const char* type, const _byte* pData, const uint size)
+			{
+				_byte header[8];
+				StoreBigEndian(header, size);
+				memcpy(header + 4, type, 4);
+
+				_byte footer[4];
+				StoreBigEndian(footer, Crc32(pData, size, Crc32(header + 4, 4, 0)));
+
+				file.write((const char*)header, 8);
+				file.write((const char*)pData, size);
+				file.write((const char*)footer, 4);
+			}
+		}
+
+		// Child process reading its standard input from a pipe. It is started without a shell, so arguments
+		// such as the output path reach the program verbatim.
+		class FrameEncoder::PipeProcess
+		{
+		private:
+#if defined(_WIN32)
+			HANDLE mInput;
+			HANDLE mProcess;
+
+			// Quotes an argument so the child's command line parser splits it back out unchanged
+			static void AppendArgument(string& commandLine, const string& arg)
+			{
+				if (!commandLine.empty())
+					commandLine += ' ';
+
+				commandLine += '"';
+				size_t backslashes = 0;
+				for (auto c : arg)
+				{
+					if (c == '\\')
+					{
+						backslashes++;
+						continue;
+					}
+
+					// Backslashes are only special in front of a quote
+					commandLine.append(c == '"' ? 2 * backslashes + 1 : backslashes, '\\');
+					commandLine += c;
+					backslashes = 0;
+				}
+				commandLine.append(2 * backslashes, '\\');
+				commandLine += '"';
+			}
+#else
+			int mInput;
+			pid_t mPid;
+#endif
+
+		public:
+			PipeProcess()
+#if defined(_WIN32)
+				: mInput(nullptr), mProcess(nullptr)
+#else
+				: mInput(-1), mPid(-1)
+#endif
+			{
+			}
+			~PipeProcess()
+			{
+				Close();
+			}
+
+			// args[0] is the program, searched for in PATH
+			bool Start(const Array<string>& args)
+			{
+#if defined(_WIN32)
+				string commandLine;
+				for (auto& it : args)
+					AppendArgument(commandLine, it);
+
+				// Only the read end is inherited, the child sees end of file once the write end is closed
+				SECURITY_ATTRIBUTES security = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+				HANDLE read, write;
+				if (!CreatePipe(&read, &write, &security, 0))
+					return false;
+				SetHandleInformation(write, HANDLE_FLAG_INHERIT, 0);
+
+				STARTUPINFOA startup;
+				memset(&startup, 0, sizeof(startup));
+				startup.cb = sizeof(startup);
+				startup.dwFlags = STARTF_USESTDHANDLES;
+				startup.hStdInput = read;
+				startup.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+				startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+				PROCESS_INFORMATION process;
+				const BOOL started = CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &process);
+				CloseHandle(read);
+				if (!started)
+				{
+					CloseHandle(write);
+					return false;
+				}
+
+				CloseHandle(process.hThread);
+				mProcess = process.hProcess;
+				mInput = write;
+#else
+				Array<char*> argv;
+				for (auto& it : args)
+					argv.Add(const_cast<char*>(it.c_str()));
+				argv.Add(nullptr);
+
+				// The write end stays in this process only, so the child sees end of file once it is closed
+				int fds[2];
+				if (pipe(fds) != 0)
+					return false;
+				fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+				posix_spawn_file_actions_t actions;
+				posix_spawn_file_actions_init(&actions);
+				posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+				posix_spawn_file_actions_addclose(&actions, fds[0]);
+
+				const int result = posix_spawnp(&mPid, argv[0], &actions, nullptr, argv.Data(), environ);
+				posix_spawn_file_actions_destroy(&actions);
+				close(fds[0]);
+				if (result != 0)
+				{
+					close(fds[1]);
+					mPid = -1;
+					return false;
+				}
+
+				mInput = fds[1];
+#endif
+				return true;
+			}
+
+			// False once the child is gone, the caller's thread must have SIGPIPE blocked
+			bool Write(const _byte* pData, size_t size)
+			{
+				while (size > 0)
+				{
+#if defined(_WIN32)
+					DWORD written = 0;
+					if (!mInput || !WriteFile(mInput, pData, DWORD(Math::Min(size, size_t(1) << 30)), &written, nullptr))
+						return false;
+#else
+					if (mInput < 0)
+						return false;
+
+					const ssize_t written = write(mInput, pData, size);
+					if (written < 0)
+					{
+						if (errno == EINTR)
+							continue;
+
+						// EPIPE when the child exited early
+						return false;
+					}
+#endif
+					pData += written;
+					size -= size_t(written);
+				}
+
+				return true;
+			}
+
+			// Closes the input and waits for the child, true if it ran and exited with status 0
+			bool Close()
+			{
+#if defined(_WIN32)
+				if (!mProcess)
+					return false;
+
+				CloseHandle(mInput);
+				WaitForSingleObject(mProcess, INFINITE);
+				DWORD exitCode = 1;
+				GetExitCodeProcess(mProcess, &exitCode);
+				CloseHandle(mProcess);
+				mInput = nullptr;
+				mProcess = nullptr;
+
+				return exitCode == 0;
+#else
+				if (mPid < 0)
+					return false;
+
+				close(mInput);
+				int status = 0;
+				pid_t waited;
+				do
+				{
+					waited = waitpid(mPid, &status, 0);
+				} while (waited < 0 && errno == EINTR);
+				mInput = -1;
+				mPid = -1;
+
+				return waited >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+			}
+		};
+
+		FrameEncoder::FrameEncoder()
+			: mHead(0)
+			, mCount(0)
+			, mOpen(false)
+			, mStop(false)
+			, mpPipe(MakeUnique<PipeProcess>())
+			, mPipeStarted(false)
+			, mStreamWidth(0)
+			, mStreamHeight(0)
+		{
+			memset(&mStats, 0, sizeof(mStats));
+		}
+
+		FrameEncoder::~FrameEncoder()
+		{
+			Close();
+		}
+
+		bool FrameEncoder::Open(const FrameOutputSettings& settings)
+		{
+			Close();
+
+			mSettings = settings;
+			if (mSettings.format == FrameFormat::RawVideo)
+			{
+				mRawFile.open(mSettings.path, std::ios::binary);
+				if (!mRawFile)
+					return false;
+			}
+
+			mSlots.Resize(Math::Max(mSettings.ringSize, 1u));
+			for (auto& it : mSlots)
+			{
+				it.pPixels = nullptr;
+				it.capacity = 0;
+			}
+			mHead = 0;
+			mCount = 0;
+			mStreamWidth = 0;
+			mStreamHeight = 0;
+			memset(&mStats, 0, sizeof(mStats));
+
+			mStop = false;
+			mOpen = true;
+			mWriter = std::thread([this]()
+			{
+				WriterLoop();
+			});
+
+			return true;
+		}
+
+		void FrameEncoder::Close()
+		{
+			if (!mOpen)
+				return;
+
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStop = true;
+			}
+			mFrameQueued.notify_one();
+			mWriter.join();
+
+			// Frames are only complete once the encoder exited cleanly or the file is flushed
+			bool closed = true;
+			if (mPipeStarted)
+			{
+				closed = mpPipe->Close();
+				mPipeStarted = false;
+			}
+			if (mRawFile.is_open())
+			{
+				mRawFile.close();
+				closed = bool(mRawFile);
+			}
+			if (!closed)
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				mStats.writeErrors++;
+			}
+
+			for (auto& it : mSlots)
+				_mm_free(it.pPixels);
+			mSlots.Clear();
+			mOpen = false;
+		}
+
+		void FrameEncoder::Submit(const _byte* pPixels, const uint width, const uint height, const int frameId)
+		{
+			Assert(mOpen);
+
+			std::unique_lock<std::mutex> lock(mMutex);
+			mStats.framesSubmitted++;
+			if (mCount == uint(mSlots.Size()))
+			{
+				if (mSettings.dropWhenFull)
+				{
+					mStats.framesDropped++;
+					return;
+				}
+
+				const auto start = std::chrono::high_resolution_clock::now();
+				mSlotFreed.wait(lock, [this]() { return mCount < uint(mSlots.Size()); });
+				mStats.stalls++;
+				mStats.stallTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			}
+
+			// The writer does not see the slot before mCount covers it, so it is filled unlocked
+			FrameSlot& slot = mSlots[(mHead + mCount) % mSlots.Size()];
+			lock.unlock();
+
+			const size_t size = size_t(width) * height * sizeof(uint);
+			if (slot.capacity < size)
+			{
+				_mm_free(slot.pPixels);
+				slot.pPixels = (_byte*)_mm_malloc(size, 64);
+				slot.capacity = size;
+			}
+			memcpy(slot.pPixels, pPixels, size);
+			slot.width = width;
+			slot.height = height;
+			slot.frameId = frameId;
+
+			lock.lock();
+			mCount++;
+			mStats.maxQueueDepth = Math::Max(mStats.maxQueueDepth, mCount);
+			lock.unlock();
+			mFrameQueued.notify_one();
+		}
+
+		FrameOutputStats FrameEncoder::GetStats() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return mStats;
+		}
+
+		void FrameEncoder::WriterLoop()
+		{
+#if !defined(_WIN32)
+			// A pipe whose encoder exited must fail the write with EPIPE instead of killing the process
+			sigset_t pipeSignal;
+			sigemptyset(&pipeSignal);
+			sigaddset(&pipeSignal, SIGPIPE);
+			pthread_sigmask(SIG_BLOCK, &pipeSignal, nullptr);
+#endif
+
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (true)
+			{
+				mFrameQueued.wait(lock, [this]() { return mCount > 0 || mStop; });
+
+				// Close drains the ring before the thread exits
+				if (mCount == 0)
+					break;
+
+				const FrameSlot& slot = mSlots[mHead];
+				lock.unlock();
+				const bool written = WriteFrame(slot);
+				lock.lock();
+
+				mHead = (mHead + 1) % mSlots.Size();
+				mCount--;
+				if (written)
+					mStats.framesWritten++;
+				else
+					mStats.writeErrors++;
+				mSlotFreed.notify_one();
+			}
+		}
+
+		bool FrameEncoder::WriteFrame(const FrameSlot& slot)
+		{
+			char fileName[MAX_FILE_PATH];
+			switch (mSettings.format)
+			{
+			case FrameFormat::Bitmap:
+				snprintf(fileName, MAX_FILE_PATH, "%s/Frame%05i.bmp", mSettings.path.c_str(), slot.frameId);
+				return ImageIO::WriteBMP(fileName, slot.pPixels, slot.width, slot.height);
+
+			case FrameFormat::PNG:
+				snprintf(fileName, MAX_FILE_PATH, "%s/Frame%05i.png", mSettings.path.c_str(), slot.frameId);
+				return WritePNG(fileName, slot);
+
+			default:
+				return WriteStream(slot);
+			}
+		}
+
+		bool FrameEncoder::WriteStream(const FrameSlot& slot)
+		{
+			// A video stream has one resolution, set by its first frame
+			if (mStreamWidth == 0)
+			{
+				mStreamWidth = slot.width;
+				mStreamHeight = slot.height;
+
+				if (mSettings.format == FrameFormat::FFmpegPipe)
+				{
+					Array<string> args;
+					for (auto it : { "ffmpeg", "-loglevel", "error", "-y", "-f", "rawvideo", "-pix_fmt", "rgba", "-s" })
+						args.Add(it);
+					args.Add(std::to_string(mStreamWidth) + "x" + std::to_string(mStreamHeight));
+					args.Add("-r");
+					args.Add(std::to_string(mSettings.frameRate));
+					for (auto it : { "-i", "-", "-pix_fmt", "yuv420p" })
+						args.Add(it);
+					args.Add(mSettings.path);
+					mPipeStarted = mpPipe->Start(args);
+				}
+			}
+
+			if (slot.width != mStreamWidth || slot.height != mStreamHeight)
+				return false;
+
+			// Rows are flipped to top down while writing
+			const size_t rowSize = slot.width * sizeof(uint);
+			for (int y = slot.height - 1; y >= 0; y--)
+			{
+				const _byte* pRow = slot.pPixels + y * rowSize;
+				if (mSettings.format == FrameFormat::FFmpegPipe)
+				{
+					if (!mPipeStarted || !mpPipe->Write(pRow, rowSize))
+						return false;
+				}
+				else
+					mRawFile.write((const char*)pRow, rowSize);
+			}
+
+			return mSettings.format == FrameFormat::FFmpegPipe || bool(mRawFile);
+		}
+
+		bool FrameEncoder::WritePNG(const char* path, const FrameSlot& slot)
+		{
+			std::ofstream file(path, std::ios::binary);
+			if (!file)
+				return false;
+
+			// Top down RGB scanlines, each after a filter type byte of 0
+			const uint scanlineSize = 1 + 3 * slot.width;
+			const uint rawSize = scanlineSize * slot.height;
+			mEncodeBuf.Resize(rawSize);
+			for (uint y = 0; y < slot.height; y++)
+			{
+				const _byte* pSrc = slot.pPixels + (slot.height - 1 - y) * slot.width * sizeof(uint);
+				_byte* pDest = mEncodeBuf.Data() + y * scanlineSize;
+				*pDest++ = 0;
+				for (uint x = 0; x < slot.width; x++)
+				{
+					*pDest++ = pSrc[4 * x + 0];
+					*pDest++ = pSrc[4 * x + 1];
+					*pDest++ = pSrc[4 * x + 2];
+				}
+			}
+
+			static const _byte signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+			file.write((const char*)signature, 8);
+
+			_byte header[13];
+			StoreBigEndian(header, slot.width);
+			StoreBigEndian(header + 4, slot.height);
+			header[8] = 8;	// Bits per channel
+			header[9] = 2;	// RGB
+			header[10] = 0;
+			header[11] = 0;
+			header[12] = 0;
+			WriteChunk(file, "IHDR", header, 13);
+
+			// The zlib stream of stored blocks is written straight from the scanlines, no copy is made
+			const uint blockCount = Math::Max((rawSize + STORED_BLOCK_SIZE - 1) / STORED_BLOCK_SIZE, 1u);
+			const uint zlibSize = 2 + 5 * blockCount + rawSize + 4;
+			_byte chunkHeader[8];
+			StoreBigEndian(chunkHeader, zlibSize);
+			memcpy(chunkHeader + 4, "IDAT", 4);
+			file.write((const char*)chunkHeader, 8);
+
+			uint crc = Crc32(chunkHeader + 4, 4, 0);
+			auto Write = [&](const _byte* pData, const uint size)
+			{
+				file.write((const char*)pData, size);
+				crc = Crc32(pData, size, crc);
+			};
+
+			const _byte zlibHeader[2] = { 0x78, 0x01 };
+			Write(zlibHeader, 2);
+			for (uint offset = 0, b = 0; b < blockCount; b++)
+			{
+				const uint size = Math::Min(rawSize - offset, STORED_BLOCK_SIZE);
+				const _byte blockHeader[5] = { _byte(b + 1 == blockCount ? 1 : 0), _byte(size), _byte(size >> 8), _byte(~size), _byte(~size >> 8) };
+				Write(blockHeader, 5);
+				Write(mEncodeBuf.Data() + offset, size);
+				offset += size;
+			}
+
+			_byte adler[4];
+			StoreBigEndian(adler, Adler32(mEncodeBuf.Data(), rawSize, 1));
+			Write(adler, 4);
+
+			_byte chunkFooter[4];
+			StoreBigEndian(chunkFooter, crc);
+			file.write((const char*)chunkFooter, 4);
+			WriteChunk(file, "IEND", nullptr, 0);
+
+			// Errors of the final flush only show after closing
+			file.close();
+			return bool(file);
+		}
+	}
+}
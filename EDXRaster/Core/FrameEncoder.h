@@ -0,0 +1,103 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		enum class FrameFormat
+		{
+			Bitmap,		// One BMP per frame
+			PNG,		// One PNG per frame, stored deflate blocks so encoding costs about a copy
+			RawVideo,	// All frames appended to one file as top down RGBA8
+			FFmpegPipe	// Raw frames piped into an ffmpeg process that encodes the video
+		};
+
+		struct FrameOutputSettings
+		{
+			FrameFormat format;
+			string path;		// Directory of image sequences, output file otherwise
+			uint ringSize;		// Frames that can be queued before back pressure kicks in
+			bool dropWhenFull;	// Drop frames instead of stalling the renderer when the writer lags
+			uint frameRate;		// FFmpegPipe only
+
+			FrameOutputSettings()
+				: format(FrameFormat::Bitmap), ringSize(8), dropWhenFull(false), frameRate(60)
+			{
+			}
+		};
+
+		struct FrameOutputStats
+		{
+			uint64 framesSubmitted;
+			uint64 framesWritten;
+			uint64 framesDropped;
+			uint64 writeErrors;
+			uint64 stalls;		// Submits that waited for a free slot
+			double stallTime;	// Milliseconds spent waiting in Submit
+			uint maxQueueDepth;
+		};
+
+		// Writes frames on a background thread. Submit copies the frame into a pooled slot of a ring,
+		// so the render thread only pays for the copy unless the writer falls a whole ring behind.
+		// Frames are submitted from one thread only.
+		class FrameEncoder
+		{
+		private:
+			struct FrameSlot
+			{
+				_byte* pPixels;
+				size_t capacity;
+				uint width, height;
+				int frameId;
+			};
+
+			FrameOutputSettings mSettings;
+			Array<FrameSlot> mSlots;
+			uint mHead;		// Oldest queued slot, the one being written
+			uint mCount;	// Queued slots including the one being written
+
+			mutable std::mutex mMutex;
+			std::condition_variable mFrameQueued;
+			std::condition_variable mSlotFreed;
+			std::thread mWriter;
+			bool mOpen;
+			bool mStop;
+
+			// Writer thread only
+			class PipeProcess;
+			std::ofstream mRawFile;
+			UniquePtr<PipeProcess> mpPipe;
+			bool mPipeStarted;
+			uint mStreamWidth, mStreamHeight;
+			Array<_byte> mEncodeBuf;
+
+			FrameOutputStats mStats;
+
+		public:
+			FrameEncoder();
+			~FrameEncoder();
+
+			bool Open(const FrameOutputSettings& settings);
+			// Writes all queued frames, then closes the output
+			void Close();
+			bool IsOpen() const { return mOpen; }
+
+			// Pixels are RGBA8 with rows bottom up, as in the back buffer
+			void Submit(const _byte* pPixels, const uint width, const uint height, const int frameId);
+			FrameOutputStats GetStats() const;
+
+		private:
+			void WriterLoop();
+			bool WriteFrame(const FrameSlot& slot);
+			bool WriteStream(const FrameSlot& slot);
+			bool WritePNG(const char* path, const FrameSlot& slot);
+		};
+	}
+}
@@ -0,0 +1,168 @@
+#include "Profiler.h"
+#include "TaskSystem.h"
+
+#include <fstream>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		const char* RenderStats::GetStageName(const RenderStage stage)
+		{
+			static const char* names[] = {
+				"VertexProcessing",
+				"Clipping",
+				"Binning",
+				"Rasterization",
+				"FragmentProcessing",
+				"UpdateFrameBuffer",
+				"Resolve"
+			};
+
+			return names[int(stage)];
+		}
+
+		const char* RenderStats::GetCounterName(const RenderCounter counter)
+		{
+			static const char* names[] = {
+				"TrianglesIn",
+				"TrianglesCulled",
+				"TrianglesClipped",
+				"TrianglesSetup",
+				"TileRefs",
+				"TrivialAcceptRefs",
+				"CoarseRasterRefs",
+				"FineRasterRefs",
+				"MicroRasterRefs",
+				"FragmentsGenerated",
+				"QuadsShaded",
+				"ZRejectedLanes",
+				"DirtyTiles"
+			};
+
+			return names[int(counter)];
+		}
+
+		Profiler::Profiler()
+			: mEnabled(false)
+			, mEpoch(std::chrono::steady_clock::now())
+			, mFrameStart(0.0)
+		{
+			memset(&mStats.stageTimes, 0, sizeof(mStats.stageTimes));
+			memset(&mStats.counters, 0, sizeof(mStats.counters));
+			mStats.frameTime = 0.0;
+
+			for (auto& it : mCounters)
+				it = 0;
+		}
+
+		void Profiler::BeginFrame()
+		{
+			if (!mEnabled)
+				return;
+
+			// Workers only append to their own buffer, so the buffers are set up before any job runs
+			const int workerCount = TaskSystem::Instance()->GetWorkerCount();
+			while (mWorkerEvents.Size() < workerCount)
+				mWorkerEvents.Add(MakeUnique<EventBuffer>());
+			for (auto& it : mWorkerEvents)
+				it->events.Clear();
+			mExternalEvents.Clear();
+
+			for (auto& it : mCounters)
+				it = 0;
+			for (auto& it : mStats.stageTimes)
+				it = 0.0;
+
+			mFrameStart = Now();
+		}
+
+		void Profiler::EndFrame()
+		{
+			if (!mEnabled)
+				return;
+
+			const double frameEnd = Now();
+			mStats.frameTime = (frameEnd - mFrameStart) * 1e-3;
+			RecordEvent("[Frame]", mFrameStart, frameEnd);
+
+			for (auto i = 0; i < int(RenderCounter::Count); i++)
+				mStats.counters[i] = mCounters[i];
+
+			// Stage events enclose the jobs, so only jobs count as busy time
+			mEvents.Clear();
+			mStats.threadBusyTimes.Clear();
+			mStats.threadBusyTimes.Resize(mWorkerEvents.Size());
+			for (auto w = 0; w < mWorkerEvents.Size(); w++)
+			{
+				double busyTime = 0.0;
+				for (auto& event : mWorkerEvents[w]->events)
+				{
+					if (event.name[0] != '[')
+						busyTime += event.duration * 1e-3;
+					mEvents.Add(event);
+				}
+				mStats.threadBusyTimes[w] = busyTime;
+			}
+			for (auto& event : mExternalEvents)
+				mEvents.Add(event);
+		}
+
+		void Profiler::RecordEvent(const char* name, const double start, const double end)
+		{
+			const int workerId = TaskSystem::CurrentWorker();
+			if (workerId >= 0 && workerId < mWorkerEvents.Size())
+			{
+				Event event = { name, start, end - start, workerId + 1 };
+				mWorkerEvents[workerId]->events.Add(event);
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(mLock);
+			Event event = { name, start, end - start, 0 };
+			mExternalEvents.Add(event);
+		}
+
+		void Profiler::RecordStage(const RenderStage stage, const double start, const double end)
+		{
+			mStats.stageTimes[int(stage)] += (end - start) * 1e-3;
+
+			// Bracketed names mark stage and frame scopes in the trace
+			static const char* traceNames[] = {
+				"[VertexProcessing]",
+				"[Clipping]",
+				"[Binning]",
+				"[Rasterization]",
+				"[FragmentProcessing]",
+				"[UpdateFrameBuffer]",
+				"[Resolve]"
+			};
+			RecordEvent(traceNames[int(stage)], start, end);
+		}
+
+		bool Profiler::WriteChromeTrace(const char* path) const
+		{
+			std::ofstream file(path);
+			if (!file)
+				return false;
+
+			file << "{\"traceEvents\":[\n";
+			for (auto i = 0; i < mEvents.Size(); i++)
+			{
+				const Event& event = mEvents[i];
+				file << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.threadIdx
+					<< ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}"
+					<< (i + 1 < mEvents.Size() ? ",\n" : "\n");
+			}
+			file << "],\"otherData\":{";
+			for (auto i = 0; i < int(RenderCounter::Count); i++)
+			{
+				file << "\"" << RenderStats::GetCounterName(RenderCounter(i)) << "\":" << mStats.counters[i]
+					<< (i + 1 < int(RenderCounter::Count) ? "," : "");
+			}
+			file << "}}\n";
+
+			return file.good();
+		}
+	}
+}
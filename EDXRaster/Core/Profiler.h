@@ -0,0 +1,174 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Core/SmartPointer.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		enum class RenderStage
+		{
+			VertexProcessing,
+			Clipping,
+			Binning,
+			Rasterization,
+			FragmentProcessing,
+			UpdateFrameBuffer,
+			Resolve,
+			Count
+		};
+
+		enum class RenderCounter
+		{
+			TrianglesIn,
+			TrianglesCulled,	// In draws and meshlets rejected before vertex processing
+			TrianglesClipped,	// Sent through polygon clipping
+			TrianglesSetup,		// Reaching binning after clipping and backface culling
+			TileRefs,
+			TrivialAcceptRefs,	// Triangle/tile pairs by raster path
+			CoarseRasterRefs,
+			FineRasterRefs,
+			MicroRasterRefs,
+			FragmentsGenerated,
+			QuadsShaded,
+			ZRejectedLanes,
+			DirtyTiles,			// Tiles redrawn in incremental mode
+			Count
+		};
+
+		struct RenderStats
+		{
+			double frameTime; // All times in milliseconds
+			double stageTimes[int(RenderStage::Count)];
+			uint64 counters[int(RenderCounter::Count)];
+			Array<double> threadBusyTimes; // Time spent in profiled jobs, per task system worker
+
+			double GetStageTime(const RenderStage stage) const
+			{
+				return stageTimes[int(stage)];
+			}
+			uint64 GetCounter(const RenderCounter counter) const
+			{
+				return counters[int(counter)];
+			}
+			double GetThreadIdleTime(const int threadIdx) const
+			{
+				return Math::Max(0.0, frameTime - threadBusyTimes[threadIdx]);
+			}
+
+			static const char* GetStageName(const RenderStage stage);
+			static const char* GetCounterName(const RenderCounter counter);
+		};
+
+		// Frame profiler with per stage wall time, per thread job time and pipeline counters.
+		// Every entry point is a single branch when disabled. Workers record jobs into their own
+		// event buffers without locking, the buffers are merged when the frame ends.
+		class Profiler
+		{
+		private:
+			struct Event
+			{
+				const char* name;
+				double start, duration; // Microseconds since profiler creation
+				int threadIdx; // Worker index + 1, 0 for threads outside the task system
+			};
+
+			struct alignas(64) EventBuffer
+			{
+				Array<Event> events;
+			};
+
+			bool mEnabled;
+			std::chrono::steady_clock::time_point mEpoch;
+			double mFrameStart;
+
+			RenderStats mStats;
+			std::atomic<uint64> mCounters[int(RenderCounter::Count)];
+
+			Array<UniquePtr<EventBuffer>> mWorkerEvents;
+			Array<Event> mExternalEvents; // Recorded outside the task system, guarded by mLock
+			std::mutex mLock;
+
+			Array<Event> mEvents; // Last profiled frame, merged by EndFrame
+
+		public:
+			Profiler();
+
+			void SetEnabled(const bool enabled) { mEnabled = enabled; }
+			bool IsEnabled() const { return mEnabled; }
+
+			void BeginFrame();
+			void EndFrame();
+
+			double Now() const
+			{
+				return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - mEpoch).count();
+			}
+
+			// Thread safe, lock free on task system workers
+			void RecordEvent(const char* name, const double start, const double end);
+			void RecordStage(const RenderStage stage, const double start, const double end);
+
+			__forceinline void AddCounter(const RenderCounter counter, const uint64 value)
+			{
+				if (mEnabled)
+					mCounters[int(counter)] += value;
+			}
+
+			const RenderStats& GetStats() const
+			{
+				return mStats;
+			}
+
+			// Writes the events of the last profiled frame in Chrome trace event format
+			bool WriteChromeTrace(const char* path) const;
+		};
+
+		class ScopedProfileEvent
+		{
+		private:
+			Profiler& mProfiler;
+			const char* mName;
+			double mStart;
+
+		public:
+			ScopedProfileEvent(Profiler& profiler, const char* name)
+				: mProfiler(profiler), mName(name)
+			{
+				if (mProfiler.IsEnabled())
+					mStart = mProfiler.Now();
+			}
+			~ScopedProfileEvent()
+			{
+				if (mProfiler.IsEnabled())
+					mProfiler.RecordEvent(mName, mStart, mProfiler.Now());
+			}
+		};
+
+		class ScopedStageTimer
+		{
+		private:
+			Profiler& mProfiler;
+			RenderStage mStage;
+			double mStart;
+
+		public:
+			ScopedStageTimer(Profiler& profiler, const RenderStage stage)
+				: mProfiler(profiler), mStage(stage)
+			{
+				if (mProfiler.IsEnabled())
+					mStart = mProfiler.Now();
+			}
+			~ScopedStageTimer()
+			{
+				if (mProfiler.IsEnabled())
+					mProfiler.RecordStage(mStage, mStart, mProfiler.Now());
+			}
+		};
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "SIMD/SSE.h"
+
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Wide raster kernels live in their own translation units and are compiled for AVX2 / AVX-512 per function,
+// see RasterWide.h, so the rest of the binary keeps running on SSE only machines. They are selected at runtime
+// only if the CPU and OS support them.
+#if defined(_MSC_VER) || defined(__GNUC__)
+#define EDX_RASTER_AVX2 1
+#else
+#define EDX_RASTER_AVX2 0
+#endif
+
+#if (defined(_MSC_VER) && _MSC_VER >= 1911) || defined(__GNUC__)
+#define EDX_RASTER_AVX512 1
+#else
+#define EDX_RASTER_AVX512 0
+#endif
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace CPUFeatures
+		{
+			inline void CPUID(int info[4], const int leaf, const int subLeaf)
+			{
+#if defined(_MSC_VER)
+				__cpuidex(info, leaf, subLeaf);
+#else
+				__cpuid_count(leaf, subLeaf, info[0], info[1], info[2], info[3]);
+#endif
+			}
+
+			inline unsigned long long XGetBV()
+			{
+#if defined(_MSC_VER)
+				return _xgetbv(0);
+#else
+				uint eax, edx;
+				__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+				return ((unsigned long long)edx << 32) | eax;
+#endif
+			}
+
+			// Returns the widest rasterizer lane count (4, 8 or 16) usable on this machine
+			inline uint DetectRasterSIMDWidth()
+			{
+				int info[4];
+				CPUID(info, 0, 0);
+				if (info[0] < 7)
+					return 4;
+
+				CPUID(info, 1, 0);
+				const bool osxsave = (info[2] & (1 << 27)) != 0;
+				const bool avx = (info[2] & (1 << 28)) != 0;
+				if (!osxsave || !avx)
+					return 4;
+
+				// OS must save YMM (and ZMM / opmask for AVX-512) state on context switch
+				const unsigned long long xcr0 = XGetBV();
+				if ((xcr0 & 0x6) != 0x6)
+					return 4;
+
+				CPUID(info, 7, 0);
+				const bool avx2 = (info[1] & (1 << 5)) != 0;
+				const bool avx512f = (info[1] & (1 << 16)) != 0;
+
+				if (EDX_RASTER_AVX512 && avx512f && (xcr0 & 0xE6) == 0xE6)
+					return 16;
+				if (EDX_RASTER_AVX2 && avx2)
+					return 8;
+
+				return 4;
+			}
+		}
+	}
+}
@@ -0,0 +1,206 @@
+#include "RasterTexture.h"
+#include "../Utils/ImageIO.h"
+
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace
+		{
+			const uint CACHE_MAGIC = 0x58455452; // "RTEX"
+			const uint CACHE_VERSION = 1;
+		}
+
+		RasterTexture::RasterTexture(const char* path, const bool useCache)
+			: mLevelCount(0), mConstant(false)
+		{
+			// The cache is only valid for the exact image it was built from
+			struct stat fileStat;
+			const bool sourceExists = stat(path, &fileStat) == 0;
+			const uint64 sourceSize = sourceExists ? uint64(fileStat.st_size) : 0;
+			const int64 sourceTime = sourceExists ? int64(fileStat.st_mtime) : 0;
+
+			const std::string cachePath = std::string(path) + ".rtex";
+			if (useCache && sourceExists && LoadCache(cachePath.c_str(), sourceSize, sourceTime))
+				return;
+
+			Array<uint> texels;
+			int width, height;
+			if (!ImageIO::Read(path, texels, width, height))
+			{
+				// Missing textures render as mid grey instead of failing the whole mesh
+				mConstant = true;
+				mConstantColor = 0.5f * Color::WHITE;
+				return;
+			}
+
+			Init(texels.Data(), width, height);
+
+			if (useCache)
+				SaveCache(cachePath.c_str(), sourceSize, sourceTime);
+		}
+
+		RasterTexture::RasterTexture(const uint* pTexels, const int width, const int height)
+			: mLevelCount(0), mConstant(false)
+		{
+			Init(pTexels, width, height);
+		}
+
+		void RasterTexture::Init(const uint* pTexels, const int width, const int height)
+		{
+			Assert(sizeof(Color4b) == sizeof(uint));
+
+			mTexels.Clear();
+			mLevelCount = 0;
+			GenerateMipmaps(pTexels, width, height);
+		}
+
+		void RasterTexture::GenerateMipmaps(const uint* pTexels, const int width, const int height)
+		{
+			// Levels are filtered in row-major scratch memory and then stored block by block
+			Array<uint> scratch[2];
+			scratch[0].Resize(width * height);
+			memcpy(scratch[0].Data(), pTexels, width * height * sizeof(uint));
+
+			MipLevel src = { width, height, 0, 0 };
+			for (auto level = 0; ; level++)
+			{
+				const Array<uint>& srcLevel = scratch[level & 1];
+				Array<uint>& dstLevel = scratch[(level + 1) & 1];
+
+				const int blocksY = (src.height + BLOCK_SIZE - 1) >> BLOCK_SIZE_LOG_2;
+				src.blocksX = (src.width + BLOCK_SIZE - 1) >> BLOCK_SIZE_LOG_2;
+				src.offset = mTexels.Size();
+				mTexels.Resize(src.offset + src.blocksX * blocksY * BLOCK_SIZE * BLOCK_SIZE);
+
+				// Padding texels of partial blocks repeat the edge so they never hold garbage
+				for (auto y = 0; y < blocksY * BLOCK_SIZE; y++)
+				{
+					for (auto x = 0; x < src.blocksX * BLOCK_SIZE; x++)
+						mTexels[TexelIndex(src, x, y)] = srcLevel[Math::Min(y, src.height - 1) * src.width + Math::Min(x, src.width - 1)];
+				}
+				mLevels[mLevelCount++] = src;
+
+				if ((src.width == 1 && src.height == 1) || mLevelCount == MAX_LEVELS)
+					break;
+
+				MipLevel dst;
+				dst.width = Math::Max(src.width >> 1, 1);
+				dst.height = Math::Max(src.height >> 1, 1);
+				dstLevel.Resize(dst.width * dst.height);
+
+				// 2x2 box filter, the last row or column of odd sized levels is clamped
+				for (auto y = 0; y < dst.height; y++)
+				{
+					const int y0 = Math::Min(2 * y, src.height - 1);
+					const int y1 = Math::Min(2 * y + 1, src.height - 1);
+					for (auto x = 0; x < dst.width; x++)
+					{
+						const int x0 = Math::Min(2 * x, src.width - 1);
+						const int x1 = Math::Min(2 * x + 1, src.width - 1);
+
+						const uint texels[4] = {
+							srcLevel[y0 * src.width + x0],
+							srcLevel[y0 * src.width + x1],
+							srcLevel[y1 * src.width + x0],
+							srcLevel[y1 * src.width + x1]
+						};
+
+						uint filtered = 0;
+						for (auto c = 0; c < 32; c += 8)
+						{
+							uint sum = 2;
+							for (auto i = 0; i < 4; i++)
+								sum += (texels[i] >> c) & 0xFF;
+
+							filtered |= (sum >> 2) << c;
+						}
+
+						dstLevel[y * dst.width + x] = filtered;
+					}
+				}
+
+				src = dst;
+			}
+		}
+
+		bool RasterTexture::LoadCache(const char* cachePath, const uint64 sourceSize, const int64 sourceTime)
+		{
+			std::ifstream file(cachePath, std::ios::binary);
+			if (!file)
+				return false;
+
+			uint magic, version;
+			uint64 size;
+			int64 time;
+			int levelCount, texelCount;
+			file.read((char*)&magic, sizeof(magic));
+			file.read((char*)&version, sizeof(version));
+			file.read((char*)&size, sizeof(size));
+			file.read((char*)&time, sizeof(time));
+			file.read((char*)&levelCount, sizeof(levelCount));
+			file.read((char*)&texelCount, sizeof(texelCount));
+			if (!file || magic != CACHE_MAGIC || version != CACHE_VERSION || size != sourceSize || time != sourceTime ||
+				levelCount <= 0 || levelCount > MAX_LEVELS || texelCount <= 0)
+				return false;
+
+			file.read((char*)mLevels, levelCount * sizeof(MipLevel));
+			if (!file)
+				return false;
+
+			// Sampling trusts the levels, so every block of every level has to lie inside the texels
+			for (auto i = 0; i < levelCount; i++)
+			{
+				const MipLevel& level = mLevels[i];
+				if (level.width <= 0 || level.height <= 0 || level.offset < 0 ||
+					level.blocksX != (level.width + BLOCK_SIZE - 1) >> BLOCK_SIZE_LOG_2)
+					return false;
+
+				const int64 blocksY = (level.height + BLOCK_SIZE - 1) >> BLOCK_SIZE_LOG_2;
+				if (level.offset + int64(level.blocksX) * blocksY * BLOCK_SIZE * BLOCK_SIZE > texelCount)
+					return false;
+			}
+
+			// The count comes from the file, so it must be backed by the bytes left before anything is allocated
+			const std::streamoff texelStart = file.tellg();
+			file.seekg(0, std::ios::end);
+			const std::streamoff fileEnd = file.tellg();
+			file.seekg(texelStart);
+			if (!file || texelStart < 0 || fileEnd < texelStart || uint64(fileEnd - texelStart) < uint64(texelCount) * sizeof(uint))
+				return false;
+
+			mTexels.Resize(texelCount);
+			file.read((char*)mTexels.Data(), texelCount * sizeof(uint));
+			if (!file)
+			{
+				mTexels.Clear();
+				return false;
+			}
+
+			mLevelCount = levelCount;
+			return true;
+		}
+
+		void RasterTexture::SaveCache(const char* cachePath, const uint64 sourceSize, const int64 sourceTime) const
+		{
+			// Failing to write the cache only costs a rebuild next time
+			std::ofstream file(cachePath, std::ios::binary);
+			if (!file)
+				return;
+
+			const int texelCount = mTexels.Size();
+			file.write((const char*)&CACHE_MAGIC, sizeof(CACHE_MAGIC));
+			file.write((const char*)&CACHE_VERSION, sizeof(CACHE_VERSION));
+			file.write((const char*)&sourceSize, sizeof(sourceSize));
+			file.write((const char*)&sourceTime, sizeof(sourceTime));
+			file.write((const char*)&mLevelCount, sizeof(mLevelCount));
+			file.write((const char*)&texelCount, sizeof(texelCount));
+			file.write((const char*)mLevels, mLevelCount * sizeof(MipLevel));
+			file.write((const char*)mTexels.Data(), texelCount * sizeof(uint));
+		}
+	}
+}
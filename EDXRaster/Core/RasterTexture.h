@@ -0,0 +1,309 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Graphics/Texture.h"
+#include "SIMD/SSE.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// RGBA8 texture with a box filtered mip chain, sampled four lanes at a time. Level of detail
+		// is derived per lane from the quad's texture coordinate differentials, so unmerged quads pay
+		// for the footprint computation once. Addressing wraps.
+		//
+		// Every level is stored in 4x4 texel blocks of one cache line each, so the vertical neighbors
+		// of a bilinear footprint are almost always in the same line as the horizontal ones.
+		class RasterTexture
+		{
+		public:
+			static const int MAX_LEVELS = 16;
+			static const int BLOCK_SIZE_LOG_2 = 2;
+			static const int BLOCK_SIZE = 1 << BLOCK_SIZE_LOG_2;
+
+		private:
+			struct MipLevel
+			{
+				int width, height;
+				int blocksX;
+				int offset; // Into mTexels
+			};
+
+			MipLevel mLevels[MAX_LEVELS];
+			int mLevelCount;
+			Array<uint> mTexels; // Packed RGBA8, r in the low byte
+
+			bool mConstant;
+			Color mConstantColor;
+
+		public:
+			RasterTexture(const Color& color)
+				: mLevelCount(0), mConstant(true), mConstantColor(color)
+			{
+			}
+			// Decoded texels and mips are cached in a sidecar file next to the image
+			RasterTexture(const char* path, const bool useCache = true);
+			RasterTexture(const uint* pTexels, const int width, const int height);
+
+			int GetWidth() const { return mConstant ? 1 : mLevels[0].width; }
+			int GetHeight() const { return mConstant ? 1 : mLevels[0].height; }
+			int GetLevelCount() const { return mLevelCount; }
+			size_t GetMemorySize() const { return mTexels.Size() * sizeof(uint); }
+
+			// Log2 of the longer screen axis footprint in texels of level 0. Computed once per 2x2 quad from the
+			// differentials its pixels share and broadcast to the four lanes.
+			FloatSSE ComputeLod(const Vector2& dx, const Vector2& dy) const
+			{
+				if (mConstant)
+					return FloatSSE(Math::EDX_ZERO);
+
+				const float width = float(mLevels[0].width), height = float(mLevels[0].height);
+				const float dxu = dx.x * width, dxv = dx.y * height;
+				const float dyu = dy.x * width, dyv = dy.y * height;
+				const float lengthSq = Math::Max(dxu * dxu + dxv * dxv, dyu * dyu + dyv * dyv);
+
+				return FloatSSE(0.5f) * Log2(FloatSSE(Math::Max(lengthSq, 1e-8f)));
+			}
+
+			// Filter resolved at compile time, see TextureSampler. lod is only read by trilinear filtering.
+			template<TextureFilter Filter>
+			Vec3f_SSE Sample(const Vec2f_SSE& texCoord, const Vec2f_SSE differentials[2], const FloatSSE& lod) const
+			{
+				if (mConstant)
+					return Vec3f_SSE(mConstantColor.r, mConstantColor.g, mConstantColor.b);
+
+				switch (Filter)
+				{
+				case TextureFilter::Nearest:
+					return SampleNearest(texCoord, IntSSE(0));
+				case TextureFilter::Linear:
+					return SampleBilinear(texCoord, IntSSE(0));
+				case TextureFilter::Anisotropic4x:
+					return SampleAnisotropic(texCoord, differentials, 4);
+				case TextureFilter::Anisotropic8x:
+					return SampleAnisotropic(texCoord, differentials, 8);
+				case TextureFilter::Anisotropic16x:
+					return SampleAnisotropic(texCoord, differentials, 16);
+				default:
+					return SampleTrilinear(texCoord, lod);
+				}
+			}
+
+		private:
+			void Init(const uint* pTexels, const int width, const int height);
+			void GenerateMipmaps(const uint* pTexels, const int width, const int height);
+			bool LoadCache(const char* cachePath, const uint64 sourceSize, const int64 sourceTime);
+			void SaveCache(const char* cachePath, const uint64 sourceSize, const int64 sourceTime) const;
+
+			static __forceinline int TexelIndex(const MipLevel& mip, const int x, const int y)
+			{
+				return mip.offset +
+					((((y >> BLOCK_SIZE_LOG_2) * mip.blocksX + (x >> BLOCK_SIZE_LOG_2)) << (2 * BLOCK_SIZE_LOG_2)) |
+					((y & (BLOCK_SIZE - 1)) << BLOCK_SIZE_LOG_2) | (x & (BLOCK_SIZE - 1)));
+			}
+
+			static __forceinline FloatSSE Floor(const FloatSSE& x)
+			{
+				const FloatSSE truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x.m128));
+				return SSE::Select(truncated > x, truncated - FloatSSE(1.0f), truncated);
+			}
+
+			// Exponent plus a quadratic fit of the mantissa, accurate to ~0.01
+			static __forceinline FloatSSE Log2(const FloatSSE& x)
+			{
+				const __m128i bits = _mm_castps_si128(x.m128);
+				const FloatSSE exponent = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+				const FloatSSE m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+
+				return exponent + (FloatSSE(-0.34484843f) * m + FloatSSE(2.02466578f)) * m - FloatSSE(0.67487759f);
+			}
+
+			static __forceinline Vec3f_SSE Decode(const IntSSE& texels)
+			{
+				const __m128i mask = _mm_set1_epi32(0xFF);
+				const FloatSSE scale = FloatSSE(1.0f / 255.0f);
+
+				return Vec3f_SSE(FloatSSE(_mm_cvtepi32_ps(_mm_and_si128(texels.m128, mask))) * scale,
+					FloatSSE(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels.m128, 8), mask))) * scale,
+					FloatSSE(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels.m128, 16), mask))) * scale);
+			}
+
+			__forceinline void GetLevelDims(const IntSSE& level, FloatSSE& width, FloatSSE& height, const MipLevel* pMips[4]) const
+			{
+				for (auto i = 0; i < 4; i++)
+				{
+					pMips[i] = &mLevels[level[i]];
+					width[i] = float(pMips[i]->width);
+					height[i] = float(pMips[i]->height);
+				}
+			}
+
+			// Wraps integer valued texel coordinates into [0, size)
+			static __forceinline FloatSSE Wrap(const FloatSSE& x, const FloatSSE& size)
+			{
+				return SSE::Min(x - Floor(x / size) * size, size - FloatSSE(1.0f));
+			}
+
+			__forceinline IntSSE Fetch(const IntSSE& x, const IntSSE& y, const MipLevel* pMips[4]) const
+			{
+				return IntSSE(mTexels[TexelIndex(*pMips[0], x[0], y[0])],
+					mTexels[TexelIndex(*pMips[1], x[1], y[1])],
+					mTexels[TexelIndex(*pMips[2], x[2], y[2])],
+					mTexels[TexelIndex(*pMips[3], x[3], y[3])]);
+			}
+
+			Vec3f_SSE SampleNearest(const Vec2f_SSE& texCoord, const IntSSE& level) const
+			{
+				FloatSSE width, height;
+				const MipLevel* pMips[4];
+				GetLevelDims(level, width, height, pMips);
+
+				const IntSSE x = _mm_cvttps_epi32(Wrap(Floor(texCoord.u * width), width).m128);
+				const IntSSE y = _mm_cvttps_epi32(Wrap(Floor(texCoord.v * height), height).m128);
+
+				return Decode(Fetch(x, y, pMips));
+			}
+
+			Vec3f_SSE SampleBilinear(const Vec2f_SSE& texCoord, const IntSSE& level) const
+			{
+				FloatSSE width, height;
+				const MipLevel* pMips[4];
+				GetLevelDims(level, width, height, pMips);
+
+				const FloatSSE fx = texCoord.u * width - FloatSSE(0.5f);
+				const FloatSSE fy = texCoord.v * height - FloatSSE(0.5f);
+				const FloatSSE floorX = Floor(fx), floorY = Floor(fy);
+				const FloatSSE tx = fx - floorX, ty = fy - floorY;
+
+				const FloatSSE x0 = Wrap(floorX, width), y0 = Wrap(floorY, height);
+				const FloatSSE x1 = SSE::Select(x0 + FloatSSE(1.0f) >= width, FloatSSE(Math::EDX_ZERO), x0 + FloatSSE(1.0f));
+				const FloatSSE y1 = SSE::Select(y0 + FloatSSE(1.0f) >= height, FloatSSE(Math::EDX_ZERO), y0 + FloatSSE(1.0f));
+
+				const IntSSE ix0 = _mm_cvttps_epi32(x0.m128), ix1 = _mm_cvttps_epi32(x1.m128);
+				const IntSSE iy0 = _mm_cvttps_epi32(y0.m128), iy1 = _mm_cvttps_epi32(y1.m128);
+
+				const Vec3f_SSE c00 = Decode(Fetch(ix0, iy0, pMips));
+				const Vec3f_SSE c10 = Decode(Fetch(ix1, iy0, pMips));
+				const Vec3f_SSE c01 = Decode(Fetch(ix0, iy1, pMips));
+				const Vec3f_SSE c11 = Decode(Fetch(ix1, iy1, pMips));
+
+				const Vec3f_SSE top = c00 + tx * (c10 - c00);
+				const Vec3f_SSE bottom = c01 + tx * (c11 - c01);
+
+				return top + ty * (bottom - top);
+			}
+
+			Vec3f_SSE SampleTrilinear(const Vec2f_SSE& texCoord, const FloatSSE& lod) const
+			{
+				const FloatSSE clamped = SSE::Min(SSE::Max(lod, FloatSSE(Math::EDX_ZERO)), FloatSSE(float(mLevelCount - 1)));
+				const FloatSSE lodFloor = Floor(clamped);
+				const FloatSSE t = clamped - lodFloor;
+
+				const IntSSE level0 = _mm_cvttps_epi32(lodFloor.m128);
+				const IntSSE level1 = _mm_cvttps_epi32(SSE::Min(lodFloor + FloatSSE(1.0f), FloatSSE(float(mLevelCount - 1))).m128);
+
+				const Vec3f_SSE c0 = SampleBilinear(texCoord, level0);
+				if (!SSE::Any(t > FloatSSE(Math::EDX_ZERO)))
+					return c0;
+
+				const Vec3f_SSE c1 = SampleBilinear(texCoord, level1);
+				return c0 + t * (c1 - c0);
+			}
+
+			// Trilinear taps spread along the major axis of the footprint, up to maxAniso per lane
+			Vec3f_SSE SampleAnisotropic(const Vec2f_SSE& texCoord, const Vec2f_SSE differentials[2], const int maxAniso) const
+			{
+				const FloatSSE width = FloatSSE(float(mLevels[0].width));
+				const FloatSSE height = FloatSSE(float(mLevels[0].height));
+
+				const FloatSSE dxu = differentials[0].u * width, dxv = differentials[0].v * height;
+				const FloatSSE dyu = differentials[1].u * width, dyv = differentials[1].v * height;
+				const FloatSSE lengthX = SSE::Sqrt(dxu * dxu + dxv * dxv);
+				const FloatSSE lengthY = SSE::Sqrt(dyu * dyu + dyv * dyv);
+
+				const BoolSSE xMajor = lengthX >= lengthY;
+				const FloatSSE major = SSE::Select(xMajor, lengthX, lengthY);
+				const FloatSSE minor = SSE::Max(SSE::Select(xMajor, lengthY, lengthX), FloatSSE(1e-4f));
+				const Vec2f_SSE axis = Vec2f_SSE(SSE::Select(xMajor, differentials[0].u, differentials[1].u),
+					SSE::Select(xMajor, differentials[0].v, differentials[1].v));
+
+				const FloatSSE tapCount = SSE::Min(SSE::Max(-Floor(-(major / minor)), FloatSSE(1.0f)), FloatSSE(float(maxAniso)));
+				const FloatSSE lod = Log2(SSE::Max(major / tapCount, FloatSSE(1e-4f)));
+				const FloatSSE invTapCount = FloatSSE(1.0f) / tapCount;
+
+				const int maxTaps = int(Math::Max(Math::Max(tapCount[0], tapCount[1]), Math::Max(tapCount[2], tapCount[3])));
+				if (maxTaps == 1)
+					return SampleTrilinear(texCoord, lod);
+
+				Vec3f_SSE ret = Vec3f_SSE(Vector3::ZERO);
+				for (auto i = 0; i < maxTaps; i++)
+				{
+					const FloatSSE tap = FloatSSE(float(i));
+					const BoolSSE active = tap < tapCount;
+					const FloatSSE offset = (tap + FloatSSE(0.5f)) * invTapCount - FloatSSE(0.5f);
+
+					const Vec2f_SSE tapCoord = Vec2f_SSE(texCoord.u + offset * axis.u, texCoord.v + offset * axis.v);
+					ret += SSE::Select(active, invTapCount, FloatSSE(Math::EDX_ZERO)) * SampleTrilinear(tapCoord, lod);
+				}
+
+				return ret;
+			}
+		};
+
+		// Texture slots of a frame with the sample function of the current filter, resolved once per frame so
+		// shading loops neither read the render states nor switch on the filter
+		class TextureSampler
+		{
+		private:
+			typedef Vec3f_SSE (RasterTexture::*SampleFunc)(const Vec2f_SSE& texCoord, const Vec2f_SSE differentials[2], const FloatSSE& lod) const;
+
+			const RasterTexture* const* mppSlots;
+			SampleFunc mpSample;
+			bool mTrilinear;
+
+		public:
+			TextureSampler()
+				: mppSlots(nullptr), mpSample(&RasterTexture::Sample<TextureFilter::TriLinear>), mTrilinear(true)
+			{
+			}
+			// The slots must outlive the sampler and not be resized while it is used
+			TextureSampler(const Array<const RasterTexture*>& slots, const TextureFilter filter)
+				: mppSlots(slots.Data()), mTrilinear(false)
+			{
+				switch (filter)
+				{
+				case TextureFilter::Nearest:
+					mpSample = &RasterTexture::Sample<TextureFilter::Nearest>;
+					break;
+				case TextureFilter::Linear:
+					mpSample = &RasterTexture::Sample<TextureFilter::Linear>;
+					break;
+				case TextureFilter::Anisotropic4x:
+					mpSample = &RasterTexture::Sample<TextureFilter::Anisotropic4x>;
+					break;
+				case TextureFilter::Anisotropic8x:
+					mpSample = &RasterTexture::Sample<TextureFilter::Anisotropic8x>;
+					break;
+				case TextureFilter::Anisotropic16x:
+					mpSample = &RasterTexture::Sample<TextureFilter::Anisotropic16x>;
+					break;
+				default:
+					mpSample = &RasterTexture::Sample<TextureFilter::TriLinear>;
+					mTrilinear = true;
+					break;
+				}
+			}
+
+			// Level of detail of a quad for Sample, the other filters derive theirs from the differentials
+			__forceinline FloatSSE ComputeLod(const uint textureId, const Vector2& dx, const Vector2& dy) const
+			{
+				return mTrilinear ? mppSlots[textureId]->ComputeLod(dx, dy) : FloatSSE(Math::EDX_ZERO);
+			}
+
+			__forceinline Vec3f_SSE Sample(const uint textureId, const Vec2f_SSE& texCoord, const Vec2f_SSE differentials[2], const FloatSSE& lod) const
+			{
+				return (mppSlots[textureId]->*mpSample)(texCoord, differentials, lod);
+			}
+		};
+	}
+}
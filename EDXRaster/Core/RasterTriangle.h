@@ -8,6 +8,7 @@ namespace EDX
 {
 	namespace RasterRenderer
 	{
+		// Set up by TriangleSetup
 		struct RasterTriangle
 		{
 			Vector2i v0, v1, v2;
@@ -15,143 +16,17 @@ namespace EDX
 			int stepB0, stepC0, stepB1, stepC1, stepB2, stepC2;
 
 			float invDet;
+			float minZ; // Nearest depth, for Hi-Z rejection
 			uint vId0, vId1, vId2, coreId;
 			uint textureId;
+			uint drawId;
+			uint triId; // Index into the per core triangle buffer
 
 			uint rejectCorner0 : 8, rejectCorner1 : 8, rejectCorner2 : 8;
 			uint acceptCorner0 : 8, acceptCorner1 : 8, acceptCorner2 : 8;
 
 			float lambda0, lambda1; // Barycentric coordinates
 
-
-			bool Setup(Vector3& a, Vector3& b, Vector3& c, const uint* pIdx, const uint cId, const uint texId)
-			{
-				const Matrix& rasterMatrix = RenderStates::Instance()->GetRasterMatrix();
-				a = Matrix::TransformPoint(a, rasterMatrix);
-				b = Matrix::TransformPoint(b, rasterMatrix);
-				c = Matrix::TransformPoint(c, rasterMatrix);
-
-				// Convert to fixed point
-				v0.x = a.x * 16.0;
-				v0.y = a.y * 16.0;
-				v1.x = b.x * 16.0;
-				v1.y = b.y * 16.0;
-				v2.x = c.x * 16.0;
-				v2.y = c.y * 16.0;
-
-				B0 = v0.y - v1.y;
-				C0 = v1.x - v0.x;
-				B1 = v1.y - v2.y;
-				C1 = v2.x - v1.x;
-				B2 = v2.y - v0.y;
-				C2 = v0.x - v2.x;
-
-				int det = C2 * B1 - C1 * B2;
-				if (det <= 0)
-					return false;
-
-				stepB0 = 16 * B0;
-				stepC0 = 16 * C0;
-				stepB1 = 16 * B1;
-				stepC1 = 16 * C1;
-				stepB2 = 16 * B2;
-				stepC2 = 16 * C2;
-
-				invDet = 1.0f / float(Math::Abs(det));
-				vId0 = pIdx[0]; vId1 = pIdx[1]; vId2 = pIdx[2];
-				coreId = cId;
-				textureId = texId;
-
-				// Set up trivial reject and accept corners
-				float edge0Slope = B0 / float(C0);
-				float edge1Slope = B1 / float(C1);
-				float edge2Slope = B2 / float(C2);
-
-				// For edge0
-				if (edge0Slope >= 0.0f)
-				{
-					if (C0 >= 0.0f)
-					{
-						rejectCorner0 = 3;
-						acceptCorner0 = 0;
-					}
-					else
-					{
-						rejectCorner0 = 0;
-						acceptCorner0 = 3;
-					}
-				}
-				else
-				{
-					if (C0 >= 0.0f)
-					{
-						rejectCorner0 = 2;
-						acceptCorner0 = 1;
-					}
-					else
-					{
-						rejectCorner0 = 1;
-						acceptCorner0 = 2;
-					}
-				}
-				// For edge1
-				if (edge1Slope >= 0.0f)
-				{
-					if (C1 >= 0.0f)
-					{
-						rejectCorner1 = 3;
-						acceptCorner1 = 0;
-					}
-					else
-					{
-						rejectCorner1 = 0;
-						acceptCorner1 = 3;
-					}
-				}
-				else
-				{
-					if (C1 >= 0.0f)
-					{
-						rejectCorner1 = 2;
-						acceptCorner1 = 1;
-					}
-					else
-					{
-						rejectCorner1 = 1;
-						acceptCorner1 = 2;
-					}
-				}
-				// For edge2
-				if (edge2Slope >= 0.0f)
-				{
-					if (C2 >= 0.0f)
-					{
-						rejectCorner2 = 3;
-						acceptCorner2 = 0;
-					}
-					else
-					{
-						rejectCorner2 = 0;
-						acceptCorner2 = 3;
-					}
-				}
-				else
-				{
-					if (C2 >= 0.0f)
-					{
-						rejectCorner2 = 2;
-						acceptCorner2 = 1;
-					}
-					else
-					{
-						rejectCorner2 = 1;
-						acceptCorner2 = 2;
-					}
-				}
-
-				return true;
-			}
-
 			__forceinline int TopLeftEdge(const Vector2i& v1, const Vector2i& v2) const
 			{
 				return ((v2.y > v1.y) || (v1.y == v2.y && v1.x > v2.x)) ? 0 : -1;
@@ -204,7 +79,7 @@ namespace EDX
 					case 2:
 						out = stepSize * IntSSE(-C0, B0 - C0, 0, B0);
 						break;
-					case 3:
+					default:
 						out = stepSize * IntSSE(-B0 - C0, -C0, -B0, 0);
 						break;
 					}
@@ -222,7 +97,7 @@ namespace EDX
 					case 2:
 						out = stepSize * IntSSE(-C1, B1 - C1, 0, B1);
 						break;
-					case 3:
+					default:
 						out = stepSize * IntSSE(-B1 - C1, -C1, -B1, 0);
 						break;
 					}
@@ -240,7 +115,7 @@ namespace EDX
 					case 2:
 						out = stepSize * IntSSE(-C2, B2 - C2, 0, B2);
 						break;
-					case 3:
+					default:
 						out = stepSize * IntSSE(-B2 - C2, -C2, -B2, 0);
 						break;
 					}
@@ -265,6 +140,7 @@ namespace EDX
 			FloatSSE invDet;
 			uint vId0, vId1, vId2, coreId;
 			uint textureId;
+			uint triId;
 
 			FloatSSE lambda0, lambda1;
 
@@ -278,18 +154,19 @@ namespace EDX
 				, C1(tri.C1)
 				, B2(tri.B2)
 				, C2(tri.C2)
-				, invDet(tri.invDet)
 				, stepB0(2 * tri.stepB0)
 				, stepC0(2 * tri.stepC0)
 				, stepB1(2 * tri.stepB1)
 				, stepC1(2 * tri.stepC1)
 				, stepB2(2 * tri.stepB2)
 				, stepC2(2 * tri.stepC2)
+				, invDet(tri.invDet)
 				, vId0(tri.vId0)
 				, vId1(tri.vId1)
 				, vId2(tri.vId2)
 				, coreId(tri.coreId)
 				, textureId(tri.textureId)
+				, triId(tri.triId)
 			{
 			}
 
@@ -336,5 +213,42 @@ namespace EDX
 				lambda1 = FloatSSE((B2 * (x - v2.x) + C2 * (y - v2.y))) * invDet;
 			}
 		};
+
+		// Edge functions of up to four different triangles, one per lane, with the fill convention of TriangleSSE
+		struct TriangleBatchSSE
+		{
+			static const int LANES = 4;
+
+			Vec2i_SSE v0, v1, v2;
+			IntSSE B0, C0, B1, C1, B2, C2;
+
+			__forceinline void Set(const int lane, const RasterTriangle& tri)
+			{
+				v0.x[lane] = tri.v0.x; v0.y[lane] = tri.v0.y;
+				v1.x[lane] = tri.v1.x; v1.y[lane] = tri.v1.y;
+				v2.x[lane] = tri.v2.x; v2.y[lane] = tri.v2.y;
+				B0[lane] = tri.B0; C0[lane] = tri.C0;
+				B1[lane] = tri.B1; C1[lane] = tri.C1;
+				B2[lane] = tri.B2; C2[lane] = tri.C2;
+			}
+
+			__forceinline IntSSE TopLeftEdge(const Vec2i_SSE& v1, const Vec2i_SSE& v2) const
+			{
+				return ((v2.y > v1.y) | ((v1.y == v2.y) & (v1.x > v2.x)));
+			}
+
+			__forceinline IntSSE EdgeFunc0(const Vec2i_SSE& p) const
+			{
+				return B0 * (p.x - v0.x) + C0 * (p.y - v0.y) + TopLeftEdge(v0, v1);
+			}
+			__forceinline IntSSE EdgeFunc1(const Vec2i_SSE& p) const
+			{
+				return B1 * (p.x - v1.x) + C1 * (p.y - v1.y) + TopLeftEdge(v1, v2);
+			}
+			__forceinline IntSSE EdgeFunc2(const Vec2i_SSE& p) const
+			{
+				return B2 * (p.x - v2.x) + C2 * (p.y - v2.y) + TopLeftEdge(v2, v0);
+			}
+		};
 	}
 }
\ No newline at end of file
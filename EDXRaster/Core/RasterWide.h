@@ -0,0 +1,245 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "FrameBuffer.h"
+#include "Tile.h"
+#include "Shader.h"
+#include "RasterSIMD.h"
+
+// Only included by the wide kernel translation units, which define EDX_RASTER_WIDE_TARGET to the instruction
+// set attribute of their kernel first. Everything is compiled for that target alone and has internal linkage,
+// so no AVX copy of a function can be picked by the linker in place of the SSE one used elsewhere. Helpers
+// from other headers stay SSE code and are inlined into the kernel.
+#if !defined(EDX_RASTER_WIDE_TARGET)
+#error Define EDX_RASTER_WIDE_TARGET before including RasterWide.h
+#endif
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace
+		{
+			// Edge function values for a block of 2x2 quads, one quad per 128 bit lane group.
+			// Width 8 covers a 4x2 pixel block, width 16 covers a 4x4 pixel block.
+			template<int Width>
+			struct WideEdge;
+
+			template<>
+			struct WideEdge<8>
+			{
+				static const int QUAD_COUNT_X = 2;
+				static const int QUAD_COUNT_Y = 1;
+
+				union
+				{
+					__m256i v;
+					__m128i quads[2];
+				};
+
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge()
+				{
+				}
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge(const __m256i& val)
+					: v(val)
+				{
+				}
+				// Expand the edge values of the top left quad given the per quad x and y steps
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge(const IntSSE& e, const IntSSE& quadStepX, const IntSSE& quadStepY)
+				{
+					IntSSE e1 = e + quadStepX;
+					v = _mm256_inserti128_si256(_mm256_castsi128_si256(e.m128), e1.m128, 1);
+				}
+
+				// Step to the next block in x and y
+				static EDX_RASTER_WIDE_TARGET __forceinline WideEdge BlockStepX(const IntSSE& quadStepX)
+				{
+					IntSSE step = quadStepX + quadStepX;
+					return WideEdge(_mm256_inserti128_si256(_mm256_castsi128_si256(step.m128), step.m128, 1));
+				}
+				static EDX_RASTER_WIDE_TARGET __forceinline WideEdge BlockStepY(const IntSSE& quadStepY)
+				{
+					return WideEdge(_mm256_inserti128_si256(_mm256_castsi128_si256(quadStepY.m128), quadStepY.m128, 1));
+				}
+
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge& operator += (const WideEdge& rhs)
+				{
+					v = _mm256_add_epi32(v, rhs.v);
+					return *this;
+				}
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge operator + (const WideEdge& rhs) const
+				{
+					return WideEdge(_mm256_add_epi32(v, rhs.v));
+				}
+
+				EDX_RASTER_WIDE_TARGET __forceinline IntSSE Quad(const int i) const
+				{
+					return IntSSE(quads[i]);
+				}
+
+				// One bit per lane, set if all three edge functions are non-negative
+				static EDX_RASTER_WIDE_TARGET __forceinline int CoverageBits(const WideEdge& e0, const WideEdge& e1, const WideEdge& e2)
+				{
+					__m256i combined = _mm256_or_si256(_mm256_or_si256(e0.v, e1.v), e2.v);
+					return ~_mm256_movemask_ps(_mm256_castsi256_ps(combined)) & 0xFF;
+				}
+			};
+
+#if defined(EDX_RASTER_WIDE_AVX512)
+			template<>
+			struct WideEdge<16>
+			{
+				static const int QUAD_COUNT_X = 2;
+				static const int QUAD_COUNT_Y = 2;
+
+				union
+				{
+					__m512i v;
+					__m128i quads[4];
+				};
+
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge()
+				{
+				}
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge(const __m512i& val)
+					: v(val)
+				{
+				}
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge(const IntSSE& e, const IntSSE& quadStepX, const IntSSE& quadStepY)
+				{
+					quads[0] = e.m128;
+					quads[1] = (e + quadStepX).m128;
+					quads[2] = (e + quadStepY).m128;
+					quads[3] = (e + quadStepX + quadStepY).m128;
+				}
+
+				static EDX_RASTER_WIDE_TARGET __forceinline WideEdge BlockStepX(const IntSSE& quadStepX)
+				{
+					IntSSE step = quadStepX + quadStepX;
+					return WideEdge(_mm512_broadcast_i32x4(step.m128));
+				}
+				static EDX_RASTER_WIDE_TARGET __forceinline WideEdge BlockStepY(const IntSSE& quadStepY)
+				{
+					IntSSE step = quadStepY + quadStepY;
+					return WideEdge(_mm512_broadcast_i32x4(step.m128));
+				}
+
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge& operator += (const WideEdge& rhs)
+				{
+					v = _mm512_add_epi32(v, rhs.v);
+					return *this;
+				}
+				EDX_RASTER_WIDE_TARGET __forceinline WideEdge operator + (const WideEdge& rhs) const
+				{
+					return WideEdge(_mm512_add_epi32(v, rhs.v));
+				}
+
+				EDX_RASTER_WIDE_TARGET __forceinline IntSSE Quad(const int i) const
+				{
+					return IntSSE(quads[i]);
+				}
+
+				static EDX_RASTER_WIDE_TARGET __forceinline int CoverageBits(const WideEdge& e0, const WideEdge& e1, const WideEdge& e2)
+				{
+					__m512i combined = _mm512_or_si512(_mm512_or_si512(e0.v, e1.v), e2.v);
+					return _mm512_cmpge_epi32_mask(combined, _mm512_setzero_si512());
+				}
+			};
+#endif
+
+			// Evaluates edge functions for a 4x2 (Width 8) or 4x4 (Width 16) pixel block at once,
+			// then runs depth test and fragment generation only on quads with any coverage
+			template<int Width>
+			EDX_RASTER_WIDE_TARGET void FineRasterizeWide(Tile& tile,
+				FrameBuffer* pFrameBuffer,
+				FrameArray<ProjectedVertex>* pDistProjVertexBuf,
+				const Vec2i_SSE& centerOffset,
+				const Vector2i& blockMin,
+				const Vector2i& blockMax,
+				const RasterTriangle& tri)
+			{
+				typedef WideEdge<Width> EdgeType;
+				const int BlockWidth = EdgeType::QUAD_COUNT_X << 1;
+				const int BlockHeight = EdgeType::QUAD_COUNT_Y << 1;
+
+				int minX = Math::Max(blockMin.x, Math::Min(tri.v0.x, Math::Min(tri.v1.x, tri.v2.x)) >> 4);
+				int maxX = Math::Min(blockMax.x - 1, Math::Max(tri.v0.x, Math::Max(tri.v1.x, tri.v2.x)) >> 4);
+				int minY = Math::Max(blockMin.y, Math::Min(tri.v0.y, Math::Min(tri.v1.y, tri.v2.y)) >> 4);
+				int maxY = Math::Min(blockMax.y - 1, Math::Max(tri.v0.y, Math::Max(tri.v1.y, tri.v2.y)) >> 4);
+				minX -= minX % 2;
+				minY -= minY % 2;
+
+				if (maxX < minX || maxY < minY)
+					return;
+
+				TriangleSSE triSSE(tri);
+
+				Vec2i_SSE pixelCenter = Vec2i_SSE(minX << 4, minY << 4) + centerOffset;
+				EdgeType edgeVal0 = EdgeType(triSSE.EdgeFunc0(pixelCenter), triSSE.stepB0, triSSE.stepC0);
+				EdgeType edgeVal1 = EdgeType(triSSE.EdgeFunc1(pixelCenter), triSSE.stepB1, triSSE.stepC1);
+				EdgeType edgeVal2 = EdgeType(triSSE.EdgeFunc2(pixelCenter), triSSE.stepB2, triSSE.stepC2);
+
+				const EdgeType blockStepX0 = EdgeType::BlockStepX(triSSE.stepB0);
+				const EdgeType blockStepX1 = EdgeType::BlockStepX(triSSE.stepB1);
+				const EdgeType blockStepX2 = EdgeType::BlockStepX(triSSE.stepB2);
+				const EdgeType blockStepY0 = EdgeType::BlockStepY(triSSE.stepC0);
+				const EdgeType blockStepY1 = EdgeType::BlockStepY(triSSE.stepC1);
+				const EdgeType blockStepY2 = EdgeType::BlockStepY(triSSE.stepC2);
+
+				Vector2i blockCrd;
+				for (blockCrd.y = minY; blockCrd.y <= maxY; blockCrd.y += BlockHeight)
+				{
+					EdgeType edgeYBase0 = edgeVal0;
+					EdgeType edgeYBase1 = edgeVal1;
+					EdgeType edgeYBase2 = edgeVal2;
+
+					for (blockCrd.x = minX; blockCrd.x <= maxX; blockCrd.x += BlockWidth)
+					{
+						const int coveredBits = EdgeType::CoverageBits(edgeVal0, edgeVal1, edgeVal2);
+						if (coveredBits)
+						{
+							for (auto q = 0; q < Width / 4; q++)
+							{
+								if (((coveredBits >> (q << 2)) & 0xF) == 0)
+									continue;
+
+								// Quads past the block boundary belong to the neighboring block
+								Vector2i pixelCrd = Vector2i(blockCrd.x + ((q % EdgeType::QUAD_COUNT_X) << 1),
+									blockCrd.y + ((q / EdgeType::QUAD_COUNT_X) << 1));
+								if (pixelCrd.x > maxX || pixelCrd.y > maxY)
+									continue;
+
+								BoolSSE covered = (edgeVal0.Quad(q) | edgeVal1.Quad(q) | edgeVal2.Quad(q)) >= IntSSE(Math::EDX_ZERO);
+
+								pixelCenter = Vec2i_SSE(pixelCrd.x << 4, pixelCrd.y << 4) + centerOffset;
+								triSSE.CalcBarycentricCoord(pixelCenter.x, pixelCenter.y);
+
+								const ProjectedVertex& v0 = pDistProjVertexBuf[triSSE.coreId][triSSE.vId0];
+								const ProjectedVertex& v1 = pDistProjVertexBuf[triSSE.coreId][triSSE.vId1];
+								const ProjectedVertex& v2 = pDistProjVertexBuf[triSSE.coreId][triSSE.vId2];
+
+								BoolSSE zTest = pFrameBuffer->ZTestQuad(triSSE.GetDepth(v0, v1, v2), pixelCrd.x, pixelCrd.y, 0, covered);
+								BoolSSE visible = zTest & covered;
+								if (SSE::Any(visible))
+								{
+									tile.AddFragment(triSSE.lambda0, triSSE.lambda1, triSSE.coreId, triSSE.triId, pixelCrd, CoverageMask(visible, 0));
+								}
+							}
+						}
+
+						edgeVal0 += blockStepX0;
+						edgeVal1 += blockStepX1;
+						edgeVal2 += blockStepX2;
+					}
+
+					edgeVal0 = edgeYBase0 + blockStepY0;
+					edgeVal1 = edgeYBase1 + blockStepY1;
+					edgeVal2 = edgeYBase2 + blockStepY2;
+				}
+
+				// The caller and everything after it is SSE code
+				_mm256_zeroupper();
+			}
+		}
+	}
+}
@@ -4,6 +4,7 @@
 #include "FrameBuffer.h"
 #include "Tile.h"
 #include "Shader.h"
+#include "RasterSIMD.h"
 
 namespace EDX
 {
@@ -11,23 +12,100 @@ namespace EDX
 	{
 		class Rasterizer
 		{
+		public:
+			static const uint MAX_MULTI_SAMPLE_LEVEL = 5;
+			static const int MICRO_SIZE = 4; // Pixels, up to 2x2 quads
+
 		private:
+			typedef void (Rasterizer::*TrivialAcceptKernel)(Tile& tile,
+				const Vector2i& blockMin,
+				const Vector2i& blockMax,
+				const RasterTriangle& tri);
+			typedef void (Rasterizer::*FineRasterizeKernel)(Tile& tile,
+				const Tile::TriangleRef& triRef,
+				const Vector2i& blockMin,
+				const Vector2i& blockMax,
+				const RasterTriangle& tri);
+
 			FrameBuffer* mpFrameBuffer;
-			Array<ProjectedVertex>* mpDistProjVertexBuf_Ref;
+			FrameArray<ProjectedVertex>* mpDistProjVertexBuf_Ref;
 			const Vec2i_SSE mCenterOffset;
 
+			// Specialized for the current sample count and SIMD width, see SelectKernels
+			TrivialAcceptKernel mpTrivialAccept;
+			FineRasterizeKernel mpFineRasterize;
+
 		public:
-			Rasterizer(FrameBuffer* pFB, Array<ProjectedVertex>* vb)
+			Rasterizer(FrameBuffer* pFB, FrameArray<ProjectedVertex>* vb)
 				: mpFrameBuffer(pFB)
 				, mpDistProjVertexBuf_Ref(vb)
 				, mCenterOffset(Vec2i_SSE(IntSSE(8, 24, 8, 24), IntSSE(8, 8, 24, 24)))
 			{
+				SelectKernels(0, 4);
 			}
 
 			virtual ~Rasterizer()
 			{
 			}
 
+			void SetFrameBuffer(FrameBuffer* pFB)
+			{
+				mpFrameBuffer = pFB;
+			}
+
+			// Pipelined frames alternate between two sets of per core vertex buffers
+			void SetVertexBuffer(FrameArray<ProjectedVertex>* vb)
+			{
+				mpDistProjVertexBuf_Ref = vb;
+			}
+
+			// Picks the kernels instantiated for this state combination, so the per triangle paths carry no
+			// state branches and sample loops unroll. Must be called when either changes, before rasterizing.
+			void SelectKernels(const uint multiSampleLevel, const uint simdWidth)
+			{
+				Assert(multiSampleLevel <= MAX_MULTI_SAMPLE_LEVEL);
+
+				static const TrivialAcceptKernel trivialAcceptKernels[] = {
+					&Rasterizer::TrivialAcceptTriangle_SingleSample,
+					&Rasterizer::TrivialAcceptTriangle_MultiSample<1>,
+					&Rasterizer::TrivialAcceptTriangle_MultiSample<2>,
+					&Rasterizer::TrivialAcceptTriangle_MultiSample<3>,
+					&Rasterizer::TrivialAcceptTriangle_MultiSample<4>,
+					&Rasterizer::TrivialAcceptTriangle_MultiSample<5>
+				};
+				static const FineRasterizeKernel multiSampleKernels[] = {
+					nullptr,
+					&Rasterizer::FineRasterize_MultiSample<1>,
+					&Rasterizer::FineRasterize_MultiSample<2>,
+					&Rasterizer::FineRasterize_MultiSample<3>,
+					&Rasterizer::FineRasterize_MultiSample<4>,
+					&Rasterizer::FineRasterize_MultiSample<5>
+				};
+
+				mpTrivialAccept = trivialAcceptKernels[multiSampleLevel];
+				if (multiSampleLevel > 0)
+				{
+					mpFineRasterize = multiSampleKernels[multiSampleLevel];
+					return;
+				}
+
+				switch (simdWidth)
+				{
+#if EDX_RASTER_AVX512
+				case 16:
+					mpFineRasterize = &Rasterizer::FineRasterize_SingleSample_AVX512;
+					break;
+#endif
+#if EDX_RASTER_AVX2
+				case 8:
+					mpFineRasterize = &Rasterizer::FineRasterize_SingleSample_AVX2;
+					break;
+#endif
+				default:
+					mpFineRasterize = &Rasterizer::FineRasterize_SingleSample_SSE;
+					break;
+				}
+			}
 
 			void CoarseRasterize(Tile& tile,
 				const Tile::TriangleRef& triRef,
@@ -94,19 +172,16 @@ namespace EDX
 					int minY = !(i >> 1) ? blockMin.y : blockMin.y + (blockSize >> 1);
 					int maxY = !(i >> 1) ? blockMin.y + (blockSize >> 1) : blockMax.y;
 
+					if (mpFrameBuffer->HiZRejectBlock(tri.minZ, Vector2i(minX, minY), Vector2i(Math::Min(maxX, blockMax.x), Math::Min(maxY, blockMax.y))))
+						continue;
+
 					if (trivialAcceptMask[i] != 0)
 					{
-						if (mpFrameBuffer->GetSampleCount() == 1)
-							TrivialAcceptTriangle_SingleSample(tile, Vector2i(minX, minY), Vector2i(maxX, maxY), tri);
-						else
-							TrivialAcceptTriangle_MultiSample(tile, Vector2i(minX, minY), Vector2i(maxX, maxY), tri);
+						(this->*mpTrivialAccept)(tile, Vector2i(minX, minY), Vector2i(maxX, maxY), tri);
 						continue;
 					}
 
-					if (mpFrameBuffer->GetSampleCount() == 1)
-						FineRasterize_SingleSample(tile, triRef, Vector2i(minX, minY), Vector2i(maxX, maxY), tri);
-					else
-						FineRasterize_MultiSample(tile, triRef, Vector2i(minX, minY), Vector2i(maxX, maxY), tri);
+					(this->*mpFineRasterize)(tile, triRef, Vector2i(minX, minY), Vector2i(maxX, maxY), tri);
 				}
 			}
 
@@ -117,13 +192,118 @@ namespace EDX
 				const Vector2i& blockMax,
 				const RasterTriangle& tri)
 			{
-				if (mpFrameBuffer->GetSampleCount() == 1)
-					FineRasterize_SingleSample(tile, triRef, blockMin, blockMax, tri);
-				else
-					FineRasterize_MultiSample(tile, triRef, blockMin, blockMax, tri);
+				(this->*mpFineRasterize)(tile, triRef, blockMin, blockMax, tri);
 			}
 
-			__forceinline void FineRasterize_SingleSample(Tile& tile,
+			__forceinline void TrivialAcceptTriangle(Tile& tile, const Vector2i& blockMin, const Vector2i & blockMax, const RasterTriangle& tri)
+			{
+				(this->*mpTrivialAccept)(tile, blockMin, blockMax, tri);
+			}
+
+			// Lanes whose pixel bounds, as the fine path computes them, fit in one 2x2 quad aligned block of
+			// MICRO_SIZE pixels. Bounds are in 28.4 fixed point.
+			static __forceinline BoolSSE MicroTriangles(const IntSSE& minX, const IntSSE& maxX, const IntSSE& minY, const IntSSE& maxY)
+			{
+				const IntSSE QuadMask = IntSSE(~1);
+				const IntSSE Size = IntSSE(MICRO_SIZE);
+				return (((maxX >> 4) - ((minX >> 4) & QuadMask)) < Size) & (((maxY >> 4) - ((minY >> 4) & QuadMask)) < Size);
+			}
+
+			// Single sample coverage of up to four micro triangles at once, one per lane, over all 16 pixels of
+			// their blocks. Fragments match the fine path's and are emitted in the order the triangles are given.
+			void MicroRasterize(Tile& tile,
+				const RasterTriangle* const* ppTris,
+				const int count,
+				const Vector2i& blockMin,
+				const Vector2i& blockMax)
+			{
+				Assert(count > 0 && count <= TriangleBatchSSE::LANES);
+
+				// Unused lanes repeat the first triangle and are never emitted
+				TriangleBatchSSE batch;
+				for (auto lane = 0; lane < TriangleBatchSSE::LANES; lane++)
+					batch.Set(lane, *ppTris[lane < count ? lane : 0]);
+
+				const IntSSE QuadMask = IntSSE(~1);
+				Vec2i_SSE origin;
+				origin.x = (SSE::Min(batch.v0.x, SSE::Min(batch.v1.x, batch.v2.x)) >> 4) & QuadMask;
+				origin.y = (SSE::Min(batch.v0.y, SSE::Min(batch.v1.y, batch.v2.y)) >> 4) & QuadMask;
+
+				const Vec2i_SSE center = Vec2i_SSE((origin.x << 4) + IntSSE(8), (origin.y << 4) + IntSSE(8));
+				const IntSSE edgeVal0 = batch.EdgeFunc0(center);
+				const IntSSE edgeVal1 = batch.EdgeFunc1(center);
+				const IntSSE edgeVal2 = batch.EdgeFunc2(center);
+
+				// quadCoverage[q][t] is the coverage of quad q of triangle t, lanes in mCenterOffset order
+				BoolSSE quadCoverage[4][TriangleBatchSSE::LANES];
+				int coveredQuads = 0;
+				for (auto q = 0; q < 4; q++)
+				{
+					const int quadX = (q % 2) << 1;
+					const int quadY = (q >> 1) << 1;
+
+					// Quads outside the block belong to another block of the tile, or another tile
+					const IntSSE pixelX = origin.x + IntSSE(quadX);
+					const IntSSE pixelY = origin.y + IntSSE(quadY);
+					const BoolSSE inBlock = (pixelX >= IntSSE(blockMin.x)) & (pixelX < IntSSE(blockMax.x)) &
+						(pixelY >= IntSSE(blockMin.y)) & (pixelY < IntSSE(blockMax.y));
+
+					__m128 pixelCoverage[4];
+					for (auto p = 0; p < 4; p++)
+					{
+						const int dx = (quadX + (p % 2)) << 4;
+						const int dy = (quadY + (p >> 1)) << 4;
+						const IntSSE e0 = edgeVal0 + dx * batch.B0 + dy * batch.C0;
+						const IntSSE e1 = edgeVal1 + dx * batch.B1 + dy * batch.C1;
+						const IntSSE e2 = edgeVal2 + dx * batch.B2 + dy * batch.C2;
+						pixelCoverage[p] = (((e0 | e1 | e2) >= IntSSE(Math::EDX_ZERO)) & inBlock).m128;
+					}
+
+					// From one lane per triangle to one lane per pixel
+					_MM_TRANSPOSE4_PS(pixelCoverage[0], pixelCoverage[1], pixelCoverage[2], pixelCoverage[3]);
+					for (auto t = 0; t < TriangleBatchSSE::LANES; t++)
+					{
+						quadCoverage[q][t] = pixelCoverage[t];
+						if (_mm_movemask_ps(pixelCoverage[t]))
+							coveredQuads |= 1 << (4 * t + q);
+					}
+				}
+
+				for (auto t = 0; t < count; t++)
+				{
+					if (((coveredQuads >> (4 * t)) & 0xF) == 0)
+						continue;
+
+					const RasterTriangle& tri = *ppTris[t];
+					const ProjectedVertex& v0 = mpDistProjVertexBuf_Ref[tri.coreId][tri.vId0];
+					const ProjectedVertex& v1 = mpDistProjVertexBuf_Ref[tri.coreId][tri.vId1];
+					const ProjectedVertex& v2 = mpDistProjVertexBuf_Ref[tri.coreId][tri.vId2];
+					const FloatSSE invDet = FloatSSE(tri.invDet);
+
+					for (auto q = 0; q < 4; q++)
+					{
+						if (!(coveredQuads & (1 << (4 * t + q))))
+							continue;
+
+						const Vector2i pixelCrd = Vector2i(origin.x[t] + ((q % 2) << 1), origin.y[t] + ((q >> 1) << 1));
+						const Vec2i_SSE pixelCenter = Vec2i_SSE(pixelCrd.x << 4, pixelCrd.y << 4) + mCenterOffset;
+						const IntSSE dx = pixelCenter.x - IntSSE(tri.v2.x);
+						const IntSSE dy = pixelCenter.y - IntSSE(tri.v2.y);
+						const FloatSSE lambda0 = FloatSSE(tri.B1 * dx + tri.C1 * dy) * invDet;
+						const FloatSSE lambda1 = FloatSSE(tri.B2 * dx + tri.C2 * dy) * invDet;
+						const FloatSSE depth = lambda0 * v0.projectedPos.z + lambda1 * v1.projectedPos.z +
+							(FloatSSE(Math::EDX_ONE) - lambda0 - lambda1) * v2.projectedPos.z;
+
+						const BoolSSE covered = quadCoverage[q][t];
+						const BoolSSE visible = mpFrameBuffer->ZTestQuad(depth, pixelCrd.x, pixelCrd.y, 0, covered) & covered;
+						if (SSE::Any(visible))
+							tile.AddFragment(lambda0, lambda1, tri.coreId, tri.triId, pixelCrd, CoverageMask(visible, 0));
+					}
+				}
+			}
+
+		private:
+			__forceinline void FineRasterize_SingleSample_SSE(Tile& tile,
 				const Tile::TriangleRef& triRef,
 				const Vector2i& blockMin,
 				const Vector2i& blockMax,
@@ -173,17 +353,7 @@ namespace EDX
 							BoolSSE visible = zTest & covered;
 							if (SSE::Any(visible))
 							{
-								tile.fragmentBuf.Add(Fragment(triSSE.lambda0,
-									triSSE.lambda1,
-									triSSE.vId0,
-									triSSE.vId1,
-									triSSE.vId2,
-									triSSE.coreId,
-									triSSE.textureId,
-									pixelCrd,
-									CoverageMask(visible, 0),
-									tile.tileId,
-									tile.fragmentBuf.Size()));
+								tile.AddFragment(triSSE.lambda0, triSSE.lambda1, triSSE.coreId, triSSE.triId, pixelCrd, CoverageMask(visible, 0));
 							}
 						}
 
@@ -199,14 +369,28 @@ namespace EDX
 				}
 			}
 
+			// Evaluate edge functions for a 4x2 (AVX2) or 4x4 (AVX-512) pixel block at once. Defined in their own
+			// translation units, see RasterWide.h.
+			void FineRasterize_SingleSample_AVX2(Tile& tile,
+				const Tile::TriangleRef& triRef,
+				const Vector2i& blockMin,
+				const Vector2i& blockMax,
+				const RasterTriangle& tri);
+			void FineRasterize_SingleSample_AVX512(Tile& tile,
+				const Tile::TriangleRef& triRef,
+				const Vector2i& blockMin,
+				const Vector2i& blockMax,
+				const RasterTriangle& tri);
+
+			template<uint MultiSampleLevel>
 			__forceinline void FineRasterize_MultiSample(Tile& tile,
 				const Tile::TriangleRef& triRef,
 				const Vector2i& blockMin,
 				const Vector2i& blockMax,
 				const RasterTriangle& tri)
 			{
-				const uint sampleCount = mpFrameBuffer->GetSampleCount();
-				const uint multiSampleLevel = mpFrameBuffer->GetMultiSampleLevel();
+				const uint SampleCount = 1 << MultiSampleLevel;
+				const int* pSampleOffsets = FrameBuffer::MultiSampleOffsets[MultiSampleLevel];
 
 				int minX = Math::Max(blockMin.x, Math::Min(tri.v0.x, Math::Min(tri.v1.x, tri.v2.x)) >> 4);
 				int maxX = Math::Min(blockMax.x - 1, Math::Max(tri.v0.x, Math::Max(tri.v1.x, tri.v2.x)) >> 4);
@@ -242,9 +426,9 @@ namespace EDX
 						CoverageMask mask;
 						BoolSSE covered = BoolSSE(Constants::EDX_TRUE);
 
-						for (auto sampleId = 0; sampleId < sampleCount; sampleId++)
+						for (uint sampleId = 0; sampleId < SampleCount; sampleId++)
 						{
-							const Vector2i& sampleOffset = FrameBuffer::MultiSampleOffsets[multiSampleLevel][2 * sampleId];
+							const Vector2i sampleOffset = Vector2i(pSampleOffsets[2 * sampleId], pSampleOffsets[2 * sampleId + 1]);
 							IntSSE e0 = edgeVal0 + sampleOffset.x * triSSE.B0 + sampleOffset.y * triSSE.C0;
 							IntSSE e1 = edgeVal1 + sampleOffset.x * triSSE.B1 + sampleOffset.y * triSSE.C1;
 							IntSSE e2 = edgeVal2 + sampleOffset.x * triSSE.B2 + sampleOffset.y * triSSE.C2;
@@ -274,17 +458,7 @@ namespace EDX
 						{
 							triSSE.CalcBarycentricCoord(pixelCenter.x, pixelCenter.y);
 
-							tile.fragmentBuf.Add(Fragment(triSSE.lambda0,
-								triSSE.lambda1,
-								triSSE.vId0,
-								triSSE.vId1,
-								triSSE.vId2,
-								triSSE.coreId,
-								triSSE.textureId,
-								pixelCrd,
-								mask,
-								tile.tileId,
-								tile.fragmentBuf.Size()));
+							tile.AddFragment(triSSE.lambda0, triSSE.lambda1, triSSE.coreId, triSSE.triId, pixelCrd, mask);
 						}
 
 						edgeVal0 += triSSE.stepB0;
@@ -299,14 +473,6 @@ namespace EDX
 				}
 			}
 
-			__forceinline void TrivialAcceptTriangle(Tile& tile, const Vector2i& blockMin, const Vector2i & blockMax, const RasterTriangle& tri)
-			{
-				if (mpFrameBuffer->GetSampleCount() == 1)
-					TrivialAcceptTriangle_SingleSample(tile, blockMin, blockMax, tri);
-				else
-					TrivialAcceptTriangle_MultiSample(tile, blockMin, blockMax, tri);
-			}
-
 			__forceinline void TrivialAcceptTriangle_SingleSample(Tile& tile, const Vector2i& blockMin, const Vector2i & blockMax, const RasterTriangle& tri)
 			{
 				int minX = blockMin.x;
@@ -336,26 +502,17 @@ namespace EDX
 						BoolSSE zTest = mpFrameBuffer->ZTestQuad(triSSE.GetDepth(v0, v1, v2), pixelCrd.x, pixelCrd.y, 0, BoolSSE(Constants::EDX_TRUE));
 						if (SSE::Any(zTest))
 						{
-							tile.fragmentBuf.Add(Fragment(triSSE.lambda0,
-								triSSE.lambda1,
-								triSSE.vId0,
-								triSSE.vId1,
-								triSSE.vId2,
-								triSSE.coreId,
-								triSSE.textureId,
-								pixelCrd,
-								CoverageMask(zTest, 0),
-								tile.tileId,
-								tile.fragmentBuf.Size()));
+							tile.AddFragment(triSSE.lambda0, triSSE.lambda1, triSSE.coreId, triSSE.triId, pixelCrd, CoverageMask(zTest, 0));
 						}
 					}
 				}
 			}
 
+			template<uint MultiSampleLevel>
 			__forceinline void TrivialAcceptTriangle_MultiSample(Tile& tile, const Vector2i& blockMin, const Vector2i & blockMax, const RasterTriangle& tri)
 			{
-				const uint sampleCount = mpFrameBuffer->GetSampleCount();
-				const uint multiSampleLevel = mpFrameBuffer->GetMultiSampleLevel();
+				const uint SampleCount = 1 << MultiSampleLevel;
+				const int* pSampleOffsets = FrameBuffer::MultiSampleOffsets[MultiSampleLevel];
 
 				int minX = blockMin.x;
 				int maxX = blockMax.x - 1;
@@ -377,9 +534,9 @@ namespace EDX
 						CoverageMask mask;
 						bool genFragment = false;
 						Vec2i_SSE pixelCenter = pixelBase + mCenterOffset;
-						for (auto sampleId = 0; sampleId < sampleCount; sampleId++)
+						for (uint sampleId = 0; sampleId < SampleCount; sampleId++)
 						{
-							const Vector2i& sampleOffset = FrameBuffer::MultiSampleOffsets[multiSampleLevel][2 * sampleId];
+							const Vector2i sampleOffset = Vector2i(pSampleOffsets[2 * sampleId], pSampleOffsets[2 * sampleId + 1]);
 							Vec2i_SSE samplePos = pixelCenter + sampleOffset;
 							triSSE.CalcBarycentricCoord(samplePos.x, samplePos.y);
 
@@ -398,17 +555,7 @@ namespace EDX
 						if (genFragment)
 						{
 							triSSE.CalcBarycentricCoord(pixelCenter.x, pixelCenter.y);
-							tile.fragmentBuf.Add(Fragment(triSSE.lambda0,
-								triSSE.lambda1,
-								triSSE.vId0,
-								triSSE.vId1,
-								triSSE.vId2,
-								triSSE.coreId,
-								triSSE.textureId,
-								pixelCrd,
-								mask,
-								tile.tileId,
-								tile.fragmentBuf.Size()));
+							tile.AddFragment(triSSE.lambda0, triSSE.lambda1, triSSE.coreId, triSSE.triId, pixelCrd, mask);
 						}
 					}
 				}
@@ -0,0 +1,28 @@
+#include "Rasterizer.h"
+
+#if EDX_RASTER_AVX2
+
+#if defined(_MSC_VER)
+// MSVC emits the intrinsics as written without /arch, which would let AVX code into shared inline functions
+#define EDX_RASTER_WIDE_TARGET
+#else
+#define EDX_RASTER_WIDE_TARGET __attribute__((target("avx2")))
+#endif
+#include "RasterWide.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		void Rasterizer::FineRasterize_SingleSample_AVX2(Tile& tile,
+			const Tile::TriangleRef& triRef,
+			const Vector2i& blockMin,
+			const Vector2i& blockMax,
+			const RasterTriangle& tri)
+		{
+			FineRasterizeWide<8>(tile, mpFrameBuffer, mpDistProjVertexBuf_Ref, mCenterOffset, blockMin, blockMax, tri);
+		}
+	}
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include "Graphics/Texture.h"
 #include "Math/Matrix.h"
 #include "Core/SmartPointer.h"
+#include "RasterSIMD.h"
+#include "RasterTexture.h"
 
 namespace EDX
 {
@@ -24,8 +26,7 @@ namespace EDX
 
 			int FrameCount;
 			bool HierarchicalRasterize;
-
-			const Array<UniquePtr<Texture2D<Color>>>* TextureSlots = nullptr;
+			uint RasterSIMDWidth;
 
 		private:
 			RenderStates()
@@ -57,6 +58,7 @@ namespace EDX
 				MultiSampleLevel = 0;
 				BackFaceCull = true;
 				HierarchicalRasterize = true;
+				RasterSIMDWidth = CPUFeatures::DetectRasterSIMDWidth();
 				TexFilter = TextureFilter::TriLinear;
 			}
 
@@ -65,7 +67,7 @@ namespace EDX
 			const Matrix& GetModelViewInvMatrix() const { return ModelViewInvMatrix; }
 			const Matrix& GetProjectMatrix() const { return ProjMatrix; }
 			const Matrix& GetRasterMatrix() const { return RasterMatrix; }
-			const TextureFilter GetTextureFilter() const { return TexFilter; }
+			TextureFilter GetTextureFilter() const { return TexFilter; }
 		};
 	}
 }
\ No newline at end of file
@@ -7,11 +7,8 @@
 #include "../Utils/Mesh.h"
 #include "../Utils/InputBuffer.h"
 #include "Math/Matrix.h"
-#include "Windows/Bitmap.h"
-#include "Windows/Application.h"
 
-#include <ppl.h>
-using namespace concurrency;
+#include <algorithm>
 
 namespace EDX
 {
@@ -19,18 +16,24 @@ namespace EDX
 	{
 		RenderStates* RenderStates::mpInstance = nullptr;
 
-		void Renderer::Initialize(uint iScreenWidth, uint iScreenHeight)
+		Renderer::Renderer()
+			: mAsyncPipelining(false), mBackEndPending(false), mWriteFrames(false)
 		{
-			RenderStates::Instance()->DefaultSettings();
-
-			mTileDim.x = (iScreenWidth + Tile::SIZE - 1) >> Tile::SIZE_LOG_2;
-			mTileDim.y = (iScreenHeight + Tile::SIZE - 1) >> Tile::SIZE_LOG_2;
+			TaskSystem::AddRef();
 
-			if (!mpFrameBuffer)
+			// Safe to destroy before Initialize
+			for (auto& frame : mFrames)
 			{
-				mpFrameBuffer = MakeUnique<FrameBuffer>();
+				frame.pDistributedProjVertexBuf = nullptr;
+				frame.pRasterTriangleBuf = nullptr;
+				frame.pTriangleBlockBuf = nullptr;
+				frame.pTriangleHashBuf = nullptr;
 			}
-			mpFrameBuffer->Init(iScreenWidth, iScreenHeight, mTileDim, RenderStates::Instance()->MultiSampleLevel);
+		}
+
+		void Renderer::Initialize(uint iScreenWidth, uint iScreenHeight)
+		{
+			RenderStates::Instance()->DefaultSettings();
 
 			if (!mpScene)
 			{
@@ -40,46 +43,130 @@ namespace EDX
 			mpVertexShader = MakeUnique<DefaultVertexShader>();
 			mpPixelShader = MakeUnique<LambertianAlbedoPixelShader>();
 
-			int tId = 0;
-			for (auto i = 0; i < iScreenHeight; i += Tile::SIZE)
+			// Fragments address triangles by core, so there are no more cores than a packed id can hold
+			mNumCores = Math::Min(TaskSystem::Instance()->GetWorkerCount(), 1 << FragmentBuffer::CORE_ID_BITS);
+			mWriteFrames = false;
+			mFrameDirectory = "Frames";
+			mpFrameEncoder = MakeUnique<FrameEncoder>();
+			mPipelineMode = PipelineMode::Deferred;
+			mQuadMerging = true;
+			mFrustumCulling = true;
+			mClusterCulling = true;
+			mCulledDrawCount = 0;
+			mInFrame = false;
+			mShaderInvocations = 0;
+			mShadedLanes = 0;
+			mIncremental = false;
+			mTileHashesValid = false;
+			mDirtyTileCount = 0;
+			mAsyncPipelining = false;
+			mBackEndPending = false;
+			mInBatch = false;
+			mFrameIndicesValid = false;
+			mpBatchViews = nullptr;
+			mTargetUseCount = 0;
+
+			mTileScheduler.Init();
+
+			mProjectedVertexBuf.SetArena(&mFrameArena);
+			mpShadingResultBuf = nullptr;
+			for (auto& frame : mFrames)
 			{
-				for (auto j = 0; j < iScreenWidth; j += Tile::SIZE)
+				frame.viewId = -1;
+				frame.pDistributedProjVertexBuf = new FrameArray<ProjectedVertex>[mNumCores];
+				frame.pRasterTriangleBuf = new FrameArray<RasterTriangle>[mNumCores];
+				frame.pTriangleBlockBuf = new FrameArray<TriangleBlock>[mNumCores];
+				frame.pTriangleHashBuf = new FrameArray<uint64>[mNumCores];
+				for (auto i = 0; i < mNumCores; i++)
 				{
-					auto maxX = Math::Min(j + Tile::SIZE, iScreenWidth);
-					auto maxY = Math::Min(i + Tile::SIZE, iScreenHeight);
-
-					mTiles.Add(Tile(Vector2i(j, i), Vector2i(maxX, maxY), tId++));
+					// Core i's loop partition runs on worker i, so its buffers live on that worker's node
+					frame.coreArenas.Add(MakeUnique<FrameArena>());
+					frame.coreArenas[i]->SetNode(TaskSystem::Instance()->GetWorkerNode(i));
+					frame.pDistributedProjVertexBuf[i].SetArena(frame.coreArenas[i].Get());
+					frame.pRasterTriangleBuf[i].SetArena(frame.coreArenas[i].Get());
+					frame.pTriangleBlockBuf[i].SetArena(frame.coreArenas[i].Get());
+					frame.pTriangleHashBuf[i].SetArena(frame.coreArenas[i].Get());
 				}
 			}
+			mpGeometryFrame = &mFrames[0];
+			mpRenderFrame = &mFrames[0];
 
-			mNumCores = GetNumberOfCores();
-			mWriteFrames = false;
-
-			mpDistributedProjVertexBuf = new Array<ProjectedVertex>[mNumCores];
-			mpRasterTriangleBuf = new Array<RasterTriangle>[mNumCores];
-
-			mpRasterizer = MakeUnique<Rasterizer>(mpFrameBuffer.Get(), mpDistributedProjVertexBuf);
+			mpTarget = nullptr;
+			mpRasterizer = MakeUnique<Rasterizer>(nullptr, mpRenderFrame->pDistributedProjVertexBuf);
+			SelectRenderTarget(iScreenWidth, iScreenHeight);
 		}
 
 		void Renderer::Resize(uint iScreenWidth, uint iScreenHeight)
 		{
-			mTileDim.x = (iScreenWidth + Tile::SIZE - 1) >> Tile::SIZE_LOG_2;
-			mTileDim.y = (iScreenHeight + Tile::SIZE - 1) >> Tile::SIZE_LOG_2;
+			SelectRenderTarget(iScreenWidth, iScreenHeight);
+		}
+
+		void Renderer::SelectRenderTarget(const uint width, const uint height)
+		{
+			const uint sampleLevel = RenderStates::Instance()->MultiSampleLevel;
+			if (mpTarget && mpTarget->pFrameBuffer->GetWidth() == width && mpTarget->pFrameBuffer->GetHeight() == height)
+			{
+				mpTarget->lastUse = ++mTargetUseCount;
+				return;
+			}
+
+			// The back end in flight renders into the current target
+			Flush();
 
-			mpFrameBuffer->Resize(iScreenWidth, iScreenHeight, mTileDim, RenderStates::Instance()->MultiSampleLevel);
+			RenderTarget* pTarget = nullptr;
+			for (auto& it : mRenderTargets)
+			{
+				if (it->pFrameBuffer->GetWidth() == width && it->pFrameBuffer->GetHeight() == height)
+					pTarget = it.Get();
+			}
 
-			mTiles.Clear();
-			int tId = 0;
-			for (auto i = 0; i < iScreenHeight; i += Tile::SIZE)
+			if (!pTarget)
 			{
-				for (auto j = 0; j < iScreenWidth; j += Tile::SIZE)
+				// Least recently used targets make room for new resolutions
+				int slot = mRenderTargets.Size();
+				if (slot == MAX_RENDER_TARGETS)
 				{
-					auto maxX = Math::Min(j + Tile::SIZE, iScreenWidth);
-					auto maxY = Math::Min(i + Tile::SIZE, iScreenHeight);
+					slot = 0;
+					for (auto i = 1; i < mRenderTargets.Size(); i++)
+					{
+						if (mRenderTargets[i]->lastUse < mRenderTargets[slot]->lastUse)
+							slot = i;
+					}
+					mRenderTargets[slot] = MakeUnique<RenderTarget>();
+				}
+				else
+					mRenderTargets.Add(MakeUnique<RenderTarget>());
+
+				pTarget = mRenderTargets[slot].Get();
+				pTarget->tileDim.x = (width + Tile::SIZE - 1) >> Tile::SIZE_LOG_2;
+				pTarget->tileDim.y = (height + Tile::SIZE - 1) >> Tile::SIZE_LOG_2;
 
-					mTiles.Add(Tile(Vector2i(j, i), Vector2i(maxX, maxY), tId++));
+				pTarget->pFrameBuffer = MakeUnique<FrameBuffer>();
+				pTarget->pFrameBuffer->Init(width, height, pTarget->tileDim, sampleLevel);
+
+				int tId = 0;
+				for (uint i = 0; i < height; i += Tile::SIZE)
+				{
+					for (uint j = 0; j < width; j += Tile::SIZE)
+					{
+						auto maxX = Math::Min(j + Tile::SIZE, width);
+						auto maxY = Math::Min(i + Tile::SIZE, height);
+
+						pTarget->tiles.Add(Tile(Vector2i(j, i), Vector2i(maxX, maxY), tId++));
+					}
 				}
+
+				pTarget->binner.Init(mNumCores, pTarget->tiles.Size());
 			}
+			else if (pTarget->pFrameBuffer->GetMultiSampleLevel() != sampleLevel)
+				pTarget->pFrameBuffer->Resize(width, height, pTarget->tileDim, sampleLevel);
+
+			mpTarget = pTarget;
+			mpTarget->lastUse = ++mTargetUseCount;
+			mpTarget->pFrameBuffer->SetDoubleBuffered(mAsyncPipelining);
+			mpTarget->pFrameBuffer->SetCountZRejects(mProfiler.IsEnabled());
+			mpRasterizer->SetFrameBuffer(mpTarget->pFrameBuffer.Get());
+			mTileHashesValid = false;
 		}
 
 		void Renderer::SetTransform(const Matrix& mModelView, const Matrix& mProj, const Matrix& mToRaster)
@@ -93,23 +180,317 @@ namespace EDX
 
 		void Renderer::SetMSAAMode(const int sampleCountLog2)
 		{
+			// Viewers set this every frame, rebuilding the framebuffer would also drain the pipeline
+			if (uint(sampleCountLog2) == mpTarget->pFrameBuffer->GetMultiSampleLevel())
+				return;
+
+			// Only the current target is rebuilt now, pooled ones when they are selected again
+			Flush();
 			RenderStates::Instance()->MultiSampleLevel = sampleCountLog2;
-			Resize(mpFrameBuffer->GetWidth(), mpFrameBuffer->GetHeight());
+			mpTarget->pFrameBuffer->Resize(mpTarget->pFrameBuffer->GetWidth(), mpTarget->pFrameBuffer->GetHeight(), mpTarget->tileDim, sampleCountLog2);
+			mTileHashesValid = false;
+		}
+
+		void Renderer::SetTextureFilter(const TextureFilter filter)
+		{
+			if (filter == RenderStates::Instance()->TexFilter)
+				return;
+
+			Flush();
+			RenderStates::Instance()->TexFilter = filter;
+		}
+
+		void Renderer::SetRasterSIMDWidth(const uint width)
+		{
+			// Never go wider than what the CPU supports
+			const uint clamped = Math::Min(width, CPUFeatures::DetectRasterSIMDWidth());
+			RenderStates::Instance()->RasterSIMDWidth = clamped >= 16 ? 16 : (clamped >= 8 ? 8 : 4);
 		}
 
 		void Renderer::RenderMesh(const Mesh& mesh)
 		{
-			// Clear framebuffer
-			mpFrameBuffer->Clear();
+			BeginFrame();
+			Draw(mesh, Matrix::IDENTITY);
+			EndFrame();
+		}
+
+		void Renderer::RenderScene(const Scene& scene)
+		{
+			BeginFrame();
+			scene.Draw(*this);
+			EndFrame();
+		}
+
+		void Renderer::RenderBatch(const Mesh& mesh, const Array<RenderView>& views, const ViewCallback& onViewDone)
+		{
+			Assert(!mInFrame);
+			Flush();
+
+			// Pooled targets may be evicted during the batch, so the previous one is found by size again
+			const bool wasAsync = mAsyncPipelining;
+			const uint prevWidth = mpTarget->pFrameBuffer->GetWidth();
+			const uint prevHeight = mpTarget->pFrameBuffer->GetHeight();
+			SetAsyncPipelining(true);
+
+			// Views are grouped by resolution, so each target is selected once and the views of one
+			// resolution overlap in the pipeline, each geometry pass with the previous back end
+			Array<int> order;
+			order.Resize(views.Size());
+			for (auto i = 0; i < views.Size(); i++)
+				order[i] = i;
+			std::stable_sort(order.Data(), order.Data() + order.Size(), [&](const int lhs, const int rhs)
+			{
+				return views[lhs].width != views[rhs].width ? views[lhs].width < views[rhs].width : views[lhs].height < views[rhs].height;
+			});
+
+			mInBatch = true;
+			mFrameIndicesValid = false;
+			mpBatchViews = &views;
+			mViewCallback = onViewDone;
+			for (auto i = 0; i < order.Size(); i++)
+			{
+				const RenderView& view = views[order[i]];
+				SelectRenderTarget(view.width, view.height);
+				SetTransform(view.view, view.proj, view.toRaster);
+
+				BeginFrame();
+				mpGeometryFrame->viewId = order[i];
+				Draw(mesh, Matrix::IDENTITY);
+				EndFrame();
+			}
+			Flush();
+
+			mInBatch = false;
+			mFrameIndicesValid = false;
+			mpBatchViews = nullptr;
+			mViewCallback = nullptr;
+
+			SelectRenderTarget(prevWidth, prevHeight);
+			SetAsyncPipelining(wasAsync);
+		}
+
+		void Renderer::BeginFrame()
+		{
+			Assert(!mInFrame);
+			mInFrame = true;
+
+			// Pipelined frames alternate contexts, the back end in flight still reads the other one
+			if (mAsyncPipelining)
+				mpGeometryFrame = mpGeometryFrame == &mFrames[0] ? &mFrames[1] : &mFrames[0];
+			FrameContext& frame = *mpGeometryFrame;
+
+			// Everything allocated from the arenas last frame is released at once
+			mProjectedVertexBuf.Clear();
+			for (auto i = 0; i < mNumCores; i++)
+			{
+				frame.pDistributedProjVertexBuf[i].Clear();
+				frame.pRasterTriangleBuf[i].Clear();
+				frame.pTriangleBlockBuf[i].Clear();
+				frame.pTriangleHashBuf[i].Clear();
+				frame.coreArenas[i]->Reset();
+			}
+			frame.arena.Reset();
+			mFrameArena.Reset();
+			mpTarget->binner.Reset();
+
+			mProfiler.BeginFrame();
 
-			// Set texture index
-			RenderStates::Instance()->TextureSlots = &mesh.GetTextures();
+			frame.drawCalls.Clear();
+			frame.textureSlots.Clear();
+			frame.viewId = -1;
+			mVisibleMeshlets.Clear();
+			mFrameVertexCount = 0;
+			mFrameTriangleCount = 0;
+			mCulledDrawCount = 0;
 
-			VertexProcessing(mesh.GetVertexBuffer());
-			Clipping(mesh.GetIndexBuffer(), mesh.GetTextureIds());
-			TiledRasterization();
-			FragmentProcessing();
-			UpdateFrameBuffer();
+			// Clear framebuffer, incremental frames only clear the tiles they redraw.
+			// Pipelined frames clear in their back end, the previous one may still be writing.
+			if (mIncremental)
+				mpTarget->pFrameBuffer->ResetZRejectCounts();
+			else if (!mAsyncPipelining)
+				mpTarget->pFrameBuffer->Clear();
+		}
+
+		void Renderer::Draw(const Mesh& mesh, const Matrix& transform, const PixelShader* pPixelShader)
+		{
+			Assert(mInFrame);
+			FrameContext& frame = *mpGeometryFrame;
+
+			// Meshes entirely outside the view frustum never reach vertex processing
+			const Matrix worldViewProj = RenderStates::Instance()->GetModelViewProjMatrix() * transform;
+			if (mFrustumCulling && Culling::BoxOutsideFrustum(mesh.GetBounds(), worldViewProj))
+			{
+				mCulledDrawCount++;
+				mProfiler.AddCounter(RenderCounter::TrianglesCulled, mesh.GetIndexBuffer()->GetTriangleCount());
+				mProfiler.AddCounter(RenderCounter::TrianglesIn, mesh.GetIndexBuffer()->GetTriangleCount());
+				return;
+			}
+
+			DrawCall draw;
+			draw.pMesh = &mesh;
+			draw.pPixelShader = pPixelShader ? pPixelShader : mpPixelShader.Get();
+			draw.transform.Init(transform, worldViewProj);
+			draw.vertexOffset = mFrameVertexCount;
+			draw.triangleOffset = mFrameTriangleCount;
+			draw.triangleCount = mesh.GetIndexBuffer()->GetTriangleCount();
+			draw.meshletOffset = mVisibleMeshlets.Size();
+			draw.meshletCount = 0;
+
+			const Array<Meshlet>& meshlets = mesh.GetMeshlets();
+			if (mClusterCulling && meshlets.Size() > 1)
+			{
+				// Facing is tested in object space, against the eye transformed by the inverse world matrix
+				const RenderStates* pStates = RenderStates::Instance();
+				const Vector3 eyePos = Matrix::TransformPoint(Matrix::TransformPoint(Vector3::ZERO, pStates->GetModelViewInvMatrix()), draw.transform.worldInv);
+				const float frontFaceSign = pStates->BackFaceCull ? Culling::FrontFaceSign(worldViewProj, pStates->GetRasterMatrix(), eyePos) : 0.0f;
+
+				uint visibleTriangleCount = 0;
+				for (auto i = 0; i < meshlets.Size(); i++)
+				{
+					const Meshlet& meshlet = meshlets[i];
+					if (Culling::MeshletBackFacing(meshlet, eyePos, frontFaceSign) || Culling::BoxOutsideFrustum(meshlet.bounds, worldViewProj))
+						continue;
+
+					mVisibleMeshlets.Add(i);
+					visibleTriangleCount += meshlet.triangleCount;
+				}
+
+				mProfiler.AddCounter(RenderCounter::TrianglesCulled, draw.triangleCount - visibleTriangleCount);
+				if (visibleTriangleCount == 0)
+				{
+					mCulledDrawCount++;
+					mProfiler.AddCounter(RenderCounter::TrianglesIn, draw.triangleCount);
+					return;
+				}
+
+				// All visible draws keep the plain copy of the whole index buffer
+				if (visibleTriangleCount < draw.triangleCount)
+				{
+					draw.meshletCount = mVisibleMeshlets.Size() - draw.meshletOffset;
+					draw.triangleCount = visibleTriangleCount;
+				}
+				else
+					mVisibleMeshlets.Resize(draw.meshletOffset);
+			}
+
+			// Texture ids are rebased into one slot table for the whole frame
+			draw.textureOffset = frame.textureSlots.Size();
+			for (auto& it : mesh.GetTextures())
+				frame.textureSlots.Add(it.Get());
+
+			mFrameVertexCount += mesh.GetVertexBuffer()->GetVertexCount();
+			mFrameTriangleCount += draw.triangleCount;
+			frame.drawCalls.Add(draw);
+			mProfiler.AddCounter(RenderCounter::TrianglesIn, mesh.GetIndexBuffer()->GetTriangleCount());
+		}
+
+		void Renderer::EndFrame()
+		{
+			Assert(mInFrame);
+			mInFrame = false;
+
+			FrameContext& frame = *mpGeometryFrame;
+			if (frame.drawCalls.Size() > 0)
+			{
+				{
+					ScopedStageTimer timer(mProfiler, RenderStage::VertexProcessing);
+					// Every frame of a batch draws the same mesh, so its indices are concatenated once.
+					// Culled meshlets differ between views, so the set is rebuilt with cluster culling.
+					if (!mFrameIndicesValid)
+						BuildFrameBuffers();
+					mFrameIndicesValid = mInBatch && !mClusterCulling;
+					VertexProcessing();
+				}
+				{
+					ScopedStageTimer timer(mProfiler, RenderStage::Clipping);
+					Clipping();
+				}
+				{
+					ScopedStageTimer timer(mProfiler, RenderStage::Binning);
+					BinTriangles();
+				}
+			}
+			frame.eyePos = Matrix::TransformPoint(Vector3::ZERO, RenderStates::Instance()->GetModelViewInvMatrix());
+
+			// Tiles, the fragment buffers and the framebuffer are shared by consecutive back ends,
+			// so the previous frame completes before this one's bins go into the tiles
+			Flush();
+			mpRenderFrame = mpGeometryFrame;
+			mTextureSampler = TextureSampler(frame.textureSlots, RenderStates::Instance()->GetTextureFilter());
+			mpRasterizer->SetVertexBuffer(frame.pDistributedProjVertexBuf);
+			mpRasterizer->SelectKernels(mpTarget->pFrameBuffer->GetMultiSampleLevel(), RenderStates::Instance()->RasterSIMDWidth);
+			{
+				ScopedStageTimer timer(mProfiler, RenderStage::Binning);
+				MergeBins();
+				if (mIncremental)
+					UpdateDirtyTiles();
+			}
+
+			if (mAsyncPipelining && !mProfiler.IsEnabled())
+			{
+				mBackEndPending = true;
+				mBackEndTask.Run([this]()
+				{
+					RenderBackEnd();
+				});
+			}
+			else
+			{
+				RenderBackEnd();
+				CompleteFrame();
+			}
+		}
+
+		void Renderer::RenderBackEnd()
+		{
+			mShaderInvocations = 0;
+			mShadedLanes = 0;
+			if (mAsyncPipelining && !mIncremental)
+				mpTarget->pFrameBuffer->Clear();
+
+			if (mpRenderFrame->drawCalls.Size() > 0)
+			{
+				if (mPipelineMode == PipelineMode::TileLocal)
+				{
+					// Shading and write back are fused into rasterization here
+					ScopedStageTimer timer(mProfiler, RenderStage::Rasterization);
+					TiledRasterizeShade();
+				}
+				else
+				{
+					{
+						ScopedStageTimer timer(mProfiler, RenderStage::Rasterization);
+						TiledRasterization();
+					}
+					{
+						ScopedStageTimer timer(mProfiler, RenderStage::FragmentProcessing);
+						FragmentProcessing();
+					}
+					{
+						ScopedStageTimer timer(mProfiler, RenderStage::UpdateFrameBuffer);
+						UpdateFrameBuffer();
+					}
+				}
+			}
+			{
+				ScopedStageTimer timer(mProfiler, RenderStage::Resolve);
+				mpTarget->pFrameBuffer->Resolve(mIncremental && !mAsyncPipelining ? mDirtyTiles.Data() : nullptr);
+			}
+
+			if (mProfiler.IsEnabled())
+			{
+				mProfiler.AddCounter(RenderCounter::QuadsShaded, mShaderInvocations);
+				mProfiler.AddCounter(RenderCounter::ZRejectedLanes, mpTarget->pFrameBuffer->GetZRejectedLaneCount());
+			}
+		}
+
+		void Renderer::CompleteFrame()
+		{
+			mpTarget->pFrameBuffer->SwapBuffers();
+			mProfiler.EndFrame();
+
+			if (mpRenderFrame->viewId >= 0)
+				mViewCallback(mpRenderFrame->viewId, (*mpBatchViews)[mpRenderFrame->viewId], GetBackBuffer());
 
 			if (mWriteFrames)
 				WriteFrameToFile();
@@ -117,110 +498,204 @@ namespace EDX
 			RenderStates::Instance()->FrameCount++;
 		}
 
-		void Renderer::VertexProcessing(const IVertexBuffer* pVertexBuf)
+		void Renderer::Flush()
 		{
-			mProjectedVertexBuf.Resize(pVertexBuf->GetVertexCount());
-			parallel_for(0, (int)pVertexBuf->GetVertexCount(), [&](int i)
+			if (!mBackEndPending)
+				return;
+
+			mBackEndTask.Wait();
+			mBackEndPending = false;
+			CompleteFrame();
+		}
+
+		void Renderer::SetAsyncPipelining(const bool async)
+		{
+			Assert(!mInFrame);
+			Flush();
+
+			mAsyncPipelining = async;
+			mpTarget->pFrameBuffer->SetDoubleBuffered(async);
+		}
+
+		void Renderer::BuildFrameBuffers()
+		{
+			// Indices of all draws are concatenated in submission order, so the clipper's contiguous
+			// per core split keeps primitive order across draws as well as within them
+			mFrameIndexBuf.ResizeBuffer(mFrameTriangleCount);
+			mFrameTexIdBuf.Resize(mFrameTriangleCount);
+			mFrameDrawIdBuf.Resize(mFrameTriangleCount);
+			const Array<DrawCall>& drawCalls = mpGeometryFrame->drawCalls;
+			ParallelFor(0, (int)drawCalls.Size(), [&](int drawId)
 			{
-				mpVertexShader->Execute(pVertexBuf->GetPosition(i), pVertexBuf->GetNormal(i), pVertexBuf->GetTexCoord(i), &mProjectedVertexBuf[i]);
+				ScopedProfileEvent event(mProfiler, "CopyIndices");
+				const DrawCall& draw = drawCalls[drawId];
+				const IndexBuffer* pIndexBuf = draw.pMesh->GetIndexBuffer();
+				const Array<uint>& texIds = draw.pMesh->GetTextureIds();
+
+				uint dest = draw.triangleOffset;
+				auto CopyTriangles = [&](const uint first, const uint count)
+				{
+					uint* pIndices = mFrameIndexBuf.GetBuffer() + 3 * dest;
+					for (uint i = 0; i < count; i++)
+					{
+						const uint* pIndex = pIndexBuf->GetIndex(first + i);
+						pIndices[3 * i + 0] = pIndex[0] + draw.vertexOffset;
+						pIndices[3 * i + 1] = pIndex[1] + draw.vertexOffset;
+						pIndices[3 * i + 2] = pIndex[2] + draw.vertexOffset;
+
+						mFrameTexIdBuf[dest + i] = texIds[first + i] + draw.textureOffset;
+						mFrameDrawIdBuf[dest + i] = drawId;
+					}
+					dest += count;
+				};
+
+				// Meshlets are contiguous triangle ranges, so visible ones are copied as runs
+				if (draw.meshletCount == 0)
+					CopyTriangles(0, draw.triangleCount);
+				else
+				{
+					const Array<Meshlet>& meshlets = draw.pMesh->GetMeshlets();
+					for (uint i = 0; i < draw.meshletCount; i++)
+					{
+						const Meshlet& meshlet = meshlets[mVisibleMeshlets[draw.meshletOffset + i]];
+						CopyTriangles(meshlet.triangleOffset, meshlet.triangleCount);
+					}
+				}
 			});
 		}
 
-		void Renderer::Clipping(IndexBuffer* pIndexBuf, const Array<uint>& texIdBuf)
+		void Renderer::VertexProcessing()
 		{
-			parallel_for(0, mNumCores, [&](int coreId)
+			// Fixed size chunks never straddle a draw, so each job shades one vertex buffer in SoA batches
+			const Array<DrawCall>& drawCalls = mpGeometryFrame->drawCalls;
+			mVertexChunks.Clear();
+			for (auto i = 0; i < drawCalls.Size(); i++)
+			{
+				const uint vertexCount = drawCalls[i].pMesh->GetVertexBuffer()->GetVertexCount();
+				for (uint first = 0; first < vertexCount; first += VERTEX_CHUNK_SIZE)
+				{
+					VertexChunk chunk = { uint(i), uint(first), Math::Min(uint(first + VERTEX_CHUNK_SIZE), vertexCount) };
+					mVertexChunks.Add(chunk);
+				}
+			}
+
+			mProjectedVertexBuf.Resize(mFrameVertexCount);
+			ParallelFor(0, (int)mVertexChunks.Size(), [&](int i)
 			{
-				mpDistributedProjVertexBuf[coreId].Clear();
-				mpRasterTriangleBuf[coreId].Clear();
+				ScopedProfileEvent event(mProfiler, "ShadeVertices");
+				const VertexChunk& chunk = mVertexChunks[i];
+				const DrawCall& draw = drawCalls[chunk.drawId];
+				const IVertexBuffer* pVertexBuf = draw.pMesh->GetVertexBuffer();
+
+				Vec3f_SSE position;
+				Vec3f_SSE normal;
+				Vec2f_SSE texCoord;
+				for (auto first = chunk.first; first < chunk.last; first += VertexShader::BATCH_SIZE)
+				{
+					const uint count = Math::Min(uint(VertexShader::BATCH_SIZE), chunk.last - first);
+					pVertexBuf->GatherSoA(first, count, position, normal, texCoord);
+					mpVertexShader->ExecuteBatch(position, normal, texCoord, draw.transform, &mProjectedVertexBuf[draw.vertexOffset + first], count);
+				}
 			});
+		}
 
-			Clipper::Clip(mProjectedVertexBuf, pIndexBuf, texIdBuf, mpDistributedProjVertexBuf, mpRasterTriangleBuf, mNumCores);
+		void Renderer::Clipping()
+		{
+			// Per core buffers were released with their arenas in BeginFrame
+			const Vector2 guardBand = Clipper::ComputeGuardBand(mpTarget->pFrameBuffer->GetWidth(), mpTarget->pFrameBuffer->GetHeight());
+			const RenderStates* pStates = RenderStates::Instance();
+			FrameContext& frame = *mpGeometryFrame;
+			const uint clippedCount = Clipper::Clip(mProjectedVertexBuf, &mFrameIndexBuf, mFrameTexIdBuf, mFrameDrawIdBuf, frame.pDistributedProjVertexBuf, frame.pRasterTriangleBuf,
+				frame.pTriangleBlockBuf, guardBand, pStates->GetRasterMatrix(), pStates->BackFaceCull, mNumCores, mProfiler);
+			mProfiler.AddCounter(RenderCounter::TrianglesClipped, clippedCount);
 
-			parallel_for(0, mNumCores, [&](int coreId)
+			ParallelFor(0, mNumCores, [&](int coreId)
 			{
-				for (auto i = 0; i < mpDistributedProjVertexBuf[coreId].Size(); i++)
+				ScopedProfileEvent event(mProfiler, "ProjectVertices");
+				for (auto i = 0; i < frame.pDistributedProjVertexBuf[coreId].Size(); i++)
 				{
-					ProjectedVertex& vertex = mpDistributedProjVertexBuf[coreId][i];
+					ProjectedVertex& vertex = frame.pDistributedProjVertexBuf[coreId][i];
 					vertex.invW = 1.0f / vertex.projectedPos.w;
 					vertex.projectedPos.z *= vertex.invW;
 				}
 			});
 		}
 
-		void Renderer::TiledRasterization()
+		void Renderer::BinTriangles()
 		{
-			// Binning triangles
-			parallel_for(0, (int)mTiles.Size(), [&](int i)
-			{
-				for (auto c = 0; c < mNumCores; c++)
-					mTiles[i].triangleRefs[c].Clear();
-
-				mTiles[i].fragmentBuf.Clear();
-			});
-
+			// Binning triangles. Depth is cleared before the frame is rasterized, so occlusion is only
+			// tested per block while rasterizing.
+			const FrameContext& frame = *mpGeometryFrame;
 			const int Shift = Tile::SIZE_LOG_2 + 4;
-			parallel_for(0, mNumCores, [&](int coreId)
+			const IntSSE maxTileX = IntSSE(mpTarget->tileDim.x - 1);
+			const IntSSE maxTileY = IntSSE(mpTarget->tileDim.y - 1);
+			ParallelFor(0, mNumCores, [&](int coreId)
 			{
-				for (auto i = 0; i < mpRasterTriangleBuf[coreId].Size(); i++)
+				ScopedProfileEvent event(mProfiler, "BinTriangles");
+				const FrameArray<TriangleBlock>& blocks = frame.pTriangleBlockBuf[coreId];
+				const int triangleCount = frame.pRasterTriangleBuf[coreId].Size();
+				for (auto b = 0; b < blocks.Size(); b++)
 				{
-					const RasterTriangle& tri = mpRasterTriangleBuf[coreId][i];
+					const TriangleBlock& block = blocks[b];
 
-					int minX = Math::Max(0, Math::Min(tri.v0.x, Math::Min(tri.v1.x, tri.v2.x)) >> Shift);
-					int maxX = Math::Min(mTileDim.x - 1, Math::Max(tri.v0.x, Math::Max(tri.v1.x, tri.v2.x)) >> Shift);
-					int minY = Math::Max(0, Math::Min(tri.v0.y, Math::Min(tri.v1.y, tri.v2.y)) >> Shift);
-					int maxY = Math::Min(mTileDim.y - 1, Math::Max(tri.v0.y, Math::Max(tri.v1.y, tri.v2.y)) >> Shift);
+					// Tile bounds and micro triangle classification of a whole block at once
+					const IntSSE Zero = IntSSE(Math::EDX_ZERO);
+					const IntSSE vMinX = SSE::Min(block.v0x, SSE::Min(block.v1x, block.v2x));
+					const IntSSE vMaxX = SSE::Max(block.v0x, SSE::Max(block.v1x, block.v2x));
+					const IntSSE vMinY = SSE::Min(block.v0y, SSE::Min(block.v1y, block.v2y));
+					const IntSSE vMaxY = SSE::Max(block.v0y, SSE::Max(block.v1y, block.v2y));
+					const IntSSE minX = SSE::Max(Zero, vMinX >> Shift);
+					const IntSSE maxX = SSE::Min(maxTileX, vMaxX >> Shift);
+					const IntSSE minY = SSE::Max(Zero, vMinY >> Shift);
+					const IntSSE maxY = SSE::Min(maxTileY, vMaxY >> Shift);
+					const int microMask = _mm_movemask_ps(Rasterizer::MicroTriangles(vMinX, vMaxX, vMinY, vMaxY).m128);
 
-					if (maxX - minX < 2 && maxY - minY < 2)
+					const int laneCount = Math::Min(TriangleBlock::LANES, triangleCount - b * TriangleBlock::LANES);
+					for (auto lane = 0; lane < laneCount; lane++)
 					{
-						for (auto y = minY; y <= maxY; y++)
+						const int i = b * TriangleBlock::LANES + lane;
+						if (maxX[lane] - minX[lane] < 2 && maxY[lane] - minY[lane] < 2)
 						{
-							for (auto x = minX; x <= maxX; x++)
-								mTiles[y * mTileDim.x + x].triangleRefs[coreId].Add(Tile::TriangleRef(i));
+							Tile::TriangleRef triRef = Tile::TriangleRef(i, coreId);
+							triRef.micro = (microMask & (1 << lane)) != 0;
+
+							for (auto y = minY[lane]; y <= maxY[lane]; y++)
+							{
+								for (auto x = minX[lane]; x <= maxX[lane]; x++)
+								{
+									mpTarget->binner.Add(coreId, y * mpTarget->tileDim.x + x, triRef);
+								}
+							}
+							continue;
 						}
-					}
-					else
-					{
-						for (auto y = minY; y <= maxY; y++)
+
+						const TriangleEdges edges(block, lane);
+						int rejCorners[3], acptCorners[3];
+						for (auto k = 0; k < 3; k++)
 						{
-							for (auto x = minX; x <= maxX; x++)
+							rejCorners[k] = (block.rejectCorners[lane] >> (2 * k)) & 3;
+							acptCorners[k] = 3 - rejCorners[k];
+						}
+
+						for (auto y = minY[lane]; y <= maxY[lane]; y++)
+						{
+							for (auto x = minX[lane]; x <= maxX[lane]; x++)
 							{
-								Vector2i pixelBase = Vector2i(x, y);
-
-								const Vector2i rejCornerOffset0 = Vector2i(tri.rejectCorner0 % 2, tri.rejectCorner0 / 2);
-								const Vector2i rejCornerOffset1 = Vector2i(tri.rejectCorner1 % 2, tri.rejectCorner1 / 2);
-								const Vector2i rejCornerOffset2 = Vector2i(tri.rejectCorner2 % 2, tri.rejectCorner2 / 2);
-
-								const Vector2i rejCorner0 = Vector2i(
-									(pixelBase.x + rejCornerOffset0.x) << Shift,
-									(pixelBase.y + rejCornerOffset0.y) << Shift);
-								const Vector2i rejCorner1 = Vector2i(
-									(pixelBase.x + rejCornerOffset1.x) << Shift,
-									(pixelBase.y + rejCornerOffset1.y) << Shift);
-								const Vector2i rejCorner2 = Vector2i(
-									(pixelBase.x + rejCornerOffset2.x) << Shift,
-									(pixelBase.y + rejCornerOffset2.y) << Shift);
-
-								if (tri.EdgeFunc0(rejCorner0) < 0 || tri.EdgeFunc1(rejCorner1) < 0 || tri.EdgeFunc2(rejCorner2) < 0)
+								auto TileCorner = [&](const int corner)
+								{
+									return Vector2i((x + corner % 2) << Shift, (y + corner / 2) << Shift);
+								};
+
+								if (edges.EdgeFunc(0, TileCorner(rejCorners[0])) < 0 ||
+									edges.EdgeFunc(1, TileCorner(rejCorners[1])) < 0 ||
+									edges.EdgeFunc(2, TileCorner(rejCorners[2])) < 0)
 									continue;
-								
-								const Vector2i acptCornerOffset0 = Vector2i(tri.acceptCorner0 % 2, tri.acceptCorner0 / 2);
-								const Vector2i acptCornerOffset1 = Vector2i(tri.acceptCorner1 % 2, tri.acceptCorner1 / 2);
-								const Vector2i acptCornerOffset2 = Vector2i(tri.acceptCorner2 % 2, tri.acceptCorner2 / 2);
-
-								const Vector2i acptCorner0 = Vector2i(
-									(pixelBase.x + acptCornerOffset0.x) << Shift,
-									(pixelBase.y + acptCornerOffset0.y) << Shift);
-								const Vector2i acptCorner1 = Vector2i(
-									(pixelBase.x + acptCornerOffset1.x) << Shift,
-									(pixelBase.y + acptCornerOffset1.y) << Shift);
-								const Vector2i acptCorner2 = Vector2i(
-									(pixelBase.x + acptCornerOffset2.x) << Shift,
-									(pixelBase.y + acptCornerOffset2.y) << Shift);
-
-								mTiles[y * mTileDim.x + x].triangleRefs[coreId].Add(Tile::TriangleRef(i,
-									tri.EdgeFunc0(acptCorner0) >= 0,
-									tri.EdgeFunc1(acptCorner1) >= 0,
-									tri.EdgeFunc2(acptCorner2) >= 0,
+
+								mpTarget->binner.Add(coreId, y * mpTarget->tileDim.x + x, Tile::TriangleRef(i,
+									coreId,
+									edges.EdgeFunc(0, TileCorner(acptCorners[0])) >= 0,
+									edges.EdgeFunc(1, TileCorner(acptCorners[1])) >= 0,
+									edges.EdgeFunc(2, TileCorner(acptCorners[2])) >= 0,
 									true));
 							}
 						}
@@ -228,146 +703,533 @@ namespace EDX
 				}
 			});
 
+			if (mProfiler.IsEnabled())
+			{
+				uint64 triangleCount = 0;
+				for (auto i = 0; i < mNumCores; i++)
+					triangleCount += frame.pRasterTriangleBuf[i].Size();
+
+				mProfiler.AddCounter(RenderCounter::TrianglesSetup, triangleCount);
+			}
+		}
 
-			//for (auto i = 0; i < mTiles.Size(); i++)
-			parallel_for(0, (int)mTiles.Size(), [&](int i)
+		void Renderer::MergeBins()
+		{
+			// Merge per thread bins into each tile, frames without draws leave every tile empty
+			ParallelFor(0, (int)mpTarget->tiles.Size(), [&](int i)
 			{
-				RasterizeTile(mTiles[i]);
+				ScopedProfileEvent event(mProfiler, "MergeBins");
+				mpTarget->binner.Merge(mpTarget->tiles[i]);
+				mpTarget->tiles[i].fragmentBuf.SetSampleCount(mpTarget->pFrameBuffer->GetSampleCount());
 			});
 
-			mFragmentBuf.Clear();
-			mTiledShadingResultBuf.Resize(mTiles.Size());
-			for (auto i = 0; i < mTiles.Size(); i++)
+			if (mProfiler.IsEnabled())
+			{
+				uint64 refCount = 0;
+				for (auto& tile : mpTarget->tiles)
+					refCount += tile.triangleRefs.Size();
+
+				mProfiler.AddCounter(RenderCounter::TileRefs, refCount);
+			}
+		}
+
+		namespace
+		{
+			const uint64 HASH_SEED = 14695981039346656037ull;
+
+			// FNV-1a
+			__forceinline uint64 HashBytes(const void* pData, const size_t size, uint64 hash)
 			{
-				mTiledShadingResultBuf[i].Resize(mTiles[i].fragmentBuf.Size());
-				if (mTiles[i].fragmentBuf.Size() > 0)
-					mFragmentBuf.Insert(mTiles[i].fragmentBuf.Data(), mTiles[i].fragmentBuf.Size(), mFragmentBuf.Size());
+				const _byte* pBytes = (const _byte*)pData;
+				for (uint i = 0; i < size; i++)
+					hash = (hash ^ pBytes[i]) * 1099511628211ull;
+
+				return hash;
 			}
 		}
 
-		void Renderer::RasterizeTile(Tile& tile)
+		void Renderer::UpdateDirtyTiles()
 		{
-			for (auto coreId = 0; coreId < mNumCores; coreId++)
+			const RenderStates* pStates = RenderStates::Instance();
+			const FrameContext& frame = *mpRenderFrame;
+			uint64 frameHash = HashBytes(&pStates->ModelViewInvMatrix, sizeof(Matrix), HASH_SEED);
+			frameHash = HashBytes(&pStates->TexFilter, sizeof(TextureFilter), frameHash);
+
+			// Covers everything a triangle's pixels depend on, but not where it sits in the frame's buffers
+			ParallelFor(0, mNumCores, [&](int coreId)
 			{
-				for (auto j = 0; j < tile.triangleRefs[coreId].Size(); j++)
+				ScopedProfileEvent event(mProfiler, "HashTriangles");
+				const FrameArray<RasterTriangle>& triangles = frame.pRasterTriangleBuf[coreId];
+				const FrameArray<ProjectedVertex>& vertices = frame.pDistributedProjVertexBuf[coreId];
+				FrameArray<uint64>& hashes = frame.pTriangleHashBuf[coreId];
+				hashes.Resize(triangles.Size());
+
+				for (auto i = 0; i < triangles.Size(); i++)
 				{
-					const Tile::TriangleRef& triRef = tile.triangleRefs[coreId][j];
-					RasterTriangle& tri = mpRasterTriangleBuf[coreId][triRef.triId];
+					const RasterTriangle& tri = triangles[i];
+					const DrawCall& draw = frame.drawCalls[tri.drawId];
+					const RasterTexture* pTexture = frame.textureSlots[tri.textureId];
 
-					if (triRef.trivialAccept)
+					uint64 hash = HashBytes(&tri.v0, 3 * sizeof(Vector2i), HASH_SEED);
+					hash = HashBytes(&draw.pPixelShader, sizeof(draw.pPixelShader), hash);
+					hash = HashBytes(&pTexture, sizeof(pTexture), hash);
+
+					const uint vIds[3] = { tri.vId0, tri.vId1, tri.vId2 };
+					for (auto v : vIds)
 					{
-						mpRasterizer->TrivialAcceptTriangle(tile, tile.minCoord, tile.maxCoord, tri);
-						continue;
+						const ProjectedVertex& vertex = vertices[v];
+						const size_t attribSize = (const _byte*)(&vertex.texCoord + 1) - (const _byte*)&vertex.projectedPos;
+						hash = HashBytes(&vertex.projectedPos, attribSize, hash);
 					}
 
-					if (RenderStates::Instance()->HierarchicalRasterize && triRef.big)
-						mpRasterizer->CoarseRasterize(tile, triRef, Tile::SIZE, tile.minCoord, tile.maxCoord, tri);
-					else
-						mpRasterizer->FineRasterize(tile, triRef, Tile::SIZE, tile.minCoord, tile.maxCoord, tri);
+					hashes[i] = hash;
+				}
+			});
+
+			mTileHashes.Resize(mpTarget->tiles.Size());
+			mDirtyTiles.Resize(mpTarget->tiles.Size());
+			ParallelFor(0, (int)mpTarget->tiles.Size(), [&](int i)
+			{
+				ScopedProfileEvent event(mProfiler, "HashTile");
+				Tile& tile = mpTarget->tiles[i];
+
+				// Refs are in primitive order, which also decides depth ties
+				uint64 hash = frameHash;
+				for (auto j = 0; j < tile.triangleRefs.Size(); j++)
+				{
+					const Tile::TriangleRef& triRef = tile.triangleRefs[j];
+					hash = HashBytes(&frame.pTriangleHashBuf[triRef.coreId][triRef.triId], sizeof(uint64), hash);
+				}
+
+				mDirtyTiles[i] = !mTileHashesValid || hash != mTileHashes[i];
+				mTileHashes[i] = hash;
+
+				// Clean tiles get no raster jobs at all
+				if (mDirtyTiles[i])
+					mpTarget->pFrameBuffer->ClearTile(i);
+				else
+					tile.triangleRefs.Clear();
+			});
+			mTileHashesValid = true;
+
+			mDirtyTileCount = 0;
+			for (auto i = 0; i < mDirtyTiles.Size(); i++)
+				mDirtyTileCount += mDirtyTiles[i];
+			mProfiler.AddCounter(RenderCounter::DirtyTiles, mDirtyTileCount);
+		}
+
+		void Renderer::TiledRasterization()
+		{
+			// Most expensive tiles first, hot tiles split into sub tile jobs
+			mTileScheduler.BuildJobs(mpTarget->tiles);
+			mTileScheduler.Execute(mpTarget->tiles, [&](const TileJob& job, Tile& target)
+			{
+				ScopedProfileEvent event(mProfiler, "RasterizeTile");
+				const uint blockSize = job.subTileId < 0 ? Tile::SIZE : TileScheduler::SUB_TILE_SIZE;
+				RasterizeTile(target, mpTarget->tiles[job.tileId], job.minCoord, job.maxCoord, blockSize);
+			});
+			mTileScheduler.MergeSubTiles(mpTarget->tiles);
+
+			// Offsets first, so the concatenation fills storage reserved once
+			mTileFragmentOffsets.Resize(mpTarget->tiles.Size());
+			int quadCount = 0;
+			for (auto i = 0; i < mpTarget->tiles.Size(); i++)
+			{
+				mTileFragmentOffsets[i] = quadCount;
+				quadCount += mpTarget->tiles[i].fragmentBuf.Size();
+			}
+
+			mFragmentBuf.SetSampleCount(mpTarget->pFrameBuffer->GetSampleCount());
+			mFragmentBuf.Reserve(quadCount);
+			for (auto i = 0; i < mpTarget->tiles.Size(); i++)
+				mFragmentBuf.Append(mpTarget->tiles[i].fragmentBuf);
+			mpShadingResultBuf = mpRenderFrame->arena.Alloc<IntSSE>(mFragmentBuf.Size());
+			mProfiler.AddCounter(RenderCounter::FragmentsGenerated, mFragmentBuf.Size());
+		}
+
+		void Renderer::RasterizeTile(Tile& target, const Tile& source, const Vector2i& blockMin, const Vector2i& blockMax, const uint blockSize)
+		{
+			uint trivialAcceptCount = 0;
+			uint coarseCount = 0;
+			uint microCount = 0;
+			const bool hierarchical = RenderStates::Instance()->HierarchicalRasterize;
+
+			// Micro triangles are queued and rasterized four at a time, the micro path is single sample only
+			const bool microRaster = mpTarget->pFrameBuffer->GetMultiSampleLevel() == 0;
+			const RasterTriangle* microBatch[TriangleBatchSSE::LANES];
+			int microBatchSize = 0;
+			auto FlushMicroBatch = [&]()
+			{
+				if (microBatchSize == 0)
+					return;
+
+				mpRasterizer->MicroRasterize(target, microBatch, microBatchSize, blockMin, blockMax);
+				microBatchSize = 0;
+			};
+
+			// Accept flags were computed for the whole source tile, so they hold for any sub block of it
+			for (auto j = 0; j < source.triangleRefs.Size(); j++)
+			{
+				const Tile::TriangleRef& triRef = source.triangleRefs[j];
+				RasterTriangle& tri = mpRenderFrame->pRasterTriangleBuf[triRef.coreId][triRef.triId];
+
+				if (microRaster && triRef.micro)
+				{
+					microBatch[microBatchSize++] = &tri;
+					if (microBatchSize == TriangleBatchSSE::LANES)
+						FlushMicroBatch();
+					microCount++;
+					continue;
+				}
+
+				// Fragments have to stay in primitive order
+				FlushMicroBatch();
+
+				if (triRef.trivialAccept)
+				{
+					if (!mpTarget->pFrameBuffer->HiZRejectBlock(tri.minZ, blockMin, blockMax))
+						mpRasterizer->TrivialAcceptTriangle(target, blockMin, blockMax, tri);
+					trivialAcceptCount++;
+					continue;
 				}
+
+				if (hierarchical && triRef.big)
+				{
+					mpRasterizer->CoarseRasterize(target, triRef, blockSize, blockMin, blockMax, tri);
+					coarseCount++;
+				}
+				else
+					mpRasterizer->FineRasterize(target, triRef, blockSize, blockMin, blockMax, tri);
 			}
+			FlushMicroBatch();
 
+			if (mProfiler.IsEnabled())
+			{
+				mProfiler.AddCounter(RenderCounter::TrivialAcceptRefs, trivialAcceptCount);
+				mProfiler.AddCounter(RenderCounter::CoarseRasterRefs, coarseCount);
+				mProfiler.AddCounter(RenderCounter::MicroRasterRefs, microCount);
+				mProfiler.AddCounter(RenderCounter::FineRasterRefs, source.triangleRefs.Size() - trivialAcceptCount - coarseCount - microCount);
+			}
 		}
 
-		void Renderer::FragmentProcessing()
+		void Renderer::TiledRasterizeShade()
 		{
-			//for (auto i = 0; i < mFragmentBuf.Size(); i++)
-			parallel_for(0, (int)mFragmentBuf.Size(), [&](int i)
+			// Each job rasterizes, shades and writes back its own block while the fragments are still in cache.
+			// Blocks never overlap, so no global fragment or shading result buffer is needed.
+			mTileScheduler.BuildJobs(mpTarget->tiles);
+			mTileScheduler.Execute(mpTarget->tiles, [&](const TileJob& job, Tile& target)
 			{
-				Fragment& frag = mFragmentBuf[i];
+				ScopedProfileEvent event(mProfiler, "RasterizeShadeTile");
+				const uint blockSize = job.subTileId < 0 ? Tile::SIZE : TileScheduler::SUB_TILE_SIZE;
+				RasterizeTile(target, mpTarget->tiles[job.tileId], job.minCoord, job.maxCoord, blockSize);
+
+				const int fragmentCount = target.fragmentBuf.Size();
+				mProfiler.AddCounter(RenderCounter::FragmentsGenerated, fragmentCount);
+				if (fragmentCount == 0)
+					return;
 
-				const ProjectedVertex& v0 = mpDistributedProjVertexBuf[frag.coreId][frag.vId0];
-				const ProjectedVertex& v1 = mpDistributedProjVertexBuf[frag.coreId][frag.vId1];
-				const ProjectedVertex& v2 = mpDistributedProjVertexBuf[frag.coreId][frag.vId2];
+				const Vector2i& tileOrigin = mpTarget->tiles[job.tileId].minCoord;
+				target.shadingResultBuf.Resize(fragmentCount);
+				ShadeFragments(target.fragmentBuf, tileOrigin, 0, fragmentCount, target.shadingResultBuf.Data());
+
+				for (auto i = 0; i < fragmentCount; i++)
+					WriteFragment(target.fragmentBuf, i, tileOrigin, target.shadingResultBuf[i]);
+				mpTarget->pFrameBuffer->ResolveBlock(job.minCoord, job.maxCoord);
+			});
+		}
+
+		void Renderer::InterpolateFragment(Fragment& frag,
+			Vec3f_SSE& position,
+			Vec3f_SSE& normal,
+			Vec2f_SSE& texCoord,
+			Vec2f_SSE texDifferentials[2],
+			FloatSSE& texLod) const
+		{
+			const FrameArray<ProjectedVertex>& vertices = mpRenderFrame->pDistributedProjVertexBuf[frag.coreId];
+			const ProjectedVertex& v0 = vertices[frag.vId0];
+			const ProjectedVertex& v1 = vertices[frag.vId1];
+			const ProjectedVertex& v2 = vertices[frag.vId2];
+
+			frag.Interpolate(v0, v1, v2, frag.lambda0, frag.lambda1, position, normal, texCoord);
+
+			// Barycentrics are valid for all four pixel centers, so derivatives are taken over the whole quad
+			// and the level of detail is computed once for it
+			const Vector2 dx = Vector2(texCoord.u[1] - texCoord.u[0], texCoord.v[1] - texCoord.v[0]);
+			const Vector2 dy = Vector2(texCoord.u[2] - texCoord.u[0], texCoord.v[2] - texCoord.v[0]);
+			texDifferentials[0] = Vec2f_SSE(dx.x, dx.y);
+			texDifferentials[1] = Vec2f_SSE(dy.x, dy.y);
+			texLod = mTextureSampler.ComputeLod(frag.textureId, dx, dy);
+		}
+
+		IntSSE Renderer::PackColors(const Vec3f_SSE& shadingResults)
+		{
+			Color4b colorByte[4];
+			colorByte[0].FromFloats(shadingResults.x[0], shadingResults.y[0], shadingResults.z[0]);
+			colorByte[1].FromFloats(shadingResults.x[1], shadingResults.y[1], shadingResults.z[1]);
+			colorByte[2].FromFloats(shadingResults.x[2], shadingResults.y[2], shadingResults.z[2]);
+			colorByte[3].FromFloats(shadingResults.x[3], shadingResults.y[3], shadingResults.z[3]);
+
+			return _mm_loadu_si128((__m128i*)&colorByte);
+		}
+
+		void Renderer::UnpackFragment(const FragmentBuffer& fragments, const int idx, const Vector2i& tileOrigin, Fragment& frag) const
+		{
+			const uint packedId = fragments.GetTriangleId(idx);
+			const RasterTriangle& tri = mpRenderFrame->pRasterTriangleBuf[FragmentBuffer::UnpackCoreId(packedId)][FragmentBuffer::UnpackTriangleId(packedId)];
+
+			frag = Fragment(fragments.GetLambda0(idx),
+				fragments.GetLambda1(idx),
+				tri.vId0,
+				tri.vId1,
+				tri.vId2,
+				tri.coreId,
+				tri.textureId,
+				tri.drawId,
+				tileOrigin + fragments.GetTileLocalCoord(idx),
+				fragments.GetCoverageMask(idx));
+		}
+
+		void Renderer::ShadeFragments(const FragmentBuffer& fragments, const Vector2i& tileOrigin, const int first, const int fragmentCount, IntSSE* pResults)
+		{
+			const Vector3 lightDir = Vector3(1, 1, -1);
+			const Array<DrawCall>& drawCalls = mpRenderFrame->drawCalls;
+			const Vector3& eyePos = mpRenderFrame->eyePos;
+
+			// Covered lanes of partially covered quads with the same draw and texture are packed into full batches
+			Vec3f_SSE batchPosition = Vec3f_SSE(Vector3::ZERO);
+			Vec3f_SSE batchNormal = Vec3f_SSE(Vector3::UNIT_Z);
+			Vec2f_SSE batchTexCoord = Vec2f_SSE(0.0f, 0.0f);
+			Vec2f_SSE batchDifferentials[2] = { Vec2f_SSE(0.0f, 0.0f), Vec2f_SSE(0.0f, 0.0f) };
+			FloatSSE batchLod = FloatSSE(Math::EDX_ZERO);
+			Fragment batchFrag;
+			int batchFragIds[4];
+			int batchLanes[4];
+			int batchSize = 0;
+
+			uint64 invocations = 0;
+			uint64 activeLanes = 0;
+
+			auto FlushBatch = [&]()
+			{
+				if (batchSize == 0)
+					return;
+
+				IntSSE packed = PackColors(drawCalls[batchFrag.drawId].pPixelShader->Shade(batchFrag,
+					eyePos,
+					lightDir,
+					batchPosition,
+					batchNormal,
+					batchTexCoord,
+					batchDifferentials,
+					batchLod,
+					mTextureSampler));
+
+				for (auto l = 0; l < batchSize; l++)
+					pResults[batchFragIds[l]][batchLanes[l]] = packed[l];
+
+				invocations++;
+				activeLanes += batchSize;
+				batchSize = 0;
+			};
+
+			for (auto i = 0; i < fragmentCount; i++)
+			{
+				Fragment frag;
+				UnpackFragment(fragments, first + i, tileOrigin, frag);
 
 				Vec3f_SSE position;
 				Vec3f_SSE normal;
 				Vec2f_SSE texCoord;
-				frag.Interpolate(v0, v1, v2, frag.lambda0, frag.lambda1, position, normal, texCoord);
-
-				Vec3f_SSE shadingResults = mpPixelShader->Shade(frag,
-					Matrix::TransformPoint(Vector3::ZERO, RenderStates::Instance()->GetModelViewInvMatrix()),
-					Vector3(1, 1, -1),
-					position,
-					normal,
-					texCoord);
-
-				Color4b colorByte[4];
-				colorByte[0].FromFloats(shadingResults.x[0], shadingResults.y[0], shadingResults.z[0]);
-				colorByte[1].FromFloats(shadingResults.x[1], shadingResults.y[1], shadingResults.z[1]);
-				colorByte[2].FromFloats(shadingResults.x[2], shadingResults.y[2], shadingResults.z[2]);
-				colorByte[3].FromFloats(shadingResults.x[3], shadingResults.y[3], shadingResults.z[3]);
-
-				mTiledShadingResultBuf[frag.tileId][frag.intraTileIdx] = _mm_loadu_si128((__m128i*)&colorByte);
+				Vec2f_SSE texDifferentials[2];
+				FloatSSE texLod;
+				InterpolateFragment(frag, position, normal, texCoord, texDifferentials, texLod);
+
+				const int laneMask = frag.coverageMask.GetLaneMask();
+				if (!mQuadMerging || laneMask == 0xF)
+				{
+					pResults[i] = PackColors(drawCalls[frag.drawId].pPixelShader->Shade(frag,
+						eyePos,
+						lightDir,
+						position,
+						normal,
+						texCoord,
+						texDifferentials,
+						texLod,
+						mTextureSampler));
+
+					invocations++;
+					activeLanes += frag.coverageMask.GetLaneCount();
+					continue;
+				}
+
+				for (auto lane = 0; lane < 4; lane++)
+				{
+					if ((laneMask & (1 << lane)) == 0)
+						continue;
+
+					if (batchSize > 0 && (batchFrag.drawId != frag.drawId || batchFrag.textureId != frag.textureId))
+						FlushBatch();
+					if (batchSize == 0)
+						batchFrag = frag;
+
+					batchPosition.x[batchSize] = position.x[lane];
+					batchPosition.y[batchSize] = position.y[lane];
+					batchPosition.z[batchSize] = position.z[lane];
+					batchNormal.x[batchSize] = normal.x[lane];
+					batchNormal.y[batchSize] = normal.y[lane];
+					batchNormal.z[batchSize] = normal.z[lane];
+					batchTexCoord.u[batchSize] = texCoord.u[lane];
+					batchTexCoord.v[batchSize] = texCoord.v[lane];
+					batchDifferentials[0].u[batchSize] = texDifferentials[0].u[lane];
+					batchDifferentials[0].v[batchSize] = texDifferentials[0].v[lane];
+					batchDifferentials[1].u[batchSize] = texDifferentials[1].u[lane];
+					batchDifferentials[1].v[batchSize] = texDifferentials[1].v[lane];
+					batchLod[batchSize] = texLod[lane];
+					batchFragIds[batchSize] = i;
+					batchLanes[batchSize] = lane;
+
+					if (++batchSize == 4)
+						FlushBatch();
+				}
+			}
+			FlushBatch();
+
+			mShaderInvocations += invocations;
+			mShadedLanes += activeLanes;
+		}
+
+		void Renderer::FragmentProcessing()
+		{
+			// Shading runs per tile so neighboring partial quads can be merged
+			ParallelFor(0, (int)mpTarget->tiles.Size(), [&](int i)
+			{
+				const int fragmentCount = mpTarget->tiles[i].fragmentBuf.Size();
+				if (fragmentCount > 0)
+				{
+					ScopedProfileEvent event(mProfiler, "ShadeTile");
+					ShadeFragments(mFragmentBuf, mpTarget->tiles[i].minCoord, mTileFragmentOffsets[i], fragmentCount, mpShadingResultBuf + mTileFragmentOffsets[i]);
+				}
 			});
 		}
 
 		void Renderer::UpdateFrameBuffer()
 		{
-			parallel_for(0, (int)mTiledShadingResultBuf.Size(), [&](int i)
+			ParallelFor(0, (int)mpTarget->tiles.Size(), [&](int i)
 			{
-				for (auto j = 0; j < mTiles[i].fragmentBuf.Size(); j++)
-				{
-					const Fragment& frag = mTiles[i].fragmentBuf[j];
-					for (auto sId = 0; sId < mpFrameBuffer->GetSampleCount(); sId++)
-					{
-						int maskShift = sId << 2;
+				if (mpTarget->tiles[i].fragmentBuf.Size() == 0)
+					return;
 
-						const IntSSE& quadResults = mTiledShadingResultBuf[i][j];
-						if (frag.coverageMask.GetBit(maskShift) != 0)
-						{
-							mpFrameBuffer->SetPixel(Color4b(quadResults.m128.m128i_u8[0],
-								quadResults.m128.m128i_u8[1],
-								quadResults.m128.m128i_u8[2]),
-								frag.x, frag.y, sId);
-						}
-						if (frag.coverageMask.GetBit(maskShift + 1) != 0)
-						{
-							mpFrameBuffer->SetPixel(Color4b(quadResults.m128.m128i_u8[4],
-								quadResults.m128.m128i_u8[5],
-								quadResults.m128.m128i_u8[6]),
-								frag.x + 1, frag.y, sId);
-						}
-						if (frag.coverageMask.GetBit(maskShift + 2) != 0)
-						{
-							mpFrameBuffer->SetPixel(Color4b(quadResults.m128.m128i_u8[8],
-								quadResults.m128.m128i_u8[9],
-								quadResults.m128.m128i_u8[10]),
-								frag.x, frag.y + 1, sId);
-						}
-						if (frag.coverageMask.GetBit(maskShift + 3) != 0)
-						{
-							mpFrameBuffer->SetPixel(Color4b(quadResults.m128.m128i_u8[12],
-								quadResults.m128.m128i_u8[13],
-								quadResults.m128.m128i_u8[14]),
-								frag.x + 1, frag.y + 1, sId);
-						}
-					}
-				}
+				ScopedProfileEvent event(mProfiler, "WriteTile");
+				for (auto j = 0; j < mpTarget->tiles[i].fragmentBuf.Size(); j++)
+					WriteFragment(mpTarget->tiles[i].fragmentBuf, j, mpTarget->tiles[i].minCoord, mpShadingResultBuf[mTileFragmentOffsets[i] + j]);
+				mpTarget->pFrameBuffer->ResolveBlock(mpTarget->tiles[i].minCoord, mpTarget->tiles[i].maxCoord);
 			});
+		}
 
-			mpFrameBuffer->Resolve();
+		void Renderer::WriteFragment(const FragmentBuffer& fragments, const int idx, const Vector2i& tileOrigin, const IntSSE& quadResults)
+		{
+			const Vector2i pixelCoord = tileOrigin + fragments.GetTileLocalCoord(idx);
+			const uint sampleCount = mpTarget->pFrameBuffer->GetSampleCount();
+			if (sampleCount == 1)
+			{
+				mpTarget->pFrameBuffer->WriteQuad(quadResults, pixelCoord.x, pixelCoord.y, fragments.GetSampleLaneMask(idx, 0));
+				return;
+			}
+
+			int laneMasks[1 << Rasterizer::MAX_MULTI_SAMPLE_LEVEL];
+			for (uint sId = 0; sId < sampleCount; sId++)
+				laneMasks[sId] = fragments.GetSampleLaneMask(idx, sId);
+			mpTarget->pFrameBuffer->WriteQuadSamples(quadResults, pixelCoord.x, pixelCoord.y, laneMasks);
+		}
+
+		void Renderer::SetIncrementalRendering(const bool incremental)
+		{
+			Flush();
+			mIncremental = incremental;
+			mTileHashesValid = false;
+		}
+
+		void Renderer::SetProfiling(const bool enable)
+		{
+			Flush();
+			mProfiler.SetEnabled(enable);
+			mpTarget->pFrameBuffer->SetCountZRejects(enable);
 		}
 
-		void Renderer::WriteFrameToFile() const
+		size_t Renderer::GetFrameMemoryHighWaterMark() const
 		{
-			char fileName[MAX_PATH];
-			sprintf_s(fileName, MAX_PATH, "%s/Frames/Frame%05i.bmp", Application::GetBaseDirectory(), RenderStates::Instance()->FrameCount);
+			size_t highWaterMark = mFrameArena.GetHighWaterMark();
+			for (auto& frame : mFrames)
+			{
+				highWaterMark += frame.arena.GetHighWaterMark();
+				for (auto& it : frame.coreArenas)
+					highWaterMark += it->GetHighWaterMark();
+			}
 
-			Bitmap::SaveBitmapFile(fileName, GetBackBuffer(), mpFrameBuffer->GetWidth(), mpFrameBuffer->GetHeight());
+			return highWaterMark;
+		}
+
+		ShadingStats Renderer::GetShadingStats() const
+		{
+			ShadingStats stats;
+			stats.shaderInvocations = mShaderInvocations;
+			stats.shadedLanes = mShadedLanes;
+
+			return stats;
+		}
+
+		void Renderer::WriteFrameToFile()
+		{
+			if (!mpFrameEncoder->IsOpen())
+			{
+				FrameOutputSettings settings;
+				settings.path = mFrameDirectory;
+				mpFrameEncoder->Open(settings);
+			}
+
+			mpFrameEncoder->Submit(GetBackBuffer(), mpTarget->pFrameBuffer->GetWidth(), mpTarget->pFrameBuffer->GetHeight(), RenderStates::Instance()->FrameCount);
+		}
+
+		void Renderer::SetWriteFrames(const bool wf)
+		{
+			if (wf == mWriteFrames)
+				return;
+
+			// The frame in flight is still written, then queued frames are drained
+			Flush();
+			mWriteFrames = wf;
+			if (!mWriteFrames)
+				mpFrameEncoder->Close();
+		}
+
+		bool Renderer::SetFrameOutput(const FrameOutputSettings& settings)
+		{
+			Flush();
+			mWriteFrames = mpFrameEncoder->Open(settings);
+
+			return mWriteFrames;
 		}
 
 		const _byte* Renderer::GetBackBuffer() const
 		{
-			return mpFrameBuffer->GetColorBuffer();
+			return mpTarget->pFrameBuffer->GetColorBuffer();
 		}
 
 		Renderer::~Renderer()
 		{
-			Memory::SafeDeleteArray(mpDistributedProjVertexBuf);
-			Memory::SafeDeleteArray(mpRasterTriangleBuf);
+			// A pipelined frame still in flight is completed, so it is presented and written out
+			Flush();
+
+			for (auto& frame : mFrames)
+			{
+				Memory::SafeDeleteArray(frame.pDistributedProjVertexBuf);
+				Memory::SafeDeleteArray(frame.pRasterTriangleBuf);
+				Memory::SafeDeleteArray(frame.pTriangleBlockBuf);
+				Memory::SafeDeleteArray(frame.pTriangleHashBuf);
+			}
 
 			RenderStates::DeleteInstance();
+			TaskSystem::Release();
 		}
 	}
 }
\ No newline at end of file
@@ -4,36 +4,175 @@
 #include "RenderStates.h"
 #include "Shader.h"
 #include "RasterTriangle.h"
+#include "TriangleSetup.h"
 #include "Tile.h"
+#include "FragmentBuffer.h"
+#include "Binning.h"
+#include "TileScheduler.h"
+#include "Scene.h"
+#include "Culling.h"
+#include "FrameArena.h"
+#include "Profiler.h"
+#include "FrameEncoder.h"
+#include "TaskSystem.h"
 #include "../Utils/InputBuffer.h"
-#include "Windows/Threading.h"
+
+#include <atomic>
+#include <functional>
 
 namespace EDX
 {
 	namespace RasterRenderer
 	{
+		enum class PipelineMode
+		{
+			Deferred,	// Rasterize all tiles, then shade, then write back, each as a separate pass
+			TileLocal	// Rasterize, shade and write back each tile in one job
+		};
+
+		struct ShadingStats
+		{
+			uint64 shaderInvocations;
+			uint64 shadedLanes;
+
+			float LaneUtilization() const
+			{
+				return shaderInvocations > 0 ? shadedLanes / float(4 * shaderInvocations) : 0.0f;
+			}
+		};
+
+		struct DrawCall
+		{
+			const class Mesh* pMesh;
+			const class PixelShader* pPixelShader;
+			DrawTransform transform;
+			uint vertexOffset;
+			uint triangleOffset;
+			uint triangleCount;
+			uint textureOffset;
+			// Range of mVisibleMeshlets drawn, empty when the whole mesh is
+			uint meshletOffset;
+			uint meshletCount;
+		};
+
+		// One camera of a batch, views of the same resolution share a pooled framebuffer
+		struct RenderView
+		{
+			Matrix view;
+			Matrix proj;
+			Matrix toRaster;
+			uint width, height;
+		};
+
+		// Receives each finished view of a batch, rows bottom up. The pixels are only valid during the call.
+		typedef std::function<void(const int viewId, const RenderView& view, const _byte* pPixels)> ViewCallback;
+
 		class Renderer
 		{
 		private:
-			UniquePtr<class FrameBuffer> mpFrameBuffer;
+			static const uint VERTEX_CHUNK_SIZE = 1024;
+
+			struct VertexChunk
+			{
+				uint drawId;
+				uint first, last;
+			};
+
+			// Everything the back end of a frame reads after its geometry is processed. Two of these let
+			// the geometry of the next frame run while the back end of the previous one finishes.
+			struct FrameContext
+			{
+				Array<DrawCall> drawCalls;
+				Array<const RasterTexture*> textureSlots;
+				Vector3 eyePos;
+				int viewId; // Index into the batch views, -1 outside of batches
+
+				FrameArena arena;
+				Array<UniquePtr<FrameArena>> coreArenas;
+				FrameArray<ProjectedVertex>* pDistributedProjVertexBuf;
+				FrameArray<RasterTriangle>* pRasterTriangleBuf;
+				FrameArray<TriangleBlock>* pTriangleBlockBuf; // SoA copy of the setup data binning reads
+				FrameArray<uint64>* pTriangleHashBuf;
+			};
+
+			// Framebuffer and tile grid of one resolution, pooled so switching resolutions rebuilds neither
+			struct RenderTarget
+			{
+				UniquePtr<class FrameBuffer> pFrameBuffer;
+				Array<Tile> tiles;
+				Vector2i tileDim;
+				TileBinner binner;
+				uint lastUse;
+			};
+
+			static const int MAX_RENDER_TARGETS = 4;
+			Array<UniquePtr<RenderTarget>> mRenderTargets;
+			RenderTarget* mpTarget;
+			uint mTargetUseCount;
+
 			UniquePtr<class Rasterizer> mpRasterizer;
 			UniquePtr<class VertexShader> mpVertexShader;
 			UniquePtr<class PixelShader> mpPixelShader;
 			UniquePtr<class Scene> mpScene;
+			TextureSampler mTextureSampler; // Slots and filter of the frame in the back end, set with its kernels
+
+			Array<VertexChunk> mVertexChunks;
+			IndexBuffer mFrameIndexBuf;
+			Array<uint> mFrameTexIdBuf;
+			Array<uint> mFrameDrawIdBuf;
+			Array<uint> mVisibleMeshlets;
+			uint mFrameVertexCount;
+			uint mFrameTriangleCount;
+			uint mCulledDrawCount;
+			bool mFrustumCulling;
+			bool mClusterCulling;
+			bool mInFrame;
+
+			bool mInBatch;
+			bool mFrameIndicesValid;
+			const Array<RenderView>* mpBatchViews;
+			ViewCallback mViewCallback;
+
+			// Per frame pipeline data lives in frame arenas, one per core plus one for serial stages
+			FrameArena mFrameArena;
+			FrameArray<ProjectedVertex> mProjectedVertexBuf;
+
+			FrameContext mFrames[2];
+			FrameContext* mpGeometryFrame;	// Filled by Draw and the geometry stages
+			FrameContext* mpRenderFrame;	// Read by rasterization, shading and write back
 
-			Array<ProjectedVertex> mProjectedVertexBuf;
-			Array<ProjectedVertex>* mpDistributedProjVertexBuf;
-			Array<RasterTriangle>* mpRasterTriangleBuf;
-			Array<Fragment> mFragmentBuf;
-			Array<Array<IntSSE>> mTiledShadingResultBuf;
+			// Pipelined, EndFrame returns once the back end of its frame is started. The frame is
+			// completed by the next EndFrame or Flush, dependent state changes flush first.
+			bool mAsyncPipelining;
+			bool mBackEndPending;
+			Task mBackEndTask;
 
-			Array<Tile> mTiles;
-			Vector2i mTileDim;
+			FragmentBuffer mFragmentBuf;
+			Array<uint> mTileFragmentOffsets;
+			IntSSE* mpShadingResultBuf; // Indexed by mTileFragmentOffsets
+
+			TileScheduler mTileScheduler;
 
 			int mNumCores;
 			bool mWriteFrames;
+			string mFrameDirectory;
+			UniquePtr<FrameEncoder> mpFrameEncoder;
+			PipelineMode mPipelineMode;
+			bool mQuadMerging;
+
+			// Incremental mode, tiles whose content hash matches last frame keep their color and depth
+			bool mIncremental;
+			bool mTileHashesValid;
+			Array<uint64> mTileHashes;
+			Array<bool> mDirtyTiles;
+			uint mDirtyTileCount;
+
+			Profiler mProfiler;
+			std::atomic<uint64> mShaderInvocations;
+			std::atomic<uint64> mShadedLanes;
 
 		public:
+			Renderer();
 			~Renderer();
 
 		public:
@@ -41,21 +180,89 @@ namespace EDX
 			void Resize(uint iScreenWidth, uint iScreenHeight);
 			void SetTransform(const class Matrix& mModelView, const Matrix& mProj, const Matrix& mToRaster);
 			void RenderMesh(const class Mesh& mesh);
+			void RenderScene(const Scene& scene);
+
+			// Draws between BeginFrame and EndFrame share one clear, binning, raster and resolve pass.
+			// Meshes and shaders must stay alive until EndFrame returns.
+			void BeginFrame();
+			void Draw(const Mesh& mesh, const Matrix& transform, const PixelShader* pPixelShader = nullptr);
+			void EndFrame();
 
-			void WriteFrameToFile() const;
+			// Renders the mesh once per view and streams each finished view to onViewDone, pipelined
+			// and with the mesh's index setup shared. Leaves the transform of the last view set.
+			void RenderBatch(const Mesh& mesh, const Array<RenderView>& views, const ViewCallback& onViewDone);
+
+			// Overlaps the geometry stages of each frame with the back end of the previous one.
+			// The back buffer then lags one EndFrame behind and holds the last completed frame.
+			void SetAsyncPipelining(const bool async);
+			bool IsAsyncPipelining() const { return mAsyncPipelining; }
+			// Waits for the frame in flight and completes it
+			void Flush();
+
+			// Queues the last completed frame on the frame encoder, opening the default output if none is
+			void WriteFrameToFile();
+			// Last completed frame, valid until the next EndFrame
 			const _byte* GetBackBuffer() const;
 			void SetMSAAMode(const int msaaCountLog2);
-			void SetTextureFilter(const TextureFilter filter) { RenderStates::Instance()->TexFilter = filter; }
-			void SetHierarchicalRasterize(const bool hRas) { RenderStates::Instance()->HierarchicalRasterize = hRas; }
-			void SetWriteFrames(const bool wf) { mWriteFrames = wf; }
+			void SetTextureFilter(const TextureFilter filter);
+			void SetHierarchicalRasterize(const bool hRas) { Flush(); RenderStates::Instance()->HierarchicalRasterize = hRas; }
+			void SetBackFaceCulling(const bool cull) { RenderStates::Instance()->BackFaceCull = cull; }
+			// Writes every completed frame, by default as a BMP sequence in the frame directory
+			void SetWriteFrames(const bool wf);
+			// Directory of the default output, relative to the working directory unless the caller passes
+			// a full path. Takes effect when the default output is next opened.
+			void SetFrameDirectory(const char* directory) { mFrameDirectory = directory; }
+			// Starts writing frames to this output, encoded on a background thread
+			bool SetFrameOutput(const FrameOutputSettings& settings);
+			FrameOutputStats GetFrameOutputStats() const { return mpFrameEncoder->GetStats(); }
+			void SetRasterSIMDWidth(const uint width);
+			void SetSplitHotTiles(const bool split) { Flush(); mTileScheduler.SetSplitHotTiles(split); }
+			void SetCrossNodeStealing(const bool steal) { Flush(); mTileScheduler.SetCrossNodeStealing(steal); }
+			void SetPipelineMode(const PipelineMode mode) { Flush(); mPipelineMode = mode; }
+			void SetQuadMerging(const bool merge) { Flush(); mQuadMerging = merge; }
+			void SetFrustumCulling(const bool cull) { mFrustumCulling = cull; }
+			// Culls meshlets outside the frustum or entirely back facing before their indices reach the clipper
+			void SetClusterCulling(const bool cull) { mClusterCulling = cull; }
+			uint GetCulledDrawCount() const { return mCulledDrawCount; }
+
+			// Only redraws tiles whose binned triangles or shading inputs changed since the last frame
+			void SetIncrementalRendering(const bool incremental);
+			uint GetDirtyTileCount() const { return mDirtyTileCount; }
+			size_t GetFrameMemoryHighWaterMark() const;
+
+			// Stage timings and counters of the last frame rendered with profiling on. Profiled frames
+			// complete within their EndFrame, also when pipelined, so timings belong to one frame.
+			void SetProfiling(const bool enable);
+			bool IsProfiling() const { return mProfiler.IsEnabled(); }
+			const RenderStats& GetRenderStats() const { return mProfiler.GetStats(); }
+			bool WriteChromeTrace(const char* path) const { return mProfiler.WriteChromeTrace(path); }
+			ShadingStats GetShadingStats() const;
 
 		private:
-			void VertexProcessing(const IVertexBuffer* pVertexBuf);
-			void Clipping(IndexBuffer* pIndexBuf, const Array<uint>& texIdBuf);
+			void SelectRenderTarget(const uint width, const uint height);
+			void BuildFrameBuffers();
+			void VertexProcessing();
+			void Clipping();
+			void BinTriangles();
+			void MergeBins();
+			void UpdateDirtyTiles();
+			void RenderBackEnd();
+			void CompleteFrame();
 			void TiledRasterization();
-			void RasterizeTile(Tile& tile);
+			void TiledRasterizeShade();
+			void RasterizeTile(Tile& target, const Tile& source, const Vector2i& blockMin, const Vector2i& blockMax, const uint blockSize);
+			void InterpolateFragment(Fragment& frag,
+				Vec3f_SSE& position,
+				Vec3f_SSE& normal,
+				Vec2f_SSE& texCoord,
+				Vec2f_SSE texDifferentials[2],
+				FloatSSE& texLod) const;
+			static IntSSE PackColors(const Vec3f_SSE& shadingResults);
+			void UnpackFragment(const FragmentBuffer& fragments, const int idx, const Vector2i& tileOrigin, Fragment& frag) const;
+			void ShadeFragments(const FragmentBuffer& fragments, const Vector2i& tileOrigin, const int first, const int fragmentCount, IntSSE* pResults);
 			void FragmentProcessing();
 			void UpdateFrameBuffer();
+			void WriteFragment(const FragmentBuffer& fragments, const int idx, const Vector2i& tileOrigin, const IntSSE& quadResults);
 		};
 
 	}
@@ -1,4 +1,5 @@
 #include "Scene.h"
+#include "Renderer.h"
 
 #include "../Utils/Mesh.h"
 #include "../Utils/InputBuffer.h"
@@ -7,9 +8,17 @@ namespace EDX
 {
 	namespace RasterRenderer
 	{
-		void Scene::AddMesh(Mesh* pMesh)
+		void Scene::AddMesh(Mesh* pMesh, const Matrix& transform, const PixelShader* pPixelShader)
 		{
 			mMeshes.Add(UniquePtr<Mesh>(pMesh));
+			mTransforms.Add(transform);
+			mPixelShaders.Add(pPixelShader);
+		}
+
+		void Scene::Draw(Renderer& renderer) const
+		{
+			for (auto i = 0; i < mMeshes.Size(); i++)
+				renderer.Draw(*mMeshes[i], mTransforms[i], mPixelShaders[i]);
 		}
 	}
-}
\ No newline at end of file
+}
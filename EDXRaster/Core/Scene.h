@@ -1,6 +1,7 @@
 #pragma once
 
 #include "EDXPrerequisites.h"
+#include "Math/Matrix.h"
 #include "Core/SmartPointer.h"
 
 namespace EDX
@@ -11,9 +12,19 @@ namespace EDX
 		{
 		private:
 			Array<UniquePtr<class Mesh>> mMeshes;
+			Array<Matrix> mTransforms;
+			Array<const class PixelShader*> mPixelShaders; // Renderer default if null
 
 		public:
-			void AddMesh(Mesh* pMesh);
+			void AddMesh(Mesh* pMesh, const Matrix& transform = Matrix::IDENTITY, const PixelShader* pPixelShader = nullptr);
+
+			// Issues one draw per mesh, in insertion order
+			void Draw(class Renderer& renderer) const;
+
+			uint GetMeshCount() const
+			{
+				return mMeshes.Size();
+			}
 		};
 	}
 }
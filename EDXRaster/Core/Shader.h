@@ -24,14 +24,70 @@ namespace EDX
 			}
 		};
 
+		// Per draw call object transform, position and normal are shaded in world space
+		struct DrawTransform
+		{
+			Matrix world;
+			Matrix worldInv;
+			Matrix worldViewProj;
+
+			// Images of the basis vectors, so batched shaders can transform SoA vertices with broadcasts
+			Vector4 worldViewProjCols[4];
+			Vector3 worldCols[4];
+			Vector3 normalCols[3];
+
+			void Init(const Matrix& mWorld, const Matrix& mWorldViewProj)
+			{
+				world = mWorld;
+				worldInv = Matrix::Inverse(mWorld);
+				worldViewProj = mWorldViewProj;
+
+				worldViewProjCols[0] = Matrix::TransformPoint(Vector4(1.0f, 0.0f, 0.0f, 0.0f), worldViewProj);
+				worldViewProjCols[1] = Matrix::TransformPoint(Vector4(0.0f, 1.0f, 0.0f, 0.0f), worldViewProj);
+				worldViewProjCols[2] = Matrix::TransformPoint(Vector4(0.0f, 0.0f, 1.0f, 0.0f), worldViewProj);
+				worldViewProjCols[3] = Matrix::TransformPoint(Vector4(0.0f, 0.0f, 0.0f, 1.0f), worldViewProj);
+
+				worldCols[3] = Matrix::TransformPoint(Vector3::ZERO, world);
+				worldCols[0] = Matrix::TransformPoint(Vector3::UNIT_X, world) - worldCols[3];
+				worldCols[1] = Matrix::TransformPoint(Vector3::UNIT_Y, world) - worldCols[3];
+				worldCols[2] = Matrix::TransformPoint(Vector3::UNIT_Z, world) - worldCols[3];
+
+				normalCols[0] = Matrix::TransformNormal(Vector3::UNIT_X, worldInv);
+				normalCols[1] = Matrix::TransformNormal(Vector3::UNIT_Y, worldInv);
+				normalCols[2] = Matrix::TransformNormal(Vector3::UNIT_Z, worldInv);
+			}
+		};
+
 		class VertexShader
 		{
 		public:
+			static const int BATCH_SIZE = 4;
+
 			virtual ~VertexShader() {}
 			virtual void Execute(const Vector3& vPosIn,
 				const Vector3& vNormalIn,
 				const Vector2& vTexIn,
+				const DrawTransform& transform,
 				ProjectedVertex* pOut) = 0;
+
+			// Shades up to BATCH_SIZE vertices given in SoA form, only the first count lanes are valid.
+			// Falls back to one Execute call per vertex unless overridden.
+			virtual void ExecuteBatch(const Vec3f_SSE& posIn,
+				const Vec3f_SSE& normalIn,
+				const Vec2f_SSE& texIn,
+				const DrawTransform& transform,
+				ProjectedVertex* pOut,
+				const int count)
+			{
+				for (auto i = 0; i < count; i++)
+				{
+					Execute(Vector3(posIn.x[i], posIn.y[i], posIn.z[i]),
+						Vector3(normalIn.x[i], normalIn.y[i], normalIn.z[i]),
+						Vector2(texIn.u[i], texIn.v[i]),
+						transform,
+						&pOut[i]);
+				}
+			}
 		};
 
 		class DefaultVertexShader : public VertexShader
@@ -40,13 +96,47 @@ namespace EDX
 			virtual void Execute(const Vector3& vPosIn,
 				const Vector3& vNormalIn,
 				const Vector2& vTexIn,
+				const DrawTransform& transform,
 				ProjectedVertex* pOut)
 			{
-				pOut->projectedPos = Matrix::TransformPoint(Vector4(vPosIn.x, vPosIn.y, vPosIn.z, 1.0f), RenderStates::Instance()->GetModelViewProjMatrix());
-				pOut->position = vPosIn;
-				pOut->normal = vNormalIn;
+				pOut->projectedPos = Matrix::TransformPoint(Vector4(vPosIn.x, vPosIn.y, vPosIn.z, 1.0f), transform.worldViewProj);
+				pOut->position = Matrix::TransformPoint(vPosIn, transform.world);
+				pOut->normal = Matrix::TransformNormal(vNormalIn, transform.worldInv);
 				pOut->texCoord = vTexIn;
 			}
+
+			virtual void ExecuteBatch(const Vec3f_SSE& posIn,
+				const Vec3f_SSE& normalIn,
+				const Vec2f_SSE& texIn,
+				const DrawTransform& transform,
+				ProjectedVertex* pOut,
+				const int count)
+			{
+				const Vector4* pClipCols = transform.worldViewProjCols;
+				const Vector3* pWorldCols = transform.worldCols;
+				const Vector3* pNormalCols = transform.normalCols;
+
+				FloatSSE clipX = posIn.x * pClipCols[0].x + posIn.y * pClipCols[1].x + posIn.z * pClipCols[2].x + pClipCols[3].x;
+				FloatSSE clipY = posIn.x * pClipCols[0].y + posIn.y * pClipCols[1].y + posIn.z * pClipCols[2].y + pClipCols[3].y;
+				FloatSSE clipZ = posIn.x * pClipCols[0].z + posIn.y * pClipCols[1].z + posIn.z * pClipCols[2].z + pClipCols[3].z;
+				FloatSSE clipW = posIn.x * pClipCols[0].w + posIn.y * pClipCols[1].w + posIn.z * pClipCols[2].w + pClipCols[3].w;
+
+				FloatSSE worldX = posIn.x * pWorldCols[0].x + posIn.y * pWorldCols[1].x + posIn.z * pWorldCols[2].x + pWorldCols[3].x;
+				FloatSSE worldY = posIn.x * pWorldCols[0].y + posIn.y * pWorldCols[1].y + posIn.z * pWorldCols[2].y + pWorldCols[3].y;
+				FloatSSE worldZ = posIn.x * pWorldCols[0].z + posIn.y * pWorldCols[1].z + posIn.z * pWorldCols[2].z + pWorldCols[3].z;
+
+				FloatSSE normalX = normalIn.x * pNormalCols[0].x + normalIn.y * pNormalCols[1].x + normalIn.z * pNormalCols[2].x;
+				FloatSSE normalY = normalIn.x * pNormalCols[0].y + normalIn.y * pNormalCols[1].y + normalIn.z * pNormalCols[2].y;
+				FloatSSE normalZ = normalIn.x * pNormalCols[0].z + normalIn.y * pNormalCols[1].z + normalIn.z * pNormalCols[2].z;
+
+				for (auto i = 0; i < count; i++)
+				{
+					pOut[i].projectedPos = Vector4(clipX[i], clipY[i], clipZ[i], clipW[i]);
+					pOut[i].position = Vector3(worldX[i], worldY[i], worldZ[i]);
+					pOut[i].normal = Vector3(normalX[i], normalY[i], normalZ[i]);
+					pOut[i].texCoord = Vector2(texIn.u[i], texIn.v[i]);
+				}
+			}
 		};
 
 		struct CoverageMask
@@ -100,6 +190,20 @@ namespace EDX
 			{
 				return bits[0] | bits[1] | bits[2] | bits[3];
 			}
+			// Lanes of the quad covered by any sample
+			inline int GetLaneMask() const
+			{
+				uint mask = Merge();
+				mask |= mask >> 16;
+				mask |= mask >> 8;
+				mask |= mask >> 4;
+				return mask & 0xF;
+			}
+			inline int GetLaneCount() const
+			{
+				const int mask = GetLaneMask();
+				return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + (mask >> 3);
+			}
 		};
 
 		struct Fragment
@@ -110,9 +214,12 @@ namespace EDX
 			unsigned short x, y;
 			uint vId0, vId1, vId2, coreId;
 			uint textureId;
-			uint tileId;
-			uint intraTileIdx;
+			uint drawId;
 
+			// Unpacked from a FragmentBuffer right before shading
+			Fragment()
+			{
+			}
 			Fragment(const FloatSSE& l0,
 				const FloatSSE& l1,
 				const int id0,
@@ -120,22 +227,20 @@ namespace EDX
 				const int id2,
 				const int cId,
 				const int texId,
+				const int dId,
 				const Vector2i& pixelCoord,
-				const CoverageMask& mask,
-				const int tId,
-				const uint intraTId)
+				const CoverageMask& mask)
 				: lambda0(l0)
 				, lambda1(l1)
+				, coverageMask(mask)
+				, x(pixelCoord.x)
+				, y(pixelCoord.y)
 				, vId0(id0)
 				, vId1(id1)
 				, vId2(id2)
 				, coreId(cId)
 				, textureId(texId)
-				, x(pixelCoord.x)
-				, y(pixelCoord.y)
-				, coverageMask(mask)
-				, tileId(tId)
-				, intraTileIdx(intraTId)
+				, drawId(dId)
 			{
 			}
 
@@ -174,12 +279,19 @@ namespace EDX
 		{
 		public:
 			virtual ~PixelShader() {}
+			// Lanes are independent and may come from different quads, texDifferentials holds the
+			// screen space texture coordinate derivatives in x and y of each lane's source quad and
+			// texLod its level of detail from TextureSampler::ComputeLod. Textures are sampled through
+			// sampler with fragIn.textureId.
 			virtual Vec3f_SSE Shade(Fragment& fragIn,
 				const Vector3& eyePos,
 				const Vector3& lightDir,
 				const Vec3f_SSE& position,
 				const Vec3f_SSE& normal,
-				const Vec2f_SSE& texCoord) const = 0;
+				const Vec2f_SSE& texCoord,
+				const Vec2f_SSE texDifferentials[2],
+				const FloatSSE& texLod,
+				const TextureSampler& sampler) const = 0;
 		};
 
 		class LambertianPixelShader : public PixelShader
@@ -214,7 +326,10 @@ namespace EDX
 				const Vector3& lightDir,
 				const Vec3f_SSE& position,
 				const Vec3f_SSE& normal,
-				const Vec2f_SSE& texCoord) const
+				const Vec2f_SSE& texCoord,
+				const Vec2f_SSE texDifferentials[2],
+				const FloatSSE& texLod,
+				const TextureSampler& sampler) const
 			{
 				FloatSSE w = SSE::Rsqrt(Math::Dot(normal, normal));
 				Vec3f_SSE _normal = normal * w;
@@ -224,19 +339,7 @@ namespace EDX
 				BoolSSE mask = diffuseAmount < FloatSSE(Math::EDX_ZERO);
 				diffuseAmount = SSE::Select(mask, FloatSSE(Math::EDX_ZERO), diffuseAmount);
 
-				// Sample texture
-				const Vector2 differentials[2] = { Vector2(texCoord.u[1] - texCoord.u[0], texCoord.v[1] - texCoord.v[0]),
-					Vector2(texCoord.u[2] - texCoord.u[0], texCoord.v[2] - texCoord.v[0]) };
-
-				(*RenderStates::Instance()->TextureSlots)[fragIn.textureId]->SetFilter(RenderStates::Instance()->GetTextureFilter());
-				Vec3f_SSE Albedo;
-				for (auto i = 0; i < 4; i++)
-				{
-					Color color = (*RenderStates::Instance()->TextureSlots)[fragIn.textureId]->Sample(Vector2(texCoord.u[i], texCoord.v[i]), differentials);
-					Albedo.x[i] = color.r;
-					Albedo.y[i] = color.g;
-					Albedo.z[i] = color.b;
-				}
+				Vec3f_SSE Albedo = sampler.Sample(fragIn.textureId, texCoord, texDifferentials, texLod);
 				FloatSSE diffuse = (diffuseAmount + 0.2f) * 3 * Math::EDX_INV_PI;
 
 				return diffuse * Albedo;
@@ -251,7 +354,10 @@ namespace EDX
 				const Vector3& lightDir,
 				const Vec3f_SSE& position,
 				const Vec3f_SSE& normal,
-				const Vec2f_SSE& texCoord) const
+				const Vec2f_SSE& texCoord,
+				const Vec2f_SSE texDifferentials[2],
+				const FloatSSE& texLod,
+				const TextureSampler& sampler) const
 			{
 				FloatSSE w = SSE::Rsqrt(Math::Dot(normal, normal));
 				Vec3f_SSE _normal = normal * w;
@@ -0,0 +1,523 @@
+#include "TaskSystem.h"
+
+#include <algorithm>
+#include <xmmintrin.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace
+		{
+			thread_local int tCurrentWorker = -1;
+
+#if !defined(_WIN32)
+			const int MPOL_PREFERRED_POLICY = 1; // From linux/mempolicy.h, so libnuma is not needed
+
+			// Parses sysfs cpu lists such as "0-7,16-23"
+			void ParseCPUList(const char* path, Array<int>& cpus)
+			{
+				FILE* pFile = fopen(path, "r");
+				if (!pFile)
+					return;
+
+				int first, last;
+				while (fscanf(pFile, "%d", &first) == 1)
+				{
+					last = first;
+					int c = fgetc(pFile);
+					if (c == '-')
+					{
+						if (fscanf(pFile, "%d", &last) != 1)
+							break;
+						c = fgetc(pFile);
+					}
+
+					for (auto cpu = first; cpu <= last; cpu++)
+						cpus.Add(cpu);
+
+					if (c != ',')
+						break;
+				}
+				fclose(pFile);
+			}
+#endif
+		}
+
+		namespace NodeMemory
+		{
+#if defined(_WIN32)
+			void* Reserve(const size_t bytes)
+			{
+				return VirtualAlloc(nullptr, bytes, MEM_RESERVE, PAGE_READWRITE);
+			}
+
+			void Commit(void* pMem, const size_t bytes, const int node)
+			{
+				// Pages already committed keep their node
+				VirtualAllocExNuma(GetCurrentProcess(), pMem, bytes, MEM_COMMIT, PAGE_READWRITE, DWORD(TaskSystem::Instance()->GetNodeOSId(node)));
+			}
+
+			void Release(void* pMem, const size_t bytes)
+			{
+				if (pMem)
+					VirtualFree(pMem, 0, MEM_RELEASE);
+			}
+#else
+			void* Reserve(const size_t bytes)
+			{
+				void* pMem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+				return pMem == MAP_FAILED ? nullptr : pMem;
+			}
+
+			void Commit(void* pMem, const size_t bytes, const int node)
+			{
+				// Anonymous pages are backed on first touch anyway, only the placement policy needs setting
+				const TaskSystem* pTasks = TaskSystem::Instance();
+				if (pTasks->GetNodeCount() < 2 || bytes == 0)
+					return;
+
+				const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+				const size_t begin = size_t(pMem) & ~(pageSize - 1);
+				const size_t end = (size_t(pMem) + bytes + pageSize - 1) & ~(pageSize - 1);
+
+				const int osNode = pTasks->GetNodeOSId(node);
+				unsigned long nodeMask[16] = { 0 };
+				if (osNode >= int(8 * sizeof(nodeMask)) - 1)
+					return;
+
+				nodeMask[osNode / (8 * sizeof(unsigned long))] |= 1ul << (osNode % (8 * sizeof(unsigned long)));
+				syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED_POLICY, nodeMask, 8 * sizeof(nodeMask), 0);
+			}
+
+			void Release(void* pMem, const size_t bytes)
+			{
+				if (pMem)
+					munmap(pMem, bytes);
+			}
+#endif
+		}
+
+		TaskSystem* TaskSystem::mpInstance = nullptr;
+		int TaskSystem::mRefCount = 0;
+		std::mutex TaskSystem::mInstanceLock;
+
+		void TaskSystem::AddRef()
+		{
+			std::lock_guard<std::mutex> lock(mInstanceLock);
+			Instance();
+			mRefCount++;
+		}
+
+		void TaskSystem::Release()
+		{
+			std::lock_guard<std::mutex> lock(mInstanceLock);
+			Assert(mRefCount > 0);
+			if (--mRefCount == 0)
+			{
+				delete mpInstance;
+				mpInstance = nullptr;
+			}
+		}
+
+		TaskSystem::TaskSystem()
+			: mJobCount(0), mShutdown(false)
+		{
+			Array<Array<int>> nodeCPUs;
+			DetectTopology(nodeCPUs);
+
+			mNodeCount = nodeCPUs.Size();
+			for (auto node = 0; node < mNodeCount; node++)
+			{
+				mNodeFirstWorkers.Add(mWorkerNodes.Size());
+				for (auto cpu : nodeCPUs[node])
+				{
+					mWorkerNodes.Add(node);
+					mWorkerCPUs.Add(cpu);
+				}
+			}
+			mNodeFirstWorkers.Add(mWorkerNodes.Size());
+			mNodeJoiners.Resize(mNodeCount);
+			for (auto& it : mNodeJoiners)
+				it = 0;
+
+			const int workerCount = mWorkerNodes.Size();
+			mStealOrders.Resize(workerCount);
+			for (auto w = 0; w < workerCount; w++)
+			{
+				const int node = mWorkerNodes[w];
+				for (auto i = 0; i < mNodeCount; i++)
+				{
+					const int victimNode = (node + i) % mNodeCount;
+					const int first = mNodeFirstWorkers[victimNode];
+					const int count = mNodeFirstWorkers[victimNode + 1] - first;
+
+					// Within the own node start right after this worker, so thieves spread out
+					const int start = victimNode == node ? w - first : 0;
+					for (auto j = 0; j < count; j++)
+						mStealOrders[w].Add(first + (start + j) % count);
+				}
+			}
+
+			for (auto w = 0; w < workerCount; w++)
+			{
+				mWorkers.Add(MakeUnique<std::thread>([this, w]()
+				{
+					WorkerLoop(w);
+				}));
+			}
+		}
+
+		TaskSystem::~TaskSystem()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mLock);
+				mShutdown = true;
+			}
+			mWake.notify_all();
+
+			for (auto& it : mWorkers)
+				it->join();
+		}
+
+		void TaskSystem::DetectTopology(Array<Array<int>>& nodeCPUs)
+		{
+#if defined(_WIN32)
+			ULONG highestNode = 0;
+			if (GetNumaHighestNodeNumber(&highestNode))
+			{
+				for (auto node = 0; node <= int(highestNode); node++)
+				{
+					GROUP_AFFINITY affinity;
+					if (!GetNumaNodeProcessorMaskEx(USHORT(node), &affinity) || affinity.Mask == 0)
+						continue;
+
+					Array<int> cpus;
+					for (auto bit = 0; bit < 64; bit++)
+					{
+						if (affinity.Mask & (KAFFINITY(1) << bit))
+							cpus.Add(affinity.Group * 64 + bit);
+					}
+					nodeCPUs.Add(cpus);
+					mNodeIds.Add(node);
+				}
+			}
+#else
+			cpu_set_t allowed;
+			CPU_ZERO(&allowed);
+			const bool hasMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+			// Nodes are numbered sparsely on some machines
+			if (DIR* pDir = opendir("/sys/devices/system/node"))
+			{
+				Array<int> osNodes;
+				while (dirent* pEntry = readdir(pDir))
+				{
+					int node;
+					if (sscanf(pEntry->d_name, "node%d", &node) == 1)
+						osNodes.Add(node);
+				}
+				closedir(pDir);
+				std::sort(osNodes.Data(), osNodes.Data() + osNodes.Size());
+
+				for (auto node : osNodes)
+				{
+					char path[128];
+					snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+					Array<int> cpus, usable;
+					ParseCPUList(path, cpus);
+					for (auto cpu : cpus)
+					{
+						if (!hasMask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)))
+							usable.Add(cpu);
+					}
+
+					if (usable.Size() > 0)
+					{
+						nodeCPUs.Add(usable);
+						mNodeIds.Add(node);
+					}
+				}
+			}
+#endif
+
+			// No NUMA information, one node with every processor and no pinning
+			if (nodeCPUs.Size() == 0)
+			{
+				const int cpuCount = Math::Max(1, int(std::thread::hardware_concurrency()));
+				Array<int> cpus;
+				for (auto cpu = 0; cpu < cpuCount; cpu++)
+					cpus.Add(-1);
+
+				nodeCPUs.Add(cpus);
+				mNodeIds.Clear();
+				mNodeIds.Add(0);
+			}
+		}
+
+		int TaskSystem::CurrentWorker()
+		{
+			return tCurrentWorker;
+		}
+
+		void TaskSystem::WorkerLoop(const int workerId)
+		{
+			tCurrentWorker = workerId;
+
+			const int cpu = mWorkerCPUs[workerId];
+			if (cpu >= 0)
+			{
+#if defined(_WIN32)
+				GROUP_AFFINITY affinity;
+				memset(&affinity, 0, sizeof(affinity));
+				affinity.Group = WORD(cpu / 64);
+				affinity.Mask = KAFFINITY(1) << (cpu % 64);
+				SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+#else
+				cpu_set_t cpuSet;
+				CPU_ZERO(&cpuSet);
+				CPU_SET(cpu, &cpuSet);
+				pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+			}
+
+			std::unique_lock<std::mutex> lock(mLock);
+			while (true)
+			{
+				Job* pJob = FindJob(workerId);
+				if (!pJob && !mShutdown)
+				{
+					// Loops of one frame come in quick succession, polling a while saves a wake up
+					lock.unlock();
+					for (auto i = 0; i < SPIN_COUNT && mJobCount.load(std::memory_order_relaxed) == 0; i++)
+						_mm_pause();
+					lock.lock();
+
+					mWake.wait(lock, [this, workerId, &pJob]()
+					{
+						pJob = FindJob(workerId);
+						return mShutdown || pJob;
+					});
+				}
+
+				if (mShutdown)
+					return;
+
+				Job& job = *pJob;
+				job.refs++;
+				lock.unlock();
+
+				RunJob(job, workerId);
+
+				lock.lock();
+				job.refs--;
+				RemoveJob(job);
+				mDone.notify_all();
+			}
+		}
+
+		void TaskSystem::InitJob(Job& job, const int begin, const int count, const StealScope scope) const
+		{
+			const int workerCount = mWorkers.Size();
+			job.count = count;
+			job.scope = scope;
+			job.completed = 0;
+			job.refs = 0;
+			job.pPartitions = new Partition[workerCount];
+			for (auto w = 0; w < workerCount; w++)
+			{
+				job.pPartitions[w].next = begin + int(int64(w) * count / workerCount);
+				job.pPartitions[w].end = begin + int(int64(w + 1) * count / workerCount);
+			}
+		}
+
+		void TaskSystem::Submit(Job& job)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mLock);
+				mJobs.Add(&job);
+				mJobCount = mJobs.Size();
+			}
+			mWake.notify_all();
+		}
+
+		void TaskSystem::Join(Job& job)
+		{
+			// Workers help with their own loop, so nested loops cannot run out of threads
+			const int workerId = CurrentWorker();
+			std::unique_lock<std::mutex> lock(mLock);
+			if (workerId >= 0)
+			{
+				job.refs++;
+				lock.unlock();
+
+				RunJob(job, workerId);
+
+				lock.lock();
+
+				// Workers blocked in a join only run their own loop. Once every worker of a node is blocked,
+				// nothing else would run the items left there, so the joiner takes them over.
+				const int node = mWorkerNodes[workerId];
+				BlockJoiner(node);
+				while (job.completed.load() != job.count)
+				{
+					const int stalledNode = FindStalledNode(job, node);
+					if (stalledNode < 0)
+					{
+						mDone.wait(lock);
+						continue;
+					}
+
+					// Items run while helping may join loops of their own
+					mNodeJoiners[node]--;
+					lock.unlock();
+					for (auto w = mNodeFirstWorkers[stalledNode]; w < mNodeFirstWorkers[stalledNode + 1]; w++)
+						RunPartition(job, w);
+					lock.lock();
+					BlockJoiner(node);
+				}
+				mNodeJoiners[node]--;
+
+				job.refs--;
+				RemoveJob(job);
+			}
+
+			mDone.wait(lock, [&job]() { return job.completed.load() == job.count && job.refs == 0; });
+			RemoveJob(job);
+			lock.unlock();
+
+			delete[] job.pPartitions;
+			job.pPartitions = nullptr;
+		}
+
+		void TaskSystem::BlockJoiner(const int node)
+		{
+			// Only a node becoming stalled can let other joiners go on
+			if (++mNodeJoiners[node] == GetNodeWorkerCount(node))
+				mDone.notify_all();
+		}
+
+		void TaskSystem::RunJob(Job& job, const int workerId)
+		{
+			// Steal orders list the own node first
+			const int node = mWorkerNodes[workerId];
+			for (auto victim : mStealOrders[workerId])
+			{
+				if (job.scope == StealScope::Node && mWorkerNodes[victim] != node)
+					break;
+
+				RunPartition(job, victim);
+			}
+		}
+
+		void TaskSystem::RunPartition(Job& job, const int victim)
+		{
+			Partition& partition = job.pPartitions[victim];
+			while (partition.next.load(std::memory_order_relaxed) < partition.end)
+			{
+				const int idx = partition.next.fetch_add(1);
+				if (idx >= partition.end)
+					break;
+
+				job.pInvoke(job.pFunc, idx);
+				job.completed.fetch_add(1);
+			}
+		}
+
+		bool TaskSystem::HasWork(const Job& job, const int node) const
+		{
+			const int first = node < 0 ? 0 : mNodeFirstWorkers[node];
+			const int last = node < 0 ? mWorkers.Size() : mNodeFirstWorkers[node + 1];
+			for (auto w = first; w < last; w++)
+			{
+				if (job.pPartitions[w].next.load(std::memory_order_relaxed) < job.pPartitions[w].end)
+					return true;
+			}
+
+			return false;
+		}
+
+		TaskSystem::Job* TaskSystem::FindJob(const int workerId) const
+		{
+			const int node = mWorkerNodes[workerId];
+			for (auto i = mJobs.Size() - 1; i >= 0; i--)
+			{
+				if (HasWork(*mJobs[i], mJobs[i]->scope == StealScope::Node ? node : -1))
+					return mJobs[i];
+			}
+
+			return nullptr;
+		}
+
+		int TaskSystem::FindStalledNode(const Job& job, const int node) const
+		{
+			for (auto n = 0; n < mNodeCount; n++)
+			{
+				if (n != node && mNodeJoiners[n] == GetNodeWorkerCount(n) && HasWork(job, n))
+					return n;
+			}
+
+			return -1;
+		}
+
+		void TaskSystem::RemoveJob(Job& job)
+		{
+			// Jobs stay listed until every partition is claimed, called with mLock held
+			if (HasWork(job, -1))
+				return;
+
+			for (auto i = 0; i < mJobs.Size(); i++)
+			{
+				if (mJobs[i] == &job)
+				{
+					for (auto j = i; j < mJobs.Size() - 1; j++)
+						mJobs[j] = mJobs[j + 1];
+					mJobs.Resize(mJobs.Size() - 1);
+					break;
+				}
+			}
+			mJobCount = mJobs.Size();
+		}
+
+		void Task::Run(const std::function<void()>& func)
+		{
+			Assert(!mPending);
+
+			mFunc = func;
+			mJob.pInvoke = [](const void* pFunc, const int idx)
+			{
+				(*(const std::function<void()>*)pFunc)();
+			};
+			mJob.pFunc = &mFunc;
+
+			TaskSystem* pTasks = TaskSystem::Instance();
+			// A single call has no data on any node
+			pTasks->InitJob(mJob, 0, 1, StealScope::AllNodes);
+			pTasks->Submit(mJob);
+			mPending = true;
+		}
+
+		void Task::Wait()
+		{
+			if (!mPending)
+				return;
+
+			TaskSystem::Instance()->Join(mJob);
+			mPending = false;
+		}
+	}
+}
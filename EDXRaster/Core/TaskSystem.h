@@ -0,0 +1,303 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Core/SmartPointer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Pages preferring one NUMA node. Reserved ranges are only backed when first touched, so parts of one
+		// range can be committed to different nodes. Sizes and offsets are rounded out to whole pages.
+		namespace NodeMemory
+		{
+			void* Reserve(const size_t bytes);
+			void Commit(void* pMem, const size_t bytes, const int node);
+			void Release(void* pMem, const size_t bytes);
+
+			inline void* Alloc(const size_t bytes, const int node)
+			{
+				void* pMem = Reserve(bytes);
+				if (pMem)
+					Commit(pMem, bytes, node);
+
+				return pMem;
+			}
+		}
+
+		// Partitions a worker may steal once its own is done
+		enum class StealScope
+		{
+			Node,		// Only those of its own node, items never leave the node owning their data
+			AllNodes	// Its own node first, then the other nodes
+		};
+
+		// Worker pool with one thread pinned to every logical processor the process may run on. Workers are
+		// numbered node by node. Parallel loops split their range evenly into one partition per worker, a
+		// worker runs its own partition first and then steals from other workers of its node. Loops over
+		// the same count therefore hand the same items to the same node every time, which is what tile
+		// ownership, per core buffers and NodeArray placement rely on. Stealing across nodes is opt in.
+		class TaskSystem
+		{
+		public:
+			static const int SPIN_COUNT = 4096; // Idle polls before a worker sleeps
+
+		private:
+			struct alignas(64) Partition
+			{
+				std::atomic<int> next;
+				int end;
+			};
+
+			struct Job
+			{
+				void (*pInvoke)(const void* pFunc, const int idx);
+				const void* pFunc;
+				int count;
+				StealScope scope;
+				Partition* pPartitions; // One per worker, freed by Join
+				std::atomic<int> completed;
+				int refs; // Threads inside RunJob, guarded by mLock
+			};
+
+			Array<UniquePtr<std::thread>> mWorkers;
+			Array<int> mWorkerNodes;
+			Array<int> mWorkerCPUs;
+			Array<Array<int>> mStealOrders;
+			Array<int> mNodeFirstWorkers; // Node n owns workers [mNodeFirstWorkers[n], mNodeFirstWorkers[n + 1])
+			Array<int> mNodeIds; // Operating system numbers of the nodes
+			Array<int> mNodeJoiners; // Workers of each node blocked in Join, guarded by mLock
+			int mNodeCount;
+
+			std::mutex mLock;
+			std::condition_variable mWake;
+			std::condition_variable mDone;
+			Array<Job*> mJobs; // Jobs with partitions left to claim, latest last
+			std::atomic<int> mJobCount;
+			bool mShutdown;
+
+			static TaskSystem* mpInstance;
+			static int mRefCount; // Guarded by mInstanceLock
+			static std::mutex mInstanceLock;
+
+		public:
+			static TaskSystem* Instance()
+			{
+				if (!mpInstance)
+					mpInstance = new TaskSystem;
+
+				return mpInstance;
+			}
+			// The pool is shared by every renderer in the process. Each holds a reference for its lifetime and
+			// the last release shuts the workers down, a pool only ever reached through Instance lives until exit.
+			static void AddRef();
+			static void Release();
+
+			~TaskSystem();
+
+			int GetWorkerCount() const
+			{
+				return mWorkers.Size();
+			}
+			int GetNodeCount() const
+			{
+				return mNodeCount;
+			}
+			int GetWorkerNode(const int workerId) const
+			{
+				return mWorkerNodes[workerId];
+			}
+			int GetNodeOSId(const int node) const
+			{
+				return mNodeIds[node];
+			}
+			int GetNodeFirstWorker(const int node) const
+			{
+				return mNodeFirstWorkers[node];
+			}
+			int GetNodeWorkerCount(const int node) const
+			{
+				return mNodeFirstWorkers[node + 1] - mNodeFirstWorkers[node];
+			}
+			// Own worker first, then the rest of its node, then the other nodes. Stealing within the node
+			// stops at the first worker of another node.
+			const Array<int>& GetStealOrder(const int workerId) const
+			{
+				return mStealOrders[workerId];
+			}
+
+			// Node whose workers own item idx of a parallel loop over count items
+			int GetItemNode(const int idx, const int count) const
+			{
+				return mWorkerNodes[GetItemWorker(idx, count)];
+			}
+			int GetItemWorker(const int idx, const int count) const
+			{
+				return int((int64(idx + 1) * mWorkers.Size() - 1) / count);
+			}
+
+			// Worker running the calling thread, -1 outside of the pool
+			static int CurrentWorker();
+
+			// Calls func(i) for every i in [begin, end) and returns once all calls are done. Callers outside
+			// the pool only wait, workers run their own partition of nested loops.
+			template<typename Func>
+			void ParallelFor(const int begin, const int end, const Func& func, const StealScope scope = StealScope::Node)
+			{
+				const int count = end - begin;
+				if (count <= 0)
+					return;
+
+				if (count == 1)
+				{
+					func(begin);
+					return;
+				}
+
+				Job job;
+				job.pInvoke = [](const void* pFunc, const int idx)
+				{
+					(*(const Func*)pFunc)(idx);
+				};
+				job.pFunc = &func;
+				InitJob(job, begin, count, scope);
+				Submit(job);
+				Join(job);
+			}
+
+		private:
+			friend class Task;
+
+			TaskSystem();
+
+			void DetectTopology(Array<Array<int>>& nodeCPUs);
+			void WorkerLoop(const int workerId);
+
+			void InitJob(Job& job, const int begin, const int count, const StealScope scope) const;
+			void Submit(Job& job);
+			void Join(Job& job);
+			void RunJob(Job& job, const int workerId);
+			void RunPartition(Job& job, const int victim);
+			// Partitions of the node left to claim, of any node for node -1
+			bool HasWork(const Job& job, const int node) const;
+			// Latest job with partitions the worker may claim, mLock held
+			Job* FindJob(const int workerId) const;
+			// Counts a worker of the node as blocked, mLock held
+			void BlockJoiner(const int node);
+			// Node other than this one whose workers are all blocked in joins while the job has work left there, mLock held
+			int FindStalledNode(const Job& job, const int node) const;
+			void RemoveJob(Job& job);
+		};
+
+		// A function run on the pool in the background. Wait must be called before the next Run.
+		class Task
+		{
+		private:
+			std::function<void()> mFunc;
+			TaskSystem::Job mJob;
+			bool mPending;
+
+		public:
+			Task()
+				: mPending(false)
+			{
+			}
+			~Task()
+			{
+				Wait();
+			}
+
+			void Run(const std::function<void()>& func);
+			void Wait();
+		};
+
+		// Zero filled array of trivially copyable items of a fixed number of elements each, every item placed
+		// on the node owning it in parallel loops over all items
+		template<typename T>
+		class NodeArray
+		{
+		private:
+			T* mpData;
+			int mSize;
+
+		public:
+			NodeArray()
+				: mpData(nullptr), mSize(0)
+			{
+			}
+			~NodeArray()
+			{
+				Clear();
+			}
+
+			NodeArray(const NodeArray&) = delete;
+			NodeArray& operator = (const NodeArray&) = delete;
+
+			void Init(const int itemCount, const int itemSize)
+			{
+				Clear();
+				if (itemCount == 0 || itemSize == 0)
+					return;
+
+				mSize = itemCount * itemSize;
+				mpData = (T*)NodeMemory::Reserve(mSize * sizeof(T));
+				Assert(mpData);
+
+				// Workers are numbered node by node, so each node owns one contiguous run of items
+				const TaskSystem* pTasks = TaskSystem::Instance();
+				for (auto first = 0; first < itemCount;)
+				{
+					const int node = pTasks->GetItemNode(first, itemCount);
+					auto last = first + 1;
+					while (last < itemCount && pTasks->GetItemNode(last, itemCount) == node)
+						last++;
+
+					NodeMemory::Commit(mpData + first * itemSize, (last - first) * itemSize * sizeof(T), node);
+					first = last;
+				}
+			}
+
+			void Clear()
+			{
+				NodeMemory::Release(mpData, mSize * sizeof(T));
+				mpData = nullptr;
+				mSize = 0;
+			}
+
+			__forceinline int Size() const
+			{
+				return mSize;
+			}
+			__forceinline T* Data()
+			{
+				return mpData;
+			}
+			__forceinline const T* Data() const
+			{
+				return mpData;
+			}
+			__forceinline T& operator [] (const int idx)
+			{
+				Assert(idx < mSize);
+				return mpData[idx];
+			}
+			__forceinline const T& operator [] (const int idx) const
+			{
+				Assert(idx < mSize);
+				return mpData[idx];
+			}
+		};
+
+		template<typename Func>
+		inline void ParallelFor(const int begin, const int end, const Func& func, const StealScope scope = StealScope::Node)
+		{
+			TaskSystem::Instance()->ParallelFor(begin, end, func, scope);
+		}
+	}
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Shader.h"
+#include "FragmentBuffer.h"
 #include "Math/Vector.h"
 
 namespace EDX
@@ -15,14 +16,19 @@ namespace EDX
 			struct TriangleRef
 			{
 				uint triId;
+				uint coreId;
 				bool acceptEdge0;
 				bool acceptEdge1;
 				bool acceptEdge2;
 				bool trivialAccept;
 				bool big;
+				bool micro; // Covers pixels of at most one MICRO_SIZE aligned block, see Rasterizer::MicroRasterize
 
-				TriangleRef(uint id, bool acptE0 = false, bool acptE1 = false, bool acptE2 = false, bool _big = false)
-					: triId(id), acceptEdge0(acptE0), acceptEdge1(acptE1), acceptEdge2(acptE2), trivialAccept(false), big(_big)
+				TriangleRef()
+				{
+				}
+				TriangleRef(uint id, uint cId, bool acptE0 = false, bool acptE1 = false, bool acptE2 = false, bool _big = false)
+					: triId(id), coreId(cId), acceptEdge0(acptE0), acceptEdge1(acptE1), acceptEdge2(acptE2), trivialAccept(false), big(_big), micro(false)
 				{
 					if (acceptEdge0 && acceptEdge1 && acceptEdge2)
 						trivialAccept = true;
@@ -31,13 +37,29 @@ namespace EDX
 
 			Vector2i minCoord, maxCoord;
 			uint tileId;
-			Array<TriangleRef> triangleRefs[12];
-			Array<Fragment> fragmentBuf;
+			Array<TriangleRef> triangleRefs; // Merged from all binning threads in primitive order
+			FragmentBuffer fragmentBuf;
+			Array<IntSSE> shadingResultBuf; // Only used by the tile-local pipeline
 
 			Tile(const Vector2i& min, const Vector2i& max, const uint tId)
 				: minCoord(min), maxCoord(max), tileId(tId)
 			{
 			}
+
+			// Quad coordinates are stored relative to the enclosing full tile, so sub tiles can share the layout
+			__forceinline void AddFragment(const FloatSSE& lambda0,
+				const FloatSSE& lambda1,
+				const uint coreId,
+				const uint triId,
+				const Vector2i& pixelCoord,
+				const CoverageMask& mask)
+			{
+				fragmentBuf.Add(lambda0,
+					lambda1,
+					FragmentBuffer::PackTriangleId(coreId, triId),
+					Vector2i(pixelCoord.x & (SIZE - 1), pixelCoord.y & (SIZE - 1)),
+					mask);
+			}
 		};
 	}
 }
\ No newline at end of file
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Tile.h"
+#include "TaskSystem.h"
+#include "Core/SmartPointer.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		struct TileJob
+		{
+			uint tileId;
+			int subTileId; // -1 when the job covers the whole tile
+			Vector2i minCoord, maxCoord;
+			uint cost;
+		};
+
+		// Schedules tile rasterization using the binned ref counts as cost estimates. Jobs are sorted
+		// most expensive first and dealt round robin to the deques of the workers on the node owning
+		// the tile. Workers pop from the front of their own deque and steal from the back of others
+		// of their node once it runs dry. Stealing from other nodes is opt in.
+		class TileScheduler
+		{
+		public:
+			static const uint TRIVIAL_ACCEPT_WEIGHT = 4;
+			static const uint MIN_SPLIT_COST = 64;
+			static const int SUB_TILE_SIZE = Tile::SIZE >> 1;
+
+		private:
+			class WorkQueue
+			{
+			private:
+				Array<uint> mJobIds;
+				int mHead, mTail;
+				std::mutex mLock;
+
+			public:
+				WorkQueue()
+					: mHead(0), mTail(0)
+				{
+				}
+
+				void Clear()
+				{
+					mJobIds.Clear();
+					mHead = mTail = 0;
+				}
+				void Push(const uint jobId)
+				{
+					mJobIds.Add(jobId);
+					mTail = mJobIds.Size();
+				}
+				bool Pop(uint& jobId)
+				{
+					std::lock_guard<std::mutex> lock(mLock);
+					if (mHead == mTail)
+						return false;
+
+					jobId = mJobIds[mHead++];
+					return true;
+				}
+				bool Steal(uint& jobId)
+				{
+					std::lock_guard<std::mutex> lock(mLock);
+					if (mHead == mTail)
+						return false;
+
+					jobId = mJobIds[--mTail];
+					return true;
+				}
+			};
+
+			struct SplitTile
+			{
+				uint tileId;
+				int firstSubTile, subTileCount;
+			};
+
+			Array<TileJob> mJobs;
+			Array<UniquePtr<WorkQueue>> mQueues;
+			Array<Tile> mSubTiles;
+			Array<SplitTile> mSplitTiles;
+			bool mSplitHotTiles;
+			bool mCrossNodeStealing;
+
+		public:
+			TileScheduler()
+				: mSplitHotTiles(true), mCrossNodeStealing(false)
+			{
+			}
+
+			// One deque per task system worker. Jobs are dealt to workers by node, so this follows the pool
+			// and not the renderer's core count, which is capped by the packed triangle id.
+			void Init()
+			{
+				const int numWorkers = TaskSystem::Instance()->GetWorkerCount();
+				mQueues.Clear();
+				for (auto i = 0; i < numWorkers; i++)
+					mQueues.Add(MakeUnique<WorkQueue>());
+			}
+
+			void SetSplitHotTiles(const bool split)
+			{
+				mSplitHotTiles = split;
+			}
+			// Lets workers steal tiles of other nodes once their node runs dry, at the cost of reading
+			// the tile and its bins across the interconnect
+			void SetCrossNodeStealing(const bool steal)
+			{
+				mCrossNodeStealing = steal;
+			}
+
+			static uint EstimateCost(const Tile& tile)
+			{
+				uint cost = 0;
+				for (auto i = 0; i < tile.triangleRefs.Size(); i++)
+					cost += tile.triangleRefs[i].trivialAccept ? TRIVIAL_ACCEPT_WEIGHT : 1;
+
+				return cost;
+			}
+
+			// Builds and distributes the jobs for this frame, must run after the binning merge pass
+			void BuildJobs(Array<Tile>& tiles)
+			{
+				mJobs.Clear();
+				mSplitTiles.Clear();
+
+				uint totalCost = 0;
+				uint busyTiles = 0;
+				Array<uint> costs;
+				costs.Resize(tiles.Size());
+				for (auto i = 0; i < tiles.Size(); i++)
+				{
+					costs[i] = EstimateCost(tiles[i]);
+					totalCost += costs[i];
+					busyTiles += costs[i] > 0;
+				}
+
+				// Tiles far above average cost are split into sub tile jobs
+				const uint avgCost = busyTiles > 0 ? totalCost / busyTiles : 0;
+				const uint splitCost = Math::Max(MIN_SPLIT_COST, 4 * avgCost);
+
+				int subTileCount = 0;
+				for (auto i = 0; i < tiles.Size(); i++)
+				{
+					const Tile& tile = tiles[i];
+					if (costs[i] == 0)
+						continue;
+
+					if (!mSplitHotTiles || costs[i] < splitCost)
+					{
+						TileJob job = { tile.tileId, -1, tile.minCoord, tile.maxCoord, costs[i] };
+						mJobs.Add(job);
+						continue;
+					}
+
+					SplitTile split = { tile.tileId, subTileCount, 0 };
+					for (auto y = tile.minCoord.y; y < tile.maxCoord.y; y += SUB_TILE_SIZE)
+					{
+						for (auto x = tile.minCoord.x; x < tile.maxCoord.x; x += SUB_TILE_SIZE)
+						{
+							const Vector2i subMin = Vector2i(x, y);
+							const Vector2i subMax = Vector2i(Math::Min(x + SUB_TILE_SIZE, tile.maxCoord.x), Math::Min(y + SUB_TILE_SIZE, tile.maxCoord.y));
+
+							if (subTileCount == mSubTiles.Size())
+								mSubTiles.Add(Tile(subMin, subMax, tile.tileId));
+
+							Tile& subTile = mSubTiles[subTileCount];
+							subTile.minCoord = subMin;
+							subTile.maxCoord = subMax;
+							subTile.tileId = tile.tileId;
+							subTile.fragmentBuf.SetSampleCount(tile.fragmentBuf.GetSampleCount());
+
+							TileJob job = { tile.tileId, subTileCount, subMin, subMax, costs[i] >> 2 };
+							mJobs.Add(job);
+							subTileCount++;
+							split.subTileCount++;
+						}
+					}
+					mSplitTiles.Add(split);
+				}
+
+				std::sort(mJobs.Data(), mJobs.Data() + mJobs.Size(), [](const TileJob& lhs, const TileJob& rhs)
+				{
+					return lhs.cost > rhs.cost;
+				});
+
+				for (auto& it : mQueues)
+					it->Clear();
+
+				// Tiles belong to the node that clears them and holds their framebuffer memory
+				const TaskSystem* pTasks = TaskSystem::Instance();
+				Array<int> nextWorker;
+				nextWorker.Resize(pTasks->GetNodeCount());
+				for (auto& it : nextWorker)
+					it = 0;
+				for (auto i = 0; i < mJobs.Size(); i++)
+				{
+					const int node = pTasks->GetItemNode(mJobs[i].tileId, tiles.Size());
+					const int worker = pTasks->GetNodeFirstWorker(node) + nextWorker[node]++ % pTasks->GetNodeWorkerCount(node);
+					mQueues[worker]->Push(i);
+				}
+			}
+
+			// Runs func(job, targetTile) for every job. Sub tile jobs rasterize into pooled tiles whose
+			// fragments are folded back into the parent by MergeSubTiles.
+			template<typename JobFunc>
+			void Execute(Array<Tile>& tiles, JobFunc func)
+			{
+				const int numWorkers = mQueues.Size();
+				const StealScope scope = mCrossNodeStealing ? StealScope::AllNodes : StealScope::Node;
+				ParallelFor(0, numWorkers, [&](int workerId)
+				{
+					const TaskSystem* pTasks = TaskSystem::Instance();
+					const Array<int>& stealOrder = pTasks->GetStealOrder(workerId);
+					const int node = pTasks->GetWorkerNode(workerId);
+					uint jobId;
+					while (true)
+					{
+						bool found = mQueues[workerId]->Pop(jobId);
+						for (auto i = 1; !found && i < numWorkers; i++)
+						{
+							if (scope == StealScope::Node && pTasks->GetWorkerNode(stealOrder[i]) != node)
+								break;
+
+							found = mQueues[stealOrder[i]]->Steal(jobId);
+						}
+
+						if (!found)
+							break;
+
+						const TileJob& job = mJobs[jobId];
+						Tile& target = job.subTileId < 0 ? tiles[job.tileId] : mSubTiles[job.subTileId];
+						func(job, target);
+					}
+				}, scope);
+			}
+
+			void MergeSubTiles(Array<Tile>& tiles)
+			{
+				ParallelFor(0, (int)mSplitTiles.Size(), [&](int i)
+				{
+					const SplitTile& split = mSplitTiles[i];
+					Tile& tile = tiles[split.tileId];
+					int quadCount = 0;
+					for (auto j = split.firstSubTile; j < split.firstSubTile + split.subTileCount; j++)
+						quadCount += mSubTiles[j].fragmentBuf.Size();
+
+					tile.fragmentBuf.Clear();
+					tile.fragmentBuf.Reserve(quadCount);
+
+					// Quad coordinates are already relative to the parent tile
+					for (auto j = split.firstSubTile; j < split.firstSubTile + split.subTileCount; j++)
+						tile.fragmentBuf.Append(mSubTiles[j].fragmentBuf);
+				});
+			}
+
+			const Array<TileJob>& GetJobs() const
+			{
+				return mJobs;
+			}
+		};
+	}
+}
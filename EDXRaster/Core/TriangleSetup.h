@@ -0,0 +1,222 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Math/Matrix.h"
+#include "SIMD/SSE.h"
+#include "RasterTriangle.h"
+#include "FragmentBuffer.h"
+#include "FrameArena.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Binning inputs of four consecutive triangles of one core, lane i of block j is triangle 4 * j + i.
+		// Lanes past the core's triangle count are undefined.
+		struct TriangleBlock
+		{
+			static const int LANES = 4;
+
+			IntSSE v0x, v0y, v1x, v1y, v2x, v2y;
+			IntSSE B0, C0, B1, C1, B2, C2;
+			IntSSE rejectCorners; // Two bits per edge, the accept corner is always 3 - reject corner
+		};
+
+		// Edge functions of one lane of a block, with the same top left bias as RasterTriangle
+		struct TriangleEdges
+		{
+			int B[3], C[3];
+			int x[3], y[3]; // Edge k starts at vertex k
+			int bias[3];
+
+			TriangleEdges(const TriangleBlock& block, const int lane)
+			{
+				B[0] = block.B0[lane]; B[1] = block.B1[lane]; B[2] = block.B2[lane];
+				C[0] = block.C0[lane]; C[1] = block.C1[lane]; C[2] = block.C2[lane];
+				x[0] = block.v0x[lane]; x[1] = block.v1x[lane]; x[2] = block.v2x[lane];
+				y[0] = block.v0y[lane]; y[1] = block.v1y[lane]; y[2] = block.v2y[lane];
+				for (auto k = 0; k < 3; k++)
+				{
+					const int k1 = k == 2 ? 0 : k + 1;
+					bias[k] = ((y[k1] > y[k]) || (y[k] == y[k1] && x[k] > x[k1])) ? 0 : -1;
+				}
+			}
+
+			__forceinline int EdgeFunc(const int k, const Vector2i& p) const
+			{
+				return B[k] * (p.x - x[k]) + C[k] * (p.y - y[k]) + bias[k];
+			}
+		};
+
+		// Sets up the clipper's output four triangles at a time. Fixed point conversion, the determinant and
+		// backface test, edge coefficients and corner selection all run across SSE lanes. Accepted triangles
+		// are appended in submission order to the core's RasterTriangle buffer, read by the rasterizer, and
+		// to its TriangleBlock store, read by binning. A core keeps as many triangles per frame as a packed
+		// fragment id can address, later ones are dropped.
+		class TriangleSetup
+		{
+		private:
+			// Only x and y of the raster transform matter for setup
+			FloatSSE mRasterX[4], mRasterY[4];
+
+			Vec3f_SSE mA, mB, mC;
+			uint mVertexIds[3][TriangleBlock::LANES];
+			uint mTextureIds[TriangleBlock::LANES];
+			uint mDrawIds[TriangleBlock::LANES];
+			int mCount;
+
+			uint mCoreId;
+			FrameArray<RasterTriangle>& mTriangles;
+			FrameArray<TriangleBlock>& mBlocks;
+
+		public:
+			TriangleSetup(const Matrix& rasterMatrix, const uint coreId, FrameArray<RasterTriangle>& triangles, FrameArray<TriangleBlock>& blocks)
+				: mCount(0), mCoreId(coreId), mTriangles(triangles), mBlocks(blocks)
+			{
+				for (auto i = 0; i < 4; i++)
+				{
+					const Vector4 col = Matrix::TransformPoint(Vector4(float(i == 0), float(i == 1), float(i == 2), float(i == 3)), rasterMatrix);
+					mRasterX[i] = FloatSSE(col.x);
+					mRasterY[i] = FloatSSE(col.y);
+				}
+			}
+
+			// Positions are after the homogeneous divide, before the raster transform
+			template<bool CullBackFace>
+			__forceinline void Add(const Vector3& a, const Vector3& b, const Vector3& c, const uint* pIdx, const uint texId, const uint drawId)
+			{
+				mA.x[mCount] = a.x; mA.y[mCount] = a.y; mA.z[mCount] = a.z;
+				mB.x[mCount] = b.x; mB.y[mCount] = b.y; mB.z[mCount] = b.z;
+				mC.x[mCount] = c.x; mC.y[mCount] = c.y; mC.z[mCount] = c.z;
+				mVertexIds[0][mCount] = pIdx[0];
+				mVertexIds[1][mCount] = pIdx[1];
+				mVertexIds[2][mCount] = pIdx[2];
+				mTextureIds[mCount] = texId;
+				mDrawIds[mCount] = drawId;
+
+				if (++mCount == TriangleBlock::LANES)
+					Flush<CullBackFace>();
+			}
+
+			template<bool CullBackFace>
+			void Flush()
+			{
+				if (mCount == 0)
+					return;
+
+				const IntSSE Zero = IntSSE(Math::EDX_ZERO);
+
+				IntSSE v0x, v0y, v1x, v1y, v2x, v2y;
+				ToFixedPoint(mA, v0x, v0y);
+				ToFixedPoint(mB, v1x, v1y);
+				ToFixedPoint(mC, v2x, v2y);
+
+				// Twice the signed area, positive for counter clockwise triangles
+				IntSSE det = (v0x - v2x) * (v1y - v2y) - (v2x - v1x) * (v2y - v0y);
+				IntSSE vId1 = _mm_loadu_si128((const __m128i*)mVertexIds[1]);
+				IntSSE vId2 = _mm_loadu_si128((const __m128i*)mVertexIds[2]);
+				if (!CullBackFace)
+				{
+					// Back faces are kept with their winding flipped
+					const BoolSSE flip = det < Zero;
+					const IntSSE x1 = v1x, y1 = v1y, id1 = vId1;
+					v1x = SSE::Select(flip, v2x, v1x);
+					v1y = SSE::Select(flip, v2y, v1y);
+					v2x = SSE::Select(flip, x1, v2x);
+					v2y = SSE::Select(flip, y1, v2y);
+					vId1 = SSE::Select(flip, vId2, vId1);
+					vId2 = SSE::Select(flip, id1, vId2);
+					det = SSE::Select(flip, Zero - det, det);
+				}
+
+				const BoolSSE active = IntSSE(0, 1, 2, 3) < IntSSE(mCount);
+				const int acceptMask = _mm_movemask_ps((active & (det > Zero)).m128);
+				const int count = mCount;
+				mCount = 0;
+				if (acceptMask == 0)
+					return;
+
+				const IntSSE B0 = v0y - v1y, C0 = v1x - v0x;
+				const IntSSE B1 = v1y - v2y, C1 = v2x - v1x;
+				const IntSSE B2 = v2y - v0y, C2 = v0x - v2x;
+				const IntSSE rejectCorners = RejectCorner(B0, C0) | (RejectCorner(B1, C1) << 2) | (RejectCorner(B2, C2) << 4);
+				const FloatSSE invDet = FloatSSE(Math::EDX_ONE) / FloatSSE(det);
+				const FloatSSE minZ = SSE::Min(mA.z, SSE::Min(mB.z, mC.z));
+
+				for (auto lane = 0; lane < count; lane++)
+				{
+					if (!(acceptMask & (1 << lane)))
+						continue;
+
+					if (uint(mTriangles.Size()) > FragmentBuffer::TRI_ID_MASK)
+						break;
+
+					RasterTriangle tri;
+					tri.v0 = Vector2i(v0x[lane], v0y[lane]);
+					tri.v1 = Vector2i(v1x[lane], v1y[lane]);
+					tri.v2 = Vector2i(v2x[lane], v2y[lane]);
+					tri.B0 = B0[lane]; tri.C0 = C0[lane];
+					tri.B1 = B1[lane]; tri.C1 = C1[lane];
+					tri.B2 = B2[lane]; tri.C2 = C2[lane];
+					tri.stepB0 = 16 * tri.B0; tri.stepC0 = 16 * tri.C0;
+					tri.stepB1 = 16 * tri.B1; tri.stepC1 = 16 * tri.C1;
+					tri.stepB2 = 16 * tri.B2; tri.stepC2 = 16 * tri.C2;
+					tri.invDet = invDet[lane];
+					tri.minZ = minZ[lane];
+					tri.lambda0 = tri.lambda1 = 0.0f;
+					tri.vId0 = mVertexIds[0][lane];
+					tri.vId1 = vId1[lane];
+					tri.vId2 = vId2[lane];
+					tri.coreId = mCoreId;
+					tri.textureId = mTextureIds[lane];
+					tri.drawId = mDrawIds[lane];
+
+					const int corners = rejectCorners[lane];
+					tri.rejectCorner0 = corners & 3;
+					tri.rejectCorner1 = (corners >> 2) & 3;
+					tri.rejectCorner2 = (corners >> 4) & 3;
+					tri.acceptCorner0 = 3 - tri.rejectCorner0;
+					tri.acceptCorner1 = 3 - tri.rejectCorner1;
+					tri.acceptCorner2 = 3 - tri.rejectCorner2;
+
+					tri.triId = mTriangles.Size();
+					const int slot = tri.triId % TriangleBlock::LANES;
+					if (slot == 0)
+						mBlocks.Resize(mBlocks.Size() + 1);
+
+					TriangleBlock& block = mBlocks[mBlocks.Size() - 1];
+					block.v0x[slot] = tri.v0.x; block.v0y[slot] = tri.v0.y;
+					block.v1x[slot] = tri.v1.x; block.v1y[slot] = tri.v1.y;
+					block.v2x[slot] = tri.v2.x; block.v2y[slot] = tri.v2.y;
+					block.B0[slot] = tri.B0; block.C0[slot] = tri.C0;
+					block.B1[slot] = tri.B1; block.C1[slot] = tri.C1;
+					block.B2[slot] = tri.B2; block.C2[slot] = tri.C2;
+					block.rejectCorners[slot] = corners;
+
+					mTriangles.Add(tri);
+				}
+			}
+
+		private:
+			// Raster transform and conversion to 28.4 fixed point, truncating toward zero
+			__forceinline void ToFixedPoint(const Vec3f_SSE& p, IntSSE& x, IntSSE& y) const
+			{
+				const FloatSSE Scale = FloatSSE(16.0f);
+				x = _mm_cvttps_epi32(((mRasterX[0] * p.x + mRasterX[1] * p.y + mRasterX[2] * p.z + mRasterX[3]) * Scale).m128);
+				y = _mm_cvttps_epi32(((mRasterY[0] * p.x + mRasterY[1] * p.y + mRasterY[2] * p.z + mRasterY[3]) * Scale).m128);
+			}
+
+			// Tile corner farthest outside the edge, picked from the signs of the slope B / C and of C. The slope
+			// sign comes from the integer signs without a divide, a zero C gives a non negative slope only for B > 0.
+			static __forceinline IntSSE RejectCorner(const IntSSE& B, const IntSSE& C)
+			{
+				const IntSSE Zero = IntSSE(Math::EDX_ZERO);
+				const BoolSSE slopeNonNegative = ((C != Zero) & ((B == Zero) | ((B ^ C) >= Zero))) | ((C == Zero) & (B > Zero));
+				const BoolSSE cNonNegative = C >= Zero;
+				return SSE::Select(slopeNonNegative,
+					SSE::Select(cNonNegative, IntSSE(3), IntSSE(0)),
+					SSE::Select(cNonNegative, IntSSE(2), IntSSE(1)));
+			}
+		};
+	}
+}
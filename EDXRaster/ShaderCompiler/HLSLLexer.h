@@ -18,10 +18,14 @@ namespace EDX
 			int mLine;
 
 		public:
-			void Init(const char* fileName)
+			void Init(const char* fileName, const string& str)
 			{
 				mFileName = fileName;
-				// Init mString and other pointers here
+				mString = str;
+				mpCurrent = mString.c_str();
+				mpEnd = mpCurrent + mString.length();
+				mpCurrentLineStart = mpCurrent;
+				mLine = 1;
 			}
 
 			Array<HLSLToken> Tokenize(const char* fileName,
@@ -29,19 +33,285 @@ namespace EDX
 				Array<CompileError>& ErrorList)
 			{
 				Array<HLSLToken> ret;
+				Init(fileName, str);
 
 				while (HasCharsAvailable())
 				{
 					SkipWhitespaceAndEmptyLines();
+					if (!HasCharsAvailable())
+						break;
 
+					// No preprocessor, directives are skipped as a whole
+					if (Peek() == '#')
+					{
+						SkipToNextLine();
+						continue;
+					}
 
+					HLSLToken token = NextToken();
+					if (token.Type == HLSLTokenType::Invalid)
+					{
+						ErrorList.Add(CompileError("Unexpected character '" + token.Literal + "'", token.SrcInfo));
+						continue;
+					}
+
+					ret.Add(token);
 				}
+
+				return ret;
 			}
 
 		private:
 			HLSLToken NextToken()
 			{
-				
+				SourceInfo srcInfo = { mFileName, mLine, int(mpCurrent - mpCurrentLineStart) + 1 };
+				const char* pStart = mpCurrent;
+				const char ch = Peek();
+
+				if (IsChar(ch) || ch == '_')
+				{
+					while (HasCharsAvailable() && (IsCharOrDigit(Peek()) || Peek() == '_'))
+						++mpCurrent;
+
+					const string word(pStart, mpCurrent);
+					return HLSLToken(MatchKeyword(word), word, srcInfo);
+				}
+
+				if (IsDigit(ch) || (ch == '.' && IsDigit(Peek(1))))
+					return NumberToken(srcInfo);
+
+				if (ch == '"')
+				{
+					++mpCurrent;
+					while (HasCharsAvailable() && Peek() != '"' && !IsEOL(Peek()))
+						++mpCurrent;
+
+					const string literal(pStart + 1, mpCurrent);
+					if (Peek() != '"')
+						return HLSLToken(HLSLTokenType::Invalid, "\"", srcInfo);
+
+					++mpCurrent;
+					return HLSLToken(HLSLTokenType::StringConstant, literal, srcInfo);
+				}
+
+				// Longest operator first
+				static const struct
+				{
+					const char* str;
+					HLSLTokenType type;
+				} operators[] = {
+					{ "<<=", HLSLTokenType::LowerLowerEqual },
+					{ ">>=", HLSLTokenType::GreaterGreaterEqual },
+					{ "++", HLSLTokenType::PlusPlus },
+					{ "+=", HLSLTokenType::PlusEqual },
+					{ "--", HLSLTokenType::MinusMinus },
+					{ "-=", HLSLTokenType::MinusEqual },
+					{ "*=", HLSLTokenType::TimesEqual },
+					{ "/=", HLSLTokenType::DivEqual },
+					{ "%=", HLSLTokenType::ModEqual },
+					{ "==", HLSLTokenType::EqualEqual },
+					{ "!=", HLSLTokenType::NotEqual },
+					{ "<<", HLSLTokenType::LowerLower },
+					{ "<=", HLSLTokenType::LowerEqual },
+					{ ">>", HLSLTokenType::GreaterGreater },
+					{ ">=", HLSLTokenType::GreaterEqual },
+					{ "&&", HLSLTokenType::AndAnd },
+					{ "&=", HLSLTokenType::AndEqual },
+					{ "||", HLSLTokenType::OrOr },
+					{ "|=", HLSLTokenType::OrEqual },
+					{ "^=", HLSLTokenType::XorEqual },
+					{ "+", HLSLTokenType::Plus },
+					{ "-", HLSLTokenType::Minus },
+					{ "*", HLSLTokenType::Times },
+					{ "/", HLSLTokenType::Div },
+					{ "%", HLSLTokenType::Mod },
+					{ "(", HLSLTokenType::LeftParenthesis },
+					{ ")", HLSLTokenType::RightParenthesis },
+					{ "<", HLSLTokenType::Lower },
+					{ ">", HLSLTokenType::Greater },
+					{ "&", HLSLTokenType::And },
+					{ "|", HLSLTokenType::Or },
+					{ "^", HLSLTokenType::Xor },
+					{ "!", HLSLTokenType::Not },
+					{ "~", HLSLTokenType::Neg },
+					{ "=", HLSLTokenType::Equal },
+					{ "{", HLSLTokenType::LeftBrace },
+					{ "}", HLSLTokenType::RightBrace },
+					{ ";", HLSLTokenType::Semicolon },
+					{ "[", HLSLTokenType::LeftSquareBracket },
+					{ "]", HLSLTokenType::RightSquareBracket },
+					{ "?", HLSLTokenType::Question },
+					{ ":", HLSLTokenType::Colon },
+					{ ",", HLSLTokenType::Comma },
+					{ ".", HLSLTokenType::Dot },
+				};
+
+				for (const auto& op : operators)
+				{
+					const int length = int(strlen(op.str));
+					if (mpCurrent + length > mpEnd || strncmp(mpCurrent, op.str, length) != 0)
+						continue;
+
+					mpCurrent += length;
+					return HLSLToken(op.type, op.str, srcInfo);
+				}
+
+				++mpCurrent;
+				return HLSLToken(HLSLTokenType::Invalid, string(1, ch), srcInfo);
+			}
+
+			HLSLToken NumberToken(const SourceInfo& srcInfo)
+			{
+				const char* pStart = mpCurrent;
+
+				if (Peek() == '0' && (Peek(1) == 'x' || Peek(1) == 'X'))
+				{
+					mpCurrent += 2;
+					while (HasCharsAvailable() && IsHexDigit(Peek()))
+						++mpCurrent;
+					if (Peek() == 'u' || Peek() == 'U')
+						++mpCurrent;
+
+					return HLSLToken(HLSLTokenType::UnsignedIntegerConstant, string(pStart, mpCurrent), srcInfo);
+				}
+
+				bool isFloat = false;
+				while (HasCharsAvailable() && IsDigit(Peek()))
+					++mpCurrent;
+
+				if (Peek() == '.')
+				{
+					isFloat = true;
+					++mpCurrent;
+					while (HasCharsAvailable() && IsDigit(Peek()))
+						++mpCurrent;
+				}
+
+				if ((Peek() == 'e' || Peek() == 'E') &&
+					(IsDigit(Peek(1)) || ((Peek(1) == '+' || Peek(1) == '-') && IsDigit(Peek(2)))))
+				{
+					isFloat = true;
+					mpCurrent += 2;
+					while (HasCharsAvailable() && IsDigit(Peek()))
+						++mpCurrent;
+				}
+
+				// Suffixes are dropped from the literal
+				const string literal(pStart, mpCurrent);
+				const char suffix = Peek();
+				if (suffix == 'f' || suffix == 'F' || suffix == 'h' || suffix == 'H')
+				{
+					isFloat = true;
+					++mpCurrent;
+				}
+				else if (!isFloat && (suffix == 'u' || suffix == 'U'))
+					++mpCurrent;
+
+				return HLSLToken(isFloat ? HLSLTokenType::FloatConstant : HLSLTokenType::UnsignedIntegerConstant, literal, srcInfo);
+			}
+
+			static HLSLTokenType MatchKeyword(const string& word)
+			{
+				static const struct
+				{
+					const char* str;
+					HLSLTokenType type;
+				} keywords[] = {
+					{ "if", HLSLTokenType::If },
+					{ "else", HLSLTokenType::Else },
+					{ "for", HLSLTokenType::For },
+					{ "while", HLSLTokenType::While },
+					{ "do", HLSLTokenType::Do },
+					{ "return", HLSLTokenType::Return },
+					{ "switch", HLSLTokenType::Switch },
+					{ "case", HLSLTokenType::Case },
+					{ "break", HLSLTokenType::Break },
+					{ "default", HLSLTokenType::Default },
+					{ "continue", HLSLTokenType::Continue },
+					{ "goto", HLSLTokenType::Goto },
+					{ "void", HLSLTokenType::Void },
+					{ "const", HLSLTokenType::Const },
+					{ "true", HLSLTokenType::BoolConstant },
+					{ "false", HLSLTokenType::BoolConstant },
+					{ "Texture", HLSLTokenType::Texture },
+					{ "Texture1D", HLSLTokenType::Texture1D },
+					{ "Texture1DArray", HLSLTokenType::Texture1DArray },
+					{ "Texture2D", HLSLTokenType::Texture2D },
+					{ "Texture2DArray", HLSLTokenType::Texture2DArray },
+					{ "Texture2DMS", HLSLTokenType::Texture2DMS },
+					{ "Texture2DMSArray", HLSLTokenType::Texture2DMSArray },
+					{ "Texture3D", HLSLTokenType::Texture3D },
+					{ "TextureCube", HLSLTokenType::TextureCube },
+					{ "TextureCubeArray", HLSLTokenType::TextureCubeArray },
+					{ "sampler", HLSLTokenType::Sampler },
+					{ "sampler1D", HLSLTokenType::Sampler1D },
+					{ "sampler2D", HLSLTokenType::Sampler2D },
+					{ "sampler3D", HLSLTokenType::Sampler3D },
+					{ "samplerCUBE", HLSLTokenType::SamplerCube },
+					{ "SamplerState", HLSLTokenType::SamplerState },
+					{ "SamplerComparisonState", HLSLTokenType::SamplerComparisonState },
+					{ "Buffer", HLSLTokenType::Buffer },
+					{ "AppendStructuredBuffer", HLSLTokenType::AppendStructuredBuffer },
+					{ "ByteAddressBuffer", HLSLTokenType::ByteAddressBuffer },
+					{ "ConsumeStructuredBuffer", HLSLTokenType::ConsumeStructuredBuffer },
+					{ "RWBuffer", HLSLTokenType::RWBuffer },
+					{ "RWByteAddressBuffer", HLSLTokenType::RWByteAddressBuffer },
+					{ "RWStructuredBuffer", HLSLTokenType::RWStructuredBuffer },
+					{ "RWTexture1D", HLSLTokenType::RWTexture1D },
+					{ "RWTexture1DArray", HLSLTokenType::RWTexture1DArray },
+					{ "RWTexture2D", HLSLTokenType::RWTexture2D },
+					{ "RWTexture2DArray", HLSLTokenType::RWTexture2DArray },
+					{ "RWTexture3D", HLSLTokenType::RWTexture3D },
+					{ "StructuredBuffer", HLSLTokenType::StructuredBuffer },
+					{ "InputPatch", HLSLTokenType::InputPatch },
+					{ "OutputPatch", HLSLTokenType::OutputPatch },
+					{ "in", HLSLTokenType::In },
+					{ "out", HLSLTokenType::Out },
+					{ "inout", HLSLTokenType::InOut },
+					{ "static", HLSLTokenType::Static },
+					{ "struct", HLSLTokenType::Struct },
+					{ "cbuffer", HLSLTokenType::CBuffer },
+					{ "groupshared", HLSLTokenType::GroupShared },
+					{ "nointerpolation", HLSLTokenType::NoInterpolation },
+					{ "row_major", HLSLTokenType::RowMajor },
+				};
+
+				for (const auto& keyword : keywords)
+				{
+					if (word == keyword.str)
+						return keyword.type;
+				}
+
+				// Numeric types follow the enum layout: scalar, 1-4 vectors, then the 16 matrices from NxM
+				static const struct
+				{
+					const char* str;
+					HLSLTokenType type;
+				} numericTypes[] = {
+					{ "bool", HLSLTokenType::Bool },
+					{ "int", HLSLTokenType::Int },
+					{ "uint", HLSLTokenType::Uint },
+					{ "half", HLSLTokenType::Half },
+					{ "float", HLSLTokenType::Float },
+				};
+
+				for (const auto& numeric : numericTypes)
+				{
+					const size_t baseLength = strlen(numeric.str);
+					if (word.compare(0, baseLength, numeric.str) != 0)
+						continue;
+
+					const char* pSuffix = word.c_str() + baseLength;
+					const auto IsDim = [](char ch) { return ch >= '1' && ch <= '4'; };
+					if (pSuffix[0] == 0)
+						return numeric.type;
+					if (IsDim(pSuffix[0]) && pSuffix[1] == 0)
+						return HLSLTokenType(int(numeric.type) + pSuffix[0] - '0');
+					if (IsDim(pSuffix[0]) && pSuffix[1] == 'x' && IsDim(pSuffix[2]) && pSuffix[3] == 0)
+						return HLSLTokenType(int(numeric.type) + 5 + (pSuffix[2] - '1') * 4 + (pSuffix[0] - '1'));
+				}
+
+				return HLSLTokenType::Identifier;
 			}
 
 			// Utils
@@ -166,14 +436,12 @@ namespace EDX
 						{
 							// C Style comment, eat everything up to * /
 							mpCurrent += 2;
-							bool bClosedComment = false;
 							while (HasCharsAvailable())
 							{
 								if (Peek() == '*')
 								{
 									if (Peek(1) == '/')
 									{
-										bClosedComment = true;
 										mpCurrent += 2;
 										break;
 									}
@@ -190,7 +458,6 @@ namespace EDX
 								++mpCurrent;
 							}
 							//@todo-rco: Error if no closing * / found and we got to EOL
-							//check(bClosedComment);
 						}
 						else
 						{
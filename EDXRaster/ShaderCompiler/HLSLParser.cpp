@@ -0,0 +1,842 @@
+#include "HLSLParser.h"
+
+#include <cstdlib>
+#include <string>
+
+namespace EDX
+{
+	namespace ShaderCompiler
+	{
+		bool HLSLParser::Parse(const Array<HLSLToken>& tokens,
+			const char* entryPoint,
+			ShaderProgram& program,
+			Array<CompileError>& errorList)
+		{
+			mpTokens = &tokens;
+			mPos = 0;
+			mpProgram = &program;
+			mpErrors = &errorList;
+			mTextureCount = 0;
+			mSymbols.Clear();
+
+			if (tokens.Size() == 0)
+			{
+				SourceInfo srcInfo = { "", 0, 0 };
+				errorList.Add(CompileError("Empty shader", srcInfo));
+				return false;
+			}
+
+			static const char* uniformNames[] = { "EyePosition", "LightDirection" };
+			for (auto i = 0; i < int(IRUniform::Count); i++)
+			{
+				Symbol symbol = { uniformNames[i], SymbolType::Uniform, i, 3 };
+				mSymbols.Add(symbol);
+				mUniformValues[i] = -1;
+			}
+
+			bool foundEntry = false;
+			while (!IsAtEnd())
+			{
+				if (!ParseGlobal(entryPoint, foundEntry))
+					return false;
+			}
+
+			if (!foundEntry)
+				return Error(string("Entry point '") + entryPoint + "' not found", Current());
+
+			program.Optimize();
+			return true;
+		}
+
+		bool HLSLParser::ParseGlobal(const char* entryPoint, bool& foundEntry)
+		{
+			const HLSLToken& token = Current();
+			if (Match(HLSLTokenType::Texture2D) || Match(HLSLTokenType::SamplerState) ||
+				Match(HLSLTokenType::Sampler) || Match(HLSLTokenType::Sampler2D))
+			{
+				const bool isTexture = token.Type == HLSLTokenType::Texture2D;
+				const HLSLToken& name = Current();
+				if (!Expect(HLSLTokenType::Identifier, "resource name") || !SkipRegister() || !Expect(HLSLTokenType::Semicolon, "';'"))
+					return false;
+
+				// The texture always binds to the material texture of the shaded triangle
+				if (isTexture && mTextureCount++ > 0)
+					return Error("Only one Texture2D can be bound", name);
+
+				Symbol symbol = { name.Literal, isTexture ? SymbolType::Texture : SymbolType::Sampler, 0, 0 };
+				mSymbols.Add(symbol);
+				return true;
+			}
+
+			if (TypeWidth(token.Type) != 0 && Peek(1).Type == HLSLTokenType::Identifier && Peek(2).Type == HLSLTokenType::LeftParenthesis)
+			{
+				if (Peek(1).Literal != entryPoint)
+					return Error("Functions other than the entry point are not supported", Peek(1));
+				if (foundEntry)
+					return Error("Entry point redefined", Peek(1));
+
+				foundEntry = true;
+				return ParseFunction();
+			}
+
+			return Error("Unsupported global declaration '" + token.Literal + "'", token);
+		}
+
+		bool HLSLParser::ParseFunction()
+		{
+			const int returnWidth = TypeWidth(Current().Type);
+			if (returnWidth < 3)
+				return Error("Pixel shaders return float3 or float4", Current());
+
+			mPos += 3; // Return type, name and '('
+
+			static const struct
+			{
+				const char* name;
+				IRInput input;
+				int width;
+			} semantics[] = {
+				{ "POSITION", IRInput::Position, 3 },
+				{ "WORLDPOS", IRInput::Position, 3 },
+				{ "NORMAL", IRInput::Normal, 3 },
+				{ "TEXCOORD", IRInput::TexCoord, 2 },
+				{ "TEXCOORD0", IRInput::TexCoord, 2 },
+			};
+
+			for (auto paramIdx = 0; !Match(HLSLTokenType::RightParenthesis); paramIdx++)
+			{
+				if (paramIdx > 0 && !Expect(HLSLTokenType::Comma, "','"))
+					return false;
+
+				Match(HLSLTokenType::In);
+				const HLSLToken& type = Current();
+				const int width = TypeWidth(type.Type);
+				if (width <= 0)
+					return Error("Expected scalar or vector parameter type", type);
+				mPos++;
+
+				const HLSLToken& name = Current();
+				if (!Expect(HLSLTokenType::Identifier, "parameter name") || !Expect(HLSLTokenType::Colon, "':'"))
+					return false;
+
+				const HLSLToken& semantic = Current();
+				if (!Expect(HLSLTokenType::Identifier, "semantic"))
+					return false;
+
+				int semanticIdx = -1;
+				for (uint i = 0; i < sizeof(semantics) / sizeof(semantics[0]); i++)
+				{
+					if (semantic.Literal == semantics[i].name)
+						semanticIdx = i;
+				}
+				if (semanticIdx < 0)
+					return Error("Unsupported input semantic '" + semantic.Literal + "'", semantic);
+				if (width > semantics[semanticIdx].width)
+					return Error("Parameter is wider than its input", name);
+
+				IRInstruction instr(IROp::Input, semantics[semanticIdx].width);
+				instr.slot = int(semantics[semanticIdx].input);
+				const Value input = Convert(Emit(instr), width, name);
+
+				Symbol symbol = { name.Literal, SymbolType::Variable, input.id, width };
+				mSymbols.Add(symbol);
+			}
+
+			// Output semantic, SV_Target or COLOR
+			if (Match(HLSLTokenType::Colon) && !Expect(HLSLTokenType::Identifier, "output semantic"))
+				return false;
+
+			if (!Expect(HLSLTokenType::LeftBrace, "'{'"))
+				return false;
+
+			bool returned = false;
+			while (!returned)
+			{
+				if (IsAtEnd())
+					return Error("Missing return statement", Current());
+				if (!ParseStatement(returned))
+					return false;
+			}
+
+			return Expect(HLSLTokenType::RightBrace, "'}' after return");
+		}
+
+		bool HLSLParser::ParseStatement(bool& returned)
+		{
+			const HLSLToken& token = Current();
+			switch (token.Type)
+			{
+			case HLSLTokenType::Return:
+			{
+				mPos++;
+				Value value = ParseExpression();
+				if (!value.IsValid())
+					return false;
+
+				// Alpha is dropped, scalars become grey
+				value = Convert(value, 3, token);
+				if (!value.IsValid())
+					return false;
+
+				mpProgram->result = value.id;
+				returned = true;
+				return Expect(HLSLTokenType::Semicolon, "';'");
+			}
+
+			case HLSLTokenType::Semicolon:
+				mPos++;
+				return true;
+
+			case HLSLTokenType::LeftBrace:
+				// Blocks share the function scope
+				mPos++;
+				while (!Match(HLSLTokenType::RightBrace))
+				{
+					if (IsAtEnd())
+						return Error("Missing '}'", token);
+					if (!ParseStatement(returned))
+						return false;
+					if (returned)
+						return Error("Return inside a block is not supported", token);
+				}
+				return true;
+
+			case HLSLTokenType::If:
+			case HLSLTokenType::For:
+			case HLSLTokenType::While:
+			case HLSLTokenType::Do:
+			case HLSLTokenType::Switch:
+				return Error("Control flow is not supported", token);
+
+			case HLSLTokenType::Identifier:
+				return ParseAssignment();
+
+			default:
+				return ParseDeclaration();
+			}
+		}
+
+		bool HLSLParser::ParseDeclaration()
+		{
+			while (Match(HLSLTokenType::Static) || Match(HLSLTokenType::Const))
+			{
+			}
+
+			const HLSLToken& type = Current();
+			const int width = TypeWidth(type.Type);
+			if (width <= 0)
+				return Error("Expected statement, '" + type.Literal + "' is not a scalar or vector type", type);
+			mPos++;
+
+			do
+			{
+				const HLSLToken& name = Current();
+				if (!Expect(HLSLTokenType::Identifier, "variable name"))
+					return false;
+
+				Value value;
+				if (Match(HLSLTokenType::Equal))
+					value = Convert(ParseExpression(), width, name);
+				else
+				{
+					IRInstruction zero(IROp::Constant, width);
+					value = Emit(zero);
+				}
+
+				if (!value.IsValid())
+					return false;
+
+				Symbol symbol = { name.Literal, SymbolType::Variable, value.id, width };
+				mSymbols.Add(symbol);
+			} while (Match(HLSLTokenType::Comma));
+
+			return Expect(HLSLTokenType::Semicolon, "';'");
+		}
+
+		bool HLSLParser::ParseAssignment()
+		{
+			const HLSLToken& name = Current();
+			mPos++;
+
+			const Symbol* pSymbol = FindSymbol(name.Literal);
+			if (!pSymbol)
+				return Error("Undeclared identifier '" + name.Literal + "'", name);
+			if (pSymbol->type != SymbolType::Variable)
+				return Error("Cannot assign to '" + name.Literal + "'", name);
+
+			int writeMask[4] = { 0, 1, 2, 3 };
+			int maskWidth = pSymbol->width;
+			if (Match(HLSLTokenType::Dot))
+			{
+				const HLSLToken& swizzle = Current();
+				if (!Expect(HLSLTokenType::Identifier, "write mask") || !ParseSwizzle(swizzle, pSymbol->width, true, writeMask, maskWidth))
+					return false;
+			}
+
+			const HLSLToken& op = Current();
+			IROp binaryOp;
+			switch (op.Type)
+			{
+			case HLSLTokenType::Equal: binaryOp = IROp::Constant; break;
+			case HLSLTokenType::PlusEqual: binaryOp = IROp::Add; break;
+			case HLSLTokenType::MinusEqual: binaryOp = IROp::Sub; break;
+			case HLSLTokenType::TimesEqual: binaryOp = IROp::Mul; break;
+			case HLSLTokenType::DivEqual: binaryOp = IROp::Div; break;
+			default:
+				return Error("Expected assignment", op);
+			}
+			mPos++;
+
+			Value rhs = ParseExpression();
+			if (!rhs.IsValid())
+				return false;
+
+			const Value current = { pSymbol->value, pSymbol->width };
+			if (binaryOp != IROp::Constant)
+				rhs = Binary(binaryOp, Swizzle(current, writeMask, maskWidth), rhs, op);
+			rhs = Convert(rhs, maskWidth, op);
+			if (!rhs.IsValid())
+				return false;
+
+			bool fullWrite = maskWidth == pSymbol->width;
+			for (auto i = 0; i < maskWidth; i++)
+				fullWrite = fullWrite && writeMask[i] == i;
+
+			// SSA, the variable is rebound to a new value
+			Value assigned = rhs;
+			if (!fullWrite)
+			{
+				IRInstruction merge(IROp::Merge, pSymbol->width);
+				merge.argCount = 2;
+				merge.args[0] = current.id;
+				merge.args[1] = rhs.id;
+				for (auto i = 0; i < 4; i++)
+					merge.components[i] = -1;
+				for (auto i = 0; i < maskWidth; i++)
+					merge.components[writeMask[i]] = i;
+				assigned = Emit(merge);
+			}
+
+			for (auto i = mSymbols.Size() - 1; i >= 0; i--)
+			{
+				if (mSymbols[i].name == name.Literal)
+				{
+					mSymbols[i].value = assigned.id;
+					break;
+				}
+			}
+
+			return Expect(HLSLTokenType::Semicolon, "';'");
+		}
+
+		bool HLSLParser::SkipRegister()
+		{
+			// : register(t0)
+			if (!Match(HLSLTokenType::Colon))
+				return true;
+
+			return Expect(HLSLTokenType::Identifier, "register") &&
+				Expect(HLSLTokenType::LeftParenthesis, "'('") &&
+				Expect(HLSLTokenType::Identifier, "register slot") &&
+				Expect(HLSLTokenType::RightParenthesis, "')'");
+		}
+
+		HLSLParser::Value HLSLParser::ParseExpression()
+		{
+			Value lhs = ParseMultiplicative();
+			while (lhs.IsValid())
+			{
+				const HLSLToken& op = Current();
+				if (!Match(HLSLTokenType::Plus) && !Match(HLSLTokenType::Minus))
+					break;
+
+				lhs = Binary(op.Type == HLSLTokenType::Plus ? IROp::Add : IROp::Sub, lhs, ParseMultiplicative(), op);
+			}
+
+			return lhs;
+		}
+
+		HLSLParser::Value HLSLParser::ParseMultiplicative()
+		{
+			Value lhs = ParseUnary();
+			while (lhs.IsValid())
+			{
+				const HLSLToken& op = Current();
+				if (!Match(HLSLTokenType::Times) && !Match(HLSLTokenType::Div))
+					break;
+
+				lhs = Binary(op.Type == HLSLTokenType::Times ? IROp::Mul : IROp::Div, lhs, ParseUnary(), op);
+			}
+
+			return lhs;
+		}
+
+		HLSLParser::Value HLSLParser::ParseUnary()
+		{
+			if (Match(HLSLTokenType::Plus))
+				return ParseUnary();
+
+			if (Match(HLSLTokenType::Minus))
+			{
+				const Value value = ParseUnary();
+				if (!value.IsValid())
+					return value;
+
+				IRInstruction neg(IROp::Neg, value.width);
+				neg.argCount = 1;
+				neg.args[0] = value.id;
+				return Emit(neg);
+			}
+
+			return ParsePostfix();
+		}
+
+		HLSLParser::Value HLSLParser::ParsePostfix()
+		{
+			Value value = ParsePrimary();
+			while (value.IsValid() && Match(HLSLTokenType::Dot))
+			{
+				const HLSLToken& swizzle = Current();
+				int components[4], count;
+				if (!Expect(HLSLTokenType::Identifier, "swizzle") || !ParseSwizzle(swizzle, value.width, false, components, count))
+					return ErrorValue("", swizzle);
+
+				value = Swizzle(value, components, count);
+			}
+
+			return value;
+		}
+
+		HLSLParser::Value HLSLParser::ParsePrimary()
+		{
+			const HLSLToken& token = Current();
+			if (IsAtEnd())
+				return ErrorValue("Unexpected end of shader", token);
+
+			switch (token.Type)
+			{
+			case HLSLTokenType::LeftParenthesis:
+			{
+				mPos++;
+				const Value value = ParseExpression();
+				if (!value.IsValid() || !Expect(HLSLTokenType::RightParenthesis, "')'"))
+					return ErrorValue("", token);
+
+				return value;
+			}
+
+			case HLSLTokenType::FloatConstant:
+			case HLSLTokenType::UnsignedIntegerConstant:
+				mPos++;
+				return Constant(float(strtod(token.Literal.c_str(), nullptr)));
+
+			case HLSLTokenType::BoolConstant:
+				mPos++;
+				return Constant(token.Literal == "true" ? 1.0f : 0.0f);
+
+			case HLSLTokenType::Identifier:
+			{
+				mPos++;
+				if (Current().Type == HLSLTokenType::LeftParenthesis)
+					return ParseIntrinsic(token);
+
+				const Symbol* pSymbol = FindSymbol(token.Literal);
+				if (!pSymbol)
+					return ErrorValue("Undeclared identifier '" + token.Literal + "'", token);
+
+				switch (pSymbol->type)
+				{
+				case SymbolType::Variable:
+				{
+					const Value value = { pSymbol->value, pSymbol->width };
+					return value;
+				}
+				case SymbolType::Uniform:
+				{
+					// Loaded once, later reads share the value
+					int& uniformValue = mUniformValues[pSymbol->value];
+					if (uniformValue < 0)
+					{
+						IRInstruction uniform(IROp::Uniform, pSymbol->width);
+						uniform.slot = pSymbol->value;
+						uniformValue = Emit(uniform).id;
+					}
+
+					const Value value = { uniformValue, pSymbol->width };
+					return value;
+				}
+				case SymbolType::Texture:
+					return ParseSample(*pSymbol);
+				default:
+					return ErrorValue("Samplers can only be passed to Sample", token);
+				}
+			}
+
+			default:
+			{
+				const int width = TypeWidth(token.Type);
+				if (width > 0 && Peek(1).Type == HLSLTokenType::LeftParenthesis)
+				{
+					mPos += 2;
+					return ParseConstructor(width);
+				}
+
+				return ErrorValue("Unexpected '" + token.Literal + "' in expression", token);
+			}
+			}
+		}
+
+		HLSLParser::Value HLSLParser::ParseConstructor(const int width)
+		{
+			const HLSLToken& token = Peek(-2);
+
+			Array<Value> args;
+			int totalWidth = 0;
+			do
+			{
+				const Value arg = ParseExpression();
+				if (!arg.IsValid())
+					return arg;
+
+				args.Add(arg);
+				totalWidth += arg.width;
+			} while (Match(HLSLTokenType::Comma));
+
+			if (!Expect(HLSLTokenType::RightParenthesis, "')'"))
+				return ErrorValue("", token);
+
+			if (args.Size() == 1)
+				return args[0].width == 1 ? Broadcast(args[0], width) : Convert(args[0], width, token);
+			if (totalWidth != width)
+				return ErrorValue("Wrong number of components in constructor", token);
+
+			IRInstruction construct(IROp::Construct, width);
+			construct.argCount = args.Size();
+			for (auto i = 0; i < args.Size(); i++)
+			{
+				construct.args[i] = args[i].id;
+				construct.components[i] = args[i].width;
+			}
+
+			return Emit(construct);
+		}
+
+		HLSLParser::Value HLSLParser::ParseIntrinsic(const HLSLToken& name)
+		{
+			enum class Kind
+			{
+				ElementWise,	// Args broadcast to the widest one
+				Reduce,			// Vector args, scalar result
+				Normalize,
+				Cross
+			};
+
+			static const struct
+			{
+				const char* name;
+				IROp op;
+				int argCount;
+				Kind kind;
+			} intrinsics[] = {
+				{ "abs", IROp::Abs, 1, Kind::ElementWise },
+				{ "sqrt", IROp::Sqrt, 1, Kind::ElementWise },
+				{ "rsqrt", IROp::Rsqrt, 1, Kind::ElementWise },
+				{ "floor", IROp::Floor, 1, Kind::ElementWise },
+				{ "frac", IROp::Frac, 1, Kind::ElementWise },
+				{ "saturate", IROp::Saturate, 1, Kind::ElementWise },
+				{ "min", IROp::Min, 2, Kind::ElementWise },
+				{ "max", IROp::Max, 2, Kind::ElementWise },
+				{ "pow", IROp::Pow, 2, Kind::ElementWise },
+				{ "lerp", IROp::Lerp, 3, Kind::ElementWise },
+				{ "clamp", IROp::Clamp, 3, Kind::ElementWise },
+				{ "dot", IROp::Dot, 2, Kind::Reduce },
+				{ "length", IROp::Length, 1, Kind::Reduce },
+				{ "normalize", IROp::Normalize, 1, Kind::Normalize },
+				{ "cross", IROp::Cross, 2, Kind::Cross },
+			};
+
+			int intrinsicIdx = -1;
+			for (uint i = 0; i < sizeof(intrinsics) / sizeof(intrinsics[0]); i++)
+			{
+				if (name.Literal == intrinsics[i].name)
+					intrinsicIdx = i;
+			}
+			if (intrinsicIdx < 0)
+				return ErrorValue("Unknown function '" + name.Literal + "'", name);
+
+			const auto& intrinsic = intrinsics[intrinsicIdx];
+			mPos++; // '('
+
+			Value args[IRInstruction::MAX_ARGS];
+			int argCount = 0;
+			int width = 1;
+			if (!Match(HLSLTokenType::RightParenthesis))
+			{
+				do
+				{
+					if (argCount == intrinsic.argCount)
+						return ErrorValue("Too many arguments to '" + name.Literal + "'", name);
+
+					args[argCount] = ParseExpression();
+					if (!args[argCount].IsValid())
+						return args[argCount];
+
+					width = Math::Max(width, args[argCount++].width);
+				} while (Match(HLSLTokenType::Comma));
+
+				if (!Expect(HLSLTokenType::RightParenthesis, "')'"))
+					return ErrorValue("", name);
+			}
+
+			if (argCount != intrinsic.argCount)
+				return ErrorValue("Wrong number of arguments to '" + name.Literal + "'", name);
+
+			IRInstruction instr(intrinsic.op, width);
+			instr.argCount = argCount;
+			switch (intrinsic.kind)
+			{
+			case Kind::ElementWise:
+				for (auto i = 0; i < argCount; i++)
+				{
+					args[i] = args[i].width == 1 ? Broadcast(args[i], width) : args[i];
+					if (args[i].width != width)
+						return ErrorValue("Mismatched argument widths in '" + name.Literal + "'", name);
+				}
+				break;
+
+			case Kind::Reduce:
+			case Kind::Normalize:
+				if (argCount == 2 && args[0].width != args[1].width)
+					return ErrorValue("Mismatched argument widths in '" + name.Literal + "'", name);
+
+				instr.width = intrinsic.kind == Kind::Reduce ? 1 : width;
+				instr.components[0] = width;
+				break;
+
+			case Kind::Cross:
+				if (args[0].width != 3 || args[1].width != 3)
+					return ErrorValue("cross takes two float3 arguments", name);
+				break;
+			}
+
+			for (auto i = 0; i < argCount; i++)
+				instr.args[i] = args[i].id;
+
+			return Emit(instr);
+		}
+
+		HLSLParser::Value HLSLParser::ParseSample(const Symbol& texture)
+		{
+			// tex.Sample(sampler, uv), the sampler state comes from the render states
+			const HLSLToken& token = Current();
+			if (!Expect(HLSLTokenType::Dot, "'.Sample'"))
+				return ErrorValue("", token);
+
+			const HLSLToken& method = Current();
+			if (!Expect(HLSLTokenType::Identifier, "'Sample'") || method.Literal != "Sample")
+				return ErrorValue("Only Texture2D.Sample is supported", method);
+
+			const HLSLToken& sampler = Peek(1);
+			const Symbol* pSampler = FindSymbol(sampler.Literal);
+			if (!Expect(HLSLTokenType::LeftParenthesis, "'('") || !Expect(HLSLTokenType::Identifier, "sampler"))
+				return ErrorValue("", token);
+			if (!pSampler || pSampler->type != SymbolType::Sampler)
+				return ErrorValue("'" + sampler.Literal + "' is not a sampler", sampler);
+			if (!Expect(HLSLTokenType::Comma, "','"))
+				return ErrorValue("", token);
+
+			const Value texCoord = Convert(ParseExpression(), 2, method);
+			if (!texCoord.IsValid() || !Expect(HLSLTokenType::RightParenthesis, "')'"))
+				return ErrorValue("", method);
+
+			IRInstruction sample(IROp::Sample, 4);
+			sample.argCount = 1;
+			sample.args[0] = texCoord.id;
+			sample.slot = texture.value;
+			return Emit(sample);
+		}
+
+		bool HLSLParser::ParseSwizzle(const HLSLToken& token, const int sourceWidth, const bool writeMask, int components[4], int& count)
+		{
+			const string& str = token.Literal;
+			if (str.length() > 4)
+				return Error("Invalid swizzle '" + str + "'", token);
+
+			count = int(str.length());
+			for (auto i = 0; i < count; i++)
+			{
+				int component;
+				switch (str[i])
+				{
+				case 'x': case 'r': component = 0; break;
+				case 'y': case 'g': component = 1; break;
+				case 'z': case 'b': component = 2; break;
+				case 'w': case 'a': component = 3; break;
+				default:
+					return Error("Invalid swizzle '" + str + "'", token);
+				}
+
+				if (component >= sourceWidth)
+					return Error("Swizzle '" + str + "' out of range", token);
+
+				for (auto j = 0; j < i && writeMask; j++)
+				{
+					if (components[j] == component)
+						return Error("Repeated component in write mask '" + str + "'", token);
+				}
+
+				components[i] = component;
+			}
+
+			return true;
+		}
+
+		HLSLParser::Value HLSLParser::Emit(const IRInstruction& instr)
+		{
+			const Value value = { mpProgram->Add(instr), instr.width };
+			return value;
+		}
+
+		HLSLParser::Value HLSLParser::Constant(const float value)
+		{
+			IRInstruction constant(IROp::Constant, 1);
+			constant.constant[0] = value;
+			return Emit(constant);
+		}
+
+		HLSLParser::Value HLSLParser::Swizzle(const Value& value, const int* components, const int width)
+		{
+			IRInstruction swizzle(IROp::Swizzle, width);
+			swizzle.argCount = 1;
+			swizzle.args[0] = value.id;
+			for (auto i = 0; i < width; i++)
+				swizzle.components[i] = components[i];
+
+			return Emit(swizzle);
+		}
+
+		HLSLParser::Value HLSLParser::Broadcast(const Value& value, const int width)
+		{
+			static const int components[4] = { 0, 0, 0, 0 };
+			return value.width == width ? value : Swizzle(value, components, width);
+		}
+
+		HLSLParser::Value HLSLParser::Convert(const Value& value, const int width, const HLSLToken& token)
+		{
+			static const int components[4] = { 0, 1, 2, 3 };
+			if (!value.IsValid() || value.width == width)
+				return value;
+
+			// Scalars broadcast and wider vectors truncate, like HLSL implicit conversions
+			if (value.width == 1)
+				return Broadcast(value, width);
+			if (value.width > width)
+				return Swizzle(value, components, width);
+
+			return ErrorValue("Cannot convert a " + std::to_string(value.width) + " component value to " + std::to_string(width), token);
+		}
+
+		HLSLParser::Value HLSLParser::Binary(const IROp op, Value lhs, Value rhs, const HLSLToken& token)
+		{
+			if (!lhs.IsValid() || !rhs.IsValid())
+				return ErrorValue("", token);
+
+			if (lhs.width == 1)
+				lhs = Broadcast(lhs, rhs.width);
+			else if (rhs.width == 1)
+				rhs = Broadcast(rhs, lhs.width);
+			if (lhs.width != rhs.width)
+				return ErrorValue("Mismatched operand widths for '" + token.Literal + "'", token);
+
+			IRInstruction instr(op, lhs.width);
+			instr.argCount = 2;
+			instr.args[0] = lhs.id;
+			instr.args[1] = rhs.id;
+			return Emit(instr);
+		}
+
+		const HLSLParser::Symbol* HLSLParser::FindSymbol(const string& name) const
+		{
+			for (auto i = mSymbols.Size() - 1; i >= 0; i--)
+			{
+				if (mSymbols[i].name == name)
+					return &mSymbols[i];
+			}
+
+			return nullptr;
+		}
+
+		int HLSLParser::TypeWidth(const HLSLTokenType type)
+		{
+			// Integer and bool types are evaluated as float, matrices are not supported
+			static const HLSLTokenType baseTypes[] = {
+				HLSLTokenType::Bool,
+				HLSLTokenType::Int,
+				HLSLTokenType::Uint,
+				HLSLTokenType::Half,
+				HLSLTokenType::Float
+			};
+
+			for (const auto base : baseTypes)
+			{
+				const int offset = int(type) - int(base);
+				if (offset == 0)
+					return 1;
+				if (offset > 0 && offset <= 4)
+					return offset;
+				if (offset > 4 && offset <= 20)
+					return -1;
+			}
+
+			return 0;
+		}
+
+		const HLSLToken& HLSLParser::Current() const
+		{
+			return Peek(0);
+		}
+
+		const HLSLToken& HLSLParser::Peek(const int offset) const
+		{
+			const int idx = Math::Max(0, Math::Min(mPos + offset, mpTokens->Size() - 1));
+			return (*mpTokens)[idx];
+		}
+
+		bool HLSLParser::IsAtEnd() const
+		{
+			return mPos >= mpTokens->Size();
+		}
+
+		bool HLSLParser::Match(const HLSLTokenType type)
+		{
+			if (IsAtEnd() || Current().Type != type)
+				return false;
+
+			mPos++;
+			return true;
+		}
+
+		bool HLSLParser::Expect(const HLSLTokenType type, const char* what)
+		{
+			if (Match(type))
+				return true;
+
+			return Error(string("Expected ") + what + (IsAtEnd() ? " at end of shader" : " before '" + Current().Literal + "'"), Current());
+		}
+
+		bool HLSLParser::Error(const string& msg, const HLSLToken& token)
+		{
+			// Empty messages propagate a failure that was already reported
+			if (!msg.empty())
+				mpErrors->Add(CompileError(msg, token.SrcInfo));
+			return false;
+		}
+
+		HLSLParser::Value HLSLParser::ErrorValue(const string& msg, const HLSLToken& token)
+		{
+			Error(msg, token);
+			const Value value = { -1, 0 };
+			return value;
+		}
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "CompilerCommon.h"
+#include "ShaderIR.h"
+
+namespace EDX
+{
+	namespace ShaderCompiler
+	{
+		// Recursive descent parser for the straight line pixel shader subset of HLSL: float scalar and
+		// vector math, intrinsics, swizzles, one Texture2D and the POSITION, NORMAL and TEXCOORD inputs.
+		// EyePosition and LightDirection are predefined float3 uniforms.
+		class HLSLParser
+		{
+		private:
+			enum class SymbolType
+			{
+				Variable,
+				Uniform,
+				Texture,
+				Sampler
+			};
+
+			struct Symbol
+			{
+				string name;
+				SymbolType type;
+				int value;	// Instruction for variables, slot for uniforms and textures
+				int width;
+			};
+
+			struct Value
+			{
+				int id;
+				int width;
+
+				bool IsValid() const { return id >= 0; }
+			};
+
+			const Array<HLSLToken>* mpTokens;
+			int mPos;
+			ShaderProgram* mpProgram;
+			Array<CompileError>* mpErrors;
+
+			Array<Symbol> mSymbols;
+			int mUniformValues[int(IRUniform::Count)];
+			int mTextureCount;
+
+		public:
+			// Builds the optimized program of the entry point, false if any error was reported
+			bool Parse(const Array<HLSLToken>& tokens,
+				const char* entryPoint,
+				ShaderProgram& program,
+				Array<CompileError>& errorList);
+
+		private:
+			bool ParseGlobal(const char* entryPoint, bool& foundEntry);
+			bool ParseFunction();
+			bool ParseStatement(bool& returned);
+			bool ParseDeclaration();
+			bool ParseAssignment();
+			bool SkipRegister();
+
+			Value ParseExpression();
+			Value ParseMultiplicative();
+			Value ParseUnary();
+			Value ParsePostfix();
+			Value ParsePrimary();
+			Value ParseConstructor(const int width);
+			Value ParseIntrinsic(const HLSLToken& name);
+			Value ParseSample(const Symbol& texture);
+			bool ParseSwizzle(const HLSLToken& token, const int sourceWidth, const bool writeMask, int components[4], int& count);
+
+			Value Emit(const IRInstruction& instr);
+			Value Constant(const float value);
+			Value Swizzle(const Value& value, const int* components, const int width);
+			Value Broadcast(const Value& value, const int width);
+			Value Convert(const Value& value, const int width, const HLSLToken& token);
+			Value Binary(const IROp op, Value lhs, Value rhs, const HLSLToken& token);
+
+			const Symbol* FindSymbol(const string& name) const;
+			static int TypeWidth(const HLSLTokenType type);
+
+			const HLSLToken& Current() const;
+			const HLSLToken& Peek(const int offset) const;
+			bool IsAtEnd() const;
+			bool Match(const HLSLTokenType type);
+			bool Expect(const HLSLTokenType type, const char* what);
+			bool Error(const string& msg, const HLSLToken& token);
+			Value ErrorValue(const string& msg, const HLSLToken& token);
+		};
+	}
+}
@@ -0,0 +1,279 @@
+#include "ShaderCodeGen.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace EDX
+{
+	namespace ShaderCompiler
+	{
+		string ShaderCodeGen::EmitPixelShader(const ShaderProgram& program,
+			const char* className,
+			const char* sourceName,
+			const string& source)
+		{
+			const Array<IRInstruction>& instructions = program.instructions;
+
+			// Components nobody reads are not emitted, so the generated code holds no unused values
+			Array<int> readMasks;
+			readMasks.Resize(instructions.Size());
+			for (auto i = 0; i < readMasks.Size(); i++)
+				readMasks[i] = 0;
+
+			for (auto i = 0; i < instructions.Size(); i++)
+			{
+				for (auto j = 0; j < instructions[i].argCount; j++)
+					readMasks[instructions[i].args[j]] |= ShaderProgram::ReadComponents(instructions[i], j);
+			}
+			if (program.result >= 0)
+				readMasks[program.result] |= 7;
+
+			std::ostringstream code;
+			code << "// Generated by ShaderCodeGen from " << sourceName << ", do not edit\n"
+				"#pragma once\n"
+				"\n"
+				"#include \"Core/Shader.h\"\n"
+				"#include \"Core/RasterTexture.h\"\n"
+				"#include \"ShaderCompiler/ShaderIR.h\"\n"
+				"\n"
+				"namespace EDX\n"
+				"{\n"
+				"\tnamespace RasterRenderer\n"
+				"\t{\n"
+				"\t\tclass " << className << " : public PixelShader\n"
+				"\t\t{\n"
+				"\t\tpublic:\n"
+				"\t\t\tstatic const char* GetSource()\n"
+				"\t\t\t{\n"
+				"\t\t\t\treturn ";
+
+			std::istringstream lines(source);
+			string line;
+			bool firstLine = true;
+			while (std::getline(lines, line))
+			{
+				code << (firstLine ? "" : "\n\t\t\t\t\t") << "\"" << EscapeString(line) << "\\n\"";
+				firstLine = false;
+			}
+			if (firstLine)
+				code << "\"\"";
+
+			code << ";\n"
+				"\t\t\t}\n"
+				"\n"
+				"\t\t\tVec3f_SSE Shade(Fragment& fragIn,\n"
+				"\t\t\t\tconst Vector3& eyePos,\n"
+				"\t\t\t\tconst Vector3& lightDir,\n"
+				"\t\t\t\tconst Vec3f_SSE& position,\n"
+				"\t\t\t\tconst Vec3f_SSE& normal,\n"
+				"\t\t\t\tconst Vec2f_SSE& texCoord,\n"
+				"\t\t\t\tconst Vec2f_SSE texDifferentials[2],\n"
+				"\t\t\t\tconst FloatSSE& texLod,\n"
+				"\t\t\t\tconst TextureSampler& sampler) const\n"
+				"\t\t\t{\n"
+				"\t\t\t\tusing namespace ShaderCompiler;\n";
+
+			for (auto i = 0; i < instructions.Size(); i++)
+			{
+				const IRInstruction& instr = instructions[i];
+				const int mask = readMasks[i];
+
+				auto Arg = [&](const int arg, const int component)
+				{
+					return Value(instr.args[arg], component);
+				};
+				auto Define = [&](const int component, const string& expr)
+				{
+					if (mask & (1 << component))
+						code << "\t\t\t\tconst FloatSSE " << Value(i, component) << " = " << expr << ";\n";
+				};
+				auto DefineBinary = [&](const char* op)
+				{
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, Arg(0, c) + " " + op + " " + Arg(1, c));
+				};
+				auto DefineCall = [&](const char* func)
+				{
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, string(func) + "(" + Arg(0, c) + (instr.argCount > 1 ? ", " + Arg(1, c) : "") + ")");
+				};
+
+				switch (instr.op)
+				{
+				case IROp::Constant:
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, Literal(instr.constant[c]));
+					break;
+
+				case IROp::Input:
+					if (instr.slot == int(IRInput::TexCoord))
+					{
+						Define(0, "texCoord.u");
+						Define(1, "texCoord.v");
+					}
+					else
+					{
+						const string input = instr.slot == int(IRInput::Position) ? "position" : "normal";
+						Define(0, input + ".x");
+						Define(1, input + ".y");
+						Define(2, input + ".z");
+					}
+					break;
+
+				case IROp::Uniform:
+				{
+					const string uniform = instr.slot == int(IRUniform::EyePosition) ? "eyePos" : "lightDir";
+					Define(0, "FloatSSE(" + uniform + ".x)");
+					Define(1, "FloatSSE(" + uniform + ".y)");
+					Define(2, "FloatSSE(" + uniform + ".z)");
+					break;
+				}
+
+				case IROp::Add: DefineBinary("+"); break;
+				case IROp::Sub: DefineBinary("-"); break;
+				case IROp::Mul: DefineBinary("*"); break;
+				case IROp::Div: DefineBinary("/"); break;
+				case IROp::Min: DefineCall("SSE::Min"); break;
+				case IROp::Max: DefineCall("SSE::Max"); break;
+				case IROp::Abs: DefineCall("IRMath::Abs"); break;
+				case IROp::Sqrt: DefineCall("SSE::Sqrt"); break;
+				case IROp::Rsqrt: DefineCall("SSE::Rsqrt"); break;
+				case IROp::Floor: DefineCall("IRMath::Floor"); break;
+				case IROp::Frac: DefineCall("IRMath::Frac"); break;
+				case IROp::Saturate: DefineCall("IRMath::Saturate"); break;
+				case IROp::Pow: DefineCall("IRMath::Pow"); break;
+
+				case IROp::Neg:
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, "FloatSSE(Math::EDX_ZERO) - " + Arg(0, c));
+					break;
+
+				case IROp::Lerp:
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, Arg(0, c) + " + (" + Arg(1, c) + " - " + Arg(0, c) + ") * " + Arg(2, c));
+					break;
+
+				case IROp::Clamp:
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, "SSE::Min(SSE::Max(" + Arg(0, c) + ", " + Arg(1, c) + "), " + Arg(2, c) + ")");
+					break;
+
+				case IROp::Dot:
+				case IROp::Length:
+				case IROp::Normalize:
+				{
+					// Summed left to right like Evaluate
+					const int other = instr.op == IROp::Dot ? 1 : 0;
+					string dot = Arg(0, 0) + " * " + Arg(other, 0);
+					for (auto c = 1; c < instr.components[0]; c++)
+						dot += " + " + Arg(0, c) + " * " + Arg(other, c);
+
+					if (instr.op == IROp::Dot)
+						Define(0, dot);
+					else if (instr.op == IROp::Length)
+						Define(0, "SSE::Sqrt(" + dot + ")");
+					else
+					{
+						const string invLength = "invLength" + std::to_string(i);
+						code << "\t\t\t\tconst FloatSSE " << invLength << " = SSE::Rsqrt(" << dot << ");\n";
+						for (auto c = 0; c < instr.width; c++)
+							Define(c, Arg(0, c) + " * " + invLength);
+					}
+					break;
+				}
+
+				case IROp::Cross:
+					Define(0, Arg(0, 1) + " * " + Arg(1, 2) + " - " + Arg(0, 2) + " * " + Arg(1, 1));
+					Define(1, Arg(0, 2) + " * " + Arg(1, 0) + " - " + Arg(0, 0) + " * " + Arg(1, 2));
+					Define(2, Arg(0, 0) + " * " + Arg(1, 1) + " - " + Arg(0, 1) + " * " + Arg(1, 0));
+					break;
+
+				case IROp::Swizzle:
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, Arg(0, instr.components[c]));
+					break;
+
+				case IROp::Merge:
+					for (auto c = 0; c < instr.width; c++)
+						Define(c, instr.components[c] >= 0 ? Arg(1, instr.components[c]) : Arg(0, c));
+					break;
+
+				case IROp::Construct:
+				{
+					int idx = 0;
+					for (auto j = 0; j < instr.argCount; j++)
+					{
+						for (auto c = 0; c < instr.components[j]; c++)
+							Define(idx++, Arg(j, c));
+					}
+					break;
+				}
+
+				case IROp::Sample:
+				{
+					const string sample = "sample" + std::to_string(i);
+					code << "\t\t\t\tconst Vec3f_SSE " << sample << " = sampler.Sample(fragIn.textureId, Vec2f_SSE("
+						<< Arg(0, 0) << ", " << Arg(0, 1) << "), texDifferentials, texLod);\n";
+					Define(0, sample + ".x");
+					Define(1, sample + ".y");
+					Define(2, sample + ".z");
+					Define(3, "FloatSSE(Math::EDX_ONE)");
+					break;
+				}
+				}
+			}
+
+			if (program.result >= 0)
+				code << "\t\t\t\treturn Vec3f_SSE(" << Value(program.result, 0) << ", " << Value(program.result, 1) << ", " << Value(program.result, 2) << ");\n";
+			else
+				code << "\t\t\t\treturn Vec3f_SSE(Vector3::ZERO);\n";
+
+			code << "\t\t\t}\n"
+				"\t\t};\n"
+				"\t}\n"
+				"}\n";
+
+			return code.str();
+		}
+
+		string ShaderCodeGen::Value(const int instr, const int component)
+		{
+			return "v" + std::to_string(instr) + "_" + std::to_string(component);
+		}
+
+		string ShaderCodeGen::Literal(const float value)
+		{
+			// Ten significant digits round trip every float, folded infinities and NaNs keep their bits
+			char literal[48];
+			if (std::isfinite(value))
+				snprintf(literal, sizeof(literal), "FloatSSE(%.9ef)", value);
+			else
+			{
+				uint bits;
+				memcpy(&bits, &value, sizeof(bits));
+				snprintf(literal, sizeof(literal), "IRMath::FromBits(0x%08xu)", bits);
+			}
+
+			return literal;
+		}
+
+		string ShaderCodeGen::EscapeString(const string& str)
+		{
+			string ret;
+			for (auto c : str)
+			{
+				if (c == '\\' || c == '"')
+					ret += '\\';
+
+				if (c == '\t')
+					ret += "\\t";
+				else if (c != '\r')
+					ret += c;
+			}
+
+			return ret;
+		}
+	}
+}
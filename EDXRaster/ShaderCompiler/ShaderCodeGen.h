@@ -0,0 +1,29 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "ShaderIR.h"
+
+namespace EDX
+{
+	namespace ShaderCompiler
+	{
+		// Emits an optimized program as C++, a header declaring a PixelShader subclass whose Shade runs
+		// the instructions as straight line SSE code. Shaders known at build time are compiled this way,
+		// so they pay neither dispatch nor register traffic of the CompiledPixelShader interpreter.
+		// Every component is computed with the same operations in the same order as Evaluate.
+		class ShaderCodeGen
+		{
+		public:
+			// The header also holds the HLSL source, for comparing against the interpreted program
+			static string EmitPixelShader(const ShaderProgram& program,
+				const char* className,
+				const char* sourceName,
+				const string& source);
+
+		private:
+			static string Value(const int instr, const int component);
+			static string Literal(const float value);
+			static string EscapeString(const string& str);
+		};
+	}
+}
@@ -0,0 +1,181 @@
+#include "ShaderIR.h"
+
+namespace EDX
+{
+	namespace ShaderCompiler
+	{
+		void ShaderProgram::Optimize()
+		{
+			FoldConstants();
+			EliminateDeadCode();
+			AllocateRegisters();
+		}
+
+		void ShaderProgram::FoldConstants()
+		{
+			// Values are only read by later instructions, so a single forward pass sees final args
+			Array<int> remap;
+			remap.Resize(instructions.Size());
+			for (auto i = 0; i < instructions.Size(); i++)
+			{
+				IRInstruction& instr = instructions[i];
+				remap[i] = i;
+
+				bool allConstant = instr.IsPure();
+				for (auto j = 0; j < instr.argCount; j++)
+				{
+					instr.args[j] = remap[instr.args[j]];
+					allConstant = allConstant && instructions[instr.args[j]].op == IROp::Constant;
+				}
+
+				// Identity swizzles only forward their source
+				if (instr.op == IROp::Swizzle && instructions[instr.args[0]].width == instr.width)
+				{
+					bool identity = true;
+					for (auto j = 0; j < instr.width; j++)
+						identity = identity && instr.components[j] == j;
+
+					if (identity)
+					{
+						remap[i] = instr.args[0];
+						continue;
+					}
+				}
+
+				if (!allConstant)
+					continue;
+
+				IRRegister args[IRInstruction::MAX_ARGS];
+				const IRRegister* ppArgs[IRInstruction::MAX_ARGS];
+				for (auto j = 0; j < instr.argCount; j++)
+				{
+					const IRInstruction& arg = instructions[instr.args[j]];
+					for (auto c = 0; c < arg.width; c++)
+						args[j].c[c] = FloatSSE(arg.constant[c]);
+					ppArgs[j] = &args[j];
+				}
+
+				IRRegister folded;
+				Evaluate(instr, ppArgs, folded);
+
+				const int width = instr.width;
+				instr = IRInstruction(IROp::Constant, width);
+				for (auto c = 0; c < width; c++)
+					instr.constant[c] = folded.c[c][0];
+			}
+
+			result = remap[result];
+		}
+
+		void ShaderProgram::EliminateDeadCode()
+		{
+			Array<bool> live;
+			live.Resize(instructions.Size());
+			for (auto i = 0; i < live.Size(); i++)
+				live[i] = false;
+
+			live[result] = true;
+			for (auto i = instructions.Size() - 1; i >= 0; i--)
+			{
+				if (!live[i])
+					continue;
+
+				for (auto j = 0; j < instructions[i].argCount; j++)
+					live[instructions[i].args[j]] = true;
+			}
+
+			Array<int> remap;
+			Array<IRInstruction> compacted;
+			remap.Resize(instructions.Size());
+			for (auto i = 0; i < instructions.Size(); i++)
+			{
+				if (!live[i])
+					continue;
+
+				IRInstruction instr = instructions[i];
+				for (auto j = 0; j < instr.argCount; j++)
+					instr.args[j] = remap[instr.args[j]];
+
+				remap[i] = compacted.Size();
+				compacted.Add(instr);
+			}
+
+			result = remap[result];
+			instructions = compacted;
+		}
+
+		void ShaderProgram::AllocateRegisters()
+		{
+			Array<int> lastUse;
+			lastUse.Resize(instructions.Size());
+			for (auto i = 0; i < instructions.Size(); i++)
+			{
+				lastUse[i] = i;
+				for (auto j = 0; j < instructions[i].argCount; j++)
+					lastUse[instructions[i].args[j]] = i;
+			}
+			lastUse[result] = instructions.Size();
+
+			Array<int> freeList;
+			int freeCount = 0;
+			freeList.Resize(instructions.Size());
+			registers.Resize(instructions.Size());
+			registerCount = 0;
+			for (auto i = 0; i < instructions.Size(); i++)
+			{
+				registers[i] = freeCount > 0 ? freeList[--freeCount] : registerCount++;
+
+				// Freed after the destination is picked so it never aliases an arg
+				const IRInstruction& instr = instructions[i];
+				for (auto j = 0; j < instr.argCount; j++)
+				{
+					const int arg = instr.args[j];
+					bool seen = false;
+					for (auto k = 0; k < j; k++)
+						seen = seen || instr.args[k] == arg;
+
+					if (!seen && lastUse[arg] == i)
+						freeList[freeCount++] = registers[arg];
+				}
+			}
+		}
+
+		int ShaderProgram::ReadComponents(const IRInstruction& instr, const int arg)
+		{
+			switch (instr.op)
+			{
+			case IROp::Dot:
+			case IROp::Length:
+			case IROp::Normalize:
+				return (1 << instr.components[0]) - 1;
+			case IROp::Cross:
+				return 7;
+			case IROp::Sample:
+				return 3;
+			case IROp::Swizzle:
+			{
+				int mask = 0;
+				for (auto i = 0; i < instr.width; i++)
+					mask |= 1 << instr.components[i];
+				return mask;
+			}
+			case IROp::Merge:
+			{
+				int mask = 0;
+				for (auto i = 0; i < instr.width; i++)
+				{
+					if (arg == 1 && instr.components[i] >= 0)
+						mask |= 1 << instr.components[i];
+					else if (arg == 0 && instr.components[i] < 0)
+						mask |= 1 << i;
+				}
+				return mask;
+			}
+			case IROp::Construct:
+				return (1 << instr.components[arg]) - 1;
+			default:
+				return (1 << instr.width) - 1;
+			}
+		}
+	}
+}
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "SIMD/SSE.h"
+
+namespace EDX
+{
+	namespace ShaderCompiler
+	{
+		// Straight line SSA code, every instruction defines one value of 1 to 4 float components
+		enum class IROp
+		{
+			Constant,
+			Input,		// Interpolated attribute, slot is an IRInput
+			Uniform,	// Per frame constant, slot is an IRUniform
+			Add,
+			Sub,
+			Mul,
+			Div,
+			Neg,
+			Min,
+			Max,
+			Abs,
+			Sqrt,
+			Rsqrt,
+			Floor,
+			Frac,
+			Saturate,
+			Pow,
+			Lerp,
+			Clamp,
+			Dot,
+			Cross,
+			Length,
+			Normalize,
+			Swizzle,	// components[i] selects from args[0]
+			Merge,		// components[i] selects from args[1], or keeps args[0] when negative
+			Construct,	// Concatenates the components of all args
+			Sample,		// Texture slot, rgb plus a = 1
+		};
+
+		enum class IRInput
+		{
+			Position,
+			Normal,
+			TexCoord,
+			Count
+		};
+
+		enum class IRUniform
+		{
+			EyePosition,
+			LightDirection,
+			Count
+		};
+
+		struct IRInstruction
+		{
+			static const int MAX_ARGS = 4;
+
+			IROp op;
+			int width;
+			int argCount;
+			int args[MAX_ARGS];
+			int components[4];
+			float constant[4];
+			int slot;
+
+			IRInstruction(const IROp o = IROp::Constant, const int w = 1)
+				: op(o), width(w), argCount(0), slot(0)
+			{
+				for (auto i = 0; i < 4; i++)
+				{
+					args[i] = -1;
+					components[i] = i;
+					constant[i] = 0.0f;
+				}
+			}
+
+			bool IsPure() const
+			{
+				return op != IROp::Constant && op != IROp::Input && op != IROp::Uniform && op != IROp::Sample;
+			}
+		};
+
+		struct IRRegister
+		{
+			FloatSSE c[4];
+		};
+
+		// Component math of the ops that are more than one operator, shared by Evaluate and the
+		// shaders emitted by ShaderCodeGen so both round the same way
+		namespace IRMath
+		{
+			__forceinline FloatSSE Abs(const FloatSSE& a)
+			{
+				return SSE::Max(a, FloatSSE(Math::EDX_ZERO) - a);
+			}
+			__forceinline FloatSSE Floor(const FloatSSE& a)
+			{
+				const FloatSSE truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.m128));
+				return SSE::Select(truncated > a, truncated - FloatSSE(1.0f), truncated);
+			}
+			__forceinline FloatSSE Frac(const FloatSSE& a)
+			{
+				return a - Floor(a);
+			}
+			__forceinline FloatSSE Saturate(const FloatSSE& a)
+			{
+				return SSE::Min(SSE::Max(a, FloatSSE(Math::EDX_ZERO)), FloatSSE(Math::EDX_ONE));
+			}
+			__forceinline FloatSSE Pow(const FloatSSE& a, const FloatSSE& b)
+			{
+				return FloatSSE(Math::Pow(a[0], b[0]), Math::Pow(a[1], b[1]), Math::Pow(a[2], b[2]), Math::Pow(a[3], b[3]));
+			}
+			// Constants that have no literal, such as folded infinities
+			__forceinline FloatSSE FromBits(const uint bits)
+			{
+				return _mm_castsi128_ps(_mm_set1_epi32(int(bits)));
+			}
+		}
+
+		class ShaderProgram
+		{
+		public:
+			Array<IRInstruction> instructions;
+			int result;
+
+			// Filled by Optimize. Registers are reused after their last read, but never by an
+			// instruction reading them, so Evaluate does not have to handle aliasing
+			Array<int> registers;
+			int registerCount;
+
+		public:
+			ShaderProgram()
+				: result(-1), registerCount(0)
+			{
+			}
+
+			int Add(const IRInstruction& instr)
+			{
+				instructions.Add(instr);
+				return instructions.Size() - 1;
+			}
+
+			// Folds constants, drops unused code and compacts the instruction list
+			void Optimize();
+
+			// The passes of Optimize in the order it runs them
+			void FoldConstants();
+			void EliminateDeadCode();
+			void AllocateRegisters();
+
+			static void Evaluate(const IRInstruction& instr, const IRRegister* const* ppArgs, IRRegister& out);
+			// Bit i set if instr reads component i of args[arg]
+			static int ReadComponents(const IRInstruction& instr, const int arg);
+		};
+
+		__forceinline void ShaderProgram::Evaluate(const IRInstruction& instr, const IRRegister* const* ppArgs, IRRegister& out)
+		{
+			const int width = instr.width;
+			const IRRegister& a = *ppArgs[0];
+
+			// Element wise ops see args of equal width, the parser inserts broadcasts.
+			// Dot, Length and Normalize keep the arg width in components[0]
+			switch (instr.op)
+			{
+			case IROp::Add:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = a.c[i] + ppArgs[1]->c[i];
+				break;
+			case IROp::Sub:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = a.c[i] - ppArgs[1]->c[i];
+				break;
+			case IROp::Mul:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = a.c[i] * ppArgs[1]->c[i];
+				break;
+			case IROp::Div:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = a.c[i] / ppArgs[1]->c[i];
+				break;
+			case IROp::Neg:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = FloatSSE(Math::EDX_ZERO) - a.c[i];
+				break;
+			case IROp::Min:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = SSE::Min(a.c[i], ppArgs[1]->c[i]);
+				break;
+			case IROp::Max:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = SSE::Max(a.c[i], ppArgs[1]->c[i]);
+				break;
+			case IROp::Abs:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = IRMath::Abs(a.c[i]);
+				break;
+			case IROp::Sqrt:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = SSE::Sqrt(a.c[i]);
+				break;
+			case IROp::Rsqrt:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = SSE::Rsqrt(a.c[i]);
+				break;
+			case IROp::Floor:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = IRMath::Floor(a.c[i]);
+				break;
+			case IROp::Frac:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = IRMath::Frac(a.c[i]);
+				break;
+			case IROp::Saturate:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = IRMath::Saturate(a.c[i]);
+				break;
+			case IROp::Pow:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = IRMath::Pow(a.c[i], ppArgs[1]->c[i]);
+				break;
+			case IROp::Lerp:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = a.c[i] + (ppArgs[1]->c[i] - a.c[i]) * ppArgs[2]->c[i];
+				break;
+			case IROp::Clamp:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = SSE::Min(SSE::Max(a.c[i], ppArgs[1]->c[i]), ppArgs[2]->c[i]);
+				break;
+			case IROp::Dot:
+			case IROp::Length:
+			case IROp::Normalize:
+			{
+				const IRRegister& b = instr.op == IROp::Dot ? *ppArgs[1] : a;
+				const int argWidth = instr.components[0];
+				FloatSSE dot = a.c[0] * b.c[0];
+				for (auto i = 1; i < argWidth; i++)
+					dot = dot + a.c[i] * b.c[i];
+
+				if (instr.op == IROp::Dot)
+					out.c[0] = dot;
+				else if (instr.op == IROp::Length)
+					out.c[0] = SSE::Sqrt(dot);
+				else
+				{
+					const FloatSSE invLength = SSE::Rsqrt(dot);
+					for (auto i = 0; i < width; i++)
+						out.c[i] = a.c[i] * invLength;
+				}
+				break;
+			}
+			case IROp::Cross:
+			{
+				const IRRegister& b = *ppArgs[1];
+				const FloatSSE x = a.c[1] * b.c[2] - a.c[2] * b.c[1];
+				const FloatSSE y = a.c[2] * b.c[0] - a.c[0] * b.c[2];
+				const FloatSSE z = a.c[0] * b.c[1] - a.c[1] * b.c[0];
+				out.c[0] = x;
+				out.c[1] = y;
+				out.c[2] = z;
+				break;
+			}
+			case IROp::Swizzle:
+				for (auto i = 0; i < width; i++)
+					out.c[i] = a.c[instr.components[i]];
+				break;
+			case IROp::Merge:
+				for (auto i = 0; i < width; i++)
+				{
+					if (instr.components[i] >= 0)
+						out.c[i] = ppArgs[1]->c[instr.components[i]];
+					else
+						out.c[i] = a.c[i];
+				}
+				break;
+			case IROp::Construct:
+			{
+				// Arg widths are stored in components
+				int idx = 0;
+				for (auto i = 0; i < instr.argCount; i++)
+				{
+					for (auto j = 0; j < instr.components[i]; j++)
+						out.c[idx++] = ppArgs[i]->c[j];
+				}
+				break;
+			}
+			default:
+				Assert(false);
+			}
+		}
+	}
+}
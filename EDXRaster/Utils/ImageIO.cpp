@@ -0,0 +1,781 @@
+#include "ImageIO.h"
+
+#include <fstream>
+#include <utility>
+
+#if defined(_WIN32)
+#include "Graphics/Color.h"
+#include "Windows/Bitmap.h"
+#include "Core/Memory.h"
+#endif
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace ImageIO
+		{
+			namespace
+			{
+				// Rejects images whose texel count could overflow the buffers, 256M texels is far beyond any texture
+				const uint64 MAX_TEXELS = 1ull << 28;
+
+				__forceinline uint Load16LE(const _byte* p)
+				{
+					return uint(p[0]) | (uint(p[1]) << 8);
+				}
+				__forceinline uint Load32LE(const _byte* p)
+				{
+					return uint(p[0]) | (uint(p[1]) << 8) | (uint(p[2]) << 16) | (uint(p[3]) << 24);
+				}
+				__forceinline uint Load32BE(const _byte* p)
+				{
+					return (uint(p[0]) << 24) | (uint(p[1]) << 16) | (uint(p[2]) << 8) | uint(p[3]);
+				}
+				__forceinline void Store16LE(_byte* p, const uint value)
+				{
+					p[0] = _byte(value);
+					p[1] = _byte(value >> 8);
+				}
+				__forceinline void Store32LE(_byte* p, const uint value)
+				{
+					Store16LE(p, value);
+					Store16LE(p + 2, value >> 16);
+				}
+				__forceinline uint Pack(const uint r, const uint g, const uint b, const uint a)
+				{
+					return r | (g << 8) | (b << 16) | (a << 24);
+				}
+
+				bool ValidSize(const int64 width, const int64 height)
+				{
+					return width > 0 && height > 0 && uint64(width) * uint64(height) <= MAX_TEXELS;
+				}
+
+#if !defined(_WIN32)
+				bool ReadFile(const char* path, Array<_byte>& data)
+				{
+					std::ifstream file(path, std::ios::binary | std::ios::ate);
+					if (!file)
+						return false;
+
+					const std::streamoff size = file.tellg();
+					if (size <= 0 || size > 0x7FFFFFFF)
+						return false;
+
+					data.Resize(int(size));
+					file.seekg(0);
+					file.read((char*)data.Data(), size);
+					return bool(file);
+				}
+#endif
+
+				// Uncompressed 8, 24 and 32 bit files, the only ones texture tools write
+				bool DecodeBMP(const _byte* pData, const size_t size, Array<uint>& texels, int& width, int& height)
+				{
+					if (size < 54)
+						return false;
+
+					const uint pixelOffset = Load32LE(pData + 10);
+					const uint infoSize = Load32LE(pData + 14);
+					const int fileWidth = int(Load32LE(pData + 18));
+					const int fileHeight = int(Load32LE(pData + 22));
+					const uint bitCount = Load16LE(pData + 28);
+					const uint compression = Load32LE(pData + 30);
+					const bool topDown = fileHeight < 0;
+
+					// Fields above are read from a BITMAPINFOHEADER, older core headers are not supported
+					if (infoSize < 40 || infoSize > size)
+						return false;
+					// Bit fields are only accepted in the standard BGRA layout of 32 bit files
+					if (!(compression == 0 || (compression == 3 && bitCount == 32)) || !(bitCount == 8 || bitCount == 24 || bitCount == 32))
+						return false;
+					if (!ValidSize(fileWidth, topDown ? -int64(fileHeight) : int64(fileHeight)))
+						return false;
+
+					width = fileWidth;
+					height = topDown ? -fileHeight : fileHeight;
+					const size_t rowSize = ((size_t(width) * bitCount + 31) / 32) * 4;
+					if (pixelOffset > size || rowSize * height > size - pixelOffset)
+						return false;
+
+					uint palette[256];
+					if (bitCount == 8)
+					{
+						const uint paletteOffset = 14 + infoSize;
+						uint colorCount = Load32LE(pData + 46);
+						if (colorCount == 0 || colorCount > 256)
+							colorCount = 256;
+						if (paletteOffset > pixelOffset || 4 * size_t(colorCount) > pixelOffset - paletteOffset)
+							return false;
+
+						for (auto i = 0; i < 256; i++)
+						{
+							const _byte* p = pData + paletteOffset + 4 * Math::Min(uint(i), colorCount - 1);
+							palette[i] = Pack(p[2], p[1], p[0], 255);
+						}
+					}
+
+					texels.Resize(width * height);
+					for (auto y = 0; y < height; y++)
+					{
+						const _byte* pRow = pData + pixelOffset + rowSize * (topDown ? height - 1 - y : y);
+						uint* pDest = texels.Data() + y * width;
+						for (auto x = 0; x < width; x++)
+						{
+							if (bitCount == 8)
+								pDest[x] = palette[pRow[x]];
+							else if (bitCount == 24)
+								pDest[x] = Pack(pRow[3 * x + 2], pRow[3 * x + 1], pRow[3 * x], 255);
+							else
+								pDest[x] = Pack(pRow[4 * x + 2], pRow[4 * x + 1], pRow[4 * x], compression == 3 ? pRow[4 * x + 3] : 255);
+						}
+					}
+
+					return true;
+				}
+
+				// True color and grey scale files, raw or run length encoded
+				bool DecodeTGA(const _byte* pData, const size_t size, Array<uint>& texels, int& width, int& height)
+				{
+					if (size < 18)
+						return false;
+
+					const uint idLength = pData[0];
+					const uint colorMapType = pData[1];
+					const uint imageType = pData[2];
+					const uint bitCount = pData[16];
+					const bool topDown = (pData[17] & 0x20) != 0;
+					const bool rle = imageType == 10 || imageType == 11;
+					const bool grey = imageType == 3 || imageType == 11;
+
+					if (colorMapType != 0 || !(imageType == 2 || imageType == 3 || imageType == 10 || imageType == 11))
+						return false;
+					if (grey ? bitCount != 8 : (bitCount != 24 && bitCount != 32))
+						return false;
+
+					width = int(Load16LE(pData + 12));
+					height = int(Load16LE(pData + 14));
+					if (!ValidSize(width, height))
+						return false;
+
+					const uint pixelSize = bitCount / 8;
+					auto Decode = [&](const _byte* p)
+					{
+						if (grey)
+							return Pack(p[0], p[0], p[0], 255);
+
+						return Pack(p[2], p[1], p[0], pixelSize == 4 ? p[3] : 255);
+					};
+
+					// Pixels are decoded in file order, rows are flipped afterwards if stored top down
+					texels.Resize(width * height);
+					size_t pos = 18 + idLength;
+					const int texelCount = width * height;
+					for (auto i = 0; i < texelCount;)
+					{
+						int runLength = 1;
+						bool repeat = false;
+						if (rle)
+						{
+							if (pos >= size)
+								return false;
+
+							const uint header = pData[pos++];
+							runLength = int(header & 0x7F) + 1;
+							repeat = (header & 0x80) != 0;
+							if (runLength > texelCount - i)
+								return false;
+						}
+
+						const size_t bytes = repeat ? pixelSize : pixelSize * runLength;
+						if (pos > size || bytes > size - pos)
+							return false;
+
+						for (auto j = 0; j < runLength; j++, i++)
+							texels[i] = Decode(pData + pos + (repeat ? 0 : j * pixelSize));
+						pos += bytes;
+					}
+
+					if (topDown)
+					{
+						for (auto y = 0; y < height / 2; y++)
+						{
+							uint* pRow0 = texels.Data() + y * width;
+							uint* pRow1 = texels.Data() + (height - 1 - y) * width;
+							for (auto x = 0; x < width; x++)
+								std::swap(pRow0[x], pRow1[x]);
+						}
+					}
+
+					return true;
+				}
+
+				// Decoder of zlib streams as in RFC 1950 and 1951, output size known up front
+				class Inflater
+				{
+				private:
+					static const int MAX_BITS = 15;
+
+					struct Huffman
+					{
+						short count[MAX_BITS + 1];	// Codes of each length
+						short symbol[288];			// Symbols ordered by code
+					};
+
+					const _byte* mpIn;
+					size_t mInSize;
+					size_t mInPos;
+					uint mBitBuf;
+					int mBitCount;
+
+					_byte* mpOut;
+					size_t mOutSize;
+					size_t mOutPos;
+					bool mError;
+
+				public:
+					Inflater(const _byte* pIn, const size_t inSize, _byte* pOut, const size_t outSize)
+						: mpIn(pIn), mInSize(inSize), mInPos(0), mBitBuf(0), mBitCount(0)
+						, mpOut(pOut), mOutSize(outSize), mOutPos(0), mError(false)
+					{
+					}
+
+					// True if the stream is intact and fills the output exactly
+					bool Run()
+					{
+						if (mInSize < 2)
+							return false;
+
+						const uint cmf = mpIn[0], flg = mpIn[1];
+						if ((cmf & 0xF) != 8 || (cmf >> 4) > 7 || ((cmf << 8) | flg) % 31 != 0 || (flg & 0x20))
+							return false;
+						mInPos = 2;
+
+						int last;
+						do
+						{
+							last = Bits(1);
+							const int type = Bits(2);
+							bool ok = false;
+							switch (type)
+							{
+							case 0:
+								ok = Stored();
+								break;
+							case 1:
+								ok = Fixed();
+								break;
+							case 2:
+								ok = Dynamic();
+								break;
+							}
+
+							if (!ok || mError)
+								return false;
+						} while (!last);
+
+						return mOutPos == mOutSize;
+					}
+
+				private:
+					int Bits(const int need)
+					{
+						uint value = mBitBuf;
+						while (mBitCount < need)
+						{
+							if (mInPos >= mInSize)
+							{
+								mError = true;
+								return 0;
+							}
+							value |= uint(mpIn[mInPos++]) << mBitCount;
+							mBitCount += 8;
+						}
+
+						mBitBuf = value >> need;
+						mBitCount -= need;
+						return int(value & ((1u << need) - 1));
+					}
+
+					bool Stored()
+					{
+						// Stored blocks start at a byte boundary
+						mBitBuf = 0;
+						mBitCount = 0;
+						if (mInSize - mInPos < 4)
+							return false;
+
+						const uint length = Load16LE(mpIn + mInPos);
+						if ((length ^ 0xFFFF) != Load16LE(mpIn + mInPos + 2))
+							return false;
+						mInPos += 4;
+
+						if (length > mInSize - mInPos || length > mOutSize - mOutPos)
+							return false;
+
+						memcpy(mpOut + mOutPos, mpIn + mInPos, length);
+						mInPos += length;
+						mOutPos += length;
+						return true;
+					}
+
+					// Incomplete codes are accepted, over subscribed ones are not
+					static bool Build(Huffman& huffman, const short* pLengths, const int count)
+					{
+						memset(huffman.count, 0, sizeof(huffman.count));
+						for (auto i = 0; i < count; i++)
+							huffman.count[pLengths[i]]++;
+
+						int left = 1;
+						for (auto len = 1; len <= MAX_BITS; len++)
+						{
+							left <<= 1;
+							left -= huffman.count[len];
+							if (left < 0)
+								return false;
+						}
+
+						short offsets[MAX_BITS + 1];
+						offsets[1] = 0;
+						for (auto len = 1; len < MAX_BITS; len++)
+							offsets[len + 1] = offsets[len] + huffman.count[len];
+
+						for (auto i = 0; i < count; i++)
+						{
+							if (pLengths[i] != 0)
+								huffman.symbol[offsets[pLengths[i]]++] = short(i);
+						}
+
+						return true;
+					}
+
+					int Decode(const Huffman& huffman)
+					{
+						int code = 0, first = 0, index = 0;
+						for (auto len = 1; len <= MAX_BITS; len++)
+						{
+							code |= Bits(1);
+							const int count = huffman.count[len];
+							if (code - count < first)
+								return huffman.symbol[index + (code - first)];
+
+							index += count;
+							first = (first + count) << 1;
+							code <<= 1;
+						}
+
+						mError = true;
+						return -1;
+					}
+
+					bool Codes(const Huffman& lengthCode, const Huffman& distCode)
+					{
+						static const short LENGTH_BASE[29] = {
+							3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+							35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+						static const short LENGTH_EXTRA[29] = {
+							0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+							3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+						static const short DIST_BASE[30] = {
+							1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+							257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+						static const short DIST_EXTRA[30] = {
+							0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+							7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+						while (true)
+						{
+							int symbol = Decode(lengthCode);
+							if (mError)
+								return false;
+
+							if (symbol < 256)
+							{
+								if (mOutPos >= mOutSize)
+									return false;
+								mpOut[mOutPos++] = _byte(symbol);
+							}
+							else if (symbol == 256)
+								return true;
+							else
+							{
+								symbol -= 257;
+								if (symbol >= 29)
+									return false;
+								const size_t length = LENGTH_BASE[symbol] + Bits(LENGTH_EXTRA[symbol]);
+
+								const int distSymbol = Decode(distCode);
+								if (mError || distSymbol >= 30)
+									return false;
+								const size_t dist = DIST_BASE[distSymbol] + Bits(DIST_EXTRA[distSymbol]);
+								if (mError || dist > mOutPos || length > mOutSize - mOutPos)
+									return false;
+
+								// Copies may overlap their source, so they go byte by byte
+								for (size_t i = 0; i < length; i++, mOutPos++)
+									mpOut[mOutPos] = mpOut[mOutPos - dist];
+							}
+						}
+					}
+
+					bool Fixed()
+					{
+						struct FixedCodes
+						{
+							Huffman lengthCode, distCode;
+						};
+
+						// Built once by the first caller, concurrent decoders wait on the static's initialization
+						static const FixedCodes codes = []
+						{
+							FixedCodes fixed;
+							short lengths[288];
+							auto symbol = 0;
+							for (; symbol < 144; symbol++)
+								lengths[symbol] = 8;
+							for (; symbol < 256; symbol++)
+								lengths[symbol] = 9;
+							for (; symbol < 280; symbol++)
+								lengths[symbol] = 7;
+							for (; symbol < 288; symbol++)
+								lengths[symbol] = 8;
+							Build(fixed.lengthCode, lengths, 288);
+
+							for (symbol = 0; symbol < 30; symbol++)
+								lengths[symbol] = 5;
+							Build(fixed.distCode, lengths, 30);
+							return fixed;
+						}();
+
+						return Codes(codes.lengthCode, codes.distCode);
+					}
+
+					bool Dynamic()
+					{
+						static const short ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+						const int lengthCount = Bits(5) + 257;
+						const int distCount = Bits(5) + 1;
+						const int codeCount = Bits(4) + 4;
+						if (mError || lengthCount > 286 || distCount > 30)
+							return false;
+
+						short lengths[286 + 30];
+						auto i = 0;
+						for (; i < codeCount; i++)
+							lengths[ORDER[i]] = short(Bits(3));
+						for (; i < 19; i++)
+							lengths[ORDER[i]] = 0;
+
+						Huffman lengthCode, distCode;
+						if (mError || !Build(lengthCode, lengths, 19))
+							return false;
+
+						for (i = 0; i < lengthCount + distCount;)
+						{
+							const int symbol = Decode(lengthCode);
+							if (mError)
+								return false;
+
+							if (symbol < 16)
+							{
+								lengths[i++] = short(symbol);
+								continue;
+							}
+
+							short repeated = 0;
+							int repeat;
+							if (symbol == 16)
+							{
+								if (i == 0)
+									return false;
+								repeated = lengths[i - 1];
+								repeat = 3 + Bits(2);
+							}
+							else if (symbol == 17)
+								repeat = 3 + Bits(3);
+							else
+								repeat = 11 + Bits(7);
+
+							if (mError || i + repeat > lengthCount + distCount)
+								return false;
+							while (repeat--)
+								lengths[i++] = repeated;
+						}
+
+						// Every block needs its end code
+						if (lengths[256] == 0)
+							return false;
+
+						return Build(lengthCode, lengths, lengthCount) &&
+							Build(distCode, lengths + lengthCount, distCount) &&
+							Codes(lengthCode, distCode);
+					}
+				};
+
+				__forceinline _byte Paeth(const int a, const int b, const int c)
+				{
+					const int p = a + b - c;
+					const int pa = Math::Abs(p - a), pb = Math::Abs(p - b), pc = Math::Abs(p - c);
+					if (pa <= pb && pa <= pc)
+						return _byte(a);
+
+					return _byte(pb <= pc ? b : c);
+				}
+
+				// Non interlaced files of every color type, 16 bit channels are cut to their high byte
+				bool DecodePNG(const _byte* pData, const size_t size, Array<uint>& texels, int& width, int& height)
+				{
+					uint bitDepth = 0, colorType = 0;
+					uint palette[256];
+					uint paletteSize = 0;
+					Array<_byte> compressed;
+					bool hasHeader = false;
+
+					for (auto i = 0; i < 256; i++)
+						palette[i] = Pack(0, 0, 0, 255);
+
+					size_t pos = 8;
+					while (true)
+					{
+						if (size - pos < 12)
+							return false;
+
+						const uint length = Load32BE(pData + pos);
+						const _byte* pType = pData + pos + 4;
+						const _byte* pChunk = pData + pos + 8;
+						if (length > size - pos - 12)
+							return false;
+
+						if (memcmp(pType, "IHDR", 4) == 0)
+						{
+							if (length < 13)
+								return false;
+
+							const uint fileWidth = Load32BE(pChunk);
+							const uint fileHeight = Load32BE(pChunk + 4);
+							bitDepth = pChunk[8];
+							colorType = pChunk[9];
+							if (pChunk[10] != 0 || pChunk[11] != 0 || pChunk[12] != 0 || !ValidSize(fileWidth, fileHeight))
+								return false;
+
+							// Bit depths valid for each color type
+							const bool valid = (colorType == 0 && (bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8 || bitDepth == 16)) ||
+								(colorType == 3 && (bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8)) ||
+								((colorType == 2 || colorType == 4 || colorType == 6) && (bitDepth == 8 || bitDepth == 16));
+							if (!valid)
+								return false;
+
+							width = int(fileWidth);
+							height = int(fileHeight);
+							hasHeader = true;
+						}
+						else if (memcmp(pType, "PLTE", 4) == 0)
+						{
+							paletteSize = Math::Min(length / 3, 256u);
+							for (uint i = 0; i < paletteSize; i++)
+								palette[i] = Pack(pChunk[3 * i], pChunk[3 * i + 1], pChunk[3 * i + 2], 255);
+						}
+						else if (memcmp(pType, "tRNS", 4) == 0 && colorType == 3)
+						{
+							for (uint i = 0; i < Math::Min(length, paletteSize); i++)
+								palette[i] = (palette[i] & 0x00FFFFFF) | (uint(pChunk[i]) << 24);
+						}
+						else if (memcmp(pType, "IDAT", 4) == 0)
+							compressed.Insert(pChunk, int(length), compressed.Size());
+						else if (memcmp(pType, "IEND", 4) == 0)
+							break;
+
+						pos += 12 + size_t(length);
+					}
+
+					if (!hasHeader || (colorType == 3 && paletteSize == 0))
+						return false;
+
+					static const uint CHANNELS[7] = { 1, 0, 3, 1, 2, 0, 4 };
+					const uint channels = CHANNELS[colorType];
+					const size_t rowSize = (size_t(width) * channels * bitDepth + 7) / 8;
+					const size_t pixelSize = Math::Max(channels * bitDepth / 8, 1u);
+
+					// 16 bit RGBA can exceed the texel limit's byte count
+					const size_t rawSize = (rowSize + 1) * height;
+					if (rawSize > 0x7FFFFFFF)
+						return false;
+
+					Array<_byte> raw;
+					raw.Resize(int(rawSize));
+					Inflater inflater(compressed.Data(), compressed.Size(), raw.Data(), raw.Size());
+					if (!inflater.Run())
+						return false;
+
+					// Filters are undone in place, each row refers to the unfiltered row above
+					for (auto y = 0; y < height; y++)
+					{
+						_byte* pRow = raw.Data() + y * (rowSize + 1) + 1;
+						const _byte* pPrev = y > 0 ? pRow - (rowSize + 1) : nullptr;
+						const uint filter = pRow[-1];
+						for (size_t x = 0; x < rowSize; x++)
+						{
+							const int a = x >= pixelSize ? pRow[x - pixelSize] : 0;
+							const int b = pPrev ? pPrev[x] : 0;
+							const int c = pPrev && x >= pixelSize ? pPrev[x - pixelSize] : 0;
+							switch (filter)
+							{
+							case 0:
+								break;
+							case 1:
+								pRow[x] = _byte(pRow[x] + a);
+								break;
+							case 2:
+								pRow[x] = _byte(pRow[x] + b);
+								break;
+							case 3:
+								pRow[x] = _byte(pRow[x] + ((a + b) >> 1));
+								break;
+							case 4:
+								pRow[x] = _byte(pRow[x] + Paeth(a, b, c));
+								break;
+							default:
+								return false;
+							}
+						}
+					}
+
+					// PNG rows are top down
+					texels.Resize(width * height);
+					const uint sampleStep = bitDepth / 8;
+					for (auto y = 0; y < height; y++)
+					{
+						const _byte* pRow = raw.Data() + (height - 1 - y) * (rowSize + 1) + 1;
+						uint* pDest = texels.Data() + y * width;
+						for (auto x = 0; x < width; x++)
+						{
+							if (bitDepth < 8)
+							{
+								const uint bit = uint(x) * bitDepth;
+								const uint value = (pRow[bit >> 3] >> (8 - bitDepth - (bit & 7))) & ((1u << bitDepth) - 1);
+								if (colorType == 3)
+									pDest[x] = palette[value];
+								else
+								{
+									const uint grey = value * 255 / ((1u << bitDepth) - 1);
+									pDest[x] = Pack(grey, grey, grey, 255);
+								}
+								continue;
+							}
+
+							const _byte* p = pRow + x * channels * sampleStep;
+							switch (colorType)
+							{
+							case 0:
+								pDest[x] = Pack(p[0], p[0], p[0], 255);
+								break;
+							case 2:
+								pDest[x] = Pack(p[0], p[sampleStep], p[2 * sampleStep], 255);
+								break;
+							case 3:
+								pDest[x] = palette[p[0]];
+								break;
+							case 4:
+								pDest[x] = Pack(p[0], p[0], p[0], p[sampleStep]);
+								break;
+							case 6:
+								pDest[x] = Pack(p[0], p[sampleStep], p[2 * sampleStep], p[3 * sampleStep]);
+								break;
+							}
+						}
+					}
+
+					return true;
+				}
+			}
+
+			bool Decode(const _byte* pData, const size_t size, Array<uint>& texels, int& width, int& height)
+			{
+				// Formats are told apart by signature, TGA has none and is tried last
+				static const _byte PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+				bool decoded;
+				if (size >= 8 && memcmp(pData, PNG_SIGNATURE, 8) == 0)
+					decoded = DecodePNG(pData, size, texels, width, height);
+				else if (size >= 2 && pData[0] == 'B' && pData[1] == 'M')
+					decoded = DecodeBMP(pData, size, texels, width, height);
+				else
+					decoded = DecodeTGA(pData, size, texels, width, height);
+
+				if (!decoded)
+					texels.Clear();
+
+				return decoded;
+			}
+
+#if defined(_WIN32)
+			bool Read(const char* path, Array<uint>& texels, int& width, int& height)
+			{
+				int channel;
+				Color4b* pTexels = Bitmap::ReadFromFile<Color4b>(path, &width, &height, &channel);
+				if (!pTexels)
+					return false;
+
+				texels.Resize(width * height);
+				memcpy(texels.Data(), pTexels, texels.Size() * sizeof(uint));
+				Memory::SafeDeleteArray(pTexels);
+
+				return true;
+			}
+#else
+			bool Read(const char* path, Array<uint>& texels, int& width, int& height)
+			{
+				Array<_byte> data;
+				if (!ReadFile(path, data))
+					return false;
+
+				return Decode(data.Data(), data.Size(), texels, width, height);
+			}
+#endif
+
+			bool WriteBMP(const char* path, const _byte* pPixels, const uint width, const uint height)
+			{
+				std::ofstream file(path, std::ios::binary);
+				if (!file)
+					return false;
+
+				const uint rowSize = (3 * width + 3) & ~3u;
+				const uint imageSize = rowSize * height;
+
+				_byte header[54];
+				memset(header, 0, sizeof(header));
+				header[0] = 'B';
+				header[1] = 'M';
+				Store32LE(header + 2, 54 + imageSize);
+				Store32LE(header + 10, 54);
+				Store32LE(header + 14, 40);
+				Store32LE(header + 18, width);
+				Store32LE(header + 22, height);
+				Store16LE(header + 26, 1);
+				Store16LE(header + 28, 24);
+				Store32LE(header + 34, imageSize);
+				file.write((const char*)header, sizeof(header));
+
+				// Both are bottom up, only the channel order is swapped
+				Array<_byte> row;
+				row.Resize(rowSize);
+				memset(row.Data(), 0, rowSize);
+				for (uint y = 0; y < height; y++)
+				{
+					const _byte* pSrc = pPixels + size_t(y) * width * sizeof(uint);
+					for (uint x = 0; x < width; x++)
+					{
+						row[3 * x + 0] = pSrc[4 * x + 2];
+						row[3 * x + 1] = pSrc[4 * x + 1];
+						row[3 * x + 2] = pSrc[4 * x + 0];
+					}
+					file.write((const char*)row.Data(), rowSize);
+				}
+
+				file.close();
+				return bool(file);
+			}
+		}
+	}
+}
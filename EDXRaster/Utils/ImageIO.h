@@ -0,0 +1,23 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Image files in the layout of the back buffer and textures: RGBA8 texels, r in the low byte,
+		// rows bottom up
+		namespace ImageIO
+		{
+			// Uses EDXUtil's loader on Windows. Elsewhere BMP, TGA and non interlaced PNG are decoded here.
+			bool Read(const char* path, Array<uint>& texels, int& width, int& height);
+			// Decodes a BMP, TGA or PNG file already in memory, on every platform. Malformed or truncated
+			// data fails and leaves texels empty.
+			bool Decode(const _byte* pData, const size_t size, Array<uint>& texels, int& width, int& height);
+
+			// 24 bit BMP, alpha is dropped
+			bool WriteBMP(const char* path, const _byte* pPixels, const uint width, const uint height);
+		}
+	}
+}
@@ -2,6 +2,7 @@
 
 #include "EDXPrerequisites.h"
 #include "Core/Memory.h"
+#include "SIMD/SSE.h"
 
 namespace EDX
 {
@@ -30,7 +31,7 @@ namespace EDX
 		{
 			Vector3 Position;
 			Vector3 Normal;
-			Color	Color;
+			EDX::Color	Color;
 			static const VertexFormat Format = VertexFormat::PositionNormalColor;
 			static const int Size = 32;
 
@@ -58,6 +59,8 @@ namespace EDX
 			virtual Vector3		 GetNormal(const uint idx) const = 0;
 			virtual Vector2		 GetTexCoord(const uint idx) const = 0;
 			virtual Color		 GetColor(const uint idx) const = 0;
+			// Loads count (at most 4) consecutive vertices starting at first into SoA lanes
+			virtual void		 GatherSoA(const uint first, const uint count, Vec3f_SSE& position, Vec3f_SSE& normal, Vec2f_SSE& texCoord) const = 0;
 			virtual void		 Release() = 0;
 			uint				 GetVertexCount() const
 			{
@@ -70,8 +73,13 @@ namespace EDX
 		{
 		private:
 			_byte* mpBuffer;
+			bool mOwnsBuffer;
 
 		public:
+			VertexBuffer()
+				: mpBuffer(nullptr), mOwnsBuffer(true)
+			{
+			}
 			~VertexBuffer()
 			{
 				Release();
@@ -79,10 +87,22 @@ namespace EDX
 
 			void NewBuffer(const uint vertexCount)
 			{
+				Release();
 				mVertexCount = vertexCount;
 				mBufSize = vertexCount * VertexType::Size;
 
 				mpBuffer = new _byte[mBufSize];
+				mOwnsBuffer = true;
+			}
+			// Uses vertices owned by someone else, e.g. a mapped mesh cache, which must outlive the buffer
+			void MapBuffer(const void* pData, const uint vertexCount)
+			{
+				Release();
+				mVertexCount = vertexCount;
+				mBufSize = vertexCount * VertexType::Size;
+
+				mpBuffer = (_byte*)pData;
+				mOwnsBuffer = false;
 			}
 			void* GetBuffer() const
 			{
@@ -126,9 +146,40 @@ namespace EDX
 				Color* ret = (Color*)(mpBuffer + idx * VertexType::Size + VertexType::ColorOffset);
 				return *ret;
 			}
+			inline void GatherSoA(const uint first, const uint count, Vec3f_SSE& position, Vec3f_SSE& normal, Vec2f_SSE& texCoord) const
+			{
+				// Lanes past count stay zero
+				position = Vec3f_SSE(Vector3::ZERO);
+				normal = Vec3f_SSE(Vector3::ZERO);
+				texCoord = Vec2f_SSE(0.0f, 0.0f);
+				for (uint i = 0; i < count; i++)
+				{
+					const _byte* pVertex = mpBuffer + (first + i) * VertexType::Size;
+
+					const Vector3& pos = *(Vector3*)(pVertex + VertexType::PosOffset);
+					position.x[i] = pos.x;
+					position.y[i] = pos.y;
+					position.z[i] = pos.z;
+					if (VertexType::NormalOffset != -1)
+					{
+						const Vector3& n = *(Vector3*)(pVertex + VertexType::NormalOffset);
+						normal.x[i] = n.x;
+						normal.y[i] = n.y;
+						normal.z[i] = n.z;
+					}
+					if (VertexType::TexOffset != -1)
+					{
+						const Vector2& uv = *(Vector2*)(pVertex + VertexType::TexOffset);
+						texCoord.u[i] = uv.x;
+						texCoord.v[i] = uv.y;
+					}
+				}
+			}
 			void Release()
 			{
-				Memory::SafeDeleteArray(mpBuffer);
+				if (mOwnsBuffer)
+					Memory::SafeDeleteArray(mpBuffer);
+				mpBuffer = nullptr;
 			}
 
 		};
@@ -145,12 +196,28 @@ namespace EDX
 			return ret;
 		}
 
+		template<typename VertexType = Vertex_PositionNormalTex>
+		static IVertexBuffer* CreateMappedVertexBuffer(const void* pData, const size_t vertexCount)
+		{
+			VertexBuffer<VertexType>* ret = new VertexBuffer < VertexType >;
+			ret->MapBuffer(pData, vertexCount);
+
+			return ret;
+		}
+
 		class IndexBuffer
 		{
 		private:
 			Array<uint>	mBuffer;
+			// Either mBuffer or indices mapped from a mesh cache
+			const uint* mpIndices;
+			size_t mIndexCount;
 
 		public:
+			IndexBuffer()
+				: mpIndices(nullptr), mIndexCount(0)
+			{
+			}
 			~IndexBuffer()
 			{
 				Release();
@@ -159,41 +226,70 @@ namespace EDX
 			void ResizeBuffer(const uint triCount)
 			{
 				mBuffer.Resize(3 * triCount);
+				SyncToBuffer();
+			}
+			// The mapped indices are read only and must outlive the buffer
+			void Map(const uint* pIndices, const uint triCount)
+			{
+				mBuffer.Clear();
+				mpIndices = pIndices;
+				mIndexCount = 3 * triCount;
+			}
+			inline bool IsMapped() const
+			{
+				return mpIndices && mpIndices != mBuffer.Data();
 			}
 			inline uint* GetBuffer()
 			{
+				Assert(!IsMapped());
 				return mBuffer.Data();
 			}
+			inline const uint* GetBuffer() const
+			{
+				return mpIndices;
+			}
 			inline uint GetTriangleCount() const
 			{
-				return mBuffer.Size() / 3;
+				return mIndexCount / 3;
 			}
 			inline size_t GetBufferSize() const
 			{
-				return mBuffer.Size();
+				return mIndexCount;
 			}
 			inline const uint* GetIndex(const uint idx) const
 			{
-				Assert(3 * idx < mBuffer.Size());
-				return (uint*)&mBuffer[3 * idx];
+				Assert(3 * idx < mIndexCount);
+				return mpIndices + 3 * idx;
 			}
 			inline void AppendTriangle(const int idx0, const int idx1, const int idx2)
 			{
+				Assert(!IsMapped());
 				mBuffer.Add(idx0);
 				mBuffer.Add(idx1);
 				mBuffer.Add(idx2);
+				SyncToBuffer();
 			}
-			inline void CopyFrom(IndexBuffer& other)
+			inline void CopyFrom(const IndexBuffer& other)
 			{
 				mBuffer.Resize(other.GetBufferSize());
-				memcpy(mBuffer.Data(), other.GetBuffer(), other.GetBufferSize() * sizeof(uint));
+				memcpy(mBuffer.Data(), other.mpIndices, other.GetBufferSize() * sizeof(uint));
+				SyncToBuffer();
 			}
 			void Release()
 			{
+				mBuffer.Clear();
+				SyncToBuffer();
+			}
+
+		private:
+			inline void SyncToBuffer()
+			{
+				mpIndices = mBuffer.Data();
+				mIndexCount = mBuffer.Size();
 			}
 		};
 
-		static IndexBuffer* CreateIndexBuffer(const void* pData, const size_t triCount)
+		inline IndexBuffer* CreateIndexBuffer(const void* pData, const size_t triCount)
 		{
 			IndexBuffer* ret = nullptr;
 			ret = new IndexBuffer;
@@ -204,6 +300,14 @@ namespace EDX
 			return ret;
 		}
 
+		inline IndexBuffer* CreateMappedIndexBuffer(const uint* pIndices, const size_t triCount)
+		{
+			IndexBuffer* ret = new IndexBuffer;
+			ret->Map(pIndices, triCount);
+
+			return ret;
+		}
+
 		template class VertexBuffer < Vertex_PositionNormalTex > ;
 	}
 }
\ No newline at end of file
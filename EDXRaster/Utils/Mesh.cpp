@@ -13,26 +13,79 @@ namespace EDX
 			const Vector3& rot,
 			const char* path)
 		{
+			if (LoadFromCache(pos, scl, rot, path))
+				return;
+
 			ObjMesh mesh;
 			mesh.LoadFromObj(pos, scl, rot, path);
-
-			mpVertexBuf.Reset(CreateVertexBuffer(&mesh.GetVertexAt(0), mesh.GetVertexCount()));
-			mpIndexBuf.Reset(CreateIndexBuffer(mesh.GetIndexAt(0), mesh.GetTriangleCount()));
+			InitGeometry(mesh);
+			MeshCache::Build(path, pos, scl, rot, mesh, *this);
 
 			// Initialize materials
 			const auto& materialInfo = mesh.GetMaterialInfo();
 			for (auto i = 0; i < materialInfo.Size(); i++)
 			{
 				if (materialInfo[i].strTexturePath[0])
-					mTextures.Add(MakeUnique<ImageTexture<Color, Color4b>>(materialInfo[i].strTexturePath, 1.0f));
+					mTextures.Add(MakeUnique<RasterTexture>(materialInfo[i].strTexturePath));
 				else
-					mTextures.Add(MakeUnique<ConstantTexture2D<Color>>(materialInfo[i].color));
+					mTextures.Add(MakeUnique<RasterTexture>(materialInfo[i].color));
 			}
+		}
+
+		void Mesh::InitGeometry(const ObjMesh& mesh)
+		{
+			// Source order has poor locality, so geometry is reordered and split into meshlets up front
+			Array<Vertex_PositionNormalTex> vertices;
+			vertices.Resize(mesh.GetVertexCount());
+			memcpy((void*)vertices.Data(), &mesh.GetVertexAt(0), vertices.Size() * Vertex_PositionNormalTex::Size);
+
+			Array<uint> indices;
+			indices.Resize(3 * mesh.GetTriangleCount());
+			memcpy(indices.Data(), mesh.GetIndexAt(0), indices.Size() * sizeof(uint));
+
 			mTexIdx = mesh.GetMaterialIdxBuf();
+			MeshOptimizer::Optimize(vertices, indices, mTexIdx, mMeshlets);
+
+			mpVertexBuf.Reset(CreateVertexBuffer(vertices.Data(), vertices.Size()));
+			mpIndexBuf.Reset(CreateIndexBuffer(indices.Data(), indices.Size() / 3));
 
 			mBounds = mesh.GetBounds();
 		}
 
+		bool Mesh::LoadFromCache(const Vector3& pos,
+			const Vector3& scl,
+			const Vector3& rot,
+			const char* path)
+		{
+			mpCache.Reset(new MeshCache);
+			if (!mpCache->Open(path, pos, scl, rot))
+			{
+				mpCache.Reset(nullptr);
+				return false;
+			}
+
+			// Vertices and indices stay in the mapping, pages are faulted in on first use
+			const MeshCache::Header& header = mpCache->GetHeader();
+			mpVertexBuf.Reset(CreateMappedVertexBuffer(mpCache->GetVertices(), header.vertexCount));
+			mpIndexBuf.Reset(CreateMappedIndexBuffer(mpCache->GetIndices(), header.triangleCount));
+
+			const MeshCache::Material* pMaterials = mpCache->GetMaterials();
+			for (uint i = 0; i < header.materialCount; i++)
+			{
+				if (pMaterials[i].texturePath[0])
+					mTextures.Add(MakeUnique<RasterTexture>(pMaterials[i].texturePath));
+				else
+					mTextures.Add(MakeUnique<RasterTexture>(pMaterials[i].color));
+			}
+			mTexIdx.Resize(header.textureIdCount);
+			memcpy(mTexIdx.Data(), mpCache->GetTextureIds(), header.textureIdCount * sizeof(uint));
+			mMeshlets.Resize(header.meshletCount);
+			memcpy((void*)mMeshlets.Data(), mpCache->GetMeshlets(), header.meshletCount * sizeof(Meshlet));
+
+			mBounds = header.bounds;
+			return true;
+		}
+
 		void Mesh::LoadPlane(const Vector3& pos,
 			const Vector3& scl,
 			const Vector3& rot,
@@ -41,13 +94,9 @@ namespace EDX
 			ObjMesh mesh;
 			mesh.LoadPlane(pos, scl, rot, length);
 
-			mpVertexBuf.Reset(CreateVertexBuffer(&mesh.GetVertexAt(0), mesh.GetVertexCount()));
-			mpIndexBuf.Reset(CreateIndexBuffer(mesh.GetIndexAt(0), mesh.GetTriangleCount()));
-
-			mTextures.Add(MakeUnique<ConstantTexture2D<Color>>(0.9f * Color::WHITE));
-			mTexIdx = mesh.GetMaterialIdxBuf();
+			InitGeometry(mesh);
 
-			mBounds = mesh.GetBounds();
+			mTextures.Add(MakeUnique<RasterTexture>(0.9f * Color::WHITE));
 		}
 
 		void Mesh::LoadSphere(const Vector3& pos,
@@ -60,21 +109,19 @@ namespace EDX
 			ObjMesh mesh;
 			mesh.LoadSphere(pos, scl, rot, radius, slices, stacks);
 
-			mpVertexBuf.Reset(CreateVertexBuffer(&mesh.GetVertexAt(0), mesh.GetVertexCount()));
-			mpIndexBuf.Reset(CreateIndexBuffer(mesh.GetIndexAt(0), mesh.GetTriangleCount()));
+			InitGeometry(mesh);
 
-			mTextures.Add(MakeUnique<ConstantTexture2D<Color>>(0.9f * Color::WHITE));
-			mTexIdx = mesh.GetMaterialIdxBuf();
-
-			mBounds = mesh.GetBounds();
+			mTextures.Add(MakeUnique<RasterTexture>(0.9f * Color::WHITE));
 		}
 
 		void Mesh::Release()
 		{
 			mpVertexBuf.Reset(nullptr);
 			mpIndexBuf.Reset(nullptr);
+			mpCache.Reset(nullptr);
 			mTextures.Clear();
 			mTexIdx.Clear();
+			mMeshlets.Clear();
 		}
 	}
 }
\ No newline at end of file
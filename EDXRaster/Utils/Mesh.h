@@ -1,10 +1,12 @@
 #pragma once
 
 #include "Graphics/ObjMesh.h"
-#include "Graphics/Texture.h"
 #include "Math/BoundingBox.h"
 
 #include "Core/SmartPointer.h"
+#include "../Core/RasterTexture.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
 
 namespace EDX
 {
@@ -17,12 +19,15 @@ namespace EDX
 		class Mesh
 		{
 		private:
+			// Declared first so the mapping outlives the buffers pointing into it
+			UniquePtr<MeshCache> mpCache;
 			UniquePtr<class IVertexBuffer> mpVertexBuf;
 			UniquePtr<IndexBuffer> mpIndexBuf;
 
-			Array<UniquePtr<Texture2D<Color>>> mTextures;
+			Array<UniquePtr<RasterTexture>> mTextures;
 			Array<uint> mTexIdx;
 
+			Array<Meshlet> mMeshlets;
 			BoundingBox mBounds;
 
 		public:
@@ -47,11 +52,11 @@ namespace EDX
 			{
 				return mpVertexBuf.Get();
 			}
-			IndexBuffer* GetIndexBuffer() const
+			const IndexBuffer* GetIndexBuffer() const
 			{
 				return mpIndexBuf.Get();
 			}
-			const Array<UniquePtr<Texture2D<Color>>>& GetTextures() const
+			const Array<UniquePtr<RasterTexture>>& GetTextures() const
 			{
 				return mTextures;
 			}
@@ -59,6 +64,11 @@ namespace EDX
 			{
 				return mTexIdx;
 			}
+			// Contiguous triangle ranges covering the whole index buffer
+			const Array<Meshlet>& GetMeshlets() const
+			{
+				return mMeshlets;
+			}
 
 			inline const BoundingBox GetBounds() const
 			{
@@ -66,6 +76,13 @@ namespace EDX
 			}
 
 			void Release();
+
+		private:
+			void InitGeometry(const ObjMesh& mesh);
+			bool LoadFromCache(const Vector3& pos,
+				const Vector3& scl,
+				const Vector3& rot,
+				const char* path);
 		};
 	}
 }
\ No newline at end of file
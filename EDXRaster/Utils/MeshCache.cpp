@@ -0,0 +1,263 @@
+#include "MeshCache.h"
+#include "Mesh.h"
+
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace
+		{
+			const uint CACHE_MAGIC = 0x48534D52; // "RMSH"
+			const uint CACHE_VERSION = 3;
+
+			bool StatSource(const char* objPath, uint64& sourceSize, int64& sourceTime)
+			{
+				struct stat fileStat;
+				if (stat(objPath, &fileStat) != 0)
+					return false;
+
+				sourceSize = uint64(fileStat.st_size);
+				sourceTime = int64(fileStat.st_mtime);
+				return true;
+			}
+
+			uint64 AlignSection(const uint64 offset)
+			{
+				return (offset + MeshCache::SECTION_ALIGNMENT - 1) & ~uint64(MeshCache::SECTION_ALIGNMENT - 1);
+			}
+		}
+
+		bool MeshCache::Open(const char* objPath, const Vector3& pos, const Vector3& scl, const Vector3& rot)
+		{
+			Close();
+
+			uint64 sourceSize;
+			int64 sourceTime;
+			if (!StatSource(objPath, sourceSize, sourceTime))
+				return false;
+
+			const std::string cachePath = std::string(objPath) + ".rmesh";
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return false;
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < sizeof(Header))
+			{
+				CloseHandle(file);
+				return false;
+			}
+
+			// The view keeps the mapping and the file alive, so both handles can go right away
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			CloseHandle(file);
+			if (!mapping)
+				return false;
+
+			mpView = (const _byte*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+			if (!mpView)
+				return false;
+
+			mSize = size_t(fileSize.QuadPart);
+#else
+			const int file = open(cachePath.c_str(), O_RDONLY);
+			if (file < 0)
+				return false;
+
+			struct stat fileStat;
+			if (fstat(file, &fileStat) != 0 || uint64(fileStat.st_size) < sizeof(Header))
+			{
+				close(file);
+				return false;
+			}
+
+			// The mapping keeps the file alive, so the descriptor can go right away
+			void* pView = mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+			close(file);
+			if (pView == MAP_FAILED)
+				return false;
+
+			mpView = (const _byte*)pView;
+			mSize = size_t(fileStat.st_size);
+#endif
+			if (!Validate(sourceSize, sourceTime, pos, scl, rot))
+			{
+				Close();
+				return false;
+			}
+
+			return true;
+		}
+
+		void MeshCache::Close()
+		{
+			if (mpView)
+			{
+#if defined(_WIN32)
+				UnmapViewOfFile(mpView);
+#else
+				munmap((void*)mpView, mSize);
+#endif
+			}
+
+			mpView = nullptr;
+			mSize = 0;
+		}
+
+		bool MeshCache::Validate(const uint64 sourceSize, const int64 sourceTime, const Vector3& pos, const Vector3& scl, const Vector3& rot) const
+		{
+			const Header& header = GetHeader();
+			if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+				header.sourceSize != sourceSize || header.sourceTime != sourceTime)
+				return false;
+
+			// Geometry of an older optimizer is valid but no longer what loading the OBJ would produce
+			if (header.optimizerVersion != MeshOptimizer::VERSION || header.meshletSize != sizeof(Meshlet))
+				return false;
+
+			// The transform is baked into the vertices, so it has to match bit for bit
+			if (memcmp(&header.position, &pos, sizeof(Vector3)) != 0 ||
+				memcmp(&header.scale, &scl, sizeof(Vector3)) != 0 ||
+				memcmp(&header.rotation, &rot, sizeof(Vector3)) != 0)
+				return false;
+
+			auto SectionFits = [this](const uint64 offset, const uint64 size)
+			{
+				return offset % SECTION_ALIGNMENT == 0 && offset <= mSize && size <= mSize - offset;
+			};
+
+			if (header.vertexCount == 0 || header.triangleCount == 0 ||
+				header.textureIdCount != header.triangleCount || header.meshletCount == 0 ||
+				!SectionFits(header.vertexOffset, uint64(header.vertexCount) * Vertex_PositionNormalTex::Size) ||
+				!SectionFits(header.indexOffset, uint64(header.triangleCount) * 3 * sizeof(uint)) ||
+				!SectionFits(header.textureIdOffset, uint64(header.textureIdCount) * sizeof(uint)) ||
+				!SectionFits(header.materialOffset, uint64(header.materialCount) * sizeof(Material)) ||
+				!SectionFits(header.meshletOffset, uint64(header.meshletCount) * sizeof(Meshlet)))
+				return false;
+
+			// Drawing indexes with the contents unchecked, so they are checked once here
+			const uint* pIndices = GetIndices();
+			for (uint64 i = 0; i < 3 * uint64(header.triangleCount); i++)
+			{
+				if (pIndices[i] >= header.vertexCount)
+					return false;
+			}
+
+			const uint* pTextureIds = GetTextureIds();
+			for (uint i = 0; i < header.textureIdCount; i++)
+			{
+				if (pTextureIds[i] >= header.materialCount)
+					return false;
+			}
+
+			const Material* pMaterials = GetMaterials();
+			for (uint i = 0; i < header.materialCount; i++)
+			{
+				if (!memchr(pMaterials[i].texturePath, 0, MAX_TEXTURE_PATH))
+					return false;
+			}
+
+			// Meshlets cover the triangles in order without gaps or overlaps
+			const Meshlet* pMeshlets = GetMeshlets();
+			uint nextTriangle = 0;
+			for (uint i = 0; i < header.meshletCount; i++)
+			{
+				if (pMeshlets[i].triangleOffset != nextTriangle ||
+					pMeshlets[i].triangleCount > header.triangleCount - nextTriangle)
+					return false;
+
+				nextTriangle += pMeshlets[i].triangleCount;
+			}
+
+			return nextTriangle == header.triangleCount;
+		}
+
+		void MeshCache::Build(const char* objPath, const Vector3& pos, const Vector3& scl, const Vector3& rot, const ObjMesh& source, const Mesh& mesh)
+		{
+			Header header;
+			memset((void*)&header, 0, sizeof(Header));
+			if (!StatSource(objPath, header.sourceSize, header.sourceTime))
+				return;
+
+			const auto& materialInfo = source.GetMaterialInfo();
+			const IVertexBuffer* pVertexBuf = mesh.GetVertexBuffer();
+			const IndexBuffer* pIndexBuf = mesh.GetIndexBuffer();
+			const auto& texIdx = mesh.GetTextureIds();
+			const auto& meshlets = mesh.GetMeshlets();
+
+			header.magic = CACHE_MAGIC;
+			header.version = CACHE_VERSION;
+			header.optimizerVersion = MeshOptimizer::VERSION;
+			header.meshletSize = sizeof(Meshlet);
+			header.position = pos;
+			header.scale = scl;
+			header.rotation = rot;
+			header.vertexCount = pVertexBuf->GetVertexCount();
+			header.triangleCount = pIndexBuf->GetTriangleCount();
+			header.textureIdCount = texIdx.Size();
+			header.materialCount = materialInfo.Size();
+			header.meshletCount = meshlets.Size();
+			header.bounds = mesh.GetBounds();
+			if (header.vertexCount == 0 || header.triangleCount == 0)
+				return;
+
+			header.vertexOffset = AlignSection(sizeof(Header));
+			header.indexOffset = AlignSection(header.vertexOffset + uint64(header.vertexCount) * Vertex_PositionNormalTex::Size);
+			header.textureIdOffset = AlignSection(header.indexOffset + uint64(header.triangleCount) * 3 * sizeof(uint));
+			header.materialOffset = AlignSection(header.textureIdOffset + uint64(header.textureIdCount) * sizeof(uint));
+			header.meshletOffset = AlignSection(header.materialOffset + uint64(header.materialCount) * sizeof(Material));
+
+			Array<Material> materials;
+			materials.Resize(header.materialCount);
+			memset((void*)materials.Data(), 0, materials.Size() * sizeof(Material));
+			for (auto i = 0; i < materialInfo.Size(); i++)
+			{
+				// Truncated like strncpy_s with _TRUNCATE, the memset above leaves the terminator
+				strncpy(materials[i].texturePath, materialInfo[i].strTexturePath, MAX_TEXTURE_PATH - 1);
+				materials[i].color = materialInfo[i].color;
+			}
+
+			const std::string cachePath = std::string(objPath) + ".rmesh";
+			std::ofstream file(cachePath, std::ios::binary);
+			if (!file)
+				return;
+
+			uint64 written = 0;
+			auto WriteSection = [&](const uint64 offset, const void* pData, const uint64 size)
+			{
+				static const _byte padding[SECTION_ALIGNMENT] = { 0 };
+				file.write((const char*)padding, offset - written);
+				file.write((const char*)pData, size);
+				written = offset + size;
+			};
+
+			WriteSection(0, &header, sizeof(Header));
+			WriteSection(header.vertexOffset, pVertexBuf->GetBuffer(), uint64(header.vertexCount) * Vertex_PositionNormalTex::Size);
+			WriteSection(header.indexOffset, pIndexBuf->GetBuffer(), uint64(header.triangleCount) * 3 * sizeof(uint));
+			WriteSection(header.textureIdOffset, texIdx.Data(), uint64(header.textureIdCount) * sizeof(uint));
+			WriteSection(header.materialOffset, materials.Data(), uint64(header.materialCount) * sizeof(Material));
+			WriteSection(header.meshletOffset, meshlets.Data(), uint64(header.meshletCount) * sizeof(Meshlet));
+
+			// Validate would reject a truncated cache anyway, there is no point keeping it
+			if (!file)
+			{
+				file.close();
+				remove(cachePath.c_str());
+			}
+		}
+	}
+}
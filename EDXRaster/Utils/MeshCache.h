@@ -0,0 +1,106 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Graphics/ObjMesh.h"
+#include "Graphics/Color.h"
+#include "Math/BoundingBox.h"
+#include "InputBuffer.h"
+#include "MeshOptimizer.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		class Mesh;
+
+		// Compiled form of an OBJ stored next to it as <obj>.rmesh. Sections are 64 byte aligned and the
+		// file is memory mapped read only, so vertex and index buffers point straight into the mapping.
+		// It holds the geometry after load time optimization, so neither parsing nor optimizing is repeated.
+		// The cache is only valid for the OBJ file and load transform it was built from.
+		class MeshCache
+		{
+		public:
+			static const uint SECTION_ALIGNMENT = 64;
+			static const uint MAX_TEXTURE_PATH = 260; // MAX_PATH on Windows, fixed so caches are portable
+
+			struct Header
+			{
+				uint magic;
+				uint version;
+				uint optimizerVersion;	// MeshOptimizer::VERSION of the stored geometry
+				uint meshletSize;		// sizeof(Meshlet), catches layout changes without a version bump
+				uint64 sourceSize;
+				int64 sourceTime;
+				Vector3 position, scale, rotation; // Baked into the vertices by the OBJ loader
+
+				uint vertexCount;
+				uint triangleCount;
+				uint textureIdCount;
+				uint materialCount;
+				uint meshletCount;
+				BoundingBox bounds;
+
+				uint64 vertexOffset;
+				uint64 indexOffset;
+				uint64 textureIdOffset;
+				uint64 materialOffset;
+				uint64 meshletOffset;
+			};
+
+			struct Material
+			{
+				char texturePath[MAX_TEXTURE_PATH]; // Empty for constant colored materials
+				Color color;
+			};
+
+		private:
+			const _byte* mpView;
+			size_t mSize;
+
+		public:
+			MeshCache()
+				: mpView(nullptr), mSize(0)
+			{
+			}
+			~MeshCache()
+			{
+				Close();
+			}
+
+			// False if there is no cache for this OBJ and transform, it is out of date or its contents are malformed
+			bool Open(const char* objPath, const Vector3& pos, const Vector3& scl, const Vector3& rot);
+			void Close();
+
+			// Failing to write the cache only costs parsing the OBJ again next time
+			static void Build(const char* objPath, const Vector3& pos, const Vector3& scl, const Vector3& rot, const ObjMesh& source, const Mesh& mesh);
+
+			const Header& GetHeader() const
+			{
+				return *(const Header*)mpView;
+			}
+			const Vertex_PositionNormalTex* GetVertices() const
+			{
+				return (const Vertex_PositionNormalTex*)(mpView + GetHeader().vertexOffset);
+			}
+			const uint* GetIndices() const
+			{
+				return (const uint*)(mpView + GetHeader().indexOffset);
+			}
+			const uint* GetTextureIds() const
+			{
+				return (const uint*)(mpView + GetHeader().textureIdOffset);
+			}
+			const Material* GetMaterials() const
+			{
+				return (const Material*)(mpView + GetHeader().materialOffset);
+			}
+			const Meshlet* GetMeshlets() const
+			{
+				return (const Meshlet*)(mpView + GetHeader().meshletOffset);
+			}
+
+		private:
+			bool Validate(const uint64 sourceSize, const int64 sourceTime, const Vector3& pos, const Vector3& scl, const Vector3& rot) const;
+		};
+	}
+}
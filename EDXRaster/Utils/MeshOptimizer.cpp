@@ -0,0 +1,355 @@
+#include "MeshOptimizer.h"
+
+#include <cmath>
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		namespace MeshOptimizer
+		{
+			namespace
+			{
+				// Modelled post transform cache, the clipper's per core vertex cache is of similar size
+				const int CACHE_SIZE = 32;
+				const uint INVALID = ~0u;
+
+				// Forsyth's scoring: recently used vertices and vertices with few triangles left go first
+				float VertexScore(const int cachePos, const uint liveTriangles)
+				{
+					if (liveTriangles == 0)
+						return -1.0f;
+
+					float score = 0.0f;
+					if (cachePos >= 0)
+						score = cachePos < 3 ? 0.75f : powf(1.0f - float(cachePos - 3) / float(CACHE_SIZE - 3), 1.5f);
+
+					return score + 2.0f * powf(float(liveTriangles), -0.5f);
+				}
+
+				// Triangles around each vertex, triangles of vertex v are in [offsets[v], offsets[v + 1])
+				void BuildAdjacency(const Array<uint>& indices, const uint vertexCount, Array<uint>& offsets, Array<uint>& triangles)
+				{
+					offsets.Resize(vertexCount + 1);
+					memset(offsets.Data(), 0, offsets.Size() * sizeof(uint));
+					for (auto i = 0; i < indices.Size(); i++)
+						offsets[indices[i] + 1]++;
+					for (uint v = 0; v < vertexCount; v++)
+						offsets[v + 1] += offsets[v];
+
+					Array<uint> cursor;
+					cursor.Resize(vertexCount);
+					memcpy(cursor.Data(), offsets.Data(), vertexCount * sizeof(uint));
+
+					triangles.Resize(indices.Size());
+					for (auto i = 0; i < indices.Size(); i++)
+						triangles[cursor[indices[i]]++] = i / 3;
+				}
+
+				void OptimizeVertexCache(const Array<uint>& indices, const uint vertexCount, Array<uint>& triangleOrder)
+				{
+					const uint triangleCount = indices.Size() / 3;
+
+					Array<uint> adjOffsets, adjTriangles;
+					BuildAdjacency(indices, vertexCount, adjOffsets, adjTriangles);
+
+					// Triangles still to be emitted are kept at the front of each vertex's adjacency
+					Array<uint> liveCount;
+					Array<int> cachePos;
+					Array<float> vertexScore;
+					liveCount.Resize(vertexCount);
+					cachePos.Resize(vertexCount);
+					vertexScore.Resize(vertexCount);
+					for (uint v = 0; v < vertexCount; v++)
+					{
+						liveCount[v] = adjOffsets[v + 1] - adjOffsets[v];
+						cachePos[v] = -1;
+						vertexScore[v] = VertexScore(-1, liveCount[v]);
+					}
+
+					Array<float> triangleScore;
+					Array<bool> emitted;
+					triangleScore.Resize(triangleCount);
+					emitted.Resize(triangleCount);
+					uint best = INVALID;
+					for (uint t = 0; t < triangleCount; t++)
+					{
+						triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+						emitted[t] = false;
+						if (best == INVALID || triangleScore[t] > triangleScore[best])
+							best = t;
+					}
+
+					uint cache[CACHE_SIZE + 3];
+					int cacheSize = 0;
+					uint scanCursor = 0;
+
+					triangleOrder.Clear();
+					triangleOrder.Reserve(triangleCount);
+					while (uint(triangleOrder.Size()) < triangleCount)
+					{
+						// Nothing in the cache has triangles left, continue with the next one in source order
+						if (best == INVALID)
+						{
+							while (emitted[scanCursor])
+								scanCursor++;
+							best = scanCursor;
+						}
+
+						emitted[best] = true;
+						triangleOrder.Add(best);
+						const uint* pTri = &indices[3 * best];
+
+						uint newCache[CACHE_SIZE + 3];
+						int newSize = 0;
+						for (auto k = 0; k < 3; k++)
+						{
+							const uint v = pTri[k];
+							uint* pAdj = &adjTriangles[adjOffsets[v]];
+							for (uint i = 0; i < liveCount[v]; i++)
+							{
+								if (pAdj[i] == best)
+								{
+									pAdj[i] = pAdj[liveCount[v] - 1];
+									liveCount[v]--;
+									break;
+								}
+							}
+
+							if (k == 0 || (v != pTri[0] && (k == 1 || v != pTri[1])))
+								newCache[newSize++] = v;
+						}
+						for (auto i = 0; i < cacheSize; i++)
+						{
+							if (cache[i] != pTri[0] && cache[i] != pTri[1] && cache[i] != pTri[2])
+								newCache[newSize++] = cache[i];
+						}
+
+						// Vertices past the cache size have just been evicted
+						for (auto i = 0; i < newSize; i++)
+						{
+							const uint v = newCache[i];
+							cachePos[v] = i < CACHE_SIZE ? i : -1;
+							vertexScore[v] = VertexScore(cachePos[v], liveCount[v]);
+						}
+
+						best = INVALID;
+						float bestScore = -1.0f;
+						for (auto i = 0; i < newSize; i++)
+						{
+							const uint v = newCache[i];
+							for (uint j = 0; j < liveCount[v]; j++)
+							{
+								const uint t = adjTriangles[adjOffsets[v] + j];
+								const float score = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+								triangleScore[t] = score;
+								if (score > bestScore)
+								{
+									bestScore = score;
+									best = t;
+								}
+							}
+						}
+
+						cacheSize = Math::Min(newSize, CACHE_SIZE);
+						memcpy(cache, newCache, cacheSize * sizeof(uint));
+					}
+				}
+
+				// Grows each meshlet from a seed over shared vertices, preferring triangles that add the fewest new
+				// vertices and, on ties, the earliest in cache order. Indices are expected in cache order.
+				void BuildMeshlets(const Array<uint>& indices, const uint vertexCount, Array<uint>& triangleOrder, Array<Meshlet>& meshlets)
+				{
+					const uint triangleCount = indices.Size() / 3;
+
+					Array<uint> adjOffsets, adjTriangles;
+					BuildAdjacency(indices, vertexCount, adjOffsets, adjTriangles);
+
+					Array<uint> vertexTag; // Last meshlet that used the vertex
+					vertexTag.Resize(vertexCount);
+					memset(vertexTag.Data(), 0xFF, vertexCount * sizeof(uint));
+
+					Array<bool> emitted;
+					emitted.Resize(triangleCount);
+					for (uint t = 0; t < triangleCount; t++)
+						emitted[t] = false;
+
+					Array<uint> candidates;
+					uint seedCursor = 0;
+
+					triangleOrder.Clear();
+					triangleOrder.Reserve(triangleCount);
+					meshlets.Clear();
+					while (uint(triangleOrder.Size()) < triangleCount)
+					{
+						while (emitted[seedCursor])
+							seedCursor++;
+
+						const uint meshletId = meshlets.Size();
+						Meshlet meshlet = {};
+						meshlet.triangleOffset = triangleOrder.Size();
+						meshlet.triangleCount = 0;
+						uint meshletVertexCount = 0;
+
+						candidates.Clear();
+						uint next = seedCursor;
+						while (next != INVALID)
+						{
+							emitted[next] = true;
+							triangleOrder.Add(next);
+							meshlet.triangleCount++;
+							for (auto k = 0; k < 3; k++)
+							{
+								const uint v = indices[3 * next + k];
+								if (vertexTag[v] == meshletId)
+									continue;
+
+								vertexTag[v] = meshletId;
+								meshletVertexCount++;
+								for (auto i = adjOffsets[v]; i < adjOffsets[v + 1]; i++)
+								{
+									if (!emitted[adjTriangles[i]])
+										candidates.Add(adjTriangles[i]);
+								}
+							}
+
+							if (meshlet.triangleCount == MAX_MESHLET_TRIANGLES)
+								break;
+
+							next = INVALID;
+							uint bestNewVertices = 4;
+							for (auto i = 0; i < candidates.Size();)
+							{
+								const uint t = candidates[i];
+								if (emitted[t])
+								{
+									candidates[i] = candidates[candidates.Size() - 1];
+									candidates.Resize(candidates.Size() - 1);
+									continue;
+								}
+								i++;
+
+								const uint* pTri = &indices[3 * t];
+								const uint newVertices = (vertexTag[pTri[0]] != meshletId) +
+									(vertexTag[pTri[1]] != meshletId && pTri[1] != pTri[0]) +
+									(vertexTag[pTri[2]] != meshletId && pTri[2] != pTri[0] && pTri[2] != pTri[1]);
+								if (meshletVertexCount + newVertices > MAX_MESHLET_VERTICES)
+									continue;
+
+								if (newVertices < bestNewVertices || (newVertices == bestNewVertices && t < next))
+								{
+									bestNewVertices = newVertices;
+									next = t;
+								}
+							}
+						}
+
+						meshlets.Add(meshlet);
+					}
+				}
+
+				void ComputeMeshletBounds(const Array<Vertex_PositionNormalTex>& vertices, const Array<uint>& indices, Meshlet& meshlet)
+				{
+					const uint* pIndices = &indices[3 * meshlet.triangleOffset];
+					const uint indexCount = 3 * meshlet.triangleCount;
+
+					meshlet.bounds.mMin = meshlet.bounds.mMax = vertices[pIndices[0]].Position;
+					for (uint i = 1; i < indexCount; i++)
+					{
+						const Vector3& pos = vertices[pIndices[i]].Position;
+						meshlet.bounds.mMin = Vector3(Math::Min(meshlet.bounds.mMin.x, pos.x), Math::Min(meshlet.bounds.mMin.y, pos.y), Math::Min(meshlet.bounds.mMin.z, pos.z));
+						meshlet.bounds.mMax = Vector3(Math::Max(meshlet.bounds.mMax.x, pos.x), Math::Max(meshlet.bounds.mMax.y, pos.y), Math::Max(meshlet.bounds.mMax.z, pos.z));
+					}
+
+					meshlet.center = 0.5f * (meshlet.bounds.mMin + meshlet.bounds.mMax);
+					meshlet.radius = 0.0f;
+					for (uint i = 0; i < indexCount; i++)
+						meshlet.radius = Math::Max(meshlet.radius, Math::Length(vertices[pIndices[i]].Position - meshlet.center));
+
+					// Degenerate triangles never reach the rasterizer and take no part in the cone
+					Vector3 normals[MAX_MESHLET_TRIANGLES];
+					uint normalCount = 0;
+					Vector3 normalSum = Vector3::ZERO;
+					for (uint t = 0; t < meshlet.triangleCount; t++)
+					{
+						const Vector3& p0 = vertices[pIndices[3 * t]].Position;
+						const Vector3 normal = Math::Cross(vertices[pIndices[3 * t + 1]].Position - p0, vertices[pIndices[3 * t + 2]].Position - p0);
+						const float length = Math::Length(normal);
+						if (length <= 0.0f)
+							continue;
+
+						normals[normalCount] = normal / length;
+						normalSum += normals[normalCount];
+						normalCount++;
+					}
+
+					meshlet.coneAxis = Vector3::ZERO;
+					meshlet.coneCutoff = 2.0f;
+					const float sumLength = Math::Length(normalSum);
+					if (sumLength <= 0.0f)
+						return;
+
+					meshlet.coneAxis = normalSum / sumLength;
+					float minDot = 1.0f;
+					for (uint i = 0; i < normalCount; i++)
+						minDot = Math::Min(minDot, Math::Dot(normals[i], meshlet.coneAxis));
+
+					// Cones close to a half space would hardly ever cull
+					if (minDot > 0.1f)
+						meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+				}
+			}
+
+			void Optimize(Array<Vertex_PositionNormalTex>& vertices,
+				Array<uint>& indices,
+				Array<uint>& texIds,
+				Array<Meshlet>& meshlets)
+			{
+				const uint triangleCount = indices.Size() / 3;
+				Assert(texIds.Size() >= triangleCount);
+				meshlets.Clear();
+				if (triangleCount == 0)
+					return;
+
+				Array<uint> cacheOrder;
+				OptimizeVertexCache(indices, vertices.Size(), cacheOrder);
+
+				Array<uint> cacheIndices;
+				cacheIndices.Resize(indices.Size());
+				for (uint i = 0; i < triangleCount; i++)
+					memcpy(&cacheIndices[3 * i], &indices[3 * cacheOrder[i]], 3 * sizeof(uint));
+
+				Array<uint> meshletOrder;
+				BuildMeshlets(cacheIndices, vertices.Size(), meshletOrder, meshlets);
+
+				Array<uint> sourceTexIds = texIds;
+				for (uint i = 0; i < triangleCount; i++)
+				{
+					memcpy(&indices[3 * i], &cacheIndices[3 * meshletOrder[i]], 3 * sizeof(uint));
+					texIds[i] = sourceTexIds[cacheOrder[meshletOrder[i]]];
+				}
+
+				// Vertices in order of first use, so vertex processing and the clipper stream through them
+				Array<uint> remap;
+				remap.Resize(vertices.Size());
+				memset(remap.Data(), 0xFF, remap.Size() * sizeof(uint));
+
+				Array<Vertex_PositionNormalTex> sourceVertices = vertices;
+				vertices.Clear();
+				for (auto i = 0; i < indices.Size(); i++)
+				{
+					uint& newIdx = remap[indices[i]];
+					if (newIdx == INVALID)
+					{
+						newIdx = vertices.Size();
+						vertices.Add(sourceVertices[indices[i]]);
+					}
+					indices[i] = newIdx;
+				}
+
+				for (auto& it : meshlets)
+					ComputeMeshletBounds(vertices, indices, it);
+			}
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "EDXPrerequisites.h"
+#include "Math/BoundingBox.h"
+#include "InputBuffer.h"
+
+namespace EDX
+{
+	namespace RasterRenderer
+	{
+		// Spatially coherent run of triangles, contiguous in the optimized index buffer
+		struct Meshlet
+		{
+			uint triangleOffset;
+			uint triangleCount;
+			BoundingBox bounds;
+
+			// Bounding sphere and cone of the winding normals, for culling clusters that entirely face away.
+			// coneCutoff is the sine of the cone's half angle, above 1 for clusters that never cull.
+			Vector3 center;
+			float radius;
+			Vector3 coneAxis;
+			float coneCutoff;
+		};
+
+		namespace MeshOptimizer
+		{
+			static const uint MAX_MESHLET_VERTICES = 64;
+			static const uint MAX_MESHLET_TRIANGLES = 124;
+			// Mesh caches store the output of Optimize and are keyed on this. Bump it with every change to the
+			// vertex, triangle or meshlet order Optimize produces, or to the Meshlet struct.
+			static const uint VERSION = 1;
+
+			// Reorders triangles for the post transform vertex cache, groups them into meshlets and
+			// renumbers vertices in order of first use. Texture ids follow their triangles, unreferenced
+			// vertices are dropped.
+			void Optimize(Array<Vertex_PositionNormalTex>& vertices,
+				Array<uint>& indices,
+				Array<uint>& texIds,
+				Array<Meshlet>& meshlets);
+		}
+	}
+}
@@ -36,6 +36,11 @@ void OnInit(Object* pSender, EventArgs args)
 
 	gpRenderer = new Renderer;
 	gpRenderer->Initialize(giWindowWidth, giWindowHeight);
+	char frameDirectory[MAX_PATH];
+	sprintf_s(frameDirectory, MAX_PATH, "%s/Frames", Application::GetBaseDirectory());
+	gpRenderer->SetFrameDirectory(frameDirectory);
+	// Shows the previous frame while this one renders
+	gpRenderer->SetAsyncPipelining(true);
 	gCamera.Init(-5.0f * Vector3::UNIT_Z, Vector3::ZERO, Vector3::UNIT_Y, giWindowWidth, giWindowHeight, 65, 0.01f);
 
 	//gMesh.LoadPlane(Vector3::ZERO, Vector3(1, 1, 1), Vector3(-90.0f, 0.0f, 0.0f), 1.2f);
@@ -85,6 +90,7 @@ void OnRender(Object* pSender, EventArgs args)
 
 		EDXGui::CheckBox("Hierarchical Rasterize", gHRas);
 		EDXGui::CheckBox("Record Frames", gRecord);
+		gpRenderer->SetWriteFrames(gRecord);
 
 		ComboBoxItem AAItems[] = {
 				{ 0, "off" },
@@ -0,0 +1,68 @@
+#include "ShaderCompiler/HLSLLexer.h"
+#include "ShaderCompiler/HLSLParser.h"
+#include "ShaderCompiler/ShaderCodeGen.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace EDX;
+using namespace EDX::ShaderCompiler;
+
+// Build step compiling an HLSL pixel shader into a C++ header, see ShaderCodeGen.
+//
+// Usage: ShaderCodeGen input.hlsl entryPoint ClassName output.h
+
+int main(int argc, char* argv[])
+{
+	if (argc != 5)
+	{
+		printf("Usage: ShaderCodeGen input.hlsl entryPoint ClassName output.h\n");
+		return 1;
+	}
+
+	const char* inputPath = argv[1];
+	std::ifstream input(inputPath);
+	if (!input)
+	{
+		printf("%s: error: cannot open file\n", inputPath);
+		return 1;
+	}
+
+	std::stringstream source;
+	source << input.rdbuf();
+
+	Array<CompileError> errorList;
+	HLSLLexer lexer;
+	const Array<HLSLToken> tokens = lexer.Tokenize(inputPath, source.str(), errorList);
+
+	ShaderProgram program;
+	HLSLParser parser;
+	if (errorList.Size() == 0)
+		parser.Parse(tokens, argv[2], program, errorList);
+
+	if (errorList.Size() > 0)
+	{
+		for (auto& it : errorList)
+			printf("%s(%i,%i): error: %s\n", it.SrcInfo.FileName.c_str(), it.SrcInfo.Line, it.SrcInfo.Column, it.ErrorMsg.c_str());
+
+		return 1;
+	}
+
+	// Only the file name goes into the header, so it does not depend on the checkout location
+	std::string sourceName = inputPath;
+	const size_t slash = sourceName.find_last_of("/\\");
+	if (slash != std::string::npos)
+		sourceName = sourceName.substr(slash + 1);
+
+	const string code = ShaderCodeGen::EmitPixelShader(program, argv[3], sourceName.c_str(), source.str());
+	std::ofstream output(argv[4], std::ios::binary);
+	output << code;
+	if (!output)
+	{
+		printf("%s: error: cannot write file\n", argv[4]);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+// Same shading as LambertianAlbedoPixelShader: clamped diffuse plus a constant ambient term,
+// scaled by 3 / pi and the albedo texture
+
+Texture2D Albedo;
+SamplerState AlbedoSampler;
+
+float3 main(float3 normal : NORMAL, float2 texCoord : TEXCOORD) : SV_Target
+{
+	float3 n = normalize(normal);
+	float diffuseAmount = max(dot(normalize(LightDirection), n), 0.0);
+	float diffuse = (diffuseAmount + 0.2) * 3.0 * 0.318309886;
+
+	return diffuse * Albedo.Sample(AlbedoSampler, texCoord).rgb;
+}
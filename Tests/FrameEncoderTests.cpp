@@ -0,0 +1,167 @@
+#include "Core/FrameEncoder.h"
+#include "Utils/ImageIO.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace EDX;
+using namespace EDX::RasterRenderer;
+
+// Round trips of the frame writers through the image decoders. Returns the number of failed checks.
+
+namespace
+{
+	int gFailures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s(%i): check failed: %s\n", __FILE__, __LINE__, #condition); \
+			gFailures++; \
+		} \
+	} while (false)
+
+	// Opaque, the image formats written drop alpha
+	uint TestPixel(const uint x, const uint y, const int frameId)
+	{
+		return ((x * 7 + frameId) & 0xFF) | (((y * 13) & 0xFF) << 8) | (((x ^ y) & 0xFF) << 16) | 0xFF000000;
+	}
+
+	void MakeFrame(Array<uint>& pixels, const uint width, const uint height, const int frameId)
+	{
+		pixels.Resize(width * height);
+		for (uint y = 0; y < height; y++)
+		{
+			for (uint x = 0; x < width; x++)
+				pixels[y * width + x] = TestPixel(x, y, frameId);
+		}
+	}
+
+	bool ReadFile(const char* path, Array<_byte>& data)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+
+		data.Resize(int(file.tellg()));
+		file.seekg(0);
+		file.read((char*)data.Data(), data.Size());
+		return bool(file);
+	}
+
+	// Frames are written to the working directory and decoded back
+	void TestImageSequence(const FrameFormat format, const char* fileName)
+	{
+		// Over 64 KB of scanlines, so the PNG needs more than one stored block
+		const uint width = 200, height = 120;
+		const int frameId = 7;
+		Array<uint> pixels;
+		MakeFrame(pixels, width, height, frameId);
+
+		FrameOutputSettings settings;
+		settings.format = format;
+		settings.path = ".";
+
+		FrameEncoder encoder;
+		CHECK(encoder.Open(settings));
+		encoder.Submit((const _byte*)pixels.Data(), width, height, frameId);
+		encoder.Close();
+
+		const FrameOutputStats stats = encoder.GetStats();
+		CHECK(stats.framesWritten == 1 && stats.writeErrors == 0);
+
+		Array<_byte> data;
+		CHECK(ReadFile(fileName, data));
+		remove(fileName);
+
+		Array<uint> texels;
+		int decodedWidth, decodedHeight;
+		CHECK(ImageIO::Decode(data.Data(), data.Size(), texels, decodedWidth, decodedHeight));
+		CHECK(decodedWidth == int(width) && decodedHeight == int(height));
+		CHECK(texels.Size() == pixels.Size() && memcmp(texels.Data(), pixels.Data(), pixels.Size() * sizeof(uint)) == 0);
+	}
+
+	void TestRawVideo()
+	{
+		const char* path = "FrameEncoderTests.rgba";
+		const uint width = 5, height = 3;
+
+		FrameOutputSettings settings;
+		settings.format = FrameFormat::RawVideo;
+		settings.path = path;
+
+		FrameEncoder encoder;
+		CHECK(encoder.Open(settings));
+		Array<uint> pixels;
+		for (auto frameId = 0; frameId < 2; frameId++)
+		{
+			MakeFrame(pixels, width, height, frameId);
+			encoder.Submit((const _byte*)pixels.Data(), width, height, frameId);
+		}
+
+		// Frames of another size do not fit the stream
+		encoder.Submit((const _byte*)pixels.Data(), width - 1, height, 2);
+		encoder.Close();
+
+		const FrameOutputStats stats = encoder.GetStats();
+		CHECK(stats.framesWritten == 2 && stats.writeErrors == 1);
+
+		Array<_byte> data;
+		CHECK(ReadFile(path, data));
+		remove(path);
+
+		// Rows are stored top down, frame after frame
+		CHECK(data.Size() == int(2 * width * height * sizeof(uint)));
+		if (data.Size() != int(2 * width * height * sizeof(uint)))
+			return;
+
+		const uint* pStream = (const uint*)data.Data();
+		bool matches = true;
+		for (auto frameId = 0; frameId < 2; frameId++)
+		{
+			for (uint y = 0; y < height; y++)
+			{
+				for (uint x = 0; x < width; x++)
+					matches &= pStream[(frameId * height + y) * width + x] == TestPixel(x, height - 1 - y, frameId);
+			}
+		}
+		CHECK(matches);
+	}
+
+	// Failures of the output count as write errors rather than written frames
+	void TestWriteErrors()
+	{
+		FrameOutputSettings settings;
+		settings.format = FrameFormat::PNG;
+		settings.path = "FrameEncoderTests.missing/directory";
+
+		Array<uint> pixels;
+		MakeFrame(pixels, 4, 4, 0);
+
+		FrameEncoder encoder;
+		CHECK(encoder.Open(settings));
+		encoder.Submit((const _byte*)pixels.Data(), 4, 4, 0);
+		encoder.Close();
+
+		const FrameOutputStats stats = encoder.GetStats();
+		CHECK(stats.framesWritten == 0 && stats.writeErrors == 1);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	TestImageSequence(FrameFormat::PNG, "./Frame00007.png");
+	TestImageSequence(FrameFormat::Bitmap, "./Frame00007.bmp");
+	TestRawVideo();
+	TestWriteErrors();
+
+	if (gFailures > 0)
+		printf("%i checks failed\n", gFailures);
+	else
+		printf("All checks passed\n");
+
+	return gFailures;
+}
@@ -0,0 +1,408 @@
+#include "Utils/ImageIO.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+using namespace EDX;
+using namespace EDX::RasterRenderer;
+
+// Tests of the BMP, TGA and PNG decoders used off Windows, including malformed and truncated files.
+// Returns the number of failed checks.
+
+namespace
+{
+	int gFailures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s(%i): check failed: %s\n", __FILE__, __LINE__, #condition); \
+			gFailures++; \
+		} \
+	} while (false)
+
+	// Grey levels of the filtered PNG images below, row 0 is the top row of the file
+	uint GreyLevel(const int x, const int y)
+	{
+		return ((x * x + 3 * x * y + 7 * y) % 23) * 11;
+	}
+
+	// zlib stream of an 8x8 grey image, row y uses filter y % 5, fixed Huffman codes
+	const _byte FIXED_STREAM[] = {
+		0x78, 0xDA, 0x63, 0x60, 0xE0, 0xD6, 0x49, 0xDE, 0x20, 0xD6, 0xAF, 0xC8, 0xE8, 0xAB, 0xE3, 0x14,
+		0x9D, 0xD7, 0x3E, 0x6B, 0x33, 0x93, 0x6F, 0xDE, 0xA4, 0x0D, 0x57, 0xBE, 0x8A, 0x99, 0x33, 0xCF,
+		0x2A, 0xEC, 0x5A, 0x71, 0xE4, 0xCE, 0x6F, 0x31, 0x96, 0x80, 0xFE, 0x49, 0xFB, 0x80, 0x22, 0x92,
+		0x0C, 0x2D, 0xE6, 0x0C, 0x77, 0x2E, 0xDE, 0x61, 0x30, 0x67, 0xBC, 0x78, 0xE5, 0x15, 0x83, 0x98,
+		0x8E, 0x6B, 0x04, 0x53, 0x40, 0xE1, 0xA4, 0xCD, 0x20, 0xC5, 0x00, 0xF6, 0x83, 0x1D, 0xA3 };
+
+	// Same pattern at 16x16, dynamic Huffman codes
+	const _byte DYNAMIC_STREAM[] = {
+		0x78, 0xDA, 0x3D, 0xCE, 0x31, 0x64, 0xC4, 0x50, 0x1C, 0xC7, 0xF1, 0x7F, 0x72, 0x91, 0x25, 0x94,
+		0x2E, 0x8F, 0x8E, 0x8F, 0x1B, 0x1F, 0xE5, 0x96, 0xC7, 0xD1, 0xE5, 0x71, 0x74, 0x79, 0x64, 0x7C,
+		0x84, 0x5B, 0x42, 0x29, 0xF5, 0x08, 0x5D, 0x1E, 0x37, 0x86, 0xA3, 0x4B, 0xC8, 0x54, 0x8F, 0x70,
+		0x54, 0x38, 0xBA, 0x84, 0x8C, 0x47, 0xA6, 0x0A, 0x99, 0xCE, 0xE3, 0xA6, 0x0A, 0x99, 0xEA, 0xB8,
+		0x31, 0x64, 0xEA, 0xD2, 0xA4, 0xA5, 0xFB, 0xD7, 0xE7, 0xF7, 0x03, 0xF0, 0x48, 0x58, 0xA0, 0x04,
+		0xD7, 0xB1, 0x60, 0x4C, 0xC4, 0xB5, 0xC5, 0x09, 0x0B, 0xE4, 0x56, 0x97, 0x4D, 0xD7, 0x5F, 0x61,
+		0xCA, 0x1F, 0x6C, 0x2E, 0xD3, 0xE2, 0x34, 0x20, 0x2A, 0x54, 0x76, 0xE8, 0x00, 0xB3, 0x99, 0x8E,
+		0x5E, 0xF6, 0x1F, 0xED, 0x37, 0x5A, 0xF0, 0x27, 0x77, 0x57, 0x89, 0xC1, 0xF1, 0x93, 0xB4, 0x1A,
+		0x8B, 0x1B, 0xC2, 0x74, 0xC4, 0x60, 0x5E, 0x43, 0x4C, 0xA1, 0x35, 0x2D, 0xD0, 0xF8, 0x1C, 0xF6,
+		0x5A, 0x10, 0x64, 0x99, 0xD3, 0x05, 0x10, 0x59, 0x09, 0xB9, 0xCD, 0x8A, 0xA6, 0x1B, 0x3C, 0xDB,
+		0x8F, 0xD2, 0x72, 0x42, 0x03, 0xA5, 0xAB, 0x5F, 0x74, 0xCD, 0xD6, 0xEA, 0x75, 0x71, 0x7C, 0x74,
+		0xDF, 0xAA, 0xCF, 0xE1, 0x9A, 0xDC, 0x3B, 0x9C, 0xFA, 0xC3, 0x58, 0x2C, 0x0D, 0x03, 0x74, 0x8B,
+		0xF1, 0x0A, 0xBC, 0xD0, 0x88, 0x3E, 0x97, 0x9C, 0x71, 0x99, 0xF7, 0xC2, 0x84, 0x96, 0x50, 0xE9,
+		0xFE, 0xF0, 0x0F, 0xEB, 0xD2, 0xE6, 0x51, 0xF2, 0xF7, 0x74, 0x33, 0xA1, 0x73, 0x36, 0xDB, 0xA1,
+		0xF2, 0x78, 0x71, 0xF1, 0x5D, 0xF0, 0x9C, 0xBE, 0x37, 0x5F, 0x90, 0x39, 0xFE, 0xB8, 0x8D, 0x29,
+		0x5A, 0xAA, 0x4D, 0x3E, 0xCD, 0x22, 0x48, 0x92, 0xDC, 0x20, 0xD9, 0x86, 0x50, 0x28, 0xC1, 0x85,
+		0x2A, 0x7E, 0x00, 0xE6, 0x7D, 0x75, 0x16 };
+
+	uint Pack(const uint r, const uint g, const uint b, const uint a)
+	{
+		return r | (g << 8) | (b << 16) | (a << 24);
+	}
+
+	void Append(Array<_byte>& data, const _byte* pBytes, const int count)
+	{
+		for (auto i = 0; i < count; i++)
+			data.Add(pBytes[i]);
+	}
+
+	void Append32BE(Array<_byte>& data, const uint value)
+	{
+		const _byte bytes[4] = { _byte(value >> 24), _byte(value >> 16), _byte(value >> 8), _byte(value) };
+		Append(data, bytes, 4);
+	}
+
+	// CRCs are left zero, the decoder does not check them
+	void AppendChunk(Array<_byte>& data, const char* type, const _byte* pChunk, const int length)
+	{
+		Append32BE(data, length);
+		Append(data, (const _byte*)type, 4);
+		Append(data, pChunk, length);
+		Append32BE(data, 0);
+	}
+
+	Array<_byte> MakePNG(const uint width, const uint height, const _byte bitDepth, const _byte colorType,
+		const _byte* pStream, const int streamSize)
+	{
+		static const _byte SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		Array<_byte> data;
+		Append(data, SIGNATURE, 8);
+
+		_byte header[13] = {};
+		for (auto i = 0; i < 4; i++)
+		{
+			header[i] = _byte(width >> (24 - 8 * i));
+			header[4 + i] = _byte(height >> (24 - 8 * i));
+		}
+		header[8] = bitDepth;
+		header[9] = colorType;
+		AppendChunk(data, "IHDR", header, 13);
+		AppendChunk(data, "IDAT", pStream, streamSize);
+		AppendChunk(data, "IEND", nullptr, 0);
+
+		return data;
+	}
+
+	// zlib stream holding the data in a single stored block, the Adler-32 is not checked either
+	Array<_byte> MakeStoredStream(const _byte* pRaw, const int size)
+	{
+		const _byte header[7] = { 0x78, 0x01, 0x01, _byte(size), _byte(size >> 8), _byte(~size), _byte(~size >> 8) };
+		Array<_byte> stream;
+		Append(stream, header, 7);
+		Append(stream, pRaw, size);
+		Append32BE(stream, 0);
+
+		return stream;
+	}
+
+	bool Decode(const Array<_byte>& data, Array<uint>& texels, int& width, int& height)
+	{
+		return ImageIO::Decode(data.Data(), data.Size(), texels, width, height);
+	}
+
+	bool DecodeFails(const Array<_byte>& data)
+	{
+		Array<uint> texels;
+		int width, height;
+		return !Decode(data, texels, width, height) && texels.Size() == 0;
+	}
+
+	bool MatchesGreyLevels(const Array<uint>& texels, const int size)
+	{
+		if (texels.Size() != size * size)
+			return false;
+
+		// Texels are bottom up
+		for (auto y = 0; y < size; y++)
+		{
+			for (auto x = 0; x < size; x++)
+			{
+				const uint grey = GreyLevel(x, size - 1 - y);
+				if (texels[y * size + x] != Pack(grey, grey, grey, 255))
+					return false;
+			}
+		}
+
+		return true;
+	}
+
+	void TestBMP()
+	{
+		const char* path = "ImageIOTests.bmp";
+		const uint pixels[6] = {
+			Pack(255, 0, 0, 255), Pack(0, 255, 0, 255), Pack(0, 0, 255, 255),
+			Pack(10, 20, 30, 255), Pack(40, 50, 60, 255), Pack(70, 80, 90, 255) };
+		CHECK(ImageIO::WriteBMP(path, (const _byte*)pixels, 3, 2));
+
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		CHECK(bool(file));
+		Array<_byte> data;
+		data.Resize(int(file.tellg()));
+		file.seekg(0);
+		file.read((char*)data.Data(), data.Size());
+		file.close();
+		remove(path);
+
+		// Three pixels of 24 bits are padded to 12 bytes a row
+		CHECK(data.Size() == 54 + 2 * 12);
+
+		Array<uint> texels;
+		int width, height;
+		CHECK(Decode(data, texels, width, height));
+		CHECK(width == 3 && height == 2);
+		CHECK(texels.Size() == 6 && memcmp(texels.Data(), pixels, sizeof(pixels)) == 0);
+
+		for (auto size = 0; size < data.Size(); size++)
+		{
+			Array<_byte> truncated;
+			Append(truncated, data.Data(), size);
+			// Cuts shorter than the BM signature go to the TGA decoder, which rejects them as well
+			CHECK(DecodeFails(truncated));
+		}
+
+		// Pixel data past the end of the file
+		Array<_byte> corrupt = data;
+		corrupt[10] = 0xFF;
+		CHECK(DecodeFails(corrupt));
+
+		// Negative width
+		corrupt = data;
+		corrupt[21] = 0x80;
+		CHECK(DecodeFails(corrupt));
+
+		// Run length compression is not supported
+		corrupt = data;
+		corrupt[30] = 1;
+		CHECK(DecodeFails(corrupt));
+
+		// Core header, the info header fields would be read from pixel data
+		corrupt = data;
+		corrupt[14] = 12;
+		CHECK(DecodeFails(corrupt));
+	}
+
+	void TestTGA()
+	{
+		// 2x2 run length encoded 32 bit, stored top down: one run of two red, then two raw pixels
+		const _byte file[] = {
+			0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 2, 0, 32, 0x20,
+			0x81, 0, 0, 255, 128,
+			0x01, 255, 0, 0, 255, 0, 255, 0, 64 };
+
+		Array<_byte> data;
+		Append(data, file, sizeof(file));
+
+		Array<uint> texels;
+		int width, height;
+		CHECK(Decode(data, texels, width, height));
+		CHECK(width == 2 && height == 2);
+		CHECK(texels.Size() == 4);
+		if (texels.Size() == 4)
+		{
+			CHECK(texels[0] == Pack(0, 0, 255, 255));
+			CHECK(texels[1] == Pack(0, 255, 0, 64));
+			CHECK(texels[2] == Pack(255, 0, 0, 128));
+			CHECK(texels[3] == Pack(255, 0, 0, 128));
+		}
+
+		for (auto size = 0; size < data.Size(); size++)
+		{
+			Array<_byte> truncated;
+			Append(truncated, data.Data(), size);
+			CHECK(DecodeFails(truncated));
+		}
+
+		// Run longer than the image
+		Array<_byte> corrupt = data;
+		corrupt[18] = 0x84;
+		CHECK(DecodeFails(corrupt));
+
+		// Color mapped images are not supported
+		corrupt = data;
+		corrupt[1] = 1;
+		CHECK(DecodeFails(corrupt));
+
+		// Zero height
+		corrupt = data;
+		corrupt[14] = 0;
+		CHECK(DecodeFails(corrupt));
+	}
+
+	void TestPNG()
+	{
+		// 2x2 RGB in a stored block, the second row uses the sub filter
+		const _byte raw[] = {
+			0, 255, 0, 0, 0, 255, 0,
+			1, 0, 0, 255, 255, 255, 0 };
+		const Array<_byte> stored = MakeStoredStream(raw, sizeof(raw));
+
+		Array<uint> texels;
+		int width, height;
+		CHECK(Decode(MakePNG(2, 2, 8, 2, stored.Data(), stored.Size()), texels, width, height));
+		CHECK(width == 2 && height == 2);
+		CHECK(texels.Size() == 4);
+		if (texels.Size() == 4)
+		{
+			CHECK(texels[0] == Pack(0, 0, 255, 255));
+			CHECK(texels[1] == Pack(255, 255, 255, 255));
+			CHECK(texels[2] == Pack(255, 0, 0, 255));
+			CHECK(texels[3] == Pack(0, 255, 0, 255));
+		}
+
+		CHECK(Decode(MakePNG(8, 8, 8, 0, FIXED_STREAM, sizeof(FIXED_STREAM)), texels, width, height));
+		CHECK(width == 8 && height == 8 && MatchesGreyLevels(texels, 8));
+
+		CHECK(Decode(MakePNG(16, 16, 8, 0, DYNAMIC_STREAM, sizeof(DYNAMIC_STREAM)), texels, width, height));
+		CHECK(width == 16 && height == 16 && MatchesGreyLevels(texels, 16));
+
+		// Palette images need their PLTE chunk
+		CHECK(DecodeFails(MakePNG(2, 2, 8, 3, stored.Data(), stored.Size())));
+		// Interlaced files are not supported
+		Array<_byte> corrupt = MakePNG(2, 2, 8, 2, stored.Data(), stored.Size());
+		corrupt[8 + 8 + 12] = 1;
+		CHECK(DecodeFails(corrupt));
+		// Bit depth not allowed for RGB
+		CHECK(DecodeFails(MakePNG(2, 2, 4, 2, stored.Data(), stored.Size())));
+		// Dimensions past the texel limit
+		CHECK(DecodeFails(MakePNG(65536, 65536, 8, 2, stored.Data(), stored.Size())));
+		// Stream shorter than the image
+		CHECK(DecodeFails(MakePNG(2, 3, 8, 2, stored.Data(), stored.Size())));
+		// Stream longer than the image
+		CHECK(DecodeFails(MakePNG(2, 1, 8, 2, stored.Data(), stored.Size())));
+
+		// Unknown filter type
+		_byte badFilter[sizeof(raw)];
+		memcpy(badFilter, raw, sizeof(raw));
+		badFilter[7] = 5;
+		const Array<_byte> badFilterStream = MakeStoredStream(badFilter, sizeof(badFilter));
+		CHECK(DecodeFails(MakePNG(2, 2, 8, 2, badFilterStream.Data(), badFilterStream.Size())));
+
+		// Missing IEND and every other cut through the chunks
+		const Array<_byte> data = MakePNG(2, 2, 8, 2, stored.Data(), stored.Size());
+		for (auto size = 0; size < data.Size(); size++)
+		{
+			Array<_byte> truncated;
+			Append(truncated, data.Data(), size);
+			CHECK(DecodeFails(truncated));
+		}
+	}
+
+	void TestInflateMalformed()
+	{
+		// Streams cut anywhere before their Adler-32 lack bits of the last block. Cuts go into a
+		// complete PNG so only the zlib stream is short.
+		const _byte* streams[2] = { FIXED_STREAM, DYNAMIC_STREAM };
+		const int streamSizes[2] = { sizeof(FIXED_STREAM), sizeof(DYNAMIC_STREAM) };
+		const uint imageSizes[2] = { 8, 16 };
+		for (auto s = 0; s < 2; s++)
+		{
+			for (auto size = 0; size < streamSizes[s] - 4; size++)
+				CHECK(DecodeFails(MakePNG(imageSizes[s], imageSizes[s], 8, 0, streams[s], size)));
+		}
+
+		// Corrupt streams must fail or decode, but never read or write out of bounds
+		for (auto s = 0; s < 2; s++)
+		{
+			Array<_byte> stream;
+			Append(stream, streams[s], streamSizes[s]);
+			for (auto i = 2; i < streamSizes[s]; i++)
+			{
+				for (auto bit = 0; bit < 8; bit++)
+				{
+					stream[i] ^= _byte(1 << bit);
+					Array<uint> texels;
+					int width, height;
+					if (!Decode(MakePNG(imageSizes[s], imageSizes[s], 8, 0, stream.Data(), stream.Size()), texels, width, height))
+						CHECK(texels.Size() == 0);
+					stream[i] ^= _byte(1 << bit);
+				}
+			}
+		}
+
+		_byte raw[] = { 0, 1, 2, 3 };
+		Array<_byte> stream = MakeStoredStream(raw, sizeof(raw));
+
+		// Compression method other than deflate
+		stream[0] = 0x79;
+		CHECK(DecodeFails(MakePNG(1, 1, 8, 2, stream.Data(), stream.Size())));
+		// Header check bits wrong
+		stream[0] = 0x78;
+		stream[1] = 0x02;
+		CHECK(DecodeFails(MakePNG(1, 1, 8, 2, stream.Data(), stream.Size())));
+		// Stored length not matching its complement
+		stream[1] = 0x01;
+		stream[5] = 0;
+		CHECK(DecodeFails(MakePNG(1, 1, 8, 2, stream.Data(), stream.Size())));
+		// Reserved block type
+		stream[5] = _byte(~4);
+		stream[2] = 0x07;
+		CHECK(DecodeFails(MakePNG(1, 1, 8, 2, stream.Data(), stream.Size())));
+
+		stream[2] = 0x01;
+		CHECK(!DecodeFails(MakePNG(1, 1, 8, 2, stream.Data(), stream.Size())));
+	}
+
+	// The fixed Huffman tables are shared by every decoder
+	void TestConcurrentDecode()
+	{
+		const Array<_byte> data = MakePNG(8, 8, 8, 0, FIXED_STREAM, sizeof(FIXED_STREAM));
+		bool results[8];
+		std::thread threads[8];
+		for (auto i = 0; i < 8; i++)
+		{
+			threads[i] = std::thread([&data, &results, i]()
+			{
+				Array<uint> texels;
+				int width, height;
+				results[i] = Decode(data, texels, width, height) && MatchesGreyLevels(texels, 8);
+			});
+		}
+
+		for (auto i = 0; i < 8; i++)
+		{
+			threads[i].join();
+			CHECK(results[i]);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	// Runs first so the threads race on the first use of the fixed Huffman tables
+	TestConcurrentDecode();
+	TestBMP();
+	TestTGA();
+	TestPNG();
+	TestInflateMalformed();
+
+	if (gFailures > 0)
+		printf("%i checks failed\n", gFailures);
+	else
+		printf("All checks passed\n");
+
+	return gFailures;
+}
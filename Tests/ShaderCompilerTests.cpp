@@ -0,0 +1,280 @@
+#include "ShaderCompiler/HLSLLexer.h"
+#include "ShaderCompiler/HLSLParser.h"
+#include "Core/CompiledPixelShader.h"
+#include "Core/RasterTexture.h"
+#include "Core/RenderStates.h"
+#include "LambertianShader.h"
+
+#include <cstdio>
+
+using namespace EDX;
+using namespace EDX::ShaderCompiler;
+using namespace EDX::RasterRenderer;
+
+// Tests of the HLSL front end, the IR passes and the shaders compiled from Shaders/Lambertian.hlsl.
+// Returns the number of failed checks.
+
+namespace
+{
+	int gFailures = 0;
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("%s(%i): check failed: %s\n", __FILE__, __LINE__, #condition); \
+			gFailures++; \
+		} \
+	} while (false)
+
+	Array<HLSLToken> Tokenize(const char* source, Array<CompileError>& errorList)
+	{
+		HLSLLexer lexer;
+		return lexer.Tokenize("Test.hlsl", source, errorList);
+	}
+
+	bool Parse(const char* source, ShaderProgram& program, Array<CompileError>& errorList)
+	{
+		const Array<HLSLToken> tokens = Tokenize(source, errorList);
+		if (errorList.Size() > 0)
+			return false;
+
+		HLSLParser parser;
+		return parser.Parse(tokens, "main", program, errorList);
+	}
+
+	int AddConstant(ShaderProgram& program, const float value)
+	{
+		IRInstruction instr(IROp::Constant, 1);
+		instr.constant[0] = value;
+		return program.Add(instr);
+	}
+
+	int AddInput(ShaderProgram& program, const IRInput input, const int width)
+	{
+		IRInstruction instr(IROp::Input, width);
+		instr.slot = int(input);
+		return program.Add(instr);
+	}
+
+	int AddBinary(ShaderProgram& program, const IROp op, const int width, const int arg0, const int arg1)
+	{
+		IRInstruction instr(op, width);
+		instr.argCount = 2;
+		instr.args[0] = arg0;
+		instr.args[1] = arg1;
+		return program.Add(instr);
+	}
+
+	bool NearlyEqual(const Vec3f_SSE& lhs, const Vec3f_SSE& rhs, const float tolerance)
+	{
+		for (auto i = 0; i < 4; i++)
+		{
+			if (Math::Abs(lhs.x[i] - rhs.x[i]) > tolerance ||
+				Math::Abs(lhs.y[i] - rhs.y[i]) > tolerance ||
+				Math::Abs(lhs.z[i] - rhs.z[i]) > tolerance)
+				return false;
+		}
+
+		return true;
+	}
+
+	void TestLexer()
+	{
+		Array<CompileError> errorList;
+		const Array<HLSLToken> tokens = Tokenize("// Comment\nfloat3 n = normal * 2.5; /* block\n comment */ return n;", errorList);
+		CHECK(errorList.Size() == 0);
+
+		const HLSLTokenType expected[] = {
+			HLSLTokenType::Float3, HLSLTokenType::Identifier, HLSLTokenType::Equal, HLSLTokenType::Identifier,
+			HLSLTokenType::Times, HLSLTokenType::FloatConstant, HLSLTokenType::Semicolon,
+			HLSLTokenType::Return, HLSLTokenType::Identifier, HLSLTokenType::Semicolon
+		};
+		const int expectedCount = sizeof(expected) / sizeof(expected[0]);
+		CHECK(tokens.Size() == expectedCount);
+		for (auto i = 0; i < Math::Min(int(tokens.Size()), expectedCount); i++)
+			CHECK(tokens[i].Type == expected[i]);
+
+		if (tokens.Size() == expectedCount)
+		{
+			CHECK(tokens[1].Literal == "n");
+			CHECK(tokens[5].Literal == "2.5");
+			CHECK(tokens[0].SrcInfo.Line == 2 && tokens[0].SrcInfo.Column == 1);
+			CHECK(tokens[7].SrcInfo.Line == 3 && tokens[7].SrcInfo.Column == 13);
+		}
+
+		errorList.Clear();
+		Tokenize("float x = 1.0 @ 2.0;", errorList);
+		CHECK(errorList.Size() == 1);
+		if (errorList.Size() == 1)
+			CHECK(errorList[0].SrcInfo.Line == 1 && errorList[0].SrcInfo.Column == 15);
+	}
+
+	void TestParser()
+	{
+		Array<CompileError> errorList;
+		ShaderProgram program;
+		CHECK(Parse("float3 main(float3 normal : NORMAL) : SV_Target\n"
+			"{\n"
+			"	float3 n = normalize(normal);\n"
+			"	return n * 0.5 + 0.5;\n"
+			"}\n", program, errorList));
+		CHECK(errorList.Size() == 0);
+		CHECK(program.result >= 0 && program.result < program.instructions.Size());
+		CHECK(program.registers.Size() == program.instructions.Size());
+
+		// The input is read once and normalized once, however often they appear in the source
+		int inputs = 0, normalizes = 0;
+		for (auto& it : program.instructions)
+		{
+			inputs += it.op == IROp::Input;
+			normalizes += it.op == IROp::Normalize;
+		}
+		CHECK(inputs == 1 && normalizes == 1);
+
+		errorList.Clear();
+		program = ShaderProgram();
+		CHECK(!Parse("float3 other() : SV_Target { return float3(1.0, 1.0, 1.0); }", program, errorList));
+		CHECK(errorList.Size() > 0);
+
+		errorList.Clear();
+		program = ShaderProgram();
+		CHECK(!Parse("float3 main(float3 normal : NORMAL) : SV_Target\n"
+			"{\n"
+			"	if (normal.x > 0.0) { return normal; }\n"
+			"	return normal;\n"
+			"}\n", program, errorList));
+		CHECK(errorList.Size() > 0);
+		if (errorList.Size() > 0)
+			CHECK(errorList[0].SrcInfo.Line == 3);
+	}
+
+	void TestFoldConstants()
+	{
+		// (1 + 2) * normal.x, then an identity swizzle of the product
+		ShaderProgram program;
+		const int one = AddConstant(program, 1.0f);
+		const int two = AddConstant(program, 2.0f);
+		const int sum = AddBinary(program, IROp::Add, 1, one, two);
+		const int normal = AddInput(program, IRInput::Normal, 3);
+
+		IRInstruction swizzleX(IROp::Swizzle, 1);
+		swizzleX.argCount = 1;
+		swizzleX.args[0] = normal;
+		swizzleX.components[0] = 0;
+		const int x = program.Add(swizzleX);
+
+		const int product = AddBinary(program, IROp::Mul, 1, sum, x);
+
+		IRInstruction identity(IROp::Swizzle, 1);
+		identity.argCount = 1;
+		identity.args[0] = product;
+		program.result = program.Add(identity);
+
+		program.FoldConstants();
+		CHECK(program.instructions[sum].op == IROp::Constant);
+		CHECK(program.instructions[sum].constant[0] == 3.0f);
+		CHECK(program.instructions[product].op == IROp::Mul);
+		CHECK(program.result == product);
+	}
+
+	void TestEliminateDeadCode()
+	{
+		ShaderProgram program;
+		const int normal = AddInput(program, IRInput::Normal, 3);
+		const int position = AddInput(program, IRInput::Position, 3);
+		AddBinary(program, IROp::Add, 3, position, position);
+		program.result = AddBinary(program, IROp::Mul, 3, normal, normal);
+
+		program.EliminateDeadCode();
+		CHECK(program.instructions.Size() == 2);
+		CHECK(program.result == 1);
+		CHECK(program.instructions[0].op == IROp::Input && program.instructions[0].slot == int(IRInput::Normal));
+		CHECK(program.instructions[1].op == IROp::Mul);
+		CHECK(program.instructions[1].args[0] == 0 && program.instructions[1].args[1] == 0);
+	}
+
+	void TestAllocateRegisters()
+	{
+		// A chain only ever needs two live values
+		ShaderProgram program;
+		int value = AddInput(program, IRInput::Normal, 3);
+		for (auto i = 0; i < 8; i++)
+			value = AddBinary(program, IROp::Mul, 3, value, value);
+		program.result = value;
+
+		program.AllocateRegisters();
+		CHECK(program.registers.Size() == program.instructions.Size());
+		CHECK(program.registerCount == 2);
+
+		for (auto i = 0; i < program.instructions.Size(); i++)
+		{
+			CHECK(program.registers[i] >= 0 && program.registers[i] < program.registerCount);
+			for (auto j = 0; j < program.instructions[i].argCount; j++)
+				CHECK(program.registers[i] != program.registers[program.instructions[i].args[j]]);
+		}
+	}
+
+	void TestLambertianEquivalence()
+	{
+		// 2x2 texture with distinct texels, sampled with differentials small enough to stay on level 0
+		const uint texels[4] = { 0xFF2040C0, 0xFF80FF10, 0xFF0000FF, 0xFFFFFFFF };
+		RasterTexture texture(texels, 2, 2);
+
+		Array<const RasterTexture*> textureSlots;
+		textureSlots.Add(&texture);
+		const TextureSampler sampler = TextureSampler(textureSlots, TextureFilter::TriLinear);
+
+		Fragment frag;
+		frag.textureId = 0;
+
+		const Vector3 eyePos = Vector3(0.0f, 0.0f, 5.0f);
+		const Vector3 lightDir = Vector3(-1.0f, 1.0f, 2.0f);
+		const Vec3f_SSE position = Vec3f_SSE(FloatSSE(0.0f, 1.0f, 2.0f, 3.0f), FloatSSE(1.0f), FloatSSE(-1.0f));
+		const Vec3f_SSE normal = Vec3f_SSE(FloatSSE(0.0f, 1.0f, -0.5f, 0.3f),
+			FloatSSE(0.0f, 2.0f, 0.25f, -0.8f),
+			FloatSSE(1.0f, 0.5f, 3.0f, 0.1f));
+		const Vec2f_SSE texCoord = Vec2f_SSE(FloatSSE(0.1f, 0.6f, 0.3f, 0.9f), FloatSSE(0.2f, 0.7f, 0.8f, 0.4f));
+		const Vec2f_SSE texDifferentials[2] = {
+			Vec2f_SSE(FloatSSE(0.01f), FloatSSE(0.0f)),
+			Vec2f_SSE(FloatSSE(0.0f), FloatSSE(0.01f))
+		};
+		const FloatSSE texLod = sampler.ComputeLod(frag.textureId, Vector2(0.01f, 0.0f), Vector2(0.0f, 0.01f));
+
+		CompiledPixelShader compiled;
+		Array<CompileError> errorList;
+		CHECK(compiled.Compile("Lambertian.hlsl", LambertianShader::GetSource(), "main", errorList));
+		CHECK(errorList.Size() == 0);
+		if (errorList.Size() > 0)
+			return;
+
+		LambertianAlbedoPixelShader builtin;
+		LambertianShader generated;
+		const Vec3f_SSE builtinColor = builtin.Shade(frag, eyePos, lightDir, position, normal, texCoord, texDifferentials, texLod, sampler);
+		const Vec3f_SSE compiledColor = compiled.Shade(frag, eyePos, lightDir, position, normal, texCoord, texDifferentials, texLod, sampler);
+		const Vec3f_SSE generatedColor = generated.Shade(frag, eyePos, lightDir, position, normal, texCoord, texDifferentials, texLod, sampler);
+
+		// The built in shader normalizes the light direction exactly, the HLSL one with rsqrt
+		CHECK(NearlyEqual(compiledColor, builtinColor, 2e-3f));
+		CHECK(NearlyEqual(generatedColor, compiledColor, 1e-6f));
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	TestLexer();
+	TestParser();
+	TestFoldConstants();
+	TestEliminateDeadCode();
+	TestAllocateRegisters();
+	TestLambertianEquivalence();
+
+	if (gFailures > 0)
+		printf("%i checks failed\n", gFailures);
+	else
+		printf("All checks passed\n");
+
+	RenderStates::DeleteInstance();
+	return gFailures;
+}